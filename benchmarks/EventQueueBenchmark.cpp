@@ -0,0 +1,115 @@
+/**
+ * @brief compare the lock-free event queue against the spinlock queue it replaced.
+ * several producers add callbacks while one consumer polls, the throughput and the
+ * latency from addImmediate to the callback running are reported
+ *
+ * usage : eventqueue_benchmark [producers] [events per producer]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "utils/EventQueue.h"
+#include "LegacySpinlock.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief the previous implementation, a spinlock around a queue of std::function,
+ * taking the lock again for every callback polled
+ *
+ */
+class SpinlockEventQueue {
+private:
+    std::atomic_flag f;
+    std::queue<std::function<void ()>> callbacks;
+public:
+    SpinlockEventQueue() { f.clear(); }
+
+    void addImmediate(std::function<void ()> fn) {
+        legacy::Spinlock l(f);
+        callbacks.push(fn);
+    }
+
+    bool poll() {
+        bool busy = false;
+        legacy::Spinlock lock(f, true);
+        for(;;) {
+            lock.lock();
+            if(callbacks.empty()) return busy;
+            auto p = callbacks.front();
+            callbacks.pop();
+            lock.unlock();
+            p();
+            busy = true;
+        }
+    }
+};
+
+struct Result {
+    double seconds;
+    std::vector<int64_t> latencies;
+};
+
+template<typename Queue>
+Result run(Queue& q, size_t producers, size_t events) {
+    size_t total = producers * events;
+    std::vector<int64_t> latencies;
+    latencies.reserve(total);
+    std::atomic<bool> go = false;
+
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p++) {
+        threads.emplace_back([&]() {
+            while(!go) std::this_thread::yield();
+            for (size_t i = 0; i < events; i++) {
+                auto start = Clock::now();
+                q.addImmediate([&latencies, start]() {
+                    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+                });
+            }
+        });
+    }
+
+    auto begin = Clock::now();
+    go = true;
+    while(latencies.size() < total) {
+        if(!q.poll()) std::this_thread::yield();
+    }
+    auto end = Clock::now();
+    for (auto& t: threads) t.join();
+    return {std::chrono::duration<double>(end - begin).count(), std::move(latencies)};
+}
+
+void report(const char* name, Result r) {
+    std::sort(r.latencies.begin(), r.latencies.end());
+    auto percentile = [&r](double p) {
+        return r.latencies[std::min(r.latencies.size() - 1, (size_t) (p * r.latencies.size()))] / 1000.0;
+    };
+    std::printf("%-22s %10.2f Mops/s   p50 %9.1f us   p99 %9.1f us   p99.9 %9.1f us\n",
+        name, r.latencies.size() / r.seconds / 1e6, percentile(0.5), percentile(0.99), percentile(0.999));
+}
+
+int main(int argc, char** argv) {
+    size_t producers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4;
+    size_t events = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+    std::printf("%zu producer(s), %zu events each\n", producers, events);
+
+    {
+        SpinlockEventQueue q;
+        report("spinlock + function", run(q, producers, events));
+    }
+    {
+        themis::EventQueue q;
+        report("lock-free unbounded", run(q, producers, events));
+    }
+    {
+        themis::EventQueue q(4096);
+        report("lock-free bounded", run(q, producers, events));
+    }
+    return 0;
+}
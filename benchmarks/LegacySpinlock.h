@@ -1,9 +1,14 @@
-#ifndef Spinlock_h
-#define Spinlock_h 1
+#ifndef LegacySpinlock_h
+#define LegacySpinlock_h 1
 
 #include <atomic>
 
-namespace themis
+/**
+ * @brief the spinlock replaced by themis::AdaptiveLock, kept only to compare
+ * against in the benchmarks
+ * 
+ */
+namespace legacy
 {
     
     /**
@@ -36,9 +41,6 @@ namespace themis
         }
     };
 
-} // namespace themis
+} // namespace legacy
 
-
-
-
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @brief compare the adaptive lock against the spinlock it replaced and std::mutex.
+ * short : every thread takes the lock for a few increments, like a queue push.
+ * long : one thread holds the lock for a while, like the driver loop doing libpq io,
+ * while the others ask for it now and then. the cpu time shows what the waiters burn
+ *
+ * usage : lock_benchmark [threads] [iterations per thread]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "utils/AdaptiveLock.h"
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief the loop of the old spinlock (see LegacySpinlock.h) behind the Lockable interface
+class RawSpinlock {
+private:
+    std::atomic_flag f;
+public:
+    RawSpinlock() { f.clear(); }
+    void lock() { while(f.test_and_set(std::memory_order_acquire)); }
+    void unlock() { f.clear(std::memory_order_release); }
+};
+
+struct Result {
+    double seconds;
+    double cpuSeconds;
+};
+
+template<typename Lock>
+Result runShort(Lock& lock, size_t threads, size_t iterations) {
+    volatile uint64_t counter = 0;
+    std::vector<std::thread> workers;
+    auto begin = Clock::now();
+    std::clock_t cpuBegin = std::clock();
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            for (size_t i = 0; i < iterations; i++) {
+                std::lock_guard<Lock> guard(lock);
+                for (int k = 0; k < 8; k++) counter = counter + 1;
+            }
+        });
+    }
+    for (auto& w: workers) w.join();
+    return {std::chrono::duration<double>(Clock::now() - begin).count(), 
+        (double) (std::clock() - cpuBegin) / CLOCKS_PER_SEC};
+}
+
+template<typename Lock>
+Result runLong(Lock& lock, size_t threads, size_t rounds) {
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> waiters;
+    auto begin = Clock::now();
+    std::clock_t cpuBegin = std::clock();
+    for (size_t t = 1; t < threads; t++) {
+        waiters.emplace_back([&]() {
+            while(!stop) {
+                {
+                    std::lock_guard<Lock> guard(lock);
+                }
+                // like a thread submitting a query now and then
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+    }
+    for (size_t i = 0; i < rounds; i++) {
+        std::lock_guard<Lock> guard(lock);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    stop = true;
+    for (auto& w: waiters) w.join();
+    return {std::chrono::duration<double>(Clock::now() - begin).count(), 
+        (double) (std::clock() - cpuBegin) / CLOCKS_PER_SEC};
+}
+
+void report(const char* name, Result r) {
+    std::printf("%-16s wall %8.3f s   cpu %8.3f s\n", name, r.seconds, r.cpuSeconds);
+}
+
+int main(int argc, char** argv) {
+    size_t threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4;
+    size_t iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+    std::printf("%zu thread(s), %zu short sections each\n", threads, iterations);
+    {
+        RawSpinlock l;
+        report("spinlock", runShort(l, threads, iterations));
+    }
+    {
+        themis::AdaptiveLock l;
+        themis::LockStats stats;
+        l.setStats(&stats);
+        report("adaptive", runShort(l, threads, iterations));
+        auto s = stats.snapshot();
+        std::printf("                 %llu acquisitions, %llu contended, %llu pauses, %llu parks\n",
+            (unsigned long long) s.acquisitions, (unsigned long long) s.contended, 
+            (unsigned long long) s.spins, (unsigned long long) s.parks);
+    }
+    {
+        std::mutex l;
+        report("std::mutex", runShort(l, threads, iterations));
+    }
+
+    std::printf("1 thread holding for 1 ms, %zu asking every 100 us, 200 rounds\n", threads - 1);
+    {
+        RawSpinlock l;
+        report("spinlock", runLong(l, threads, 200));
+    }
+    {
+        themis::AdaptiveLock l;
+        report("adaptive", runLong(l, threads, 200));
+    }
+    {
+        std::mutex l;
+        report("std::mutex", runLong(l, threads, 200));
+    }
+    return 0;
+}
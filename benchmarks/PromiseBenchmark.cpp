@@ -0,0 +1,80 @@
+/**
+ * @brief compare the cost of a promise chain against the previous promise implementation.
+ * a three link chain is built and resolved from inside a poll, the way a database result
+ * or a websocket message resolves a controller promise, and the heap allocations and the
+ * time per then are reported
+ *
+ * usage : promise_benchmark [iterations]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "utils/Promise.h"
+#include "LegacyPromise.h"
+
+using Clock = std::chrono::steady_clock;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    ++allocations;
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+/// @brief the number of then calls in one chain
+constexpr size_t LINKS = 3;
+
+template<template<typename ...> class P>
+void chain(const std::unique_ptr<themis::EventQueue>& q, int& sink) {
+    typename P<int,int,int>::ResolveFunction resolve;
+    auto p = std::make_unique<P<int,int,int>>(q, [&resolve](typename P<int,int,int>::ResolveFunction res, themis::FailFunction fail) {
+        resolve = res;
+    });
+    p->then([](std::unique_ptr<int> i) -> std::unique_ptr<int> {
+        return std::make_unique<int>(*i + 1);
+    })->then([](std::unique_ptr<int> i) -> std::unique_ptr<int> {
+        return std::make_unique<int>(*i + 1);
+    })->then([&sink](std::unique_ptr<int> i) {
+        sink += *i;
+    });
+    q->addImmediate([&resolve]() {
+        resolve(std::make_unique<int>(1));
+    });
+    while(q->poll());
+}
+
+template<template<typename ...> class P>
+void run(const char* name, size_t iterations) {
+    auto q = std::make_unique<themis::EventQueue>();
+    int sink = 0;
+    // warm up the pools
+    for (size_t i = 0; i < 1000; i++) chain<P>(q, sink);
+
+    size_t before = allocations;
+    auto begin = Clock::now();
+    for (size_t i = 0; i < iterations; i++) chain<P>(q, sink);
+    auto end = Clock::now();
+    size_t count = allocations - before;
+
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+    std::printf("%-10s %8.1f allocations/then %10.1f ns/then   (sink %d)\n",
+        name, (double) count / (iterations * LINKS), ns / (iterations * LINKS), sink);
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    std::printf("%zu chains of %zu then each\n", iterations, LINKS);
+    run<legacy::Promise>("legacy", iterations);
+    run<themis::Promise>("current", iterations);
+    return 0;
+}
@@ -1,12 +1,24 @@
 #include "network/Server.h"
 #include "protocol/websocket/WebsocketSessionHandler.h"
 #include "web/WebsocketController.h"
+#include "web/OrderedListener.h"
 #include <ng-log/logging.h>
 
 class SampleEventListener : public themis::WebsocketSessionHandler::EventListener {
+private:
+    themis::TimerHandle heartbeat;
 public:
     SampleEventListener(themis::WebsocketSessionHandler& handler, const std::unique_ptr<themis::EventQueue>& queue) 
-    : themis::WebsocketSessionHandler::EventListener(handler, queue) {}
+    : themis::WebsocketSessionHandler::EventListener(handler, queue) {
+        // push a heartbeat to the client every 30 seconds
+        heartbeat = eventQueue->addInterval(std::chrono::seconds(30), [this]() {
+            ws.getOutputStream() << "heartbeat";
+            ws.finish(true);
+        });
+    }
+    virtual ~SampleEventListener() {
+        heartbeat.cancel();
+    }
     virtual void onText(themis::WebsocketSessionHandler& handler, const std::string& msg) override {
         ws.getOutputStream() << std::string(1000, '@');
         ws.finish(true);
@@ -20,6 +32,16 @@ public:
     };        
 };
 
+/// @brief runs on the worker pool, the messages of one session are answered in order
+class ShoutProcessor : public themis::MessageProcessor {
+public:
+    virtual std::optional<Reply> processText(const std::string& msg) override {
+        std::string upper = msg;
+        for (char& c: upper) c = std::toupper(c);
+        return Reply{upper, true};
+    }
+};
+
 int main(int argc, char **argv) {
     FLAGS_alsologtostderr = 1;
     FLAGS_colorlogtostderr = 1;
@@ -30,7 +52,8 @@ int main(int argc, char **argv) {
     LOG(INFO) << "themis 2.0 started";
 
     themis::Server server("0.0.0.0", 8080);
-    server.getWebsocketControllerManager().addController<SampleEventListener>("/ws/sample");
+    server.getWebsocketControllerManager().addController<SampleEventListener>("/ws/sample")
+    .addController<themis::OrderedListener<ShoutProcessor>>("/ws/shout");
     server.dispatch();
 
     nglog::ShutdownLogging();
@@ -15,6 +15,7 @@ void themis::Reactor::onAccept(evutil_socket_t fd, sockaddr_in addr) {
     auto handler = allocator(std::move(session));
     SessionDetail detail(*this, std::move(handler));
     sessionList.emplace_back(std::move(detail));
+    ++sessionCount;
     SessionIterator* itPtr = new SessionIterator(--sessionList.end());
     prepareSession(itPtr);
 
@@ -39,14 +40,12 @@ void themis::Reactor::prepareSession(SessionIterator * itPtr, bool toggleWrite)
             parent.handleSessionRead(fd,handler);
         } catch(const SessionMovedException& move) {
             // the session no longer belongs to this reactor
-            parent.sessionList.erase(*it);
-            delete it;
+            parent.removeSession(it);
         }catch (const std::exception &e) {
             // error in session
             // remove connection
             VLOG(5) << "session closed : " << handler->getSession()->toString();
-            parent.sessionList.erase(*it);
-            delete it;
+            parent.removeSession(it);
         }
         
     },itPtr);
@@ -60,19 +59,82 @@ void themis::Reactor::prepareSession(SessionIterator * itPtr, bool toggleWrite)
 
         try {
             (**it).handler->getSession()->setLastActive(time(nullptr));
-            parent.handleSessionWrite(fd, session);
+            parent.handleSessionWrite(fd, (**it).handler);
         } catch (const std::exception &e) {
             VLOG(5) << "session closed : " << session->toString();
-            parent.sessionList.erase(*it);
-            delete it;
+            parent.removeSession(it);
         }
     },itPtr);
 
      // enable read event
-    if(toggleWrite) event_add(writeEvent, nullptr);
     event_add(readEvent, nullptr);
     (**itPtr).handler->getSession()->setReadEvent(readEvent);
     (**itPtr).handler->getSession()->setWriteEvent(writeEvent);
+    (**itPtr).handler->getSession()->setFlushScheduler([this, itPtr]() {
+        scheduleFlush(itPtr);
+    });
+    if(toggleWrite) scheduleFlush(itPtr);
+}
+
+void themis::Reactor::removeSession(SessionIterator *itPtr) {
+    unscheduleFlush(*itPtr);
+    sessionList.erase(*itPtr);
+    --sessionCount;
+    delete itPtr;
+}
+
+void themis::Reactor::scheduleFlush(SessionIterator *itPtr) {
+    if((**itPtr).flushScheduled) return;
+    if(flushList.empty()) flushListSince = std::chrono::steady_clock::now();
+    (**itPtr).flushScheduled = true;
+    flushList.push_back(itPtr);
+}
+
+void themis::Reactor::unscheduleFlush(SessionIterator it) {
+    if(!(*it).flushScheduled) return;
+    (*it).flushScheduled = false;
+    for (auto i = flushList.begin(); i != flushList.end(); ++i) {
+        if(**i == it) {
+            flushList.erase(i);
+            return;
+        }
+    }
+}
+
+bool themis::Reactor::flush() {
+    if(flushList.empty()) return false;
+    if(flushLatency.count() > 0 && 
+    std::chrono::steady_clock::now() - flushListSince < flushLatency) return false;
+
+    // handlers may schedule again while being flushed
+    std::vector<SessionIterator*> batch;
+    batch.swap(flushList);
+    for (SessionIterator* it: batch) {
+        (**it).flushScheduled = false;
+        const std::unique_ptr<Session>& session = (**it).handler->getSession();
+        if(session->isDropped()) {
+            // the peer may never read again, its write event cannot be waited for
+            VLOG(5) << "session dropped : " << session->toString();
+            removeSession(it);
+            continue;
+        }
+        // waiting for the socket to be writable, the write event will send everything
+        if(event_pending(session->getWriteEvent(), EV_WRITE, nullptr)) continue;
+        try {
+            handleSessionWrite(session->getSocket(), (**it).handler);
+        } catch (const std::exception &e) {
+            VLOG(5) << "session closed : " << session->toString();
+            removeSession(it);
+        }
+    }
+    return true;
+}
+
+std::chrono::steady_clock::duration themis::Reactor::getIdleWait(std::chrono::steady_clock::duration maxWait) {
+    if(flushList.empty()) return maxWait;
+    std::chrono::steady_clock::duration wait = flushListSince + flushLatency - std::chrono::steady_clock::now();
+    if(wait < std::chrono::steady_clock::duration::zero()) return std::chrono::steady_clock::duration::zero();
+    return wait < maxWait ? wait : maxWait;
 }
 
 void themis::Reactor::handleSessionRead(evutil_socket_t fd, const std::unique_ptr<SessionHandler> &handler) {
@@ -83,12 +145,21 @@ void themis::Reactor::handleSessionRead(evutil_socket_t fd, const std::unique_pt
     handler->handleSession();
 }
 
-void themis::Reactor::handleSessionWrite(evutil_socket_t fd, const std::unique_ptr<Session> &s) {
-    BufferReader reader(s->getOutputBuffer());
-    bool again = reader.sendTo(fd);
+void themis::Reactor::handleSessionWrite(evutil_socket_t fd, const std::unique_ptr<SessionHandler> &handler) {
+    const std::unique_ptr<Session>& s = handler->getSession();
+    bool again;
+    {
+        BufferReader reader(s->getOutputBuffer());
+        again = reader.sendTo(fd);
+    }
+    // let the handler refill the output buffer
+    handler->handleWritten();
     // if there are more data to send, toggle the write event again
     if (again) {
         event_add(s->getWriteEvent(), nullptr);
+    } else if (s->isClosing()) {
+        // everything is sent, let the write callback remove the session
+        throw std::runtime_error("session closed after flush");
     }
 }
 
@@ -137,6 +208,7 @@ void themis::Reactor::addSessionHandler(std::unique_ptr<SessionHandler> handler)
 
     SessionDetail detail(*this, std::move(handler));
     sessionList.emplace_back(std::move(detail));
+    ++sessionCount;
     SessionIterator* it = new SessionIterator(--sessionList.end());
     prepareSession(it, true);
 
@@ -149,7 +221,9 @@ void themis::Reactor::loopOnce() {
     if (timeout > 0) {
         for (auto i = sessionList.begin(); i != sessionList.end();) {
             if ((*i).handler->getSession()->isTimedout(timeout)) {
+                unscheduleFlush(i);
                 i = sessionList.erase(i);
+                --sessionCount;
             } else {
                 ++i;
             }
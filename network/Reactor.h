@@ -7,6 +7,9 @@
 
 #include <string>
 #include <list>
+#include <vector>
+#include <chrono>
+#include <atomic>
 #include <functional>
 #include "Session.h"
 
@@ -26,21 +29,36 @@ namespace themis
 
         event_base* base;
         evutil_socket_t listenSocket = -1;
-        evconnlistener* listener;
+        evconnlistener* listener = nullptr;
 
         void onAccept(evutil_socket_t fd, sockaddr_in addr);
 
         struct SessionDetail {
             Reactor& _this; // which reactor this session belongs to
             std::unique_ptr<SessionHandler> handler; // handler
+            bool flushScheduled = false; // if this session is in the flush list
             SessionDetail(const SessionDetail&) = delete;
-            SessionDetail(SessionDetail&& d): _this(d._this), handler(std::move(d.handler)) {}
+            SessionDetail(SessionDetail&& d): _this(d._this), handler(std::move(d.handler)), flushScheduled(d.flushScheduled) {}
             SessionDetail(Reactor& r, std::unique_ptr<SessionHandler> handler): _this(r), handler(std::move(handler)) {}
         };
 
         std::list<SessionDetail> sessionList;
         using SessionIterator = std::list<SessionDetail>::iterator;
 
+        /// @brief sessions written to during this tick, flushed once in flush()
+        std::vector<SessionIterator*> flushList;
+        /// @brief when the first session of the flush list was scheduled
+        std::chrono::steady_clock::time_point flushListSince;
+        std::chrono::microseconds flushLatency{0};
+
+        void scheduleFlush(SessionIterator* itPtr);
+        /**
+         * @brief remove the session from the flush list if it is in
+         * 
+         * @param it session
+         */
+        void unscheduleFlush(SessionIterator it);
+
         void prepareSession(SessionIterator* itPtr, bool toggleWrite = false);
 
         /// this function yield an valid handler
@@ -51,9 +69,18 @@ namespace themis
         time_t timeout = -1;
 
         void handleSessionRead(evutil_socket_t fd, const std::unique_ptr<SessionHandler>& handler);
-        void handleSessionWrite(evutil_socket_t fd, const std::unique_ptr<Session>& s);
+        void handleSessionWrite(evutil_socket_t fd, const std::unique_ptr<SessionHandler>& handler);
 
         bool idle = true;
+        /// @brief number of sessions in the session list, readable from other threads
+        std::atomic<size_t> sessionCount = 0;
+
+        /**
+         * @brief remove the session from the session list and free the iterator
+         * 
+         * @param itPtr iterator pointer allocated in prepareSession
+         */
+        void removeSession(SessionIterator* itPtr);
     public:
         /**
          * @brief Construct a new Reactor object listening on the given ip and port
@@ -84,10 +111,48 @@ namespace themis
          */
         void loopOnce();
 
+        /**
+         * @brief send out the output of all sessions written to since last flush, 
+         * each with a single gather write. call this at the end of each loop tick, 
+         * after the event queues feeding the sessions have been polled
+         * 
+         * @return true if any session was flushed
+         */
+        bool flush();
+
+        /**
+         * @brief allow the output to be held back up to this long so that more 
+         * writes can be batched into one, 0 (default) flushes at the end of every tick
+         * 
+         * @param latency latency budget
+         */
+        void setFlushLatency(std::chrono::microseconds latency) {
+            flushLatency = latency;
+        }
+
+        /**
+         * @brief how long the loop may sleep without holding back the output deferred
+         * by the latency budget any longer, only the thread of the reactor can call this
+         * 
+         * @param maxWait the longest sleep wanted
+         * @return std::chrono::steady_clock::duration time until the deferred flush is due, at most maxWait
+         */
+        std::chrono::steady_clock::duration getIdleWait(std::chrono::steady_clock::duration maxWait);
+
         bool isIdle() {
             return idle;
         }
 
+        /**
+         * @brief get the number of sessions currently handled by this reactor,
+         * this can be called from any thread
+         * 
+         * @return size_t session count
+         */
+        size_t getSessionCount() {
+            return sessionCount.load(std::memory_order_relaxed);
+        }
+
     };
 
 } // namespace themis
@@ -0,0 +1,107 @@
+#include "ReactorPool.h"
+#include <functional>
+#include <mutex>
+
+size_t themis::RoundRobinPolicy::select(const std::unique_ptr<HttpRequest> &req, const std::vector<size_t> &loads) {
+    return (indexGen++) % loads.size();
+}
+
+size_t themis::LeastConnectionPolicy::select(const std::unique_ptr<HttpRequest> &req, const std::vector<size_t> &loads) {
+    size_t idx = 0;
+    for (size_t i = 1; i < loads.size(); i++) {
+        if(loads[i] < loads[idx]) idx = i;
+    }
+    return idx;
+}
+
+size_t themis::KeyHashPolicy::select(const std::unique_ptr<HttpRequest> &req, const std::vector<size_t> &loads) {
+    std::string value;
+    auto& params = req->getParameters();
+    if(params.count(key)) {
+        value = params.at(key);
+    } else if(!req->getHeader(key, value)) {
+        // no routing key present
+        return fallback.select(req, loads);
+    }
+    return std::hash<std::string>()(value) % loads.size();
+}
+
+themis::ReactorPool::ReactorPool(size_t count) {
+    if(count == 0) count = 1;
+    for (size_t i = 0; i < count; i++) {
+        shards.emplace_back(std::make_unique<Shard>());
+    }
+    for (auto& s: shards) {
+        Shard* shard = s.get();
+        shard->thread = std::make_unique<std::thread>([this, shard]() {
+            while(!stop) {
+                loopOnce(*shard);
+            }
+        });
+    }
+}
+
+themis::ReactorPool::~ReactorPool() {
+    stop = true;
+    for (auto& s: shards) {
+        if(s->thread.get() && s->thread->joinable()) s->thread->join();
+    }
+}
+
+void themis::ReactorPool::loopOnce(Shard &shard) {
+    if(shard.pending) {
+        std::lock_guard<AdaptiveLock> lock(shard.upgradeLock);
+        // check if there are any pending upgrades
+        while(!shard.upgradeQueue.empty()) {
+            std::unique_ptr<SessionHandler> handler = std::move(shard.upgradeQueue.front());
+            LOG(INFO) << "upgrading session : " << handler->getSession()->toString();
+            shard.upgradeQueue.pop();
+            // toggle write event to write out the handshake
+            shard.reactor->addSessionHandler(std::move(handler));
+            --shard.pending;
+        }
+    }
+
+    // loop through the reactor for io events
+    shard.reactor->loopOnce();
+
+    bool polled = shard.queue->poll();
+    bool idle = shard.reactor->isIdle() && !polled;
+
+    // send out the messages written during this tick
+    shard.reactor->flush();
+
+    if(idle) {
+        // until the next timer or the deferred flush at most
+        std::this_thread::sleep_for(shard.reactor->getIdleWait(shard.queue->getIdleWait(std::chrono::milliseconds(10))));
+    }
+}
+
+size_t themis::ReactorPool::select(const std::unique_ptr<HttpRequest> &req) {
+    std::vector<size_t> loads;
+    loads.reserve(shards.size());
+    for (auto& s: shards) {
+        loads.push_back(s->reactor->getSessionCount() + s->pending);
+    }
+    size_t idx = policy->select(req, loads);
+    if(idx >= shards.size()) throw std::out_of_range("shard policy selected shard " + std::to_string(idx)
+        + " out of " + std::to_string(shards.size()));
+    return idx;
+}
+
+void themis::ReactorPool::addSessionHandler(size_t shard, std::unique_ptr<SessionHandler> handler) {
+    Shard& s = *shards[shard];
+    std::lock_guard<AdaptiveLock> lock(s.upgradeLock);
+    s.upgradeQueue.push(std::move(handler));
+    ++s.pending;
+}
+
+void themis::ReactorPool::setFlushLatency(std::chrono::microseconds latency) {
+    for (auto& s: shards) {
+        // the reactor belongs to the shard thread
+        Reactor* reactor = s->reactor.get();
+        s->queue->addImmediate([reactor, latency]() {
+            reactor->setFlushLatency(latency);
+        });
+    }
+}
@@ -0,0 +1,172 @@
+#ifndef ReactorPool_h
+#define ReactorPool_h 1
+
+#include <thread>
+#include <queue>
+#include <vector>
+#include <atomic>
+#include "Reactor.h"
+#include "utils/EventQueue.h"
+#include "utils/AdaptiveLock.h"
+#include "protocol/http/HttpRequest.h"
+
+namespace themis
+{
+
+    /**
+     * @brief a shard policy decides which reactor in the pool an upgraded session
+     * should be assigned to
+     *
+     */
+    class ShardPolicy {
+    public:
+        virtual ~ShardPolicy() = default;
+        /**
+         * @brief select a shard for the session that issued the given request
+         *
+         * @param req the upgrade request
+         * @param loads the number of sessions on each shard, including pending upgrades
+         * @return size_t index of the shard, must be less than loads.size()
+         */
+        virtual size_t select(const std::unique_ptr<HttpRequest>& req, const std::vector<size_t>& loads) = 0;
+    };
+
+    /**
+     * @brief assign the shards one after another
+     *
+     */
+    class RoundRobinPolicy : public ShardPolicy {
+    private:
+        size_t indexGen = 0;
+    public:
+        virtual size_t select(const std::unique_ptr<HttpRequest>& req, const std::vector<size_t>& loads) override;
+    };
+
+    /**
+     * @brief assign the shard with the fewest sessions
+     *
+     */
+    class LeastConnectionPolicy : public ShardPolicy {
+    public:
+        virtual size_t select(const std::unique_ptr<HttpRequest>& req, const std::vector<size_t>& loads) override;
+    };
+
+    /**
+     * @brief assign the shard by hashing a routing key of the upgrade request, so that
+     * sessions with the same key (a chat room for instance) always land on the same shard.
+     * the key is looked up in the request parameters first, then in the headers,
+     * requests without the key fall back to round robin
+     *
+     */
+    class KeyHashPolicy : public ShardPolicy {
+    private:
+        std::string key;
+        RoundRobinPolicy fallback;
+    public:
+        KeyHashPolicy(const std::string& key) : key(key) {}
+        virtual size_t select(const std::unique_ptr<HttpRequest>& req, const std::vector<size_t>& loads) override;
+    };
+
+    /**
+     * @brief a reactor pool runs several reactors, each on its own thread with its own
+     * event queue. sessions are handed over from other threads and placed on the shard
+     * chosen by the shard policy
+     *
+     */
+    class ReactorPool {
+    private:
+
+        struct Shard {
+            std::unique_ptr<Reactor> reactor = std::make_unique<Reactor>();
+            std::unique_ptr<EventQueue> queue = std::make_unique<EventQueue>();
+            std::unique_ptr<std::thread> thread;
+            /// @brief handlers waiting to be added to the reactor by the shard thread
+            std::queue<std::unique_ptr<SessionHandler>> upgradeQueue;
+            AdaptiveLock upgradeLock;
+            std::atomic<size_t> pending = 0;
+        };
+
+        std::vector<std::unique_ptr<Shard>> shards;
+        std::unique_ptr<ShardPolicy> policy = std::make_unique<RoundRobinPolicy>();
+        std::atomic<bool> stop = false;
+
+        /**
+         * @brief move the pending handlers into the reactor and loop once through
+         * the reactor and the event queue of the shard
+         *
+         * @param shard the shard to run
+         */
+        void loopOnce(Shard& shard);
+
+    public:
+        /**
+         * @brief Construct a new Reactor Pool and start one thread for each reactor
+         *
+         * @param count number of reactors, at least one
+         */
+        ReactorPool(size_t count);
+        ~ReactorPool();
+
+        /**
+         * @brief replace the shard policy, call this before any session is assigned
+         *
+         * @param p new policy
+         */
+        void setPolicy(std::unique_ptr<ShardPolicy> p) {
+            policy = std::move(p);
+        }
+
+        /**
+         * @brief select the shard for the given request with the current policy
+         *
+         * @param req the upgrade request
+         * @return size_t shard index
+         */
+        size_t select(const std::unique_ptr<HttpRequest>& req);
+
+        /**
+         * @brief get the event queue of the shard, the listeners on that shard should
+         * use this queue so that their events run on the shard thread
+         *
+         * @param shard shard index
+         * @return const std::unique_ptr<EventQueue>&
+         */
+        const std::unique_ptr<EventQueue>& getEventQueue(size_t shard) {
+            return shards[shard]->queue;
+        }
+
+        /**
+         * @brief hand the handler over to the shard, the handler will be added to
+         * the reactor on the shard thread with write event toggled
+         *
+         * @param shard shard index
+         * @param handler handler
+         */
+        void addSessionHandler(size_t shard, std::unique_ptr<SessionHandler> handler);
+
+        /**
+         * @brief set the flush latency budget of every reactor, see Reactor::setFlushLatency
+         * 
+         * @param latency latency budget
+         */
+        void setFlushLatency(std::chrono::microseconds latency);
+
+        /**
+         * @brief count the contention on the upgrade queues into the stats
+         * 
+         * @param stats the stats, nullptr to stop counting
+         */
+        void setLockStats(LockStats* stats) {
+            for (auto& s: shards) {
+                s->upgradeLock.setStats(stats);
+            }
+        }
+
+        size_t size() {
+            return shards.size();
+        }
+    };
+
+} // namespace themis
+
+#endif
@@ -1,16 +1,15 @@
 #include "Server.h"
 #include "network/Session.h"
 #include "protocol/http/HttpSessionHandler.h"
-#include "utils/Spinlock.h"
 
 themis::Server::~Server() {
-    if(wsThread.get() && 
-    wsThread->joinable()) wsThread->join();
+    // stop and join the websocket reactors before the controller managers go away
+    wsPool = nullptr;
 }
 
-themis::Server::Server(const std::string &ip, uint16_t port) {
+themis::Server::Server(const std::string &ip, uint16_t port, size_t wsReactorCount) {
 
-    upgradeFlag.clear();
+    wsPool = std::make_unique<ReactorPool>(wsReactorCount);
 
     httpReactor = std::make_unique<Reactor>(ip, port,
         [this](std::unique_ptr<Session> session) -> std::unique_ptr<SessionHandler> {
@@ -18,13 +17,13 @@ themis::Server::Server(const std::string &ip, uint16_t port) {
             return std::make_unique<HttpSessionHandler>(std::move(session), [this](std::unique_ptr<HttpRequest> req, 
         const std::unique_ptr<Session>& session) {
             // firstly check if the session can be upgraded into a websocket session
-            auto wsHandler = wsControllerManager.upgradeSession(req, session);
-            if(wsHandler.get()) {
+            if(wsControllerManager.isUpgradeRequest(req)) {
+                // pick the websocket reactor, the listener must use the event queue of that reactor
+                size_t shard = wsPool->select(req);
+                auto wsHandler = wsControllerManager.upgradeSession(req, session, wsPool->getEventQueue(shard));
                 // upgrade succeeded, then remove the original handler by raising an exception
-                // also add to the second reactor
-                Spinlock lock(upgradeFlag);
-                upgradeQueue.push(std::move(wsHandler));
-                lock.unlock();
+                // also add to the selected websocket reactor
+                wsPool->addSessionHandler(shard, std::move(wsHandler));
                 // inform the http reactor to clean this mess up
                 throw SessionMovedException();
             } else {
@@ -34,34 +33,6 @@ themis::Server::Server(const std::string &ip, uint16_t port) {
         });
         
     });
-
-    wsReactor = std::make_unique<Reactor>();
-    wsThread = std::make_unique<std::thread>([this]() {
-        while(!wsStop) {
-            if(! upgradeQueue.empty()) {
-                Spinlock lock(upgradeFlag);
-                // check if there are any pending upgrades
-                while(!upgradeQueue.empty()) {
-                    std::unique_ptr<WebsocketSessionHandler> handler = std::move(upgradeQueue.front());
-                    LOG(INFO) << "upgrading session : " << handler->getSession()->toString();
-                    upgradeQueue.pop();
-                    // toggle write event to write out the handshake
-                    wsReactor->addSessionHandler(std::move(handler));
-                }
-            }
-            
-            // loop through ws reactor for io events
-            wsReactor->loopOnce();
-
-            bool idle = 
-            wsReactor->isIdle() |
-            !wsControllerManager.poll();
-
-            if(idle) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            }
-        }
-    });
 }
 
 void themis::Server::dispatch() {
@@ -69,13 +40,17 @@ void themis::Server::dispatch() {
 
         httpReactor->loopOnce();
 
-        bool idle = 
-        httpReactor->isIdle() | 
-        !controllerManager.poll();
+        // poll first, the reactor is only idle if no event ran either
+        bool polled = controllerManager.poll();
+        bool idle = httpReactor->isIdle() && !polled;
+
+        // send out the responses written during this tick
+        httpReactor->flush();
 
         if(idle) {
-            // no event has been dispatched, then yield current thread
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            // no event has been dispatched, then yield current thread until the next timer 
+            // or the deferred flush at most
+            std::this_thread::sleep_for(httpReactor->getIdleWait(controllerManager.getIdleWait(std::chrono::milliseconds(10))));
         }
     }
 }
@@ -3,6 +3,7 @@
 #define Server_h 1
 
 #include "Reactor.h"
+#include "ReactorPool.h"
 #include "web/Controller.h"
 #include "web/WebsocketController.h"
 
@@ -16,11 +17,7 @@ namespace themis
     class Server {
     private:
         std::unique_ptr<Reactor> httpReactor;
-        std::unique_ptr<Reactor> wsReactor;
-        bool wsStop = false;
-        std::unique_ptr<std::thread> wsThread;
-        std::queue<std::unique_ptr<WebsocketSessionHandler>> upgradeQueue;
-        std::atomic_flag upgradeFlag;
+        std::unique_ptr<ReactorPool> wsPool;
         ControllerManager controllerManager;
         WebsocketControllerManager wsControllerManager;
 
@@ -31,8 +28,9 @@ namespace themis
          * 
          * @param ip the server ip
          * @param port listening port
+         * @param wsReactorCount number of reactor threads serving the upgraded websocket sessions
          */
-        Server(const std::string& ip, uint16_t port);
+        Server(const std::string& ip, uint16_t port, size_t wsReactorCount = 1);
 
         /**
          * @brief dispatch the server and loop through the reactor
@@ -48,6 +46,27 @@ namespace themis
             return wsControllerManager;
         }
 
+        /**
+         * @brief allow the output of http and websocket sessions to be held back 
+         * up to this long so that more writes are batched, call this before dispatch
+         * 
+         * @param latency latency budget, 0 flushes at the end of every loop tick
+         */
+        void setFlushLatency(std::chrono::microseconds latency) {
+            httpReactor->setFlushLatency(latency);
+            wsPool->setFlushLatency(latency);
+        }
+
+        /**
+         * @brief set the policy deciding which websocket reactor an upgraded session
+         * is assigned to, call this before dispatch
+         * 
+         * @param policy shard policy, round robin by default
+         */
+        void setWebsocketShardPolicy(std::unique_ptr<ShardPolicy> policy) {
+            wsPool->setPolicy(std::move(policy));
+        }
+
     };
 
 } // namespace themis
@@ -55,4 +74,4 @@ namespace themis
 
 
 
-#endif
\ No newline at end of file
+#endif
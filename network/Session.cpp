@@ -3,6 +3,11 @@
 #include <arpa/inet.h>
 
 themis::Session::~Session() {
+    if(handleState.get()) {
+        // close the handles, then notify whoever is waiting on this session
+        handleState->session = nullptr;
+        handleState->closed.cancel();
+    }
     if(readEvent) event_free(readEvent);
     if(writeEvent) event_free(writeEvent);
     if(alive) close(fd);
@@ -2,11 +2,59 @@
 #define Session_h 1
 
 #include <ng-log/logging.h>
+#include <functional>
 #include "utils/Buffer.h"
+#include "utils/Cancellation.h"
 
 namespace themis {
 
     class Reactor;
+    class Session;
+
+    /**
+     * @brief a handle to a session that stays valid after the session is gone,
+     * unlike a reference into the session list of the reactor. the handle is closed
+     * when the session is destroyed (disconnect, timeout or upgrade), and its closed
+     * token is cancelled at the same time. use it on the thread of the reactor
+     * 
+     */
+    class SessionHandle {
+    private:
+        friend class Session;
+
+        struct State {
+            Session* session;
+            CancellationToken closed = CancellationToken::create();
+
+            State(Session* session) : session(session) {}
+        };
+        std::shared_ptr<State> state;
+
+        SessionHandle(std::shared_ptr<State> state) : state(std::move(state)) {}
+
+    public:
+        SessionHandle() = default;
+
+        /// @brief get the session, nullptr if it is gone
+        Session* get() const {
+            return state.get() ? state->session : nullptr;
+        }
+
+        bool isOpen() const {
+            return get() != nullptr;
+        }
+
+        /**
+         * @brief get the token cancelled once the session is gone, subscribe to it
+         * to be notified of the disconnect
+         * 
+         * @return const CancellationToken& token, empty for an empty handle
+         */
+        const CancellationToken& getClosedToken() const {
+            static const CancellationToken none;
+            return state.get() ? state->closed : none;
+        }
+    };
 
     /**
      * @brief a connection has two built in buffer, when 
@@ -17,9 +65,17 @@ namespace themis {
         evutil_socket_t fd;
         Buffer input, output;
         const sockaddr_in addr;
-        event* readEvent,* writeEvent;
+        event* readEvent = nullptr,* writeEvent = nullptr;
         time_t lastActiveTime;
         bool alive = true;
+        bool closing = false;
+        bool dropped = false;
+        /// @brief set by the reactor to collect the output into the flush at the end of loop tick
+        std::function<void ()> flushScheduler;
+        /// @brief shared with the handles of this session, created on first use
+        std::shared_ptr<SessionHandle::State> handleState;
+        /// @brief told when output was sent, by a response streaming its body
+        std::function<void ()> writtenListener;
 
     public:
         ~Session();
@@ -52,8 +108,68 @@ namespace themis {
             lastActiveTime = val;
         }
 
+        /**
+         * @brief mark this session to be closed by the reactor once 
+         * the output buffer has been sent out
+         * 
+         */
+        void closeAfterFlush() {
+            closing = true;
+        }
+        bool isClosing() { return closing; }
+
+        /**
+         * @brief have the reactor remove this session at the end of the loop tick
+         * without sending out the output left, for a peer that stopped reading
+         * 
+         */
+        void drop() {
+            closing = true;
+            dropped = true;
+            scheduleFlush();
+        }
+        bool isDropped() { return dropped; }
+
+        void setFlushScheduler(std::function<void ()> scheduler) {
+            flushScheduler = scheduler;
+        }
+        /**
+         * @brief call this after writing to the output buffer, the output will be sent
+         * once by the reactor at the end of the current loop tick together with
+         * everything else written in the tick
+         * 
+         */
+        void scheduleFlush() {
+            if(flushScheduler) flushScheduler();
+            else if(writeEvent) event_add(writeEvent, nullptr);
+        }
+
+        /**
+         * @brief set what to call after output has been sent to the socket, for a 
+         * response producing its body while the client reads it. one at a time
+         * 
+         * @param listener the listener, nullptr to remove it
+         */
+        void setWrittenListener(std::function<void ()> listener) {
+            writtenListener = std::move(listener);
+        }
+        void notifyWritten() {
+            if(writtenListener) writtenListener();
+        }
+
         std::string toString();
 
+        /**
+         * @brief get a handle to this session, to keep while waiting for something
+         * (a response promise for instance) that may outlive the connection
+         * 
+         * @return SessionHandle handle
+         */
+        SessionHandle getHandle() {
+            if(!handleState.get()) handleState = std::make_shared<SessionHandle::State>(this);
+            return SessionHandle(handleState);
+        }
+
     };
 
     /**
@@ -80,6 +196,12 @@ namespace themis {
         SessionHandler(Session&& handler): session(std::make_unique<Session>(std::move(handler))) {}
         virtual ~SessionHandler() = default;
         virtual void handleSession() = 0;
+        /**
+         * @brief called by the reactor after output has been sent to the socket, 
+         * handlers holding back output can refill the output buffer here
+         * 
+         */
+        virtual void handleWritten() {}
         /// @brief get inner session
         /// @return session pointer
         const std::unique_ptr<Session>& getSession() {
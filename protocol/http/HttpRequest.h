@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <vector>
 #include <map>
+#include "utils/Cancellation.h"
 
 namespace themis
 {
@@ -31,6 +32,8 @@ namespace themis
         std::map<std::string, std::string> headers;
         std::map<std::string, std::string> parameters;
         std::vector<uint8_t> body;
+        /// @brief cancelled when the deadline of this request expires
+        CancellationToken token;
         const static std::map<std::string, Method> METHOD_MAP;
         const static std::map<Method, std::string> METHOD_TO_STR;
 
@@ -40,6 +43,16 @@ namespace themis
         std::map<std::string, std::string>& getHeaders() { return headers;}
         std::map<std::string, std::string>& getParameters() { return parameters;}
         std::vector<uint8_t>& getBody() { return body; }
+        /**
+         * @brief get the token of this request, pass it to the database queries made for
+         * this request so that they are dropped or cancelled once the request timed out
+         * 
+         * @return const CancellationToken& token, empty if the request has no deadline
+         */
+        const CancellationToken& getCancellationToken() { return token; }
+        void setCancellationToken(CancellationToken t) { token = std::move(t); }
+        /// @brief the time the response is due, time_point::max() if there is no deadline
+        CancellationToken::Clock::time_point getDeadline() { return token.getDeadline(); }
         Method getMethod() { return m; }
         std::string getMethodString() {
             return METHOD_TO_STR.at(m);
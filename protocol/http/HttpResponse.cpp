@@ -1,4 +1,5 @@
 #include "HttpResponse.h"
+#include <cstdio>
 #include <cstring>
 #include <stdexcept>
 
@@ -86,7 +87,11 @@ void themis::HttpResponse::setStatus(uint16_t status) {
 void themis::HttpResponse::serializeToBuffer(Buffer &buffer) {
 
     auto str = body.str();
-    headers.insert({"Content-Length", std::to_string(str.length())});
+    if(stream.get()) {
+        headers.insert({"Transfer-Encoding", "chunked"});
+    } else {
+        headers.insert({"Content-Length", std::to_string(str.length())});
+    }
 
     BufferWriter writer(buffer);
     writer.write("HTTP/1.1 ");
@@ -99,5 +104,13 @@ void themis::HttpResponse::serializeToBuffer(Buffer &buffer) {
         writer.write("\r\n");
     }
     writer.write("\r\n");
-    writer.write(str);
+    if(!stream.get()) {
+        writer.write(str);
+    } else if(!str.empty()) {
+        char size[24];
+        int length = snprintf(size, sizeof(size), "%zx\r\n", str.size());
+        writer.write(size, length);
+        writer.write(str);
+        writer.write("\r\n");
+    }
 }
@@ -5,7 +5,9 @@
 #include <string>
 #include <map>
 #include <sstream>
+#include <memory>
 #include "utils/Buffer.h"
+#include "ResponseStream.h"
 
 namespace themis {
 
@@ -14,6 +16,7 @@ namespace themis {
         std::string status;
         std::map<std::string, std::string> headers;        
         std::ostringstream body;
+        std::shared_ptr<ResponseStream> stream;
     public:
 
         /**
@@ -28,6 +31,20 @@ namespace themis {
         std::ostringstream& getResponseStream() {
             return body;
         }
+
+        /**
+         * @brief send the body in chunks as it is written to the stream, instead of all
+         * at once with its length. the body written to the response stream goes first
+         * 
+         * @return std::shared_ptr<ResponseStream> the stream, the same one if called again
+         */
+        std::shared_ptr<ResponseStream> startStream() {
+            if(!stream.get()) stream = std::make_shared<ResponseStream>();
+            return stream;
+        }
+        const std::shared_ptr<ResponseStream>& getStream() {
+            return stream;
+        }
         
         HttpResponse() { 
             setStatus(200); 
@@ -38,7 +55,8 @@ namespace themis {
         
         /**
          * @brief serialize the entire response to the buffer, 
-         * including status line, headers and body
+         * including status line, headers and body. for a streamed
+         * response the body goes out as the first chunk
          * 
          * @param buffer target buffer
          */
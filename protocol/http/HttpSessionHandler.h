@@ -44,6 +44,10 @@ namespace themis
 
         HttpSessionHandler(std::unique_ptr<Session> s, CallbackFunction func) : SessionHandler(std::move(s)), cb(func) {};
         virtual void handleSession() override;
+        /// @brief let a streamed response know the client took some of it
+        virtual void handleWritten() override {
+            session->notifyWritten();
+        }
     };
 
 } // namespace themis
@@ -0,0 +1,116 @@
+#include "ResponseStream.h"
+#include <cstdio>
+
+namespace {
+
+    /// @brief size in hex, then the data, see rfc 9112 section 7.1
+    void frameChunk(std::string& out, std::string_view data) {
+        char size[24];
+        int length = snprintf(size, sizeof(size), "%zx\r\n", data.size());
+        out.append(size, length);
+        out.append(data);
+        out.append("\r\n");
+    }
+
+}
+
+themis::ResponseStream::~ResponseStream() {
+    if(!ended) abort();
+}
+
+void themis::ResponseStream::write(std::string_view data) {
+    // an empty chunk would end the body
+    if(data.empty() || !isOpen()) return;
+    if(!attached) {
+        frameChunk(held, data);
+    } else {
+        std::string chunk;
+        frameChunk(chunk, data);
+        Session* s = session.get();
+        BufferWriter(s->getOutputBuffer()).write(chunk);
+        s->scheduleFlush();
+    }
+    updateWritability();
+}
+
+void themis::ResponseStream::end() {
+    if(!isOpen()) return;
+    if(!attached) {
+        held.append("0\r\n\r\n");
+        ended = true;
+        return;
+    }
+    Session* s = session.get();
+    BufferWriter(s->getOutputBuffer()).write(std::string("0\r\n\r\n"));
+    // the response is done, the session times out again
+    s->setLastActive(time(nullptr));
+    s->scheduleFlush();
+    ended = true;
+    detach();
+}
+
+void themis::ResponseStream::abort() {
+    if(ended) return;
+    ended = true;
+    held.clear();
+    if(!attached) return;
+    if(Session* s = session.get()) {
+        s->closeAfterFlush();
+        s->scheduleFlush();
+    }
+    detach();
+}
+
+size_t themis::ResponseStream::getQueuedBytes() const {
+    if(!attached) return held.size();
+    Session* s = session.get();
+    return s ? s->getOutputBuffer().size() : 0;
+}
+
+void themis::ResponseStream::updateWritability() {
+    size_t queued = getQueuedBytes();
+    if(writable && queued >= highWatermark) {
+        writable = false;
+        if(writabilityListener) writabilityListener(false);
+    } else if(!writable && queued <= lowWatermark) {
+        writable = true;
+        if(writabilityListener) writabilityListener(true);
+    }
+}
+
+void themis::ResponseStream::attach(SessionHandle session, CancellationToken token) {
+    attached = true;
+    this->session = std::move(session);
+    this->token = std::move(token);
+    Session* s = this->session.get();
+    if(!s) {
+        // the client left before the response was ready
+        ended = true;
+        this->token.cancel();
+        return;
+    }
+    if(!held.empty()) {
+        BufferWriter(s->getOutputBuffer()).write(held);
+        held = std::string();
+    }
+    s->scheduleFlush();
+    if(ended) {
+        s->setLastActive(time(nullptr));
+        return;
+    }
+    s->setWrittenListener([this]() {
+        updateWritability();
+    });
+    closeSubscription = this->session.getClosedToken().subscribe([this]() {
+        closeSubscription = 0;
+        // stop the work for the client, a cancelled query reads on and drops its rows
+        this->token.cancel();
+    });
+    updateWritability();
+}
+
+void themis::ResponseStream::detach() {
+    if(Session* s = session.get()) s->setWrittenListener(nullptr);
+    session.getClosedToken().unsubscribe(closeSubscription);
+    closeSubscription = 0;
+}
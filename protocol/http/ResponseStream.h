@@ -0,0 +1,109 @@
+#ifndef ResponseStream_h
+#define ResponseStream_h 1
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include "network/Session.h"
+#include "utils/Cancellation.h"
+
+namespace themis
+{
+
+    class ControllerManager;
+
+    /**
+     * @brief the body of a response sent while it is produced, in chunked transfer
+     * encoding. get it from HttpResponse::startStream, resolve the response, then keep
+     * writing until end. what is written before the response is sent is held and
+     * goes out right after the headers.
+     * like the websocket session, the stream tells its producer to pause once the
+     * bytes waiting for the client cross the high watermark and to go on once they
+     * fell to the low one. use it on the thread of the controller manager
+     *
+     */
+    class ResponseStream {
+    private:
+        friend ControllerManager;
+
+        SessionHandle session;
+        bool attached = false;
+        bool ended = false;
+        bool writable = true;
+        size_t lowWatermark = 64 * 1024;
+        size_t highWatermark = 256 * 1024;
+        /// @brief the chunks written before the response was sent
+        std::string held;
+        std::function<void (bool)> writabilityListener;
+        /// @brief the token of the request, cancelled if the client hangs up mid stream
+        CancellationToken token;
+        size_t closeSubscription = 0;
+
+        void updateWritability();
+        /// @brief stop listening to the session, the stream is done with it
+        void detach();
+
+        /**
+         * @brief send the response through the session, called by the controller manager
+         * once the headers are in the output buffer
+         *
+         * @param session the client
+         * @param token the token of the request, the work for it stops if the client leaves
+         */
+        void attach(SessionHandle session, CancellationToken token);
+
+    public:
+        ResponseStream() = default;
+        ResponseStream(const ResponseStream&) = delete;
+        /// @brief a stream dropped without end is aborted
+        ~ResponseStream();
+
+        /**
+         * @brief frame the data as a chunk of the body
+         *
+         * @param data the data, nothing is sent for empty data
+         */
+        void write(std::string_view data);
+
+        /// @brief send the last chunk, nothing can be written afterwards
+        void end();
+
+        /**
+         * @brief the body can not be completed, the connection is closed after what was
+         * written so that the client sees it cut short instead of waiting for the end
+         *
+         */
+        void abort();
+
+        /// @brief not ended and the client is still there
+        bool isOpen() const {
+            return !ended && (!attached || session.isOpen());
+        }
+
+        bool isWritable() const {
+            return writable;
+        }
+
+        /// @brief the bytes written and not sent to the client yet
+        size_t getQueuedBytes() const;
+
+        void setWatermarks(size_t low, size_t high) {
+            lowWatermark = low;
+            highWatermark = high;
+        }
+
+        /**
+         * @brief called with false once the queued bytes reach the high watermark, and with
+         * true once they fell back to the low one. pause the producer, a RowStream for
+         * instance, while not writable
+         *
+         * @param listener the listener
+         */
+        void setWritabilityListener(std::function<void (bool)> listener) {
+            writabilityListener = std::move(listener);
+        }
+    };
+
+} // namespace themis
+
+#endif
@@ -21,15 +21,25 @@ const std::map<themis::WebsocketFrameHeader::Operation,uint8_t> themis::Websocke
 };
 
 void themis::WebsocketFrame::parseBody(BufferReader &reader) {
-    size_t acquired = reader.getBytes(payload.data() + receivedLength, header.payloadLength - receivedLength);
-    // if the client use xor masking, then mask through the payload
-    if(header.masked) {
-        for (size_t i = receivedLength; i < acquired + receivedLength; i++)
-        {
-            payload[i] ^= header.maskingKey[i % 4];
+    while(receivedLength < header.payloadLength) {
+        uint8_t* span;
+        size_t acquired = reader.getSpan(&span, header.payloadLength - receivedLength);
+        if(!acquired) break;
+        // if the client use xor masking, then mask through the payload
+        if(header.masked) {
+            for (size_t i = 0; i < acquired; i++)
+            {
+                span[i] ^= header.maskingKey[(receivedLength + i) % 4];
+            }
+        }
+        size_t offset = receivedLength;
+        receivedLength += acquired;
+        if(isControlFrame() || !sink) {
+            std::memcpy(payload.data() + offset, span, acquired);
+        } else {
+            sink(span, acquired);
         }
     }
-    receivedLength += acquired;
     if(receivedLength == header.payloadLength) {
         state = COMPLETE;
         reader.finialize();
@@ -42,11 +52,19 @@ void themis::WebsocketFrame::parseFrom(BufferReader &reader) {
     {
     case AWAIT_HEADER:
         if(header.parseFrom(reader)) {
-            // the header has ended, then parse body
+            // the header has ended, check the declared length before accepting any payload
+            if(isControlFrame()) {
+                if(header.payloadLength > MAX_CONTROL_PAYLOAD || !header.finalFrame) 
+                    throw WebsocketCloseException(WebsocketCloseException::PROTOCOL_ERROR, "malformed control frame");
+                payload.resize(header.payloadLength);
+            } else if(header.payloadLength > maxPayloadLength) {
+                throw WebsocketCloseException(WebsocketCloseException::MESSAGE_TOO_BIG, 
+                    "frame payload of " + std::to_string(header.payloadLength) + " byte(s) exceeded limit");
+            } else if(!sink) {
+                payload.resize(header.payloadLength);
+            }
             state = AWAIT_PAYLOAD;
-            payload.resize(header.payloadLength);
             receivedLength = 0;
-            parseBody(reader);
         }
         break;
     case AWAIT_PAYLOAD:
@@ -91,8 +109,8 @@ bool themis::WebsocketFrameHeader::parseFrom(BufferReader &reader) {
         payloadLength = be16toh(extended);
     } else if (payloadLength == 127) {
         uint64_t extended;
-        acquired = reader.getBytes(&extended, 4);
-        if(acquired != 4) {
+        acquired = reader.getBytes(&extended, 8);
+        if(acquired != 8) {
             reader.revert();
             return false;
         }
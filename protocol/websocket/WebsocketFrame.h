@@ -6,6 +6,8 @@
 #include <cstring>
 #include <vector>
 #include <map>
+#include <functional>
+#include <stdexcept>
 #include "utils/Buffer.h"
 
 namespace themis
@@ -13,6 +15,29 @@ namespace themis
 
     class WebsocketFrame;
 
+    /**
+     * @brief thrown when the peer violated the protocol in a way that the connection
+     * should be failed with a close frame carrying the status code
+     * 
+     */
+    class WebsocketCloseException : public std::runtime_error {
+    public:
+        enum Code : uint16_t {
+            NORMAL_CLOSURE = 1000,
+            PROTOCOL_ERROR = 1002,
+            INVALID_PAYLOAD = 1007,
+            MESSAGE_TOO_BIG = 1009
+        };
+
+    private:
+        uint16_t code;
+
+    public:
+        WebsocketCloseException(uint16_t code, const std::string& reason) 
+        : std::runtime_error(reason), code(code) {}
+        uint16_t getCode() const { return code; }
+    };
+
     class WebsocketFrameHeader {
     public:
 
@@ -90,35 +115,63 @@ namespace themis
             COMPLETE
         };
 
+        /// @brief receive the unmasked payload of data frames as it arrives, 
+        /// the span points into the input buffer and is only valid during the call
+        using PayloadSink = std::function<void (const uint8_t*, size_t)>;
+
+        /// @brief control frames must not carry more than this
+        const static size_t MAX_CONTROL_PAYLOAD = 125;
+
     private:
 
         State state = AWAIT_HEADER;
         WebsocketFrameHeader header;
-        size_t receivedLength;
+        size_t receivedLength = 0;
+        size_t maxPayloadLength = 4 * 1024 * 1024;
         std::vector<uint8_t> payload;
+        PayloadSink sink;
 
         void parseBody(BufferReader& reader);
 
     public:
 
         bool isFinalFrame() const { return header.finalFrame; }
+        bool isControlFrame() const { 
+            return header.opcode == WebsocketFrameHeader::CONNECTION_CLOSE_FRAME ||
+            header.opcode == WebsocketFrameHeader::PING_FRAME ||
+            header.opcode == WebsocketFrameHeader::PONG_FRAME;
+        }
         size_t getPayloadLength() const { return header.payloadLength; }
+        size_t getReceivedLength() const { return receivedLength; }
         State getState() const { return state; }
         WebsocketFrameHeader::Operation getOperationCode() const { return header.opcode; }
+        /// @brief the payload of control frames, data frames are handed to the sink instead
         std::vector<uint8_t>& getPayload() { return payload; }
+
+        /**
+         * @brief frames declaring a longer payload fail with MESSAGE_TOO_BIG before 
+         * any of the payload is received
+         * 
+         * @param length max payload length of one frame
+         */
+        void setMaxPayloadLength(size_t length) { maxPayloadLength = length; }
+        void setPayloadSink(PayloadSink s) { sink = s; }
+
         /**
          * @brief reset this frame into default state
          * 
          */
         void reset() {
             state = AWAIT_HEADER;
+            receivedLength = 0;
             payload.clear();
         }
         /**
-         * @brief try to convert data from the given buffer reader
+         * @brief try to convert data from the given buffer reader, 
+         * a call either completes the header or consumes the payload, 
+         * so the caller can validate the header before any payload is handed out
          * 
          * @param reader reader
-         * @return true if the frame is completed
          */
         void parseFrom(BufferReader& reader);
 
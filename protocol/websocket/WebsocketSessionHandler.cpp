@@ -1,20 +1,64 @@
 #include "WebsocketSessionHandler.h"
 #include "protocol/websocket/WebsocketFrame.h"
 #include "utils/Buffer.h"
+#include <endian.h>
 #include <ng-log/logging.h>
 
-void themis::WebsocketSessionHandler::dispatchFrame() {
+void themis::WebsocketSessionHandler::beginFrame() {
+    if(pendingFrame->isControlFrame()) return;
+
+    if(pendingFrame->getOperationCode() == WebsocketFrameHeader::CONTINUATION_FRAME) {
+        if(!inMessage) throw WebsocketCloseException(WebsocketCloseException::PROTOCOL_ERROR, "invalid continuation frame");
+    } else {
+        // a new message begins
+        if(inMessage) throw WebsocketCloseException(WebsocketCloseException::PROTOCOL_ERROR, "expected continuation frame");
+        inMessage = true;
+        textMessage = pendingFrame->getOperationCode() == WebsocketFrameHeader::TEXT_FRAME;
+        messageLength = 0;
+        utf8.reset();
+        if(!streaming) {
+            if(textMessage) message = std::string();
+            else message = std::vector<uint8_t>();
+        }
+    }
 
-    auto& payload = pendingFrame->getPayload();
+    if(messageLength + pendingFrame->getPayloadLength() > maxMessageSize) {
+        throw WebsocketCloseException(WebsocketCloseException::MESSAGE_TOO_BIG, 
+            "message exceeded " + std::to_string(maxMessageSize) + " byte(s)");
+    }
+    if(!streaming && messageLength == 0) {
+        // usually the only frame of the message, avoid growing while appending
+        std::visit([this](auto& m) {
+            m.reserve(pendingFrame->getPayloadLength());
+        }, message);
+    }
+}
+
+void themis::WebsocketSessionHandler::receivePayload(const uint8_t *data, size_t length) {
+    messageLength += length;
+    // characters may be split across frames and reads, the validator carries them over
+    if(textMessage && validateUtf8 && !utf8.update(data, length)) {
+        throw WebsocketCloseException(WebsocketCloseException::INVALID_PAYLOAD, "invalid utf-8 in text message");
+    }
+    if(streaming) {
+        bool last = pendingFrame->isFinalFrame() && 
+        pendingFrame->getReceivedLength() == pendingFrame->getPayloadLength();
+        listener->onFragment(*this, textMessage, data, length, last);
+        return;
+    }
 
     const auto writeVisitor = MessageVisitor {
         [&](std::vector<uint8_t>& v) {
-            v.insert(v.end(), payload.begin(), payload.end());
+            v.insert(v.end(), data, data + length);
         },
         [&](std::string& s) {
-            s.append(reinterpret_cast<std::string::traits_type::char_type *>(payload.data()), payload.size());
+            s.append(reinterpret_cast<const std::string::traits_type::char_type *>(data), length);
         }
     };
+    std::visit(writeVisitor, message);
+}
+
+void themis::WebsocketSessionHandler::dispatchFrame() {
 
     const auto readVisitor = MessageVisitor {
         [this](std::vector<uint8_t>& v) {
@@ -27,53 +71,178 @@ void themis::WebsocketSessionHandler::dispatchFrame() {
 
     switch (pendingFrame->getOperationCode()) {
         case WebsocketFrameHeader::TEXT_FRAME:
-            message = std::string();
-            std::visit(writeVisitor,message);
-            break;
         case WebsocketFrameHeader::BINARY_FRAME:
-            message = std::vector<uint8_t>();
-            std::visit(writeVisitor, message);
-            break;
         case WebsocketFrameHeader::CONTINUATION_FRAME:
-            if(! message.valueless_by_exception()) throw std::runtime_error("invalid continuation frame");
-            std::visit(writeVisitor, message);
+            if(!pendingFrame->isFinalFrame()) break;
+            // the message has ended, invoke listener
+            inMessage = false;
+            if(textMessage && validateUtf8 && !utf8.finish()) {
+                throw WebsocketCloseException(WebsocketCloseException::INVALID_PAYLOAD, "text message ended in an incomplete character");
+            }
+            if(streaming) {
+                // the last piece has already been handed out unless the final frame is empty
+                if(pendingFrame->getPayloadLength() == 0) listener->onFragment(*this, textMessage, nullptr, 0, true);
+            } else {
+                std::visit(readVisitor, message);
+                // release the message storage
+                message = std::vector<uint8_t>();
+            }
+            break;
+        case WebsocketFrameHeader::CONNECTION_CLOSE_FRAME: {
+            // echo the status code and close the session once it is sent
+            auto& payload = pendingFrame->getPayload();
+            uint16_t code = WebsocketCloseException::NORMAL_CLOSURE;
+            if(payload.size() >= 2) {
+                std::memcpy(&code, payload.data(), 2);
+                code = be16toh(code);
+            }
+            close(code);
             break;
-        case WebsocketFrameHeader::CONNECTION_CLOSE_FRAME:
-            // inform reactor to end the session
-            throw std::exception();
+        }
         case WebsocketFrameHeader::PING_FRAME:
             
         case WebsocketFrameHeader::PONG_FRAME:
           break;
     }
-
-    if((pendingFrame->getOperationCode() == WebsocketFrameHeader::TEXT_FRAME ||
-    pendingFrame->getOperationCode() == WebsocketFrameHeader::BINARY_FRAME || 
-    pendingFrame->getOperationCode() == WebsocketFrameHeader::CONTINUATION_FRAME) && (pendingFrame->isFinalFrame())) {
-        // the message has ended, invoke listener
-        std::visit(readVisitor, message);
-    }
 }
 
 void themis::WebsocketSessionHandler::handleSession() {
     BufferReader reader(session->getInputBuffer());
+
+    if(session->isClosing()) {
+        // the close frame has been sent, discard anything else from peer
+        uint8_t* span;
+        while(reader.getSpan(&span, SIZE_MAX));
+        return;
+    }
     
     try {
-        pendingFrame->parseFrom(reader);
+        for(;;) {
+            WebsocketFrame::State state = pendingFrame->getState();
+            pendingFrame->parseFrom(reader);
+            if(state == WebsocketFrame::AWAIT_HEADER) {
+                // header not yet complete
+                if(pendingFrame->getState() == WebsocketFrame::AWAIT_HEADER) break;
+                beginFrame();
+                continue;
+            }
+            // payload not yet complete
+            if(pendingFrame->getState() != WebsocketFrame::COMPLETE) break;
+            dispatchFrame();
+            // prepare next frame
+            pendingFrame->reset();
+            if(session->isClosing()) break;
+        }
+    } catch(const WebsocketCloseException& e) {
+        LOG(INFO) << "failing websocket session with code " << e.getCode() << " : " << e.what();
+        close(e.getCode(), e.what());
     } catch(const std::exception& e) {
         // when frame fail to parse, close the session
         LOG(INFO) << "invalid websocket frame : " << e.what();
-        throw e;
-    }
-    
-    if(pendingFrame->getState() == WebsocketFrame::COMPLETE) {
-        dispatchFrame();
-        // prepare next frame
-        pendingFrame->reset();
+        throw;
     }
 }
 
 void themis::WebsocketSessionHandler::finish(bool text) {
-    wsWriter.finish(text);
-    event_add(session->getWriteEvent(), nullptr);
-}
\ No newline at end of file
+    finish(text, "");
+}
+
+void themis::WebsocketSessionHandler::finish(bool text, const std::string& key) {
+    if(session->isClosing()) {
+        // no data frame is allowed after the close frame
+        wsWriter.discard();
+        return;
+    }
+    std::string data = wsWriter.take();
+
+    if(overflowPolicy == COALESCE && !key.empty()) {
+        // replace the held back value of the same key
+        for(auto& m: pending) {
+            if(m.key != key) continue;
+            if(getQueuedBytes() - m.data.size() + data.size() > maxQueuedBytes) break;
+            pendingBytes = pendingBytes - m.data.size() + data.size();
+            m.data = std::move(data);
+            m.text = text;
+            return;
+        }
+    }
+
+    if(!makeRoom(data.size())) return;
+
+    if(pending.empty() && session->getOutputBuffer().size() < highWatermark) {
+        // the peer keeps up, encode directly
+        wsWriter.write(data.data(), data.size(), text);
+        session->scheduleFlush();
+    } else {
+        pendingBytes += data.size();
+        pending.push_back(PendingMessage{std::move(data), text, key});
+    }
+    updateWritability();
+}
+
+bool themis::WebsocketSessionHandler::makeRoom(size_t size) {
+    if(getQueuedBytes() + size <= maxQueuedBytes) return true;
+
+    switch (overflowPolicy) {
+        case DROP_OLDEST:
+            while(!pending.empty() && getQueuedBytes() + size > maxQueuedBytes) {
+                pendingBytes -= pending.front().data.size();
+                pending.pop_front();
+            }
+            if(getQueuedBytes() + size <= maxQueuedBytes) return true;
+            break;
+        case DROP_NEWEST:
+        case COALESCE:
+            break;
+        case DISCONNECT:
+            LOG(INFO) << "slow consumer exceeded " << maxQueuedBytes << " queued byte(s), disconnecting : " << session->toString();
+            disconnect();
+            return false;
+    }
+    VLOG(5) << "dropped outbound message of " << size << " byte(s) for slow consumer : " << session->toString();
+    return false;
+}
+
+void themis::WebsocketSessionHandler::disconnect() {
+    pending.clear();
+    pendingBytes = 0;
+    // nothing is sent anymore, the reactor removes the session at the end of the tick
+    session->getOutputBuffer().reset();
+    session->drop();
+}
+
+void themis::WebsocketSessionHandler::updateWritability() {
+    size_t queued = getQueuedBytes();
+    if(writable && queued >= highWatermark) {
+        writable = false;
+        if(listener.get()) listener->onWritabilityChanged(*this, false);
+    } else if(!writable && queued <= lowWatermark) {
+        writable = true;
+        if(listener.get()) listener->onWritabilityChanged(*this, true);
+    }
+}
+
+void themis::WebsocketSessionHandler::handleWritten() {
+    if(session->isClosing()) return;
+    bool refilled = false;
+    // move the held back messages to output buffer while the peer keeps up
+    while(!pending.empty() && session->getOutputBuffer().size() < highWatermark) {
+        auto& m = pending.front();
+        wsWriter.write(m.data.data(), m.data.size(), m.text);
+        pendingBytes -= m.data.size();
+        pending.pop_front();
+        refilled = true;
+    }
+    if(refilled) session->scheduleFlush();
+    updateWritability();
+}
+
+void themis::WebsocketSessionHandler::close(uint16_t code, const std::string &reason) {
+    if(session->isClosing()) return;
+    // the held back messages are never sent
+    pending.clear();
+    pendingBytes = 0;
+    wsWriter.writeClose(code, reason);
+    session->closeAfterFlush();
+    session->scheduleFlush();
+}
@@ -2,7 +2,9 @@
 #define WebsocketSessionHandler_h 1
 
 #include <variant>
+#include <deque>
 #include "utils/EventQueue.h"
+#include "utils/Utf8Validator.h"
 #include "network/Session.h"
 #include "WebsocketFrame.h"
 #include "WebsocketWriter.h"
@@ -19,6 +21,22 @@ namespace themis
     class WebsocketSessionHandler : public SessionHandler {
     public:
 
+        /**
+         * @brief what to do with an outgoing message when the queued outbound bytes 
+         * of the session would exceed the cap
+         * 
+         */
+        enum OverflowPolicy {
+            /// @brief drop the oldest messages that are not yet in the output buffer
+            DROP_OLDEST,
+            /// @brief drop the message being sent
+            DROP_NEWEST,
+            /// @brief keep only the latest message per key, unkeyed or new keys are dropped when over the cap
+            COALESCE,
+            /// @brief drop the session
+            DISCONNECT
+        };
+
         /**
          * @brief the EventListener class is the user defined interface to access the data
          * parsed from websocket session handler
@@ -36,6 +54,25 @@ namespace themis
             virtual ~EventListener() = default;
             virtual void onText(WebsocketSessionHandler& handler, const std::string& msg) {};
             virtual void onBinary(WebsocketSessionHandler& handler, const std::vector<uint8_t>& msg) {};
+            /**
+             * @brief called instead of onText/onBinary when the handler is streaming, 
+             * with each piece of payload as soon as it arrives, the message is never reassembled
+             * 
+             * @param handler handler
+             * @param text if the message is a text message
+             * @param data unmasked payload, only valid during this call
+             * @param length size of the payload piece, may be 0 for the last piece
+             * @param last true if this is the last piece of the message
+             */
+            virtual void onFragment(WebsocketSessionHandler& handler, bool text, const uint8_t* data, size_t length, bool last) {};
+            /**
+             * @brief called when the queued outbound bytes crossed the high watermark (not writable)
+             * or fell back to the low watermark (writable), producers should pause while not writable
+             * 
+             * @param handler handler
+             * @param writable if the session is writable
+             */
+            virtual void onWritabilityChanged(WebsocketSessionHandler& handler, bool writable) {};
             virtual void onDisconnect() {};
         };
 
@@ -43,14 +80,69 @@ namespace themis
         std::unique_ptr<WebsocketFrame> pendingFrame = std::make_unique<WebsocketFrame>();
         std::unique_ptr<EventListener> listener;
         std::variant<std::vector<uint8_t>, std::string> message;
+        /// @brief a data message has started but its final frame has not arrived
+        bool inMessage = false;
+        bool textMessage = false;
+        size_t messageLength = 0;
+        size_t maxMessageSize = 16 * 1024 * 1024;
+        /// @brief hand the payload to EventListener::onFragment instead of reassembling
+        bool streaming = false;
+        /// @brief validates text messages as their payload arrives
+        Utf8Validator utf8;
+        bool validateUtf8 = true;
         WebsocketWriter wsWriter;
 
+        /// @brief a message held back because the output buffer is over the high watermark
+        struct PendingMessage {
+            std::string data;
+            bool text;
+            std::string key;
+        };
+        std::deque<PendingMessage> pending;
+        size_t pendingBytes = 0;
+        size_t lowWatermark = 64 * 1024;
+        size_t highWatermark = 256 * 1024;
+        size_t maxQueuedBytes = 8 * 1024 * 1024;
+        OverflowPolicy overflowPolicy = DISCONNECT;
+        bool writable = true;
+
+        /**
+         * @brief inform the listener if the queued bytes crossed a watermark
+         * 
+         */
+        void updateWritability();
+        /**
+         * @brief try to make room for a message of the size by applying the overflow policy
+         * 
+         * @param size size of the message
+         * @return true if the message can be queued
+         */
+        bool makeRoom(size_t size);
+        /**
+         * @brief drop the session without sending out the remaining output
+         * 
+         */
+        void disconnect();
+
         template<class ...Ty>
         struct MessageVisitor : Ty... {
             using Ty::operator()...;
         };
         template<class... Ts> MessageVisitor(Ts...) -> MessageVisitor<Ts...>;
 
+        /**
+         * @brief validate the frame when its header is complete, 
+         * before any payload is handed out
+         * 
+         */
+        void beginFrame();
+        /**
+         * @brief receive a piece of data frame payload from the pending frame
+         * 
+         * @param data unmasked payload
+         * @param length size
+         */
+        void receivePayload(const uint8_t* data, size_t length);
         /**
          * @brief handle the frame when it reached the COMPLETE state
          * 
@@ -69,10 +161,94 @@ namespace themis
          */
         void finish(bool text);
 
+        /**
+         * @brief same as finish, but under COALESCE policy a queued message with the 
+         * same key is replaced by this one
+         * 
+         * @param text if the data in output stream is text
+         * @param key coalescing key, empty for none
+         */
+        void finish(bool text, const std::string& key);
+
+        /**
+         * @brief configure the outbound backpressure of this session
+         * 
+         * @param low the session becomes writable again when queued bytes fall to this
+         * @param high the session becomes unwritable when queued bytes reach this, 
+         * later messages are held back instead of being encoded into the output buffer
+         * @param max queued bytes never exceed this, the overflow policy decides what happens
+         */
+        void setWatermarks(size_t low, size_t high, size_t max) {
+            lowWatermark = low;
+            highWatermark = high;
+            maxQueuedBytes = max;
+        }
+        void setOverflowPolicy(OverflowPolicy p) {
+            overflowPolicy = p;
+        }
+        bool isWritable() {
+            return writable;
+        }
+        /**
+         * @brief get the number of outbound bytes in the output buffer and held back
+         * 
+         * @return size_t 
+         */
+        size_t getQueuedBytes() {
+            return session->getOutputBuffer().size() + pendingBytes;
+        }
+
         void setMaxPayloadSize(size_t newSize) {
             wsWriter.setMaxPayloadSize(newSize);
         }
 
+        /**
+         * @brief frames longer than this fail the connection with 1009
+         * 
+         * @param size max payload size of an incoming frame
+         */
+        void setMaxFrameSize(size_t size) {
+            pendingFrame->setMaxPayloadLength(size);
+        }
+
+        /**
+         * @brief messages longer than this in total fail the connection with 1009, 
+         * also applies when streaming
+         * 
+         * @param size max size of an incoming message
+         */
+        void setMaxMessageSize(size_t size) {
+            maxMessageSize = size;
+        }
+
+        /**
+         * @brief enable to receive data messages through EventListener::onFragment
+         * 
+         * @param b true to stream
+         */
+        void setStreaming(bool b) {
+            streaming = b;
+        }
+
+        /**
+         * @brief text messages that are not utf-8 fail the connection with 1007, 
+         * enabled by default as required by RFC 6455
+         * 
+         * @param b true to validate
+         */
+        void setUtf8Validation(bool b) {
+            validateUtf8 = b;
+        }
+
+        /**
+         * @brief send a close frame and close the session after it has been sent, 
+         * all later input and output are discarded
+         * 
+         * @param code close status code
+         * @param reason reason sent to the peer
+         */
+        void close(uint16_t code, const std::string& reason = "");
+
         ~WebsocketSessionHandler() {
             // this means this handler is removed by reactor for some reason
             // thus calling the disconnect callback
@@ -88,9 +264,13 @@ namespace themis
             // disable timeout
             // implement this feature by using ping mechanism
             session->setLastActive(0x7fffffffffffffffl);
+            pendingFrame->setPayloadSink([this](const uint8_t* data, size_t length) {
+                receivePayload(data, length);
+            });
         }
 
         virtual void handleSession() override;
+        virtual void handleWritten() override;
     };
     
 } // namespace themis
@@ -1,37 +1,54 @@
 #include "WebsocketWriter.h"
 #include "WebsocketFrame.h"
+#include <endian.h>
 
 void themis::WebsocketWriter::finish(bool text) {
+    std::string data = take();
+    write(data.data(), data.size(), text);
+}
+
+void themis::WebsocketWriter::write(const void *data, size_t length, bool text) {
     
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(data);
     WebsocketFrameHeader header;
     header.setOperation(text ? WebsocketFrameHeader::TEXT_FRAME : WebsocketFrameHeader::BINARY_FRAME);
 
-    std::vector<uint8_t> temp(maxPayloadSize, 0);
-    while(!outStream.eof()) {
-
-        outStream.read(reinterpret_cast<char*>(temp.data()), maxPayloadSize);
-        std::streamsize acquiredSize = outStream.gcount();
-        // peek one incase the message is exactly the size of maxPayloadSize
-        outStream.peek();
-
-        header.setPayloadLength(acquiredSize);
-
-        if (acquiredSize < maxPayloadSize ||
-        outStream.eof()) {
-            // last fragment
-            header.setFinalFrame(true);
-        }
-        // mask the payload
-        size_t index = 0;
+    size_t offset = 0;
+    do {
+        size_t fragmentSize = length - offset > maxPayloadSize ? maxPayloadSize : length - offset;
+        header.setPayloadLength(fragmentSize);
+        // last fragment
+        header.setFinalFrame(offset + fragmentSize == length);
 
         // serialize the header to buffer
         header.writeTo(baseWriter);
         // write payload
-        baseWriter.write(temp.data(), acquiredSize);
+        baseWriter.write(ptr + offset, fragmentSize);
         header.setOperation(WebsocketFrameHeader::CONTINUATION_FRAME);
-        
-    }   
-    // when finished, reset the buffer and its data
-    outStream.clear();
-    outStream.str() = "";
+        offset += fragmentSize;
+    } while(offset < length);
+}
+
+std::string themis::WebsocketWriter::take() {
+    std::string data = outStream.str();
+    // when taken, reset the buffer and its data
+    discard();
+    return data;
+}
+
+void themis::WebsocketWriter::writeClose(uint16_t code, const std::string &reason) {
+    size_t length = WebsocketFrame::MAX_CONTROL_PAYLOAD - 2;
+    if(reason.size() > length) {
+        // cut before the character the limit falls in, the peer rejects a partial one
+        while(length > 0 && (static_cast<uint8_t>(reason[length]) & 0xC0) == 0x80) length--;
+    }
+    std::string r = reason.substr(0, length);
+    WebsocketFrameHeader header;
+    header.setOperation(WebsocketFrameHeader::CONNECTION_CLOSE_FRAME);
+    header.setFinalFrame(true);
+    header.setPayloadLength(r.length() + 2);
+    header.writeTo(baseWriter);
+    uint16_t netCode = htobe16(code);
+    baseWriter.write(&netCode, sizeof(netCode));
+    baseWriter.write(r);
 }
@@ -34,6 +34,41 @@ namespace themis
          * @param mode what mode this writer should interprete the data, true if the data is pure text
          */
         void finish(bool text);
+
+        /**
+         * @brief wrap the given message into websocket frames and write them 
+         * into the base writer, the output stream is left untouched
+         * 
+         * @param data message
+         * @param length size of the message
+         * @param text true if the message is text
+         */
+        void write(const void* data, size_t length, bool text);
+
+        /**
+         * @brief take the data in the output stream out without writing it
+         * 
+         * @return std::string the data written to the output stream since last finish
+         */
+        std::string take();
+
+        /**
+         * @brief write a close frame carrying the status code and reason directly 
+         * into the base writer, the output stream is left untouched
+         * 
+         * @param code close status code
+         * @param reason utf-8 reason, truncated to the last whole character fitting in a control frame
+         */
+        void writeClose(uint16_t code, const std::string& reason);
+
+        /**
+         * @brief drop the data in the output stream without writing
+         * 
+         */
+        void discard() {
+            outStream.str("");
+            outStream.clear();
+        }
         void setMaxPayloadSize(size_t newSize) {
             maxPayloadSize = newSize;
         }
@@ -9,6 +9,16 @@
 namespace themis
 {
     
+    /**
+     * @brief how a failed query affects the queries sent with it in one pipeline batch
+     * 
+     */
+    enum class PipelineIsolation {
+        /// @brief every query succeeds or fails on its own
+        QUERY,
+        /// @brief the queries of a batch run in one transaction, one failure fails them all
+        BATCH
+    };
 
     class DatasourceConfig {
     private:
@@ -17,22 +27,57 @@ namespace themis
         std::string password;
         std::string database;
         size_t maxRetry = 3;
+        /// @brief seconds an attempt to connect may take
+        size_t connectTimeout = 10;
+        /// @brief statements kept prepared on each connection
+        size_t statementCacheSize = 256;
+        /// @brief statements sent on a connection before the first result is back, 1 disables pipelining
+        size_t pipelineDepth = 1;
+        PipelineIsolation pipelineIsolation = PipelineIsolation::QUERY;
+        /// @brief connections kept open to this datasource, and the most the pool grows to
+        size_t minConnections = 1;
+        size_t maxConnections = 1;
+        /// @brief seconds a connection above the minimum may stay idle before it is closed
+        size_t idleTimeout = 60;
+        /// @brief milliseconds a query may wait behind others before the pool opens another connection
+        size_t queueWaitThreshold = 20;
     public:
         DatasourceConfig() = default;
         DatasourceConfig(const DatasourceConfig& config) 
         : address(config.address), username(config.username), 
-        password(config.password), database(config.database) {}
+        password(config.password), database(config.database), 
+        maxRetry(config.maxRetry), connectTimeout(config.connectTimeout), statementCacheSize(config.statementCacheSize), 
+        pipelineDepth(config.pipelineDepth), pipelineIsolation(config.pipelineIsolation), 
+        minConnections(config.minConnections), maxConnections(config.maxConnections), 
+        idleTimeout(config.idleTimeout), queueWaitThreshold(config.queueWaitThreshold) {}
         void operator=(const DatasourceConfig& config) {
             address = config.address;
             username = config.username;
             password = config.password;
             database = config.database;
+            maxRetry = config.maxRetry;
+            connectTimeout = config.connectTimeout;
+            statementCacheSize = config.statementCacheSize;
+            pipelineDepth = config.pipelineDepth;
+            pipelineIsolation = config.pipelineIsolation;
+            minConnections = config.minConnections;
+            maxConnections = config.maxConnections;
+            idleTimeout = config.idleTimeout;
+            queueWaitThreshold = config.queueWaitThreshold;
         }
         std::string& getAddress() { return address; }
         std::string& getUsername() { return username; }
         std::string& getPassword() { return password; }
         std::string& getDatabase() { return database; }
         size_t& getMaxRetry() { return maxRetry; }
+        size_t& getConnectTimeout() { return connectTimeout; }
+        size_t& getStatementCacheSize() { return statementCacheSize; }
+        size_t& getPipelineDepth() { return pipelineDepth; }
+        PipelineIsolation& getPipelineIsolation() { return pipelineIsolation; }
+        size_t& getMinConnections() { return minConnections; }
+        size_t& getMaxConnections() { return maxConnections; }
+        size_t& getIdleTimeout() { return idleTimeout; }
+        size_t& getQueueWaitThreshold() { return queueWaitThreshold; }
         std::string toString() {
             std::string str = "{addr=\"" + address 
             + "\", username=\"" + username + "\""
@@ -86,6 +131,16 @@ namespace themis
 
     public:
 
+        /**
+         * @brief get the pool associated with given identifier
+         * 
+         * @param id identifier
+         * @return TPoolType& the pool, throws std::out_of_range if none was configured
+         */
+        TPoolType& getPool(const std::string& id) {
+            return *pools.at(id);
+        }
+
         /**
          * @brief add the pool associated with given identifier
          * 
@@ -0,0 +1,139 @@
+#include "Copy.h"
+#include <bit>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+
+void themis::CopyTextEncoder::field(std::string_view v) {
+    for(char c : v) {
+        switch(c) {
+        case '\\': data.append("\\\\"); break;
+        case '\n': data.append("\\n"); break;
+        case '\r': data.append("\\r"); break;
+        case '\t': data.append("\\t"); break;
+        default: data.push_back(c);
+        }
+    }
+}
+
+void themis::CopyTextEncoder::field(Timestamp v) {
+    if(v == Timestamp::max()) {
+        data.append("infinity");
+        return;
+    }
+    if(v == Timestamp::min()) {
+        data.append("-infinity");
+        return;
+    }
+    auto days = std::chrono::floor<std::chrono::days>(v);
+    std::chrono::year_month_day date(days);
+    std::chrono::hh_mm_ss<std::chrono::microseconds> time(v - days);
+    char buf[48];
+    int length = snprintf(buf, sizeof(buf), "%04d-%02u-%02u %02d:%02d:%02d.%06d+00",
+        int(date.year()), unsigned(date.month()), unsigned(date.day()),
+        int(time.hours().count()), int(time.minutes().count()), int(time.seconds().count()),
+        int(time.subseconds().count()));
+    data.append(buf, length);
+}
+
+void themis::CopyTextEncoder::field(Bytes v) {
+    static const char hex[] = "0123456789abcdef";
+    // the backslash of \x is escaped itself in the text format
+    data.append("\\\\x");
+    for(unsigned char c : v) {
+        data.push_back(hex[c >> 4]);
+        data.push_back(hex[c & 15]);
+    }
+}
+
+void themis::CopyBinaryEncoder::header() {
+    started = true;
+    // the signature, then no flags and no header extension
+    data.append("PGCOPY\n\377\r\n\0", 11);
+    append(0, 4);
+    append(0, 4);
+}
+
+void themis::CopyBinaryEncoder::append(uint64_t v, size_t length) {
+    char buf[8];
+    detail::writeBigEndian(buf, v, length);
+    data.append(buf, length);
+}
+
+void themis::CopyBinaryEncoder::field(float v) {
+    append(4, 4);
+    append(std::bit_cast<uint32_t>(v), 4);
+}
+
+void themis::CopyBinaryEncoder::field(double v) {
+    append(8, 4);
+    append(std::bit_cast<uint64_t>(v), 8);
+}
+
+void themis::CopyBinaryEncoder::field(std::string_view v) {
+    append(v.size(), 4);
+    data.append(v);
+}
+
+void themis::CopyBinaryEncoder::field(Timestamp v) {
+    append(8, 4);
+    append(detail::toPostgresTime(v), 8);
+}
+
+void themis::CopyBinaryEncoder::field(Bytes v) {
+    append(v.size(), 4);
+    data.append((const char*)v.data(), v.size());
+}
+
+void themis::CopyBinaryEncoder::finish() {
+    if(finished) return;
+    finished = true;
+    if(!started) header();
+    append((uint16_t)-1, 2);
+}
+
+void themis::CopyPipe::write(std::string data) {
+    if(data.empty()) return;
+    std::lock_guard<AdaptiveLock> guard(lock);
+    if(ended || !error.empty()) return;
+    queuedBytes += data.size();
+    chunks.push_back(std::move(data));
+}
+
+void themis::CopyPipe::end() {
+    std::lock_guard<AdaptiveLock> guard(lock);
+    ended = true;
+}
+
+void themis::CopyPipe::fail(std::string reason) {
+    std::lock_guard<AdaptiveLock> guard(lock);
+    if(ended && chunks.empty()) return;
+    error = reason.empty() ? "the copy was aborted" : std::move(reason);
+    chunks.clear();
+    queuedBytes = 0;
+}
+
+themis::CopySource::Status themis::CopyPipe::read(std::string& out) {
+    std::lock_guard<AdaptiveLock> guard(lock);
+    if(!error.empty()) throw std::runtime_error(error);
+    if(chunks.empty()) return ended ? Status::END : Status::WAIT;
+    out = std::move(chunks.front());
+    chunks.pop_front();
+    queuedBytes -= out.size();
+    return Status::DATA;
+}
+
+void themis::CopyOutStream::deliver(std::shared_ptr<CopyOutStream> self, std::string data) {
+    CopyOutStream* stream = self.get();
+    stream->pending++;
+    stream->queue->addImmediate([self = std::move(self), data = std::move(data)]() mutable {
+        self->bytes += data.size();
+        try {
+            self->onData(std::move(data));
+        } catch(...) {
+            self->pending--;
+            throw;
+        }
+        self->pending--;
+    });
+}
@@ -0,0 +1,353 @@
+#ifndef Copy_h
+#define Copy_h 1
+
+#include "PgTypes.h"
+#include "utils/AdaptiveLock.h"
+#include "utils/EventQueue.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace themis
+{
+
+    class PostgresqlConnectionPool;
+
+    /**
+     * @brief writes rows in the text format of COPY, tab separated values one row a line.
+     * the values are escaped, std::nullopt and an empty std::optional are NULL
+     *
+     */
+    class CopyTextEncoder {
+    private:
+        std::string data;
+
+        void field(std::nullopt_t) {
+            data.append("\\N");
+        }
+        void field(bool v) {
+            data.push_back(v ? 't' : 'f');
+        }
+        void field(std::string_view v);
+        void field(const char* v) {
+            field(std::string_view(v));
+        }
+        void field(const std::string& v) {
+            field(std::string_view(v));
+        }
+        void field(Timestamp v);
+        void field(Bytes v);
+        void field(const std::vector<unsigned char>& v) {
+            field(Bytes(v));
+        }
+
+        template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>>>
+        void field(T v) {
+            char buf[32];
+            auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+            data.append(buf, end);
+        }
+
+        template<typename T>
+        void field(const std::optional<T>& v) {
+            if(v) field(*v);
+            else field(std::nullopt);
+        }
+
+    public:
+        /**
+         * @brief add a row, the values in the order of the columns of the COPY
+         *
+         * @param values the values
+         * @return CopyTextEncoder& this
+         */
+        template<typename ...Args>
+        CopyTextEncoder& row(const Args&... values) {
+            size_t i = 0;
+            ((i++ ? data.push_back('\t') : void(), field(values)), ...);
+            data.push_back('\n');
+            return *this;
+        }
+
+        /// @brief nothing ends the text format
+        void finish() {}
+
+        /// @brief the bytes encoded so far
+        size_t size() const {
+            return data.size();
+        }
+
+        /// @brief take the data encoded since the last take
+        std::string take() {
+            std::string out = std::move(data);
+            data.clear();
+            return out;
+        }
+    };
+
+    /**
+     * @brief writes rows in the binary format of COPY. there is no conversion on the
+     * server, each value must have the layout of its column: int16_t for smallint,
+     * int32_t for integer, int64_t for bigint, float and double, bool, Timestamp for
+     * timestamp and timestamptz, strings for text and varchar, bytes for bytea
+     *
+     */
+    class CopyBinaryEncoder {
+    private:
+        std::string data;
+        bool started = false;
+        bool finished = false;
+
+        void header();
+        void append(uint64_t v, size_t length);
+
+        void field(std::nullopt_t) {
+            append((uint32_t)-1, 4);
+        }
+        void field(bool v) {
+            append(1, 4);
+            data.push_back(v ? 1 : 0);
+        }
+        void field(float v);
+        void field(double v);
+        void field(std::string_view v);
+        void field(const char* v) {
+            field(std::string_view(v));
+        }
+        void field(const std::string& v) {
+            field(std::string_view(v));
+        }
+        void field(Timestamp v);
+        void field(Bytes v);
+        void field(const std::vector<unsigned char>& v) {
+            field(Bytes(v));
+        }
+
+        /// @brief the smallest postgres integer holding every value of T, as Statement binds it
+        template<typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+        void field(T v) {
+            static_assert(std::is_signed_v<T> || sizeof(T) < 8, "no postgres integer holds a uint64_t");
+            size_t length = sizeof(T) == 1 || (std::is_signed_v<T> && sizeof(T) == 2) ? 2 :
+                sizeof(T) <= 2 || (std::is_signed_v<T> && sizeof(T) == 4) ? 4 : 8;
+            append(length, 4);
+            append((uint64_t)(int64_t)v, length);
+        }
+
+        template<typename T>
+        void field(const std::optional<T>& v) {
+            if(v) field(*v);
+            else field(std::nullopt);
+        }
+
+    public:
+        /**
+         * @brief add a row, the values in the order of the columns of the COPY
+         *
+         * @param values the values
+         * @return CopyBinaryEncoder& this
+         */
+        template<typename ...Args>
+        CopyBinaryEncoder& row(const Args&... values) {
+            if(!started) header();
+            append(sizeof...(Args), 2);
+            (field(values), ...);
+            return *this;
+        }
+
+        /// @brief write the trailer after the last row, once
+        void finish();
+
+        size_t size() const {
+            return data.size();
+        }
+
+        std::string take() {
+            std::string out = std::move(data);
+            data.clear();
+            return out;
+        }
+    };
+
+    /**
+     * @brief the data of a COPY FROM STDIN. read is called on the driver thread whenever
+     * the connection can take more, it should only hand over data made elsewhere or
+     * encode it, never block
+     *
+     */
+    class CopySource {
+    public:
+        enum class Status {
+            /// @brief out holds data
+            DATA,
+            /// @brief no data yet, read is called again on the next loop of the driver
+            WAIT,
+            /// @brief all data was read, the copy is ended
+            END
+        };
+
+        virtual ~CopySource() = default;
+
+        /**
+         * @brief get the next data, in the format the COPY statement names
+         *
+         * @param out empty, append the data to it
+         * @return Status see above
+         * @throw std::exception to abort the copy, the message is sent to the server as the reason
+         */
+        virtual Status read(std::string& out) = 0;
+    };
+
+    /**
+     * @brief encodes the items of a range in chunks, as the connection takes them
+     *
+     */
+    template<typename Encoder, typename Range, typename Fn>
+    class CopyRangeSource : public CopySource {
+    private:
+        Range range;
+        decltype(std::begin(std::declval<Range&>())) it;
+        Fn encodeRow;
+        Encoder encoder;
+        size_t chunkBytes;
+
+    public:
+        CopyRangeSource(Range range, Fn encodeRow, size_t chunkBytes)
+        : range(std::move(range)), it(std::begin(this->range)), encodeRow(std::move(encodeRow)), chunkBytes(chunkBytes) {}
+        CopyRangeSource(const CopyRangeSource&) = delete;
+
+        virtual Status read(std::string& out) override {
+            auto end = std::end(range);
+            while(it != end && encoder.size() < chunkBytes) {
+                encodeRow(encoder, *it);
+                ++it;
+            }
+            if(it == end) encoder.finish();
+            out = encoder.take();
+            return out.empty() ? Status::END : Status::DATA;
+        }
+    };
+
+    /**
+     * @brief copy the items of a range, encoded by the function on the driver thread
+     * as in makeCopySource<CopyBinaryEncoder>(std::move(events), [](auto& e, const Event& v) { e.row(v.id, v.at); })
+     *
+     * @param range the items, kept by the source until the copy is done. moved in or copied
+     * @param encodeRow called with the encoder and each item, adds its row
+     * @param chunkBytes about how much is encoded at a time
+     * @return std::shared_ptr<CopySource> the source
+     */
+    template<typename Encoder, typename Range, typename Fn>
+    std::shared_ptr<CopySource> makeCopySource(Range&& range, Fn encodeRow, size_t chunkBytes = 64 * 1024) {
+        return std::make_shared<CopyRangeSource<Encoder, std::decay_t<Range>, Fn>>(
+            std::forward<Range>(range), std::move(encodeRow), chunkBytes);
+    }
+
+    /**
+     * @brief data written by another thread, a controller passing on a request body for
+     * instance. the writer should not run far ahead, getQueuedBytes tells how much the
+     * connection has not taken yet
+     *
+     */
+    class CopyPipe : public CopySource {
+    private:
+        AdaptiveLock lock;
+        std::deque<std::string> chunks;
+        std::atomic<size_t> queuedBytes {0};
+        bool ended = false;
+        std::string error;
+
+    public:
+        /// @brief queue data, from any thread
+        void write(std::string data);
+        /// @brief no more data, the copy ends once the queued data is sent
+        void end();
+        /// @brief abort the copy with the reason, the queued data is dropped
+        void fail(std::string reason);
+
+        size_t getQueuedBytes() const {
+            return queuedBytes;
+        }
+
+        virtual Status read(std::string& out) override;
+    };
+
+    /**
+     * @brief the receiving end of a COPY TO STDOUT. the rows come in chunks of about
+     * chunk bytes, in the format the COPY statement names, on the queue given here.
+     * like RowStream, the driver stops reading while paused or while the window is full
+     *
+     */
+    class CopyOutStream {
+    public:
+        using DataFunction = std::function<void (std::string)>;
+
+    private:
+        friend PostgresqlConnectionPool;
+
+        const std::unique_ptr<EventQueue>& queue;
+        DataFunction onData;
+        size_t chunkBytes;
+        size_t window;
+        std::atomic<size_t> pending {0};
+        std::atomic<bool> paused {false};
+        std::atomic<size_t> bytes {0};
+
+        bool isBlocked() const {
+            return paused || pending >= window;
+        }
+
+        /// @brief hand a chunk to the callback, called by the driver thread
+        static void deliver(std::shared_ptr<CopyOutStream> self, std::string data);
+
+    public:
+        /**
+         * @brief make a stream to pass to PostgresqlDriver::copyOut
+         *
+         * @param queue the queue the callback runs on
+         * @param onData the callback, takes whole rows
+         * @param chunkBytes the data gathered before it is handed over
+         * @param window the most chunks waiting for the callback before reading stops
+         */
+        CopyOutStream(const std::unique_ptr<EventQueue>& queue, DataFunction onData, size_t chunkBytes = 64 * 1024, size_t window = 4)
+        : queue(queue), onData(std::move(onData)), chunkBytes(std::max<size_t>(chunkBytes, 1)), window(std::max<size_t>(window, 1)) {}
+        CopyOutStream(const CopyOutStream&) = delete;
+
+        /// @brief can be called from any thread
+        void pause() {
+            paused = true;
+        }
+
+        void resume() {
+            paused = false;
+        }
+
+        bool isPaused() const {
+            return paused;
+        }
+
+        size_t getChunkBytes() const {
+            return chunkBytes;
+        }
+
+        const std::unique_ptr<EventQueue>& getQueue() const {
+            return queue;
+        }
+
+        /// @brief the bytes delivered so far
+        size_t getByteCount() const {
+            return bytes;
+        }
+    };
+
+} // namespace themis
+
+#endif
@@ -0,0 +1,10 @@
+#include "Notification.h"
+#include "detail/PostgresqlConnectionPool.h"
+
+void themis::Subscription::cancel() {
+    if(!state.get() || state->cancelled.exchange(true)) return;
+    // the subscriptions of the pool are only touched by the driver thread
+    if(state->driverQueue) state->driverQueue->addImmediate([s = state]() {
+        s->pool->unsubscribe(s);
+    });
+}
@@ -0,0 +1,96 @@
+#ifndef Notification_h
+#define Notification_h 1
+
+#include "utils/EventQueue.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace themis
+{
+
+    class PostgresqlConnectionPool;
+    class PostgresqlDriver;
+
+    /**
+     * @brief a NOTIFY received on a channel listened to
+     *
+     */
+    struct Notification {
+        std::string channel;
+        std::string payload;
+        /// @brief the backend process of the session that sent it
+        int pid = 0;
+    };
+
+    /**
+     * @brief a handle to a callback registered with PostgresqlDriver::listen, the callback
+     * is removed when the handle is cancelled or destroyed, keep it as long as the callback
+     * should run. handles can be moved, and cancelled from any thread. drop them before
+     * the driver is shut down
+     *
+     */
+    class [[nodiscard]] Subscription {
+    public:
+        using NotificationFunction = std::function<void (const Notification&)>;
+
+    private:
+        friend PostgresqlConnectionPool;
+        friend PostgresqlDriver;
+
+        struct State {
+            std::string channel;
+            /// @brief the queue the callback runs on, null for the driver thread
+            EventQueue* queue;
+            NotificationFunction callback;
+            std::atomic<bool> cancelled = false;
+            /// @brief the pool holding it and the driver queue it is removed on
+            PostgresqlConnectionPool* pool = nullptr;
+            EventQueue* driverQueue = nullptr;
+
+            State(std::string channel, EventQueue* queue, NotificationFunction callback)
+            : channel(std::move(channel)), queue(queue), callback(std::move(callback)) {}
+        };
+        std::shared_ptr<State> state;
+
+        Subscription(std::shared_ptr<State> state) : state(std::move(state)) {}
+
+    public:
+        Subscription() = default;
+        Subscription(const Subscription&) = delete;
+        Subscription(Subscription&& s) = default;
+
+        /// @brief cancel the callback held, then take the one of s
+        Subscription& operator=(Subscription&& s) {
+            if(this != &s) {
+                cancel();
+                state = std::move(s.state);
+            }
+            return *this;
+        }
+
+        ~Subscription() {
+            cancel();
+        }
+
+        /**
+         * @brief remove the callback, it is not called for notifications the queue has
+         * not run yet. the channel is unlistened once no callback is left on it
+         *
+         */
+        void cancel();
+
+        bool isActive() const {
+            return state.get() && !state->cancelled;
+        }
+
+        const std::string& getChannel() const {
+            static const std::string none;
+            return state.get() ? state->channel : none;
+        }
+    };
+
+} // namespace themis
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef PgTypes_h
+#define PgTypes_h 1
+
+#include <libpq-fe.h>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <span>
+
+namespace themis
+{
+
+    /// @brief a timestamp or timestamptz value, microseconds since the unix epoch in utc
+    using Timestamp = std::chrono::sys_time<std::chrono::microseconds>;
+    /// @brief a bytea value, points into the result or the caller's buffer. decoding it needs
+    /// binary results, std::vector<unsigned char> copies and reads text results as well
+    using Bytes = std::span<const unsigned char>;
+
+    namespace detail
+    {
+
+        /// @brief the oids of the builtin types the driver encodes or decodes
+        struct PgType {
+            static constexpr Oid BOOL = 16;
+            static constexpr Oid BYTEA = 17;
+            static constexpr Oid CHAR = 18;
+            static constexpr Oid NAME = 19;
+            static constexpr Oid INT8 = 20;
+            static constexpr Oid INT2 = 21;
+            static constexpr Oid INT4 = 23;
+            static constexpr Oid TEXT = 25;
+            static constexpr Oid OID = 26;
+            static constexpr Oid JSON = 114;
+            static constexpr Oid XML = 142;
+            static constexpr Oid FLOAT4 = 700;
+            static constexpr Oid FLOAT8 = 701;
+            static constexpr Oid UNKNOWN = 705;
+            static constexpr Oid BPCHAR = 1042;
+            static constexpr Oid VARCHAR = 1043;
+            static constexpr Oid TIMESTAMP = 1114;
+            static constexpr Oid TIMESTAMPTZ = 1184;
+            static constexpr Oid NUMERIC = 1700;
+            static constexpr Oid JSONB = 3802;
+        };
+
+        /// @brief microseconds between the unix epoch and the postgres epoch, 2000-01-01
+        constexpr int64_t POSTGRES_EPOCH = 946684800LL * 1000000;
+
+        /// @brief write the low length bytes of v, the most significant first as the binary format has them
+        inline void writeBigEndian(char* out, uint64_t v, size_t length) {
+            for (size_t i = 0; i < length; i++) {
+                out[i] = char(v >> ((length - 1 - i) * 8));
+            }
+        }
+
+        /// @brief the binary timestamp, the ends of the range are infinity
+        inline int64_t toPostgresTime(Timestamp t) {
+            if(t == Timestamp::max()) return std::numeric_limits<int64_t>::max();
+            if(t == Timestamp::min()) return std::numeric_limits<int64_t>::min();
+            return t.time_since_epoch().count() - POSTGRES_EPOCH;
+        }
+
+    } // namespace detail
+
+} // namespace themis
+
+#endif
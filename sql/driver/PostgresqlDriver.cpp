@@ -1,6 +1,6 @@
 #include "PostgresqlDriver.h"
-#include "utils/Spinlock.h"
 #include <ng-log/logging.h>
+#include <mutex>
 
 themis::PostgresqlDriver* themis::PostgresqlDriver::instance = nullptr;
 
@@ -16,7 +16,7 @@ themis::PostgresqlDriver *themis::PostgresqlDriver::get() {
 
 void themis::PostgresqlDriver::loopOnce() {
 
-    Spinlock lock(driverFlag);
+    std::lock_guard<AdaptiveLock> lock(driverLock);
     busy = false;
     event_base_loop(base, EVLOOP_NONBLOCK);
     busy |= eventQueue->poll();
@@ -26,21 +26,14 @@ void themis::PostgresqlDriver::loopOnce() {
         for (auto& j: i.second->basePool) {
             // null means this connection is down temporarily
             if(!j.get()) continue;
-            if(!PQisBusy(j->conn) && !j->queries.empty()) {
-                // the connection is idle for new task, submit one
+            // the stream at the front stopped reading, see if its consumer caught up
+            if(j->streamPaused) j->pollStream();
+            // a copy in sends its data as the source has it, no socket event tells when
+            if(j->copying == PostgresqlConnectionPool::ConnectionDetail::Copy::IN) j->pollCopy();
+            if(j->readyToSend()) {
+                // the connection can take a new task, submit
                 // if the function blocked here, the whole driver will jam
-                // make the pending result objects to hand over to the user later
-                j->pendingResult = std::make_unique<PGResultSets>();
-                j->queries.front().query(j->conn);
-                // enable write so that the query can be flush out, if there are any
-                if(PQisBusy(j->conn)) {
-                    event_add(j->writeEvent, nullptr);
-                } else {
-                    // nothing happened in query, inform user
-                    j->queries.front()
-                    .onErr(std::make_unique<std::runtime_error>("there are no query submitted to connection"));
-                    j->queries.pop();
-                }
+                j->sendNextQuery(eventQueue.get());
             }
         }
     }
@@ -49,13 +42,24 @@ void themis::PostgresqlDriver::loopOnce() {
 void themis::PostgresqlDriver::initialize() {
     if(! initialized) {
 
-        Spinlock lock(driverFlag);
+        std::lock_guard<AdaptiveLock> lock(driverLock);
         // assign event base for each pool
         for(auto& i: pools) {
             i.second->setEventbase(base);
         }
 
         initializeAllPools();
+        // the connections of every pool are opened at once, wait until each is up or
+        // failed once, so that the first queries find them. failed ones retry in the loop
+        auto connecting = [this]() {
+            for (auto& p: pools) {
+                if(p.second->isConnecting()) return true;
+            }
+            return false;
+        };
+        while(connecting()) {
+            event_base_loop(base, EVLOOP_ONCE);
+        }
         driverThread = std::make_unique<std::thread>([this]() {
             while(!stop) {
                 loopOnce();
@@ -66,31 +70,141 @@ void themis::PostgresqlDriver::initialize() {
     }
 }
 
-void themis::PostgresqlDriver::shutdown() {
-    // stop driver thread
+void themis::PostgresqlDriver::stopThread() {
     stop = true;
-    if(driverThread->joinable()) driverThread->join();
-    // clean all active connections
+    if(driverThread && driverThread->joinable()) driverThread->join();
+    driverThread = nullptr;
+    stop = false;
+}
+
+void themis::PostgresqlDriver::shutdown() {
+    stopThread();
+    // clean all active connections, their events belong to the base
+    pools.clear();
     // free event base
     event_base_free(base);
-    // free all pool
-    pools.clear();
+    // ready to be configured and initialized again, the callbacks still queued
+    // refer to the pools gone
+    base = event_base_new();
+    eventQueue = std::make_unique<EventQueue>();
+    initialized = false;
 }
 
 std::unique_ptr<themis::PostgresqlDriver::QueryPromise>
-themis::PostgresqlDriver::query(std::string poolID, PostgresqlConnectionPool::QueryFunction func) {
+themis::PostgresqlDriver::query(std::string poolID, PostgresqlConnectionPool::QueryFunction func, CancellationToken token) {
 
-    Spinlock lock(driverFlag);
+    std::lock_guard<AdaptiveLock> lock(driverLock);
     if(!pools.count(poolID)) throw std::runtime_error("the pool with id \"" + poolID + "\" has no connection config");
 
     auto& pool = pools.at(poolID);
 
     return std::make_unique<QueryPromise>(eventQueue, 
-        [this, func, &pool](QueryPromise::ResolveFunction resolve, FailFunction fail) {
+        [this, func, &pool, &token](QueryPromise::ResolveFunction resolve, FailFunction fail) {
             pool->submit(func, [resolve](std::unique_ptr<PGResultSets> result) {
                 resolve(std::move(result));
             }, [fail](std::unique_ptr<std::exception> e) {
                 fail(std::move(e));
-            });
+            }, std::move(token));
+    });
+}
+
+std::unique_ptr<themis::PostgresqlDriver::QueryPromise>
+themis::PostgresqlDriver::query(std::string poolID, Statement statement, CancellationToken token) {
+
+    std::lock_guard<AdaptiveLock> lock(driverLock);
+    if(!pools.count(poolID)) throw std::runtime_error("the pool with id \"" + poolID + "\" has no connection config");
+
+    auto& pool = pools.at(poolID);
+    auto shared = std::make_shared<const Statement>(std::move(statement));
+
+    return std::make_unique<QueryPromise>(eventQueue, 
+        [shared, &pool, &token](QueryPromise::ResolveFunction resolve, FailFunction fail) {
+            pool->submit(shared, [resolve](std::unique_ptr<PGResultSets> result) {
+                resolve(std::move(result));
+            }, [fail](std::unique_ptr<std::exception> e) {
+                fail(std::move(e));
+            }, std::move(token));
+    });
+}
+
+std::unique_ptr<themis::PostgresqlDriver::QueryPromise>
+themis::PostgresqlDriver::stream(std::string poolID, Statement statement, std::shared_ptr<RowStream> rows, CancellationToken token) {
+
+    std::lock_guard<AdaptiveLock> lock(driverLock);
+    if(!pools.count(poolID)) throw std::runtime_error("the pool with id \"" + poolID + "\" has no connection config");
+
+    auto& pool = pools.at(poolID);
+    auto shared = std::make_shared<const Statement>(std::move(statement));
+
+    // on the queue of the batches, so that the promise settles after the last one
+    return std::make_unique<QueryPromise>(rows->getQueue(), 
+        [shared, rows, &pool, &token](QueryPromise::ResolveFunction resolve, FailFunction fail) {
+            pool->submit(shared, rows, [resolve](std::unique_ptr<PGResultSets> result) {
+                resolve(std::move(result));
+            }, [fail](std::unique_ptr<std::exception> e) {
+                fail(std::move(e));
+            }, std::move(token));
+    });
+}
+
+std::shared_ptr<themis::Transaction> themis::PostgresqlDriver::begin(std::string poolID, CancellationToken token) {
+
+    std::lock_guard<AdaptiveLock> lock(driverLock);
+    if(!pools.count(poolID)) throw std::runtime_error("the pool with id \"" + poolID + "\" has no connection config");
+
+    // the constructor is private, the driver hands out the handles
+    return std::shared_ptr<Transaction>(new Transaction(eventQueue, *pools.at(poolID), std::move(token)));
+}
+
+std::unique_ptr<themis::PostgresqlDriver::QueryPromise>
+themis::PostgresqlDriver::copyIn(std::string poolID, std::string sql, std::shared_ptr<CopySource> source, CancellationToken token) {
+
+    std::lock_guard<AdaptiveLock> lock(driverLock);
+    if(!pools.count(poolID)) throw std::runtime_error("the pool with id \"" + poolID + "\" has no connection config");
+
+    auto& pool = pools.at(poolID);
+
+    return std::make_unique<QueryPromise>(eventQueue, 
+        [sql, source, &pool, &token](QueryPromise::ResolveFunction resolve, FailFunction fail) {
+            pool->copyIn(sql, source, [resolve](std::unique_ptr<PGResultSets> result) {
+                resolve(std::move(result));
+            }, [fail](std::unique_ptr<std::exception> e) {
+                fail(std::move(e));
+            }, std::move(token));
+    });
+}
+
+std::unique_ptr<themis::PostgresqlDriver::QueryPromise>
+themis::PostgresqlDriver::copyOut(std::string poolID, std::string sql, std::shared_ptr<CopyOutStream> sink, CancellationToken token) {
+
+    std::lock_guard<AdaptiveLock> lock(driverLock);
+    if(!pools.count(poolID)) throw std::runtime_error("the pool with id \"" + poolID + "\" has no connection config");
+
+    auto& pool = pools.at(poolID);
+
+    // on the queue of the chunks, so that the promise settles after the last one
+    return std::make_unique<QueryPromise>(sink->getQueue(), 
+        [sql, sink, &pool, &token](QueryPromise::ResolveFunction resolve, FailFunction fail) {
+            pool->copyOut(sql, sink, [resolve](std::unique_ptr<PGResultSets> result) {
+                resolve(std::move(result));
+            }, [fail](std::unique_ptr<std::exception> e) {
+                fail(std::move(e));
+            }, std::move(token));
+    });
+}
+
+themis::Subscription themis::PostgresqlDriver::subscribe(std::string poolID, std::string channel, EventQueue* queue, 
+    Subscription::NotificationFunction callback) {
+
+    std::lock_guard<AdaptiveLock> lock(driverLock);
+    if(!pools.count(poolID)) throw std::runtime_error("the pool with id \"" + poolID + "\" has no connection config");
+
+    auto state = std::make_shared<Subscription::State>(std::move(channel), queue, std::move(callback));
+    state->pool = pools.at(poolID).get();
+    state->driverQueue = eventQueue.get();
+    // the pool is only touched by the driver thread
+    eventQueue->addImmediate([state]() {
+        state->pool->subscribe(state);
     });
+    return Subscription(state);
 }
@@ -2,8 +2,14 @@
 #define PostgresqlDriver_h 1
 
 #include "detail/PostgresqlConnectionPool.h"
+#include "RowMapper.h"
+#include "RowStream.h"
+#include "Copy.h"
+#include "Transaction.h"
+#include "Notification.h"
 #include "utils/EventQueue.h"
 #include "utils/Promise.h"
+#include "utils/AdaptiveLock.h"
 #include <memory>
 #include <thread>
 #include <libpq-fe.h>
@@ -26,42 +32,269 @@ namespace themis
         event_base* base;
         bool busy = false;
         bool stop = false;
-        std::atomic_flag driverFlag;
+        /// @brief held by the driver loop, and by the threads submitting queries
+        AdaptiveLock driverLock;
+
+        PostgresqlDriver();
 
         /**
-         * @brief execute base event loop and check for query tasks
+         * @brief hand the callback over to the pool on the driver thread
          * 
+         * @param queue the queue the callback runs on, null for the driver thread
          */
-        void loopOnce();
-
-        PostgresqlDriver();
+        Subscription subscribe(std::string poolID, std::string channel, EventQueue* queue, 
+            Subscription::NotificationFunction callback);
 
     public:
 
         static PostgresqlDriver* get();
+        /// @brief open the connections of every pool at once and start the driver thread,
+        /// the connections that cannot be opened keep retrying in the background
         virtual void initialize() override;
+        /// @brief close every pool and stop the driver thread, the pools can be configured and
+        /// initialized again afterwards. drop the transactions and subscriptions before
         virtual void shutdown() override;
 
+        /**
+         * @brief stop the driver thread and keep the pools open, the caller runs the loop
+         * with loopOnce from then on. for tests checking the state between two loops
+         * 
+         */
+        void stopThread();
+
+        /**
+         * @brief execute base event loop and check for query tasks, called by the driver
+         * thread, or by the caller once the thread is stopped
+         * 
+         */
+        void loopOnce();
+
+        /**
+         * @brief count the contention between the driver loop and the threads submitting
+         * queries into the stats
+         * 
+         * @param stats the stats, nullptr to stop counting
+         */
+        void setLockStats(LockStats* stats) {
+            driverLock.setStats(stats);
+        }
+
         /**
          * @brief execute a query, using the default connection pool
          * 
          * @param poolID the id of the pool
          * @param func the query callback function
+         * @param token the token of the request, usually from HttpRequest::getCancellationToken.
+         * once cancelled the query is dropped if not yet sent, or cancelled on the server
          * @return const std::unique_ptr<QueryPromise>& the query promise, 
          * the event queue this promise associated to is managed by driver thread, thus
          * the then and except function must be made thread-safe
          * do NOT free the promise until it fail/fulfill, otherwise the entire driver will break
          */
-        std::unique_ptr<QueryPromise> query(std::string poolID, PostgresqlConnectionPool::QueryFunction func);
+        std::unique_ptr<QueryPromise> query(std::string poolID, PostgresqlConnectionPool::QueryFunction func, 
+            CancellationToken token = CancellationToken());
         
         /**
          * @brief execute a query to the default pool
          * 
          * @param func query callback function
+         * @param token the token of the request, see above
          * @return const std::unique_ptr<QueryPromise>& 
          */
-        std::unique_ptr<QueryPromise> query(PostgresqlConnectionPool::QueryFunction func) {
-            return query("default_pool", func);
+        std::unique_ptr<QueryPromise> query(PostgresqlConnectionPool::QueryFunction func, 
+            CancellationToken token = CancellationToken()) {
+            return query("default_pool", func, std::move(token));
+        }
+
+        /**
+         * @brief execute a statement, it is prepared once per connection and executed
+         * prepared from then on. the statements prepared on a connection are bounded by
+         * DatasourceConfig::getStatementCacheSize, the least recently used are deallocated
+         * 
+         * @param poolID the id of the pool
+         * @param statement the sql text and the values bound
+         * @param token the token of the request, see above
+         * @return std::unique_ptr<QueryPromise> the query promise, see above
+         */
+        std::unique_ptr<QueryPromise> query(std::string poolID, Statement statement, 
+            CancellationToken token = CancellationToken());
+
+        /**
+         * @brief execute a statement on the default pool
+         * 
+         * @param statement the sql text and the values bound
+         * @param token the token of the request, see above
+         * @return std::unique_ptr<QueryPromise> 
+         */
+        std::unique_ptr<QueryPromise> query(Statement statement, CancellationToken token = CancellationToken()) {
+            return query("default_pool", std::move(statement), std::move(token));
+        }
+
+        /**
+         * @brief execute a statement and stream its rows, they are read from the server
+         * one at a time and handed to the stream in batches instead of being held until
+         * the statement completed. reading stops while the stream is paused or behind,
+         * so an export of any size runs in the memory of a few batches.
+         * a streamed statement is never pipelined, it has the connection to itself
+         * 
+         * @param poolID the id of the pool
+         * @param statement the sql text and the values bound
+         * @param rows the stream taking the batches
+         * @param token the token of the request, see above. once cancelled the rows
+         * still read are dropped and the statement is cancelled on the server
+         * @return std::unique_ptr<QueryPromise> on the queue of the stream, resolved after
+         * the last batch with the final result, which has no rows. if it fails, the
+         * batches before the error were delivered already
+         */
+        std::unique_ptr<QueryPromise> stream(std::string poolID, Statement statement, std::shared_ptr<RowStream> rows, 
+            CancellationToken token = CancellationToken());
+
+        /**
+         * @brief stream the rows of a statement from the default pool
+         * 
+         * @param statement the sql text and the values bound
+         * @param rows the stream taking the batches
+         * @param token the token of the request, see above
+         * @return std::unique_ptr<QueryPromise> 
+         */
+        std::unique_ptr<QueryPromise> stream(Statement statement, std::shared_ptr<RowStream> rows, 
+            CancellationToken token = CancellationToken()) {
+            return stream("default_pool", std::move(statement), std::move(rows), std::move(token));
+        }
+
+        /**
+         * @brief bulk load with COPY ... FROM STDIN, the data is read from the source on the
+         * driver thread whenever the connection can take more and sent without blocking,
+         * so the rows never have to be held at once. make the source with makeCopySource
+         * from a range and a text or binary encoder, or use a CopyPipe to pass on data
+         * produced by another thread
+         * 
+         * @param poolID the id of the pool
+         * @param sql the copy statement
+         * @param source the data, in the format the statement names
+         * @param token the token of the request, see above. once cancelled the copy is
+         * aborted and the server discards what it got
+         * @return std::unique_ptr<QueryPromise> the query promise, see above. the result
+         * tells the rows copied with PQcmdTuples
+         */
+        std::unique_ptr<QueryPromise> copyIn(std::string poolID, std::string sql, std::shared_ptr<CopySource> source, 
+            CancellationToken token = CancellationToken());
+
+        /**
+         * @brief bulk load into a table of the default pool
+         * 
+         * @param sql the copy statement
+         * @param source the data
+         * @param token the token of the request, see above
+         * @return std::unique_ptr<QueryPromise> 
+         */
+        std::unique_ptr<QueryPromise> copyIn(std::string sql, std::shared_ptr<CopySource> source, 
+            CancellationToken token = CancellationToken()) {
+            return copyIn("default_pool", std::move(sql), std::move(source), std::move(token));
+        }
+
+        /**
+         * @brief export with COPY ... TO STDOUT, the data is handed to the sink in chunks
+         * as it arrives. like stream, reading stops while the sink is paused or behind
+         * 
+         * @param poolID the id of the pool
+         * @param sql the copy statement
+         * @param sink the stream taking the chunks
+         * @param token the token of the request, see above
+         * @return std::unique_ptr<QueryPromise> on the queue of the sink, resolved after
+         * the last chunk
+         */
+        std::unique_ptr<QueryPromise> copyOut(std::string poolID, std::string sql, std::shared_ptr<CopyOutStream> sink, 
+            CancellationToken token = CancellationToken());
+
+        /**
+         * @brief export from the default pool
+         * 
+         * @param sql the copy statement
+         * @param sink the stream taking the chunks
+         * @param token the token of the request, see above
+         * @return std::unique_ptr<QueryPromise> 
+         */
+        std::unique_ptr<QueryPromise> copyOut(std::string sql, std::shared_ptr<CopyOutStream> sink, 
+            CancellationToken token = CancellationToken()) {
+            return copyOut("default_pool", std::move(sql), std::move(sink), std::move(token));
+        }
+
+        /**
+         * @brief start a transaction, its statements run on one connection of the pool.
+         * nothing is sent until its first statement, see Transaction
+         * 
+         * @param poolID the id of the pool
+         * @param token the token of the request, see above. its statements not sent yet
+         * when it is cancelled are dropped and the transaction rolls back
+         * @return std::shared_ptr<Transaction> the handle, the transaction rolls back if
+         * the last reference goes before commit or rollback
+         */
+        std::shared_ptr<Transaction> begin(std::string poolID, CancellationToken token = CancellationToken());
+
+        /**
+         * @brief start a transaction on the default pool
+         * 
+         * @param token the token of the request, see above
+         * @return std::shared_ptr<Transaction> 
+         */
+        std::shared_ptr<Transaction> begin(CancellationToken token = CancellationToken()) {
+            return begin("default_pool", std::move(token));
+        }
+
+        /**
+         * @brief call the callback with every notification sent to the channel, instead of
+         * polling a table from a timer. the pool listens on a connection of its own, opened
+         * with its first config once something is listened to and reopened if it goes down,
+         * the notifications sent while it is down are lost. like query, can be called from any
+         * thread but the driver thread
+         * 
+         * @param poolID the id of the pool
+         * @param channel the channel, matched as given, NOTIFY folds unquoted names to lower case
+         * @param queue the queue the callback runs on
+         * @param callback the callback
+         * @return Subscription the handle to cancel it
+         */
+        Subscription listen(std::string poolID, std::string channel, const std::unique_ptr<EventQueue>& queue, 
+            Subscription::NotificationFunction callback) {
+            return subscribe(std::move(poolID), std::move(channel), queue.get(), std::move(callback));
+        }
+
+        /**
+         * @brief listen to a channel of the default pool
+         * 
+         * @param channel the channel
+         * @param queue the queue the callback runs on
+         * @param callback the callback
+         * @return Subscription 
+         */
+        Subscription listen(std::string channel, const std::unique_ptr<EventQueue>& queue, 
+            Subscription::NotificationFunction callback) {
+            return subscribe("default_pool", std::move(channel), queue.get(), std::move(callback));
+        }
+
+        /**
+         * @brief listen to a channel, the callback runs on the driver thread. it must only
+         * hand the notification over, to a TopicHub or a queue of its choice
+         * 
+         * @param poolID the id of the pool
+         * @param channel the channel
+         * @param callback the callback
+         * @return Subscription 
+         */
+        Subscription listen(std::string poolID, std::string channel, Subscription::NotificationFunction callback) {
+            return subscribe(std::move(poolID), std::move(channel), nullptr, std::move(callback));
+        }
+
+        /**
+         * @brief the hit rate of the statement caches of a pool
+         * 
+         * @param poolID the id of the pool
+         * @return const StatementCacheStats& the counters, updated by the driver thread
+         */
+        const StatementCacheStats& getStatementCacheStats(std::string poolID = "default_pool") {
+            if(!pools.count(poolID)) throw std::runtime_error("the pool with id \"" + poolID + "\" has no connection config");
+            return pools.at(poolID)->getStatementCacheStats();
         }
     };
 
@@ -0,0 +1,298 @@
+#include "RowMapper.h"
+#include <bit>
+#include <charconv>
+#include <cstring>
+
+namespace {
+
+    uint64_t readBigEndian(const char* data, size_t length) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < length; i++) {
+            v = (v << 8) | (unsigned char)data[i];
+        }
+        return v;
+    }
+
+    /// @brief the binary int32 at pos, pos is moved past it
+    int32_t readInt32(std::string_view value, size_t& pos, const themis::detail::ColumnInfo& column) {
+        if(pos > value.size() || value.size() - pos < 4) themis::detail::decodeError(column, "array is truncated");
+        int32_t v = (int32_t)readBigEndian(value.data() + pos, 4);
+        pos += 4;
+        return v;
+    }
+
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    bool isNull(std::string_view value) {
+        return value.size() == 4 && (value[0] | 0x20) == 'n' && (value[1] | 0x20) == 'u'
+        && (value[2] | 0x20) == 'l' && (value[3] | 0x20) == 'l';
+    }
+
+}
+
+themis::detail::ColumnInfo themis::detail::resolveColumn(const PGresult* result, const char* name) {
+    int index = PQfnumber(result, name);
+    if(index < 0) throw std::runtime_error("the result has no column \"" + std::string(name) + "\"");
+    return ColumnInfo {name, index, PQftype(result, index), PQfformat(result, index) == 1};
+}
+
+void themis::detail::decodeError(const ColumnInfo& column, const std::string& what) {
+    throw std::runtime_error("cannot decode column \"" + std::string(column.name) + "\" : " + what);
+}
+
+int64_t themis::detail::readInteger(std::string_view value, const ColumnInfo& column) {
+    size_t expected;
+    switch (column.type) {
+    case PgType::INT2: expected = 2; break;
+    case PgType::INT4:
+    case PgType::OID: expected = 4; break;
+    case PgType::INT8: expected = 8; break;
+    default: decodeError(column, "not an integer, type oid " + std::to_string(column.type));
+    }
+    if(value.size() != expected) decodeError(column, "integer of " + std::to_string(value.size()) + " bytes");
+    uint64_t v = readBigEndian(value.data(), expected);
+    switch (column.type) {
+    case PgType::INT2: return (int16_t)v;
+    case PgType::INT4: return (int32_t)v;
+    case PgType::OID: return (uint32_t)v;
+    default: return (int64_t)v;
+    }
+}
+
+int64_t themis::detail::parseInteger(std::string_view value, const ColumnInfo& column) {
+    int64_t v = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), v);
+    if(ec != std::errc() || end != value.data() + value.size()) decodeError(column, "not an integer : " + std::string(value));
+    return v;
+}
+
+double themis::detail::readFloat(std::string_view value, const ColumnInfo& column) {
+    switch (column.type) {
+    case PgType::FLOAT4:
+        if(value.size() != 4) break;
+        return std::bit_cast<float>((uint32_t)readBigEndian(value.data(), 4));
+    case PgType::FLOAT8:
+        if(value.size() != 8) break;
+        return std::bit_cast<double>(readBigEndian(value.data(), 8));
+    case PgType::NUMERIC:
+        decodeError(column, "binary numeric is not supported, cast it to float8");
+    default:
+        return (double)readInteger(value, column);
+    }
+    decodeError(column, "float of " + std::to_string(value.size()) + " bytes");
+}
+
+double themis::detail::parseFloat(std::string_view value, const ColumnInfo& column) {
+    double v = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), v);
+    if(ec != std::errc() || end != value.data() + value.size()) decodeError(column, "not a number : " + std::string(value));
+    return v;
+}
+
+bool themis::detail::readBool(std::string_view value, const ColumnInfo& column) {
+    if(column.binary) {
+        if(column.type != PgType::BOOL || value.size() != 1) decodeError(column, "not a bool");
+        return value[0] != 0;
+    }
+    if(value == "t" || value == "true") return true;
+    if(value == "f" || value == "false") return false;
+    decodeError(column, "not a bool : " + std::string(value));
+}
+
+themis::Timestamp themis::detail::readTimestamp(std::string_view value, const ColumnInfo& column) {
+    if(column.binary) {
+        if((column.type != PgType::TIMESTAMP && column.type != PgType::TIMESTAMPTZ) || value.size() != 8) {
+            decodeError(column, "not a timestamp");
+        }
+        int64_t v = (int64_t)readBigEndian(value.data(), 8);
+        if(v == std::numeric_limits<int64_t>::max()) return Timestamp::max();
+        if(v == std::numeric_limits<int64_t>::min()) return Timestamp::min();
+        return Timestamp(std::chrono::microseconds(v + POSTGRES_EPOCH));
+    }
+
+    // the iso date style, 2024-01-02 03:04:05.678901+02:00, without the offset for timestamp
+    if(value == "infinity") return Timestamp::max();
+    if(value == "-infinity") return Timestamp::min();
+    size_t pos = 0;
+    auto number = [&](size_t minDigits, size_t maxDigits) {
+        int v = 0;
+        size_t start = pos;
+        while(pos < value.size() && pos - start < maxDigits && value[pos] >= '0' && value[pos] <= '9') {
+            v = v * 10 + (value[pos++] - '0');
+        }
+        if(pos - start < minDigits) decodeError(column, "not a timestamp : " + std::string(value));
+        return v;
+    };
+    auto expect = [&](std::string_view separators) {
+        if(pos >= value.size() || separators.find(value[pos]) == std::string_view::npos) {
+            decodeError(column, "not a timestamp : " + std::string(value));
+        }
+        pos++;
+    };
+    int year = number(4, 9);
+    expect("-");
+    int month = number(2, 2);
+    expect("-");
+    int day = number(2, 2);
+    expect(" T");
+    int hour = number(2, 2);
+    expect(":");
+    int minute = number(2, 2);
+    expect(":");
+    int second = number(2, 2);
+    int64_t micros = 0;
+    if(pos < value.size() && value[pos] == '.') {
+        pos++;
+        size_t start = pos;
+        micros = number(1, 6);
+        for (size_t i = pos - start; i < 6; i++) micros *= 10;
+    }
+    int offset = 0;
+    if(pos < value.size() && (value[pos] == '+' || value[pos] == '-')) {
+        int sign = value[pos++] == '-' ? -1 : 1;
+        offset = number(2, 2) * 3600;
+        if(pos < value.size() && value[pos] == ':') {
+            pos++;
+            offset += number(2, 2) * 60;
+        }
+        if(pos < value.size() && value[pos] == ':') {
+            pos++;
+            offset += number(2, 2);
+        }
+        offset *= sign;
+    }
+    if(pos != value.size()) decodeError(column, "not a timestamp : " + std::string(value));
+
+    std::chrono::year_month_day date {std::chrono::year(year), std::chrono::month(month), std::chrono::day(day)};
+    if(!date.ok()) decodeError(column, "not a timestamp : " + std::string(value));
+    return Timestamp(std::chrono::sys_days(date)) + std::chrono::hours(hour) + std::chrono::minutes(minute)
+    + std::chrono::seconds(second - offset) + std::chrono::microseconds(micros);
+}
+
+std::string_view themis::detail::readText(std::string_view value, const ColumnInfo& column) {
+    if(!column.binary) return value;
+    switch (column.type) {
+    case PgType::TEXT:
+    case PgType::VARCHAR:
+    case PgType::BPCHAR:
+    case PgType::NAME:
+    case PgType::CHAR:
+    case PgType::JSON:
+    case PgType::XML:
+    case PgType::UNKNOWN:
+        return value;
+    case PgType::JSONB:
+        // led by the version of the format, the text follows
+        if(value.empty() || value[0] != 1) decodeError(column, "unknown jsonb version");
+        return value.substr(1);
+    default:
+        decodeError(column, "binary value is not text, type oid " + std::to_string(column.type));
+    }
+}
+
+std::vector<unsigned char> themis::detail::parseHexBytes(std::string_view value, const ColumnInfo& column) {
+    if(value.size() < 2 || value[0] != '\\' || value[1] != 'x' || value.size() % 2) {
+        decodeError(column, "bytea is not in the hex format");
+    }
+    auto digit = [&](char c) -> unsigned char {
+        if(c >= '0' && c <= '9') return c - '0';
+        if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+        decodeError(column, "bytea is not in the hex format");
+    };
+    std::vector<unsigned char> bytes;
+    bytes.reserve(value.size() / 2 - 1);
+    for (size_t i = 2; i < value.size(); i += 2) {
+        bytes.push_back(digit(value[i]) << 4 | digit(value[i + 1]));
+    }
+    return bytes;
+}
+
+std::vector<themis::detail::ArrayElement> themis::detail::splitArray(std::string_view value, const ColumnInfo& column, Oid& elementType) {
+    std::vector<ArrayElement> elements;
+    if(column.binary) {
+        // dimensions, has null flag, element type, then size and lower bound of each dimension
+        size_t pos = 0;
+        int32_t dimensions = readInt32(value, pos, column);
+        readInt32(value, pos, column);
+        elementType = (Oid)readInt32(value, pos, column);
+        if(dimensions == 0) return elements;
+        if(dimensions != 1) decodeError(column, "only one dimensional arrays are supported");
+        int32_t count = readInt32(value, pos, column);
+        readInt32(value, pos, column);
+        if(count < 0) decodeError(column, "array is malformed");
+        elements.resize(count);
+        for (auto& e: elements) {
+            int32_t length = readInt32(value, pos, column);
+            if(length < 0) {
+                e.null = true;
+                continue;
+            }
+            if((size_t)length > value.size() - pos) decodeError(column, "array is truncated");
+            e.value = value.substr(pos, length);
+            pos += length;
+        }
+        return elements;
+    }
+
+    // {1,2,NULL,"a \"b\""}, maybe led by the bounds as in [0:2]={...}
+    elementType = 0;
+    size_t pos = 0;
+    if(!value.empty() && value[0] == '[') {
+        pos = value.find('=');
+        if(pos == std::string_view::npos) decodeError(column, "array is malformed");
+        pos++;
+    }
+    if(pos >= value.size() || value[pos] != '{' || value.back() != '}') decodeError(column, "array is malformed");
+    pos++;
+    auto skipSpace = [&]() {
+        while(pos < value.size() && isSpace(value[pos])) pos++;
+    };
+    skipSpace();
+    if(value[pos] == '}') return elements;
+    while(true) {
+        skipSpace();
+        if(pos >= value.size()) decodeError(column, "array is malformed");
+        if(value[pos] == '{') decodeError(column, "only one dimensional arrays are supported");
+        ArrayElement& e = elements.emplace_back();
+        bool quoted = value[pos] == '"';
+        if(quoted) pos++;
+        size_t start = pos;
+        // the end of the raw element, before trailing spaces of an unquoted one
+        size_t end = pos;
+        while(pos < value.size()) {
+            char c = value[pos];
+            if(c == '\\') {
+                e.escaped = true;
+                pos += 2;
+                end = pos;
+                continue;
+            }
+            if(quoted ? c == '"' : (c == ',' || c == '}')) break;
+            pos++;
+            if(quoted || !isSpace(c)) end = pos;
+        }
+        if(pos >= value.size()) decodeError(column, "array is malformed");
+        e.value = value.substr(start, end - start);
+        if(quoted) pos++;
+        else if(!e.escaped && isNull(e.value)) e.null = true;
+        if(e.escaped) {
+            for (size_t i = 0; i < e.value.size(); i++) {
+                if(e.value[i] == '\\') i++;
+                e.unescaped.push_back(e.value[i]);
+            }
+        }
+        skipSpace();
+        if(pos >= value.size()) decodeError(column, "array is malformed");
+        if(value[pos] == '}') break;
+        if(value[pos] != ',') decodeError(column, "array is malformed");
+        pos++;
+    }
+    // the strings do not move anymore
+    for (auto& e: elements) {
+        if(e.escaped) e.value = e.unescaped;
+    }
+    return elements;
+}
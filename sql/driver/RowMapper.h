@@ -0,0 +1,290 @@
+#ifndef RowMapper_h
+#define RowMapper_h 1
+
+#include "PgTypes.h"
+#include <libpq-fe.h>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace themis
+{
+
+    namespace detail
+    {
+
+        /// @brief a column of a result, looked up once per result
+        struct ColumnInfo {
+            const char* name = "";
+            int index = -1;
+            Oid type = 0;
+            bool binary = false;
+        };
+
+        /**
+         * @brief find the column by name
+         *
+         * @param result the result
+         * @param name the column name
+         * @return ColumnInfo its index, type and format
+         */
+        ColumnInfo resolveColumn(const PGresult* result, const char* name);
+
+        [[noreturn]] void decodeError(const ColumnInfo& column, const std::string& what);
+
+        /// @brief a binary int2, int4, int8 or oid, signed
+        int64_t readInteger(std::string_view value, const ColumnInfo& column);
+        int64_t parseInteger(std::string_view value, const ColumnInfo& column);
+        /// @brief a binary float4 or float8, or an integer
+        double readFloat(std::string_view value, const ColumnInfo& column);
+        double parseFloat(std::string_view value, const ColumnInfo& column);
+        bool readBool(std::string_view value, const ColumnInfo& column);
+        Timestamp readTimestamp(std::string_view value, const ColumnInfo& column);
+        /// @brief the bytes of a text value, throws if a binary value is not text
+        std::string_view readText(std::string_view value, const ColumnInfo& column);
+        /// @brief a bytea in the text hex format
+        std::vector<unsigned char> parseHexBytes(std::string_view value, const ColumnInfo& column);
+
+        /// @brief an element of an array, a view into the value unless it had to be unescaped
+        struct ArrayElement {
+            std::string_view value;
+            bool null = false;
+            /// @brief a text element with escapes, value points into unescaped
+            bool escaped = false;
+            std::string unescaped;
+        };
+
+        /**
+         * @brief split a one dimensional array into its elements
+         *
+         * @param value the array value
+         * @param column the column, the element type is written to elementType
+         * @param elementType the oid of the elements, 0 for text arrays
+         * @return std::vector<ArrayElement> the elements in order
+         */
+        std::vector<ArrayElement> splitArray(std::string_view value, const ColumnInfo& column, Oid& elementType);
+
+        template<typename T>
+        struct IsOptional : std::false_type {};
+        template<typename T>
+        struct IsOptional<std::optional<T>> : std::true_type {};
+
+    } // namespace detail
+
+    /**
+     * @brief turns the value of a column into T. the value is the raw bytes of the
+     * column, in the format the column came in
+     *
+     */
+    template<typename T, typename = void>
+    struct ColumnDecoder {
+        static_assert(sizeof(T) == 0, "no decoder for this column type, specialize ColumnDecoder");
+    };
+
+    template<typename T>
+    struct ColumnDecoder<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+        static T decode(std::string_view value, const detail::ColumnInfo& column) {
+            int64_t v = column.binary ? detail::readInteger(value, column) : detail::parseInteger(value, column);
+            if(!std::in_range<T>(v)) detail::decodeError(column, "value out of range");
+            return T(v);
+        }
+    };
+
+    template<typename T>
+    struct ColumnDecoder<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+        static T decode(std::string_view value, const detail::ColumnInfo& column) {
+            return T(column.binary ? detail::readFloat(value, column) : detail::parseFloat(value, column));
+        }
+    };
+
+    template<>
+    struct ColumnDecoder<bool> {
+        static bool decode(std::string_view value, const detail::ColumnInfo& column) {
+            return detail::readBool(value, column);
+        }
+    };
+
+    template<>
+    struct ColumnDecoder<Timestamp> {
+        static Timestamp decode(std::string_view value, const detail::ColumnInfo& column) {
+            return detail::readTimestamp(value, column);
+        }
+    };
+
+    /// @brief points into the result, valid while it lives
+    template<>
+    struct ColumnDecoder<std::string_view> {
+        static std::string_view decode(std::string_view value, const detail::ColumnInfo& column) {
+            return detail::readText(value, column);
+        }
+    };
+
+    template<>
+    struct ColumnDecoder<std::string> {
+        static std::string decode(std::string_view value, const detail::ColumnInfo& column) {
+            return std::string(detail::readText(value, column));
+        }
+    };
+
+    template<>
+    struct ColumnDecoder<Bytes> {
+        static Bytes decode(std::string_view value, const detail::ColumnInfo& column) {
+            if(!column.binary) detail::decodeError(column, "a bytea view needs binary results");
+            if(column.type != detail::PgType::BYTEA) detail::decodeError(column, "not a bytea");
+            return Bytes(reinterpret_cast<const unsigned char*>(value.data()), value.size());
+        }
+    };
+
+    template<>
+    struct ColumnDecoder<std::vector<unsigned char>> {
+        static std::vector<unsigned char> decode(std::string_view value, const detail::ColumnInfo& column) {
+            if(!column.binary) return detail::parseHexBytes(value, column);
+            Bytes bytes = ColumnDecoder<Bytes>::decode(value, column);
+            return std::vector<unsigned char>(bytes.begin(), bytes.end());
+        }
+    };
+
+    /// @brief a one dimensional array, elements may be std::optional to take NULL
+    template<typename T>
+    struct ColumnDecoder<std::vector<T>, std::enable_if_t<!std::is_same_v<T, unsigned char>>> {
+        static std::vector<T> decode(std::string_view value, const detail::ColumnInfo& column) {
+            detail::ColumnInfo element = column;
+            auto elements = detail::splitArray(value, column, element.type);
+            std::vector<T> out;
+            out.reserve(elements.size());
+            for (auto& e: elements) {
+                if constexpr (detail::IsOptional<T>::value) {
+                    if(e.null) {
+                        out.emplace_back(std::nullopt);
+                        continue;
+                    }
+                    out.emplace_back(ColumnDecoder<typename T::value_type>::decode(e.value, element));
+                } else {
+                    if(e.null) detail::decodeError(column, "array has a NULL element");
+                    if constexpr (std::is_same_v<T, std::string_view>) {
+                        // an unescaped element lives in the vector of elements, not in the result
+                        if(e.escaped) detail::decodeError(column, "escaped array elements need binary results");
+                    }
+                    out.emplace_back(ColumnDecoder<T>::decode(e.value, element));
+                }
+            }
+            return out;
+        }
+    };
+
+    /**
+     * @brief a column mapped to a member of T
+     *
+     */
+    template<typename T, typename M>
+    struct Column {
+        const char* name;
+        M T::* member;
+    };
+
+    template<typename T, typename M>
+    constexpr Column<T, M> column(const char* name, M T::* member) {
+        return Column<T, M> {name, member};
+    }
+
+    /**
+     * @brief decodes the rows of a result into T. the columns are looked up by name
+     * once, when the mapper is made. string_view and Bytes members point into the
+     * result, they are valid while it lives.
+     * a NULL goes into a std::optional member, any other member throws
+     *
+     */
+    template<typename T, typename ...Members>
+    class RowMapper {
+    private:
+        const PGresult* result;
+        std::tuple<Column<T, Members>...> columns;
+        std::array<detail::ColumnInfo, sizeof...(Members)> infos;
+
+        template<typename M>
+        void decodeField(int row, const detail::ColumnInfo& info, M& out) const {
+            if(PQgetisnull(result, row, info.index)) {
+                if constexpr (detail::IsOptional<M>::value) {
+                    out = std::nullopt;
+                    return;
+                } else {
+                    detail::decodeError(info, "value is NULL");
+                }
+            }
+            std::string_view value(PQgetvalue(result, row, info.index), PQgetlength(result, row, info.index));
+            if constexpr (detail::IsOptional<M>::value) {
+                out = ColumnDecoder<typename M::value_type>::decode(value, info);
+            } else {
+                out = ColumnDecoder<M>::decode(value, info);
+            }
+        }
+
+    public:
+        /**
+         * @brief look the columns up in the result
+         *
+         * @param result the result, must outlive the mapper
+         * @param columns the column of each member
+         * @throw std::runtime_error if the result lacks a column
+         */
+        RowMapper(const PGresult* result, Column<T, Members>... columns)
+        : result(result), columns(columns...), infos {detail::resolveColumn(result, columns.name)...} {}
+
+        int size() const {
+            return PQntuples(result);
+        }
+
+        /**
+         * @brief decode a row into out, members without a column are left alone
+         *
+         * @param row the row index
+         * @param out the object to write
+         * @throw std::runtime_error if a value does not fit its member
+         */
+        void read(int row, T& out) const {
+            [&]<size_t ...I>(std::index_sequence<I...>) {
+                (decodeField(row, infos[I], out.*(std::get<I>(columns).member)), ...);
+            }(std::index_sequence_for<Members...>());
+        }
+
+        T row(int row) const {
+            T out {};
+            read(row, out);
+            return out;
+        }
+
+        std::vector<T> all() const {
+            std::vector<T> rows(size());
+            for (int i = 0; i < (int)rows.size(); i++) {
+                read(i, rows[i]);
+            }
+            return rows;
+        }
+    };
+
+    /**
+     * @brief decode every row of the result with the columns T declares, as
+     * static auto columns() { return std::make_tuple(column("id", &T::id), ...); }
+     *
+     * @param result the result
+     * @return std::vector<T> one object per row
+     */
+    template<typename T>
+    std::vector<T> mapRows(const PGresult* result) {
+        return std::apply([result](auto ...c) {
+            return RowMapper(result, c...).all();
+        }, T::columns());
+    }
+
+} // namespace themis
+
+#endif
@@ -0,0 +1,17 @@
+#include "RowStream.h"
+
+void themis::RowStream::deliver(std::shared_ptr<RowStream> self, std::unique_ptr<PGResultSets> batch, size_t count) {
+    RowStream* stream = self.get();
+    stream->pending++;
+    stream->queue->addImmediate([self = std::move(self), batch = std::move(batch), count]() mutable {
+        self->rows += count;
+        try {
+            self->onBatch(std::move(batch));
+        } catch(...) {
+            self->pending--;
+            throw;
+        }
+        // the driver resumes reading once the window has room again
+        self->pending--;
+    });
+}
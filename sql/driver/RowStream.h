@@ -0,0 +1,95 @@
+#ifndef RowStream_h
+#define RowStream_h 1
+
+#include "detail/PostgresqlConnectionPool.h"
+#include "utils/EventQueue.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace themis
+{
+
+    /**
+     * @brief the receiving end of a streamed query. the rows are read from the server
+     * one at a time and handed to the callback in batches, on the queue given here, so
+     * a result of any size is held at most a few batches at a time.
+     * while paused, or while the batches handed over and not yet consumed fill the
+     * window, the driver stops reading the connection and the server waits on its socket
+     *
+     */
+    class RowStream {
+    public:
+        /// @brief takes a batch, one result holding up to the batch rows
+        using BatchFunction = std::function<void (std::unique_ptr<PGResultSets>)>;
+
+    private:
+        friend PostgresqlConnectionPool;
+
+        const std::unique_ptr<EventQueue>& queue;
+        BatchFunction onBatch;
+        size_t batchRows;
+        size_t window;
+        /// @brief batches handed to the queue whose callback has not returned yet
+        std::atomic<size_t> pending {0};
+        std::atomic<bool> paused {false};
+        std::atomic<size_t> rows {0};
+
+        /// @brief the driver should not read more rows for now
+        bool isBlocked() const {
+            return paused || pending >= window;
+        }
+
+        /**
+         * @brief hand a batch to the callback, called by the driver thread
+         *
+         * @param self this stream, kept alive until the callback ran
+         * @param batch the batch
+         * @param count the rows in it
+         */
+        static void deliver(std::shared_ptr<RowStream> self, std::unique_ptr<PGResultSets> batch, size_t count);
+
+    public:
+        /**
+         * @brief make a stream to pass to PostgresqlDriver::stream
+         *
+         * @param queue the queue the callback runs on, the one of the controller manager usually
+         * @param onBatch the batch callback
+         * @param batchRows the most rows in a batch
+         * @param window the most batches waiting for the callback before reading stops
+         */
+        RowStream(const std::unique_ptr<EventQueue>& queue, BatchFunction onBatch, size_t batchRows = 256, size_t window = 4)
+        : queue(queue), onBatch(std::move(onBatch)), batchRows(std::max<size_t>(batchRows, 1)), window(std::max<size_t>(window, 1)) {}
+        RowStream(const RowStream&) = delete;
+
+        /// @brief stop reading rows until resume, the batches already read are still delivered.
+        /// can be called from any thread
+        void pause() {
+            paused = true;
+        }
+
+        void resume() {
+            paused = false;
+        }
+
+        bool isPaused() const {
+            return paused;
+        }
+
+        size_t getBatchRows() const {
+            return batchRows;
+        }
+
+        const std::unique_ptr<EventQueue>& getQueue() const {
+            return queue;
+        }
+
+        /// @brief the rows delivered so far
+        size_t getRowCount() const {
+            return rows;
+        }
+    };
+
+} // namespace themis
+
+#endif
@@ -0,0 +1,59 @@
+#include "Statement.h"
+#include <bit>
+
+void themis::Statement::fillParams(ParamBuffers& buffers) const {
+    buffers.values.clear();
+    buffers.lengths.clear();
+    buffers.formats.clear();
+    // sized up front, so the values pointing into it stay valid
+    buffers.data.resize(params.size() * 8);
+
+    for (size_t i = 0; i < params.size(); i++) {
+        char* slot = buffers.data.data() + i * 8;
+        const char* value = slot;
+        int length = 0;
+        int format = 1;
+        std::visit([&](auto& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, std::monostate>) {
+                value = nullptr;
+                format = 0;
+            } else if constexpr (std::is_same_v<T, std::string>) {
+                value = v.c_str();
+                length = (int)v.size();
+                format = 0;
+            } else if constexpr (std::is_same_v<T, std::vector<unsigned char>>) {
+                // a null pointer would be NULL, an empty bytea is not
+                value = v.empty() ? "" : reinterpret_cast<const char*>(v.data());
+                length = (int)v.size();
+            } else if constexpr (std::is_same_v<T, bool>) {
+                slot[0] = v ? 1 : 0;
+                length = 1;
+            } else if constexpr (std::is_same_v<T, float>) {
+                detail::writeBigEndian(slot, std::bit_cast<uint32_t>(v), 4);
+                length = 4;
+            } else if constexpr (std::is_same_v<T, double>) {
+                detail::writeBigEndian(slot, std::bit_cast<uint64_t>(v), 8);
+                length = 8;
+            } else if constexpr (std::is_same_v<T, Timestamp>) {
+                detail::writeBigEndian(slot, (uint64_t)detail::toPostgresTime(v), 8);
+                length = 8;
+            } else {
+                detail::writeBigEndian(slot, (uint64_t)(int64_t)v, sizeof(T));
+                length = sizeof(T);
+            }
+        }, params[i]);
+        buffers.values.push_back(value);
+        buffers.lengths.push_back(length);
+        buffers.formats.push_back(format);
+    }
+
+    // the same text prepared with other types is another statement
+    buffers.key.assign(sql);
+    for (Oid type: types) {
+        if(!type) continue;
+        buffers.key.push_back('\0');
+        buffers.key.append(reinterpret_cast<const char*>(types.data()), types.size() * sizeof(Oid));
+        break;
+    }
+}
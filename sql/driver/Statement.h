@@ -0,0 +1,172 @@
+#ifndef Statement_h
+#define Statement_h 1
+
+#include "PgTypes.h"
+#include <charconv>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+namespace themis
+{
+
+    /**
+     * @brief a parameterized query, the sql text uses $1, $2 ... for the bound values.
+     * the driver prepares the text once per connection and executes the prepared
+     * statement afterwards, so the server parses and plans it only once.
+     * numbers, bool, timestamps and bytes are sent in binary format with their type,
+     * strings are sent as text and the server infers their type.
+     * results come in text format unless binary results are asked for, the RowMapper
+     * decodes either
+     *
+     */
+    class Statement {
+    public:
+        /**
+         * @brief the arrays libpq takes the params in. a connection keeps one and fills
+         * it for every statement it sends, so that sending allocates nothing once warm
+         *
+         */
+        struct ParamBuffers {
+            std::vector<const char*> values;
+            std::vector<int> lengths;
+            std::vector<int> formats;
+            /// @brief the binary numbers, 8 bytes per param, the values point into it
+            std::string data;
+            /// @brief the sql and the param types, what the statement is prepared for
+            std::string key;
+        };
+
+    private:
+        using Value = std::variant<std::monostate, bool, int16_t, int32_t, int64_t, float, double,
+            Timestamp, std::string, std::vector<unsigned char>>;
+
+        std::string sql;
+        /// @brief monostate is sent as NULL
+        std::vector<Value> params;
+        /// @brief the type of each param, 0 lets the server infer it
+        std::vector<Oid> types;
+        bool binaryResults = false;
+
+        Statement& add(Value value, Oid type) {
+            params.emplace_back(std::move(value));
+            types.push_back(type);
+            return *this;
+        }
+
+    public:
+        /**
+         * @brief make a statement and bind the arguments in order
+         *
+         * @param sql the sql text
+         * @param args the values of $1, $2 ...
+         */
+        template<typename ...Args>
+        explicit Statement(std::string sql, Args&&... args) : sql(std::move(sql)) {
+            params.reserve(sizeof...(Args));
+            types.reserve(sizeof...(Args));
+            (bind(std::forward<Args>(args)), ...);
+        }
+
+        Statement& bind(std::string value) {
+            return add(std::move(value), 0);
+        }
+
+        Statement& bind(std::string_view value) {
+            return add(std::string(value), 0);
+        }
+
+        Statement& bind(const char* value) {
+            return add(std::string(value), 0);
+        }
+
+        Statement& bind(bool value) {
+            return add(value, detail::PgType::BOOL);
+        }
+
+        Statement& bind(std::nullopt_t) {
+            return add(std::monostate(), 0);
+        }
+
+        Statement& bind(Timestamp value) {
+            return add(value, detail::PgType::TIMESTAMPTZ);
+        }
+
+        Statement& bind(Bytes value) {
+            return add(std::vector<unsigned char>(value.begin(), value.end()), detail::PgType::BYTEA);
+        }
+
+        Statement& bind(std::vector<unsigned char> value) {
+            return add(std::move(value), detail::PgType::BYTEA);
+        }
+
+        /// @brief the smallest postgres integer holding every value of T, a uint64_t goes as text
+        template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+        Statement& bind(T value) {
+            if constexpr (std::is_floating_point_v<T>) {
+                if constexpr (std::is_same_v<T, float>) return add(value, detail::PgType::FLOAT4);
+                else return add(double(value), detail::PgType::FLOAT8);
+            } else if constexpr (sizeof(T) == 1 || (std::is_signed_v<T> && sizeof(T) == 2)) {
+                return add(int16_t(value), detail::PgType::INT2);
+            } else if constexpr (sizeof(T) <= 2 || (std::is_signed_v<T> && sizeof(T) == 4)) {
+                return add(int32_t(value), detail::PgType::INT4);
+            } else if constexpr (sizeof(T) <= 4 || std::is_signed_v<T>) {
+                return add(int64_t(value), detail::PgType::INT8);
+            } else {
+                char buf[32];
+                auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+                return add(std::string(buf, end), 0);
+            }
+        }
+
+        template<typename T>
+        Statement& bind(const std::optional<T>& value) {
+            if(!value) return bind(std::nullopt);
+            return bind(*value);
+        }
+
+        /**
+         * @brief have the columns of the result sent in binary format, they are decoded
+         * without parsing text. PQgetvalue then returns the raw binary values
+         *
+         * @param binary true for binary
+         * @return Statement& this
+         */
+        Statement& setBinaryResults(bool binary = true) {
+            binaryResults = binary;
+            return *this;
+        }
+
+        bool hasBinaryResults() const {
+            return binaryResults;
+        }
+
+        const std::string& getSql() const {
+            return sql;
+        }
+
+        size_t getParamCount() const {
+            return params.size();
+        }
+
+        /// @brief the types to prepare the statement with
+        const std::vector<Oid>& getTypes() const {
+            return types;
+        }
+
+        /**
+         * @brief write the params in the form libpq takes them, strings and bytes are
+         * not copied. valid while the statement lives, no more value is bound and the
+         * buffers are not filled again
+         *
+         * @param buffers the buffers to fill, reused
+         */
+        void fillParams(ParamBuffers& buffers) const;
+    };
+
+} // namespace themis
+
+#endif
@@ -0,0 +1,68 @@
+#include "Transaction.h"
+#include <cstring>
+#include <ng-log/logging.h>
+
+themis::Transaction::~Transaction() {
+    // after the statements queued before, on the driver thread
+    queue->addImmediate([pool = &pool, pinned = std::move(pinned)]() {
+        if(!pinned->begun || pinned->ended || pinned->lost) return;
+        pool->endPinned(pinned, Ending::ROLLBACK, [](std::unique_ptr<PGResultSets>) {}, 
+        [](std::unique_ptr<std::exception> e) {
+            LOG(WARNING) << "cannot roll back an abandoned transaction : " << e->what();
+        });
+    });
+}
+
+std::unique_ptr<themis::Transaction::QueryPromise> themis::Transaction::query(Statement statement) {
+    auto shared = std::make_shared<const Statement>(std::move(statement));
+    return std::make_unique<QueryPromise>(queue, 
+        [this, shared](QueryPromise::ResolveFunction resolve, FailFunction fail) {
+            // the pool is only touched by the driver thread, queue it there
+            queue->addImmediate([pool = &pool, pinned = pinned, shared, token = token, resolve, fail]() {
+                pool->submitPinned(pinned, shared, resolve, fail, token);
+            });
+    });
+}
+
+std::unique_ptr<themis::Transaction::QueryPromise> themis::Transaction::commit() {
+    return end(nullptr, Ending::COMMIT);
+}
+
+std::unique_ptr<themis::Transaction::QueryPromise> themis::Transaction::commit(Statement last) {
+    return end(std::make_shared<const Statement>(std::move(last)), Ending::COMMIT);
+}
+
+std::unique_ptr<themis::Transaction::QueryPromise> themis::Transaction::rollback() {
+    return end(nullptr, Ending::ROLLBACK);
+}
+
+std::unique_ptr<themis::Transaction::QueryPromise> themis::Transaction::end(std::shared_ptr<const Statement> last, Ending ending) {
+    return std::make_unique<QueryPromise>(queue, 
+        [this, last, ending](QueryPromise::ResolveFunction resolve, FailFunction fail) {
+            queue->addImmediate([pool = &pool, pinned = pinned, last, token = token, ending, resolve, fail]() {
+                // the results of the last statement and its error, handed over once the end is back
+                auto result = std::make_shared<std::unique_ptr<PGResultSets>>();
+                auto error = std::make_shared<std::unique_ptr<std::exception>>();
+                if(last) {
+                    pool->submitPinned(pinned, last, [result](std::unique_ptr<PGResultSets> r) {
+                        *result = std::move(r);
+                    }, [error](std::unique_ptr<std::exception> e) {
+                        *error = std::move(e);
+                    }, token);
+                }
+                pool->endPinned(pinned, ending, [last, ending, result, error, resolve, fail](std::unique_ptr<PGResultSets> r) {
+                    if(*error) {
+                        fail(std::move(*error));
+                        return;
+                    }
+                    // the server answers a COMMIT of a failed transaction with ROLLBACK
+                    if(ending == Ending::COMMIT && r->size() && !strcmp(PQcmdStatus(r->at(0)), "ROLLBACK")) {
+                        fail(std::make_unique<std::runtime_error>("the transaction was rolled back, "
+                            "one of its statements failed or was cancelled"));
+                        return;
+                    }
+                    resolve(last ? std::move(*result) : std::move(r));
+                }, fail);
+            });
+    });
+}
@@ -0,0 +1,91 @@
+#ifndef Transaction_h
+#define Transaction_h 1
+
+#include "detail/PostgresqlConnectionPool.h"
+#include "Statement.h"
+#include "utils/Cancellation.h"
+#include "utils/EventQueue.h"
+#include "utils/Promise.h"
+#include <memory>
+
+namespace themis
+{
+
+    class PostgresqlDriver;
+
+    /**
+     * @brief statements run in order on one connection of a pool, in a transaction. get it
+     * from PostgresqlDriver::begin, then chain the statements on the promises.
+     * nothing is sent before the first statement, the BEGIN goes out in a pipeline with
+     * it and the COMMIT with the last one, so the transaction costs no round trip of its
+     * own. the connection takes no other task until the end is queued, they go to the
+     * other connections meanwhile, or wait for one if every connection runs a transaction
+     * and the pool is at its max. a task cancelled while it waits fails within a second.
+     * a handle dropped before commit or rollback rolls the transaction back.
+     * the methods can be called from any thread, the callbacks of the promises included
+     *
+     */
+    class Transaction {
+    public:
+        using QueryPromise = Promise<PGResultSets>;
+
+    private:
+        friend PostgresqlDriver;
+        using Ending = PostgresqlConnectionPool::ConnectionDetail::QueryTask::Ending;
+
+        /// @brief the queue of the driver thread, the only one touching the pool
+        const std::unique_ptr<EventQueue>& queue;
+        PostgresqlConnectionPool& pool;
+        std::shared_ptr<PostgresqlConnectionPool::PinnedTransaction> pinned;
+        CancellationToken token;
+
+        Transaction(const std::unique_ptr<EventQueue>& queue, PostgresqlConnectionPool& pool, CancellationToken token)
+        : queue(queue), pool(pool), pinned(std::make_shared<PostgresqlConnectionPool::PinnedTransaction>()), token(std::move(token)) {}
+
+        /**
+         * @brief queue the last statement if any, then the end right behind it
+         *
+         * @param last the last statement, may be null
+         * @param ending commit or rollback
+         * @return std::unique_ptr<QueryPromise> resolved once the end went through
+         */
+        std::unique_ptr<QueryPromise> end(std::shared_ptr<const Statement> last, Ending ending);
+
+    public:
+        Transaction(const Transaction&) = delete;
+        /// @brief roll back if it was neither committed nor rolled back
+        ~Transaction();
+
+        /**
+         * @brief run a statement in the transaction, the first one begins it
+         *
+         * @param statement the sql text and the values bound
+         * @return std::unique_ptr<QueryPromise> on the queue of the driver, as PostgresqlDriver::query.
+         * once a statement failed the ones after it fail as well, and commit rolls back
+         */
+        std::unique_ptr<QueryPromise> query(Statement statement);
+
+        /**
+         * @brief commit what was run
+         *
+         * @return std::unique_ptr<QueryPromise> fails if the transaction rolled back instead,
+         * because one of its statements failed or was cancelled before it was sent
+         */
+        std::unique_ptr<QueryPromise> commit();
+
+        /**
+         * @brief run the last statement and commit, both go out together
+         *
+         * @param last the last statement
+         * @return std::unique_ptr<QueryPromise> resolved with the results of the last
+         * statement once committed, see above
+         */
+        std::unique_ptr<QueryPromise> commit(Statement last);
+
+        /// @brief roll back what was run
+        std::unique_ptr<QueryPromise> rollback();
+    };
+
+} // namespace themis
+
+#endif
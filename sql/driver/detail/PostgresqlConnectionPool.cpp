@@ -1,10 +1,16 @@
 #include "PostgresqlConnectionPool.h"
 #include <libpq-fe.h>
 #include <ng-log/logging.h>
+#include <algorithm>
 #include "../PostgresqlDriver.h"
+#include "../RowStream.h"
+#include "../Copy.h"
 
-themis::PostgresqlConnectionPool::ConnectionDetail::ConnectionDetail(PGconn *conn, event_base *base, size_t pos, PostgresqlConnectionPool& parentPool)
-: conn(conn), pos(pos), parentPool(parentPool) {
+themis::PostgresqlConnectionPool::ConnectionDetail::ConnectionDetail(PGconn *conn, event_base *base, size_t pos, size_t config, PostgresqlConnectionPool& parentPool)
+: conn(conn), parentPool(parentPool), pos(pos), config(config), lastActive(std::chrono::steady_clock::now()),
+statementCache(parentPool.configs[config].getStatementCacheSize(), &parentPool.statementStats),
+pipelineDepth(std::max<size_t>(parentPool.configs[config].getPipelineDepth(), 1)),
+isolation(parentPool.configs[config].getPipelineIsolation()) {
     // allocate read&write
     if(PQsetnonblocking(conn, 1)) {
         throw std::runtime_error("cannot set connection to non-blocking : \r\n" + 
@@ -19,7 +25,7 @@ themis::PostgresqlConnectionPool::ConnectionDetail::ConnectionDetail(PGconn *con
 
         // on read event
         ConnectionDetail* _this = reinterpret_cast<ConnectionDetail *>(args);
-        DatasourceConfig& config = _this->parentPool.configs[_this->pos];
+        DatasourceConfig& config = _this->parentPool.configs[_this->config];
 
         if(ev & EV_TIMEOUT) {
             // timed out, then inform the driver to reconnect to database
@@ -53,7 +59,7 @@ themis::PostgresqlConnectionPool::ConnectionDetail::ConnectionDetail(PGconn *con
         PostgresqlDriver::get()->busy = true;
         // on write event
         ConnectionDetail* _this = reinterpret_cast<ConnectionDetail *>(args);
-        DatasourceConfig& config = _this->parentPool.configs[_this->pos];
+        DatasourceConfig& config = _this->parentPool.configs[_this->config];
         
         if(ev & EV_TIMEOUT) {
             LOG(WARNING) << "connection timed out for " << config.toString();
@@ -75,79 +81,705 @@ themis::PostgresqlConnectionPool::ConnectionDetail::ConnectionDetail(PGconn *con
         
     }, this);
 
-    reconnectEvent = event_new(base, -1, EV_TIMEOUT | EV_PERSIST, 
-        [] (evutil_socket_t fd, short what, void *arg) {
+    // register events
+    event_add(readEvent, nullptr);
+    // event_add(writeEvent, nullptr);
+}
+
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::submitQuery(QueryTask task) {
+    lastActive = std::chrono::steady_clock::now();
+    queries.push(std::move(task));
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::reportWait(const QueryTask& task) {
+    auto waited = std::chrono::steady_clock::now() - task.submitted;
+    if(waited > std::chrono::milliseconds(parentPool.configs[config].getQueueWaitThreshold())) {
+        parentPool.growFor(config);
+    }
+}
 
-            ConnectionDetail* _this = reinterpret_cast<ConnectionDetail *>(arg);
-            // try to reconnect once
-            try
-            {
-                _this->parentPool.buildConnection(_this->pos);
+void themis::PostgresqlConnectionPool::ConnectionDetail::sendNextQuery(EventQueue* queue) {
+    // the request of a cancelled task is already answered, never send it
+    while(!queries.empty() && queries.front().token.isCancelled()) dropCancelled();
+    if(queries.empty()) return;
+
+    if(depthFor(queries.front()) > 1 && queries.front().statement && !queries.front().stream) {
+        if(PQpipelineStatus(conn) == PQ_PIPELINE_OFF) {
+            if(commandActive) return;
+            if(!PQenterPipelineMode(conn)) {
+                LOG(WARNING) << "cannot enter pipeline mode : " << PQerrorMessage(conn);
+                pipelineDepth = 1;
             }
-            catch(const std::exception& e)
-            {
-                // not succeeded, add up retry count
-                ++ _this->retryCount;
-                auto& config = _this->parentPool.configs[_this->pos];
-                if (_this->retryCount > config.getMaxRetry()) {
-                    // retry procedure failed, thus should remove this connection 
-                    LOG(WARNING) << "connection with config " << config.toString() 
-                    << " cannot resume after " << config.getMaxRetry() << " times of retry";
-                    _this->parentPool.basePool[_this->pos] = nullptr;
-                }
+        }
+        if(PQpipelineStatus(conn) != PQ_PIPELINE_OFF) {
+            sendPipelined();
+            return;
+        }
+    }
+    if(PQpipelineStatus(conn) != PQ_PIPELINE_OFF) {
+        // a query function may send anything and a stream reads row by row, 
+        // they run alone once the pipeline is drained
+        if(!commands.empty() || !PQexitPipelineMode(conn)) return;
+    }
+    if(commandActive) return;
+
+    // free the statements evicted from the cache before the next one is prepared
+    if(statementCache.hasEvicted()) {
+        std::string deallocations;
+        for (auto& name: statementCache.takeEvicted()) {
+            deallocations += "DEALLOCATE " + name + ";";
+        }
+        if(PQsendQuery(conn, deallocations.c_str())) {
+            step = Step::DEALLOCATE;
+            commandActive = true;
+            event_add(writeEvent, nullptr);
+            return;
+        }
+        LOG(WARNING) << "cannot deallocate evicted statements : " << PQerrorMessage(conn);
+    }
+
+    // make the pending result objects to hand over to the user later
+    pendingResult = std::make_unique<PGResultSets>();
+    QueryTask& task = queries.front();
+    reportWait(task);
+    // the transaction must not commit without the statement it dropped
+    if(task.ending == QueryTask::Ending::COMMIT && task.transaction->failed) task.statement = parentPool.rollbackStatement;
+    if(task.statement) {
+        // the params stay in the buffers until the statement completed
+        const Statement& statement = *task.statement;
+        statement.fillParams(params);
+        const std::string* name = statementCache.find(params.key);
+        bool sent;
+        if(name) {
+            statementName = *name;
+            sent = sendPrepared(statement, statementName, task.stream != nullptr);
+        } else {
+            // prepare first, the statement is executed once the server has it
+            statementName = statementCache.allocateName();
+            step = Step::PREPARE;
+            sent = PQsendPrepare(conn, statementName.c_str(), statement.getSql().c_str(), 
+                (int)statement.getTypes().size(), statement.getTypes().data());
+        }
+        if(!sent) {
+            failFront(std::make_unique<std::runtime_error>("cannot send statement : " + std::string(PQerrorMessage(conn))));
+            return;
+        }
+    } else {
+        step = Step::EXECUTE;
+        task.query(conn);
+        if(!PQisBusy(conn)) {
+            // nothing happened in query, inform user
+            failFront(std::make_unique<std::runtime_error>("there are no query submitted to connection"));
+            return;
+        }
+    }
+    // enable write so that the query can be flush out
+    commandActive = true;
+    event_add(writeEvent, nullptr);
+
+    CancellationToken& token = queries.front().token;
+    if(!token) return;
+    activeCancel = std::make_shared<CancelState>(PQgetCancel(conn));
+    cancelSubscription = token.subscribe([state = activeCancel, queue]() {
+        // the token is cancelled on the thread of the request, cancel on the driver thread
+        queue->addImmediate([state]() {
+            if(state->finished || !state->cancel) return;
+            char error[256];
+            // PQcancel blocks until the server received the request, it is short
+            // as it only opens a connection and sends a packet
+            if(!PQcancel(state->cancel, error, sizeof(error))) {
+                LOG(WARNING) << "cannot cancel query : " << error;
             }
-            // if this succeeded, _this pointer is no longer active and should immediately return
+            state->finished = true;
+        });
+    });
+}
 
-        }, this);
+void themis::PostgresqlConnectionPool::ConnectionDetail::finishActiveQuery() {
+    if(!activeCancel.get()) return;
+    activeCancel->finished = true;
+    if(!queries.empty()) queries.front().token.unsubscribe(cancelSubscription);
+    activeCancel = nullptr;
+    cancelSubscription = 0;
+}
 
-    // register events
+bool themis::PostgresqlConnectionPool::ConnectionDetail::sendPrepared(const Statement& statement, const std::string& name, bool singleRow) {
+    step = Step::EXECUTE;
+    if(!PQsendQueryPrepared(conn, name.c_str(), (int)params.values.size(), params.values.data(), 
+        params.lengths.data(), params.formats.data(), statement.hasBinaryResults() ? 1 : 0)) return false;
+    // only right after sending, before any result is read
+    if(singleRow && !PQsetSingleRowMode(conn)) LOG(WARNING) << "cannot stream rows, the result is read at once";
+    return true;
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::streamRow(PGresult* row) {
+    QueryTask& task = queries.front();
+    if(row) {
+        if(!streamBatch) {
+            // the first row is the batch, the others are appended to it
+            streamBatch = std::make_unique<PGResultSets>();
+            streamBatch->addResult(row);
+            streamBatchRows = 1;
+        } else {
+            PGresult* batch = streamBatch->at(0);
+            bool copied = true;
+            for (int i = 0; i < PQnfields(row) && copied; i++) {
+                bool null = PQgetisnull(row, 0, i);
+                copied = PQsetvalue(batch, (int)streamBatchRows, i, null ? nullptr : PQgetvalue(row, 0, i), 
+                    null ? -1 : PQgetlength(row, 0, i));
+            }
+            PQclear(row);
+            if(!copied) throw std::runtime_error("cannot add the row to the batch, out of memory");
+            streamBatchRows++;
+        }
+        if(streamBatchRows < task.stream->getBatchRows()) return;
+    }
+    if(!streamBatch) return;
+    auto batch = std::move(streamBatch);
+    size_t count = streamBatchRows;
+    streamBatchRows = 0;
+    // nobody waits for the rows of a cancelled stream
+    if(task.token.isCancelled()) return;
+    RowStream::deliver(task.stream, std::move(batch), count);
+}
+
+bool themis::PostgresqlConnectionPool::ConnectionDetail::frontBlocked() const {
+    if(step != Step::EXECUTE || queries.empty()) return false;
+    const QueryTask& task = queries.front();
+    // a cancelled stream reads on to the end and drops what it reads
+    if(task.token.isCancelled()) return false;
+    return (task.stream && task.stream->isBlocked()) || (task.copySink && task.copySink->isBlocked());
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::pollStream() {
+    if(broken || queries.empty()) {
+        streamPaused = false;
+        return;
+    }
+    if(frontBlocked()) return;
+    PostgresqlDriver::get()->busy = true;
+    streamPaused = false;
     event_add(readEvent, nullptr);
-    // event_add(writeEvent, nullptr);
+    try {
+        // the rows libpq already buffered do not wake the read event
+        handleConnectionResponse();
+    } catch(const std::exception& e) {
+        handleConnectionError();
+    }
+}
+
+bool themis::PostgresqlConnectionPool::ConnectionDetail::pumpCopyIn() {
+    // the socket is full, the write event flushes it and the next loop goes on
+    if(event_pending(writeEvent, EV_WRITE, nullptr)) return false;
+    QueryTask& task = queries.front();
+    // a few chunks a loop, so that the other connections are served in between
+    for (int sent = 0; sent < 16 && !copyEnding; sent++) {
+        if(copyChunk.empty()) {
+            if(task.token.isCancelled()) {
+                copyEnding = true;
+                copyEndError = "the copy was cancelled";
+                break;
+            }
+            CopySource::Status status = CopySource::Status::END;
+            try {
+                if(task.copySource) status = task.copySource->read(copyChunk);
+                else copyEndError = "the statement copies from stdin, submit it with copyIn";
+            } catch(const std::exception& e) {
+                copyEndError = *e.what() ? e.what() : "the copy source failed";
+                copyChunk.clear();
+            }
+            if(status == CopySource::Status::WAIT) break;
+            if(status == CopySource::Status::END || !copyEndError.empty()) {
+                copyChunk.clear();
+                copyEnding = true;
+                break;
+            }
+            if(copyChunk.empty()) continue;
+        }
+        int result = PQputCopyData(conn, copyChunk.data(), (int)copyChunk.size());
+        if(result == -1) throw std::runtime_error("cannot send copy data : " + std::string(PQerrorMessage(conn)));
+        if(result == 0) {
+            // libpq could not buffer it without blocking, try again once the socket drained
+            event_add(writeEvent, nullptr);
+            return false;
+        }
+        copyChunk.clear();
+        PostgresqlDriver::get()->busy = true;
+    }
+    if(copyEnding) {
+        int result = PQputCopyEnd(conn, copyEndError.empty() ? nullptr : copyEndError.c_str());
+        if(result == -1) throw std::runtime_error("cannot end copy : " + std::string(PQerrorMessage(conn)));
+        if(result == 1) {
+            resetCopy();
+            PostgresqlDriver::get()->busy = true;
+        }
+    }
+    int flushed = PQflush(conn);
+    if(flushed == -1) throw std::runtime_error("cannot flush copy data : " + std::string(PQerrorMessage(conn)));
+    if(flushed == 1) event_add(writeEvent, nullptr);
+    return copying == Copy::NONE;
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::pollCopy() {
+    if(broken || queries.empty()) return;
+    try {
+        // once the end is sent the results may already be in, no read event comes for them
+        handleConnectionResponse();
+    } catch(const std::exception& e) {
+        handleConnectionError();
+    }
+}
+
+bool themis::PostgresqlConnectionPool::ConnectionDetail::readCopyOut() {
+    QueryTask& task = queries.front();
+    while(true) {
+        if(frontBlocked()) {
+            // the consumer is behind, as for a stream of rows
+            streamPaused = true;
+            event_del(readEvent);
+            return false;
+        }
+        char* buffer = nullptr;
+        int length = PQgetCopyData(conn, &buffer, 1);
+        if(length > 0) {
+            copyChunk.append(buffer, length);
+            PQfreemem(buffer);
+            if(!task.copySink || copyChunk.size() >= task.copySink->getChunkBytes()) flushCopyOut();
+            continue;
+        }
+        // the rest is not in yet
+        if(length == 0) return false;
+        if(length == -2) throw std::runtime_error("cannot read copy data : " + std::string(PQerrorMessage(conn)));
+        // the copy is done, its result follows
+        flushCopyOut();
+        resetCopy();
+        return true;
+    }
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::flushCopyOut() {
+    if(copyChunk.empty()) return;
+    std::string data = std::move(copyChunk);
+    copyChunk.clear();
+    QueryTask& task = queries.front();
+    // a statement copying to stdout outside of copyOut, or nobody waits for the data
+    if(!task.copySink || task.token.isCancelled()) return;
+    CopyOutStream::deliver(task.copySink, std::move(data));
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::resetCopy() {
+    copying = Copy::NONE;
+    copyChunk.clear();
+    copyEnding = false;
+    copyEndError.clear();
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::failFront(std::unique_ptr<std::exception> e) {
+    finishActiveQuery();
+    QueryTask task = queries.front();
+    queries.pop();
+    pendingResult = nullptr;
+    streamBatch = nullptr;
+    streamBatchRows = 0;
+    streamPaused = false;
+    resetCopy();
+    task.onErr(std::move(e));
+}
+
+bool themis::PostgresqlConnectionPool::ConnectionDetail::readyToSend() {
+    if(queries.empty()) return false;
+    if(PQpipelineStatus(conn) != PQ_PIPELINE_OFF) return pipelined.size() < depthFor(queries.front());
+    return !commandActive;
 }
 
+void themis::PostgresqlConnectionPool::ConnectionDetail::dropCancelled() {
+    QueryTask task = queries.front();
+    queries.pop();
+    // the rest of its transaction still runs, and rolls back
+    if(task.transaction) task.transaction->failed = true;
+    task.onErr(std::make_unique<CancelledException>("the query was cancelled before it was sent"));
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::sendPipelined() {
+    // tasks sent since the last sync
+    size_t batch = 0;
+    while(!queries.empty() && pipelined.size() < depthFor(queries.front())) {
+        if(queries.front().token.isCancelled()) {
+            dropCancelled();
+            continue;
+        }
+        // a query function or a stream waits for the pipeline to drain
+        if(!queries.front().statement || queries.front().stream) break;
+
+        if(statementCache.hasEvicted()) {
+            // in a batch of their own, so that a failure does not abort a task
+            if(batch && !sendSync(batch)) return;
+            batch = 0;
+            for (auto& name: statementCache.takeEvicted()) {
+                std::string sql = "DEALLOCATE " + name;
+                if(PQsendQueryParams(conn, sql.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0)) {
+                    commands.emplace_back(Command::DEALLOCATE);
+                } else {
+                    LOG(WARNING) << "cannot deallocate evicted statement : " << PQerrorMessage(conn);
+                }
+            }
+            if(!sendSync(0)) return;
+        }
 
-void themis::PostgresqlConnectionPool::ConnectionDetail::submitQuery(QueryFunction func, QueryCallbackFunction cb, QueryErrorCallbackFunction fail) {
-    queries.push(QueryTask(func, cb, fail));
+        // a statement of a transaction is synced alone, its error is its own
+        if(batch && queries.front().transaction) {
+            if(!sendSync(batch)) return;
+            batch = 0;
+        }
+        pipelined.emplace_back(queries.front());
+        queries.pop();
+        PipelinedTask& task = pipelined.back();
+        reportWait(task.task);
+        if(task.task.ending == QueryTask::Ending::COMMIT && task.task.transaction->failed) {
+            task.task.statement = parentPool.rollbackStatement;
+        }
+        // libpq copies the params out as it sends, the buffers are filled again for the next
+        const Statement& statement = *task.task.statement;
+        statement.fillParams(params);
+        const std::string* cached = statementCache.find(params.key);
+        std::string name;
+        if(cached) {
+            name = *cached;
+        } else {
+            // prepared and executed back to back, the cache trusts the prepare to succeed
+            name = statementCache.allocateName();
+            if(PQsendPrepare(conn, name.c_str(), statement.getSql().c_str(), 
+                (int)statement.getTypes().size(), statement.getTypes().data())) {
+                commands.emplace_back(Command::PREPARE, &task, params.key, name);
+                statementCache.insert(params.key, name);
+            } else {
+                task.error = "cannot send statement : " + std::string(PQerrorMessage(conn));
+            }
+        }
+        if(task.error.empty()) {
+            if(sendPrepared(statement, name)) {
+                commands.emplace_back(Command::EXECUTE, &task, params.key, name);
+            } else {
+                task.error = "cannot send statement : " + std::string(PQerrorMessage(conn));
+            }
+        }
+        batch++;
+        if(isolation == PipelineIsolation::QUERY || task.task.transaction) {
+            if(!sendSync(batch)) return;
+            batch = 0;
+        }
+    }
+    if(batch && !sendSync(batch)) return;
+    event_add(writeEvent, nullptr);
+}
+
+bool themis::PostgresqlConnectionPool::ConnectionDetail::sendSync(size_t tasks) {
+    if(!PQpipelineSync(conn)) {
+        LOG(WARNING) << "cannot send pipeline sync to " << parentPool.configs[config].toString() 
+        << " : " << PQerrorMessage(conn);
+        // the tasks fail with the connection
+        handleConnectionError();
+        return false;
+    }
+    commands.emplace_back(Command::SYNC, nullptr, "", "", tasks);
+    return true;
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::handlePipelineResponse() {
+    while(!commands.empty()) {
+        if(PQisBusy(conn)) return;
+        PGresult* result = PQgetResult(conn);
+        Command& command = commands.front();
+        // the end of the results of a command
+        if(!result) {
+            if(command.kind == Command::SYNC) return;
+            commands.pop_front();
+            continue;
+        }
+        ExecStatusType status = PQresultStatus(result);
+        if(command.kind == Command::SYNC) {
+            // a sync has one result and no end
+            PQclear(result);
+            size_t tasks = command.tasks;
+            commands.pop_front();
+            completeBatch(tasks);
+            continue;
+        }
+        if(status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) {
+            if(command.kind == Command::EXECUTE && command.task->error.empty()) command.task->results->addResult(result);
+            else PQclear(result);
+            continue;
+        }
+
+        std::string error = status == PGRES_PIPELINE_ABORTED ? 
+            "the query was skipped because an earlier query of its batch failed" : 
+            "postgresql query returned a fatal error " + std::string(PQresultErrorMessage(result));
+        const char* state = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+        // the statement is not on the server, prepare it again next time
+        if(command.kind == Command::PREPARE || (state && std::string(state) == "26000")) {
+            statementCache.erase(command.key, command.name);
+        }
+        if(command.kind == Command::DEALLOCATE) {
+            LOG(WARNING) << "cannot deallocate evicted statement : " << error;
+        } else if(command.task->error.empty()) {
+            command.task->error = error;
+        }
+        PQclear(result);
+    }
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::completeBatch(size_t tasks) {
+    // the server rolled the whole batch back if one of its tasks failed
+    bool failed = false;
+    for (size_t i = 0; i < tasks; i++) {
+        if(!pipelined[i].error.empty()) failed = true;
+    }
+    for (size_t i = 0; i < tasks; i++) {
+        PipelinedTask task = std::move(pipelined.front());
+        pipelined.pop_front();
+        if(!failed) {
+            task.task.cb(std::move(task.results));
+        } else if(!task.error.empty()) {
+            task.task.onErr(std::make_unique<std::runtime_error>(task.error));
+        } else {
+            task.task.onErr(std::make_unique<std::runtime_error>("the query was rolled back because another query of its batch failed"));
+        }
+    }
 }
 
 void themis::PostgresqlConnectionPool::ConnectionDetail::handleConnectionResponse() {
-    // not yet completed current task
-    if(PQisBusy(conn)) return;
-    // the current query has ended
-    // retrieve the result and invoke user callback
-    bool hasResult = false;
-    for (PGresult* result = PQgetResult(conn); 
-    result != nullptr; 
-    result = PQgetResult(conn))
-    {
-        hasResult = true;
+    if(PQpipelineStatus(conn) != PQ_PIPELINE_OFF) {
+        handlePipelineResponse();
+        return;
+    }
+    // nothing on the wire, the input was a notice
+    if(!commandActive) return;
+    // the result of a copy comes once all its data went through
+    if(copying == Copy::IN && !pumpCopyIn()) return;
+    if(copying == Copy::OUT && !readCopyOut()) return;
+    // read the results that arrived, PQgetResult would block for the others
+    while(true) {
+        if(frontBlocked()) {
+            // the consumer is behind, leave the rows in the socket until it caught up
+            streamPaused = true;
+            event_del(readEvent);
+            return;
+        }
+        if(PQisBusy(conn)) return;
+        PGresult* result = PQgetResult(conn);
+        // the command has ended
+        if(!result) break;
         ExecStatusType status = PQresultStatus(result);
+        if(status == PGRES_COPY_IN || status == PGRES_COPY_OUT) {
+            PQclear(result);
+            if(status == PGRES_COPY_IN) {
+                copying = Copy::IN;
+                if(!pumpCopyIn()) return;
+            } else {
+                copying = Copy::OUT;
+                if(!readCopyOut()) return;
+            }
+            continue;
+        }
+        if(status == PGRES_SINGLE_TUPLE) {
+            // the rows read before an error are dropped with the batch
+            if(error.empty()) streamRow(result);
+            else PQclear(result);
+            continue;
+        }
         if(status != PGRES_COMMAND_OK &&
         status != PGRES_TUPLES_OK) {
-            queries.front().onErr(std::make_unique<std::runtime_error>("postgresql query returned a fatal error " 
-                + std::string(PQresultErrorMessage(result))));
-            // clear current pending request
-            pendingResult = nullptr;
-            break;
-        } 
-        if(status == PGRES_NONFATAL_ERROR) {
-            // warning but not fatal
-            LOG(WARNING) << "a warning message was generated by database : " << PQresultErrorMessage(result);
+            // keep the first error, drop the rest
+            if(error.empty()) {
+                error = PQresultErrorMessage(result);
+                const char* state = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+                if(state) sqlState = state;
+            }
+            PQclear(result);
+            continue;
         }
         // query ok
-        pendingResult->addResult(result);
+        if(step == Step::EXECUTE && pendingResult) pendingResult->addResult(result);
+        else PQclear(result);
     }
-    if(!hasResult) throw std::exception();
-    // if no error occurred, call user callback and remove active task
-    queries.front().cb(std::move(pendingResult));
+    commandActive = false;
+    std::string error = std::move(this->error);
+    std::string sqlState = std::move(this->sqlState);
+    this->error.clear();
+    this->sqlState.clear();
+
+    if(step == Step::DEALLOCATE) {
+        // not a task of the user, the front one is sent next
+        if(!error.empty()) LOG(WARNING) << "cannot deallocate evicted statements : " << error;
+        step = Step::EXECUTE;
+        return;
+    }
+
+    QueryTask& task = queries.front();
+    if(step == Step::PREPARE && error.empty()) {
+        statementCache.insert(params.key, statementName);
+        if(!sendPrepared(*task.statement, statementName, task.stream != nullptr)) {
+            failFront(std::make_unique<std::runtime_error>("cannot send statement : " + std::string(PQerrorMessage(conn))));
+            return;
+        }
+        commandActive = true;
+        event_add(writeEvent, nullptr);
+        return;
+    }
+
+    if(!error.empty()) {
+        // invalid_sql_statement_name, someone deallocated it, prepare it again next time
+        if(task.statement && sqlState == "26000") statementCache.erase(params.key, statementName);
+        failFront(std::make_unique<std::runtime_error>("postgresql query returned a fatal error " + error));
+        return;
+    }
+    finishActiveQuery();
+    if((task.stream || task.copySink) && task.token.isCancelled()) {
+        // the server finished before the cancel reached it, the rows are dropped all the same
+        failFront(std::make_unique<CancelledException>("the stream was cancelled, its rows were dropped"));
+        return;
+    }
+    // the last batch goes before the completion
+    if(task.stream) streamRow(nullptr);
+    // call user callback and remove active task
+    QueryTask done = task;
     queries.pop();
+    done.cb(std::move(pendingResult));
+}
+
+void themis::PostgresqlConnectionPool::ConnectionDetail::failAll() {
+    finishActiveQuery();
+    if(pinned) {
+        // the server rolls the transaction back as the connection closes
+        pinned->lost = true;
+        pinned->connection = nullptr;
+        pinned = nullptr;
+    }
+    streamBatch = nullptr;
+    streamBatchRows = 0;
+    streamPaused = false;
+    resetCopy();
+    while(!pipelined.empty()) {
+        QueryTask task = pipelined.front().task;
+        pipelined.pop_front();
+        task.onErr(std::make_unique<std::runtime_error>
+            ("the query is submitted to the pool, but the connection associated with it is down"));
+    }
+    while(!queries.empty()) {
+        QueryTask task = queries.front();
+        queries.pop();
+        task.onErr(std::make_unique<std::runtime_error>
+            ("the query is submitted to the pool, but the connection associated with it is down"));
+    }
+    commands.clear();
 }
 
 void themis::PostgresqlConnectionPool::ConnectionDetail::handleConnectionError() {
-    // retry untill max retry
-    // if the timeout value is to small the connect operation will immediately fail
-    timeval tm {3,0};
-    event_add(reconnectEvent, &tm);
+    if(broken) return;
+    broken = true;
+    event_del(readEvent);
+    event_del(writeEvent);
+    failAll();
+    parentPool.scheduleReconnect(pos, config, 0);
+    parentPool.drainWaiting();
+}
+
+themis::PostgresqlConnectionPool::ListenConnection::ListenConnection(PGconn *conn, event_base *base, PostgresqlConnectionPool& parentPool)
+: conn(conn), readEvent(nullptr), writeEvent(nullptr), parentPool(parentPool) {
+    if(PQsetnonblocking(conn, 1)) {
+        throw std::runtime_error("cannot set connection to non-blocking : \r\n" + 
+        std::string(PQerrorMessage(conn)));
+    }
+    int socket = PQsocket(conn);
+    readEvent = event_new(base, socket, EV_READ | EV_PERSIST, [](evutil_socket_t fd, short ev, void *args) {
+        PostgresqlDriver::get()->busy = true;
+        ListenConnection* _this = reinterpret_cast<ListenConnection *>(args);
+        if(PQconsumeInput(_this->conn) != 1) {
+            LOG(WARNING) << "fatal error in consume of the listen connection " 
+            << _this->parentPool.configs[0].toString() << "\r\n" << PQerrorMessage(_this->conn);
+            _this->handleConnectionError();
+            return;
+        }
+        _this->handleResponse();
+    }, this);
+    writeEvent = event_new(base, socket, EV_WRITE, [](evutil_socket_t fd, short ev, void *args) {
+        PostgresqlDriver::get()->busy = true;
+        ListenConnection* _this = reinterpret_cast<ListenConnection *>(args);
+        int result = PQflush(_this->conn);
+        if(result == -1) {
+            LOG(WARNING) << "fatal error in flush of the listen connection " 
+            << _this->parentPool.configs[0].toString() << "\r\n" << PQerrorMessage(_this->conn);
+            _this->handleConnectionError();
+        } else if(result == 1) {
+            event_add(_this->writeEvent, nullptr);
+        }
+    }, this);
+    event_add(readEvent, nullptr);
+}
+
+void themis::PostgresqlConnectionPool::ListenConnection::syncChannels() {
+    // one command at a time, the changes made meanwhile go with the next
+    if(broken || commandActive) return;
+    std::string sql;
+    auto append = [this, &sql](const char* command, const std::string& channel) {
+        // the channel is quoted, it is matched as given
+        char* quoted = PQescapeIdentifier(conn, channel.data(), channel.size());
+        if(!quoted) {
+            LOG(WARNING) << "cannot quote channel " << channel << " : " << PQerrorMessage(conn);
+            return;
+        }
+        sql.append(command).append(quoted).append(";");
+        PQfreemem(quoted);
+    };
+    for (auto& [channel, callbacks]: parentPool.subscriptions) {
+        if(listening.insert(channel).second) append("LISTEN ", channel);
+    }
+    for (auto it = listening.begin(); it != listening.end();) {
+        if(parentPool.subscriptions.count(*it)) {
+            it++;
+            continue;
+        }
+        append("UNLISTEN ", *it);
+        it = listening.erase(it);
+    }
+    if(sql.empty()) return;
+    if(!PQsendQuery(conn, sql.c_str())) {
+        LOG(WARNING) << "cannot send " << sql << " : " << PQerrorMessage(conn);
+        handleConnectionError();
+        return;
+    }
+    commandActive = true;
+    event_add(writeEvent, nullptr);
+}
+
+void themis::PostgresqlConnectionPool::ListenConnection::handleResponse() {
+    while(commandActive && !PQisBusy(conn)) {
+        PGresult* result = PQgetResult(conn);
+        if(!result) {
+            commandActive = false;
+            break;
+        }
+        if(PQresultStatus(result) != PGRES_COMMAND_OK) {
+            LOG(WARNING) << "cannot listen : " << PQresultErrorMessage(result);
+        }
+        PQclear(result);
+    }
+    // the notifications were parsed from the input consumed
+    while(PGnotify* notify = PQnotifies(conn)) {
+        parentPool.dispatchNotification(notify);
+        PQfreemem(notify);
+    }
+    if(!commandActive) syncChannels();
+}
+
+void themis::PostgresqlConnectionPool::ListenConnection::handleConnectionError() {
+    if(broken) return;
+    broken = true;
+    event_del(readEvent);
+    event_del(writeEvent);
+    LOG(WARNING) << "the listen connection is down, notifications are lost until it is back";
+    parentPool.scheduleReconnect(LISTEN_SLOT, 0, 0);
 }
 
 void themis::PGResultSets::clearResults() {
@@ -166,65 +798,470 @@ void themis::PGResultSets::addResult(PGresult *result) {
     sets.emplace_back(result);
 }
 
-void themis::PostgresqlConnectionPool::buildConnection(size_t configIndex) {
-
-    // try to build connection up
-    auto& config = configs[configIndex];
-    
+bool themis::PostgresqlConnectionPool::PendingConnection::start() {
+    auto& config = parentPool.configs[this->config];
     // check if config has required fields
     if(config.getUsername().empty() ||
     config.getAddress().empty() ||
     config.getPassword().empty()) {
-        throw std::runtime_error("invalid config : " + config.toString());
+        LOG(WARNING) << "invalid config : " << config.toString();
+        return false;
     }
 
-    std::ostringstream uriBuilder;
-    uriBuilder << "postgresql://" << config.getUsername() << "@" << config.getAddress() 
-    << "/" << config.getDatabase() << "?password=" << config.getPassword();
+    // the address is host:port, or a bare host
+    std::string host = config.getAddress();
+    std::string port;
+    size_t colon = host.rfind(':');
+    if(colon != std::string::npos && host.find(']', colon) == std::string::npos) {
+        port = host.substr(colon + 1);
+        host = host.substr(0, colon);
+    }
+    if(host.size() > 1 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
 
-    std::string uri = uriBuilder.str();
+    const char* keywords[] = {"host", "port", "user", "password", "dbname", nullptr};
+    const char* values[] = {host.c_str(), port.empty() ? nullptr : port.c_str(), config.getUsername().c_str(), 
+        config.getPassword().c_str(), config.getDatabase().c_str(), nullptr};
 
     LOG(INFO) << "connecting to postgresql database using profile : " << config.toString();
-    clock_t begin = clock();
-    PGconn* connection = PQconnectdb(uri.c_str());
-    clock_t elapsed = ((clock() - begin) * 1000) / CLOCKS_PER_SEC;
-    
-    ConnStatusType status = PQstatus(connection);
-    if(status != CONNECTION_OK) {
-        // error in connect
-        LOG(WARNING) << "cannot connect to databaes using config : " << config.toString();
-        throw std::runtime_error("connection failed for config " + config.toString());
+    begin = std::chrono::steady_clock::now();
+    deadline = begin + std::chrono::seconds(config.getConnectTimeout());
+    conn = PQconnectStartParams(keywords, values, 0);
+    if(!conn) return false;
+    if(PQstatus(conn) == CONNECTION_BAD) {
+        LOG(WARNING) << "cannot connect to database using config : " << config.toString() 
+        << "\r\n" << PQerrorMessage(conn);
+        return false;
+    }
+    // libpq wants the socket writable first
+    waitSocket(PGRES_POLLING_WRITING);
+    return true;
+}
+
+void themis::PostgresqlConnectionPool::PendingConnection::waitRetry(std::chrono::milliseconds delay) {
+    ev = event_new(parentPool.driverBase, -1, EV_TIMEOUT, [](evutil_socket_t fd, short what, void* arg) {
+        PendingConnection* _this = reinterpret_cast<PendingConnection *>(arg);
+        // this frees _this
+        _this->parentPool.connect(_this->pos, _this->config, _this->attempt);
+    }, this);
+    timeval tv {(time_t)(delay.count() / 1000), (suseconds_t)(delay.count() % 1000 * 1000)};
+    event_add(ev, &tv);
+}
+
+void themis::PostgresqlConnectionPool::PendingConnection::waitSocket(PostgresPollingStatusType status) {
+    // the socket may change between polls, when libpq tries the next address
+    if(ev) event_free(ev);
+    ev = event_new(parentPool.driverBase, PQsocket(conn), 
+        (status == PGRES_POLLING_READING ? EV_READ : EV_WRITE) | EV_TIMEOUT, 
+        [](evutil_socket_t fd, short what, void* arg) {
+            reinterpret_cast<PendingConnection *>(arg)->poll(what);
+        }, this);
+    auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+    if(left.count() < 0) left = std::chrono::microseconds(0);
+    timeval tv {(time_t)(left.count() / 1000000), (suseconds_t)(left.count() % 1000000)};
+    event_add(ev, &tv);
+}
+
+void themis::PostgresqlConnectionPool::PendingConnection::poll(short what) {
+    PostgresqlDriver::get()->busy = true;
+    auto& config = parentPool.configs[this->config];
+    // each branch frees this, return right after
+    if(what & EV_TIMEOUT) {
+        LOG(WARNING) << "connection timed out for " << config.toString();
+        parentPool.scheduleReconnect(pos, this->config, attempt + 1);
+        return;
     }
+    PostgresPollingStatusType status = PQconnectPoll(conn);
+    switch (status) {
+    case PGRES_POLLING_OK:
+        parentPool.connected(pos);
+        return;
+    case PGRES_POLLING_FAILED:
+        LOG(WARNING) << "cannot connect to database using config : " << config.toString() 
+        << "\r\n" << PQerrorMessage(conn);
+        parentPool.scheduleReconnect(pos, this->config, attempt + 1);
+        return;
+    default:
+        waitSocket(status);
+    }
+}
 
-    LOG(INFO) << "succeded to connect in " << elapsed << " ms";
-    // note this immediately free the last connection (if exists)
-    basePool[configIndex] = 
-    std::make_unique<ConnectionDetail>(connection, driverBase, configIndex, *this);
+void themis::PostgresqlConnectionPool::connect(size_t slot, size_t configIndex, size_t attempt) {
+    // the broken connection is replaced now, its queries already failed
+    if(slot != LISTEN_SLOT) basePool[slot] = nullptr;
+    else {
+        listener = nullptr;
+        if(subscriptions.empty()) {
+            // nothing is listened to any more
+            listenPending = nullptr;
+            return;
+        }
+    }
+    auto connection = std::make_unique<PendingConnection>(*this, slot, configIndex, attempt);
+    if(!connection->start()) {
+        scheduleReconnect(slot, configIndex, attempt + 1);
+        return;
+    }
+    pendingAt(slot) = std::move(connection);
+}
+
+void themis::PostgresqlConnectionPool::scheduleReconnect(size_t slot, size_t configIndex, size_t attempt) {
+    auto& config = configs[configIndex];
+    // the listen connection has no other to fall back on, it retries as long as it is needed
+    if(attempt > config.getMaxRetry() && slot != LISTEN_SLOT) {
+        // retry procedure failed, thus should remove this connection
+        LOG(WARNING) << "connection with config " << config.toString()
+        << " cannot resume after " << config.getMaxRetry() << " times of retry";
+        pendingAt(slot) = nullptr;
+        return;
+    }
+    auto ceiling = std::min(RECONNECT_DELAY * (1 << std::min<size_t>(attempt, 16)), MAX_RECONNECT_DELAY);
+    std::uniform_int_distribution<long> half(0, ceiling.count() / 2);
+    std::chrono::milliseconds delay(ceiling.count() - ceiling.count() / 2 + half(jitter));
+    LOG(INFO) << "reconnecting to " << config.toString() << " in " << delay.count() << " ms";
+
+    auto connection = std::make_unique<PendingConnection>(*this, slot, configIndex, attempt);
+    connection->waitRetry(delay);
+    pendingAt(slot) = std::move(connection);
+}
+
+void themis::PostgresqlConnectionPool::connected(size_t slot) {
+    auto& connection = pendingAt(slot);
+    PGconn* conn = connection->conn;
+    connection->conn = nullptr;
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - connection->begin);
+    try {
+        if(slot == LISTEN_SLOT) listener = std::make_unique<ListenConnection>(conn, driverBase, *this);
+        else basePool[slot] = std::make_unique<ConnectionDetail>(conn, driverBase, slot, connection->config, *this);
+    } catch(const std::exception& e) {
+        LOG(WARNING) << e.what();
+        PQfinish(conn);
+        scheduleReconnect(slot, connection->config, connection->attempt + 1);
+        return;
+    }
+    LOG(INFO) << "succeded to connect in " << elapsed.count() << " ms";
+    connection = nullptr;
+    if(slot == LISTEN_SLOT) {
+        listener->syncChannels();
+        return;
+    }
+    drainWaiting();
+}
+
+size_t themis::PostgresqlConnectionPool::countConnections(size_t configIndex, bool withPending) const {
+    size_t count = 0;
+    for (size_t i = 0; i < basePool.size(); i++)
+    {
+        auto& detail = basePool[i];
+        if(detail.get() && !detail->broken && detail->config == configIndex) count++;
+        // a broken connection is counted by its replacement
+        else if(withPending && pending[i].get() && pending[i]->config == configIndex) count++;
+    }
+    return count;
+}
+
+void themis::PostgresqlConnectionPool::growFor(size_t configIndex) {
+    if(countConnections(configIndex, true) >= configs[configIndex].getMaxConnections()) return;
+    growRequested[configIndex] = true;
+    // the driver loop may be walking the slots, add one after it
+    event_active(growEvent, EV_TIMEOUT, 1);
+}
+
+void themis::PostgresqlConnectionPool::grow() {
+    for (size_t c = 0; c < configs.size(); c++)
+    {
+        if(!growRequested[c]) continue;
+        growRequested[c] = false;
+        // one at a time, the wait is measured again once it is up
+        bool opening = false;
+        for (auto& p: pending) {
+            if(p.get() && p->config == c && p->conn) opening = true;
+        }
+        size_t count = countConnections(c, true);
+        if(opening || count >= configs[c].getMaxConnections()) continue;
+
+        size_t slot = 0;
+        while(slot < basePool.size() && (basePool[slot].get() || pending[slot].get())) slot++;
+        if(slot == basePool.size()) {
+            basePool.emplace_back(nullptr);
+            pending.emplace_back(nullptr);
+        }
+        LOG(INFO) << "queries queue up for " << configs[c].toString() << ", opening connection " << count + 1;
+        connect(slot, c, 0);
+    }
+}
+
+void themis::PostgresqlConnectionPool::reapIdle() {
+    dropCancelledWaiting();
+    auto now = std::chrono::steady_clock::now();
+    for (auto& detail: basePool) {
+        if(!detail.get() || detail->broken || detail->outstanding() || !detail->commands.empty() || detail->pinned) continue;
+        auto& config = configs[detail->config];
+        if(now - detail->lastActive < std::chrono::seconds(config.getIdleTimeout())) continue;
+        if(countConnections(detail->config, false) <= std::max<size_t>(config.getMinConnections(), 1)) continue;
+        LOG(INFO) << "closing idle connection to " << config.toString();
+        detail = nullptr;
+    }
+}
+
+bool themis::PostgresqlConnectionPool::isConnecting() const {
+    for (auto& p: pending) {
+        if(p.get() && p->conn) return true;
+    }
+    return false;
+}
+
+size_t themis::PostgresqlConnectionPool::getConnectionCount() const {
+    size_t count = 0;
+    for (auto& detail: basePool) {
+        if(detail.get() && !detail->broken) count++;
+    }
+    return count;
+}
+
+themis::PostgresqlConnectionPool::~PostgresqlConnectionPool() {
+    if(reapEvent) event_free(reapEvent);
+    if(growEvent) event_free(growEvent);
 }
 
 void themis::PostgresqlConnectionPool::initialize() {
+    growRequested.assign(configs.size(), false);
+    reapEvent = event_new(driverBase, -1, EV_PERSIST, [](evutil_socket_t fd, short what, void* arg) {
+        reinterpret_cast<PostgresqlConnectionPool *>(arg)->reapIdle();
+    }, this);
+    timeval second {1, 0};
+    event_add(reapEvent, &second);
+    growEvent = event_new(driverBase, -1, 0, [](evutil_socket_t fd, short what, void* arg) {
+        PostgresqlDriver::get()->busy = true;
+        reinterpret_cast<PostgresqlConnectionPool *>(arg)->grow();
+    }, this);
+
+    // the min connections of every config are opened at once, at least one each
     for (size_t i = 0; i < configs.size(); i++)
     {
-        basePool.emplace_back(nullptr);
-        buildConnection(i);   
+        for (size_t j = 0; j < std::max<size_t>(configs[i].getMinConnections(), 1); j++)
+        {
+            basePool.emplace_back(nullptr);
+            pending.emplace_back(nullptr);
+            connect(basePool.size() - 1, i, 0);
+        }
     }
 }
 
 void themis::PostgresqlConnectionPool::submit
-(QueryFunction func, QueryCallbackFunction cb, QueryErrorCallbackFunction fail) {
+(QueryFunction func, QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token) {
+    submitTask(ConnectionDetail::QueryTask(func, cb, fail, std::move(token)));
+}
 
-    std::vector<size_t> suitable;
-    for (size_t i = 0; i < basePool.size(); i++)
-    {
-        if(basePool[i].get()) suitable.push_back(i);
+void themis::PostgresqlConnectionPool::submit
+(std::shared_ptr<const Statement> statement, QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token) {
+    submitTask(ConnectionDetail::QueryTask(std::move(statement), cb, fail, std::move(token)));
+}
+
+void themis::PostgresqlConnectionPool::submit
+(std::shared_ptr<const Statement> statement, std::shared_ptr<RowStream> stream, 
+QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token) {
+    ConnectionDetail::QueryTask task(std::move(statement), cb, fail, std::move(token));
+    task.stream = std::move(stream);
+    submitTask(std::move(task));
+}
+
+void themis::PostgresqlConnectionPool::submitPinned
+(std::shared_ptr<PinnedTransaction> transaction, std::shared_ptr<const Statement> statement, 
+QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token) {
+    if(transaction->lost) {
+        fail(std::make_unique<std::runtime_error>("the connection of the transaction went down, it was rolled back"));
+        return;
+    }
+    if(transaction->ended) {
+        fail(std::make_unique<std::runtime_error>("the transaction already ended"));
+        return;
     }
-    
+    if(!transaction->begun) {
+        transaction->begun = true;
+        // never dropped, the statements after it must not run outside of the transaction
+        ConnectionDetail::QueryTask begin(beginStatement, [](std::unique_ptr<PGResultSets>) {}, 
+        [transaction](std::unique_ptr<std::exception> e) {
+            transaction->failed = true;
+        }, CancellationToken());
+        begin.transaction = transaction;
+        submitTask(std::move(begin));
+    }
+    ConnectionDetail::QueryTask task(std::move(statement), cb, fail, std::move(token));
+    task.transaction = std::move(transaction);
+    submitTask(std::move(task));
+}
+
+void themis::PostgresqlConnectionPool::endPinned
+(std::shared_ptr<PinnedTransaction> transaction, ConnectionDetail::QueryTask::Ending ending, 
+QueryCallbackFunction cb, QueryErrorCallbackFunction fail) {
+    if(transaction->lost) {
+        fail(std::make_unique<std::runtime_error>("the connection of the transaction went down, it was rolled back"));
+        return;
+    }
+    if(transaction->ended) {
+        fail(std::make_unique<std::runtime_error>("the transaction already ended"));
+        return;
+    }
+    transaction->ended = true;
+    if(!transaction->begun) {
+        // nothing ran, there is nothing to end
+        cb(std::make_unique<PGResultSets>());
+        return;
+    }
+    // never dropped either, the connection is released right after it
+    ConnectionDetail::QueryTask task(ending == ConnectionDetail::QueryTask::Ending::COMMIT ? commitStatement : rollbackStatement, 
+        cb, fail, CancellationToken());
+    task.transaction = std::move(transaction);
+    task.ending = ending;
+    submitTask(std::move(task));
+}
+
+void themis::PostgresqlConnectionPool::copyIn
+(std::string sql, std::shared_ptr<CopySource> source, QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token) {
+    ConnectionDetail::QueryTask task([sql = std::move(sql)](PGconn* conn) {
+        PQsendQuery(conn, sql.c_str());
+    }, cb, fail, std::move(token));
+    task.copySource = std::move(source);
+    submitTask(std::move(task));
+}
+
+void themis::PostgresqlConnectionPool::copyOut
+(std::string sql, std::shared_ptr<CopyOutStream> sink, QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token) {
+    ConnectionDetail::QueryTask task([sql = std::move(sql)](PGconn* conn) {
+        PQsendQuery(conn, sql.c_str());
+    }, cb, fail, std::move(token));
+    task.copySink = std::move(sink);
+    submitTask(std::move(task));
+}
+
+void themis::PostgresqlConnectionPool::submitTask(ConnectionDetail::QueryTask task) {
+    if(route(task)) return;
+
     // if there are no suitable connection, fail immediately
-    if(suitable.empty()) {
-        fail(std::make_unique<std::runtime_error>("all connection in the required pool is down"));
+    if(!getConnectionCount()) {
+        task.onErr(std::make_unique<std::runtime_error>("all connection in the required pool is down"));
         return;
     }
+    // every connection runs a transaction, the task waits for one to end or to be opened
+    waiting.push_back(std::move(task));
+    for (size_t c = 0; c < configs.size(); c++) {
+        growFor(c);
+    }
+}
+
+bool themis::PostgresqlConnectionPool::route(ConnectionDetail::QueryTask& task) {
+    std::shared_ptr<PinnedTransaction> transaction = task.transaction;
+    ConnectionDetail* chosen = transaction ? transaction->connection : nullptr;
+    if(!chosen) {
+        // the least loaded connection, ties go round robin
+        size_t start = basePool.empty() ? 0 : (indexGen++) % basePool.size();
+        for (size_t i = 0; i < basePool.size(); i++)
+        {
+            auto& detail = basePool[(start + i) % basePool.size()];
+            if(!detail.get() || detail->broken || detail->pinned) continue;
+            if(!chosen || detail->outstanding() < chosen->outstanding()) chosen = detail.get();
+        }
+        if(!chosen) return false;
+        if(transaction) {
+            // the tasks queued before run ahead of the BEGIN, the ones after go elsewhere
+            transaction->connection = chosen;
+            chosen->pinned = transaction;
+        }
+    }
+    bool ends = task.ending != ConnectionDetail::QueryTask::Ending::NONE;
+    chosen->submitQuery(std::move(task));
+    if(transaction && ends) {
+        // what is queued after the end runs outside of the transaction
+        transaction->connection = nullptr;
+        chosen->pinned = nullptr;
+        drainWaiting();
+    }
+    return true;
+}
+
+void themis::PostgresqlConnectionPool::drainWaiting() {
+    // routing an end releases a connection, which drains again
+    if(draining) return;
+    draining = true;
+    bool routed = true;
+    while(routed && !waiting.empty()) {
+        routed = false;
+        // one round in order, the ones still waiting go back in the same order
+        for (size_t i = 0, n = waiting.size(); i < n; i++) {
+            ConnectionDetail::QueryTask task = std::move(waiting.front());
+            waiting.pop_front();
+            if(route(task)) routed = true;
+            else waiting.push_back(std::move(task));
+        }
+    }
+    draining = false;
+    if(waiting.empty() || getConnectionCount()) return;
+    for (auto& p: pending) {
+        if(p.get()) return;
+    }
+    // no connection left and none coming
+    while(!waiting.empty()) {
+        ConnectionDetail::QueryTask task = std::move(waiting.front());
+        waiting.pop_front();
+        task.onErr(std::make_unique<std::runtime_error>("all connection in the required pool is down"));
+    }
+}
+
+void themis::PostgresqlConnectionPool::dropCancelledWaiting() {
+    std::vector<ConnectionDetail::QueryTask> dropped;
+    for (auto it = waiting.begin(); it != waiting.end();) {
+        if(!it->token.isCancelled()) {
+            ++it;
+            continue;
+        }
+        dropped.push_back(std::move(*it));
+        it = waiting.erase(it);
+    }
+    // failed once the queue is consistent, the callbacks may submit again
+    for (auto& task: dropped) {
+        // the rest of its transaction still runs, and rolls back
+        if(task.transaction) task.transaction->failed = true;
+        task.onErr(std::make_unique<CancelledException>("the query was cancelled before it was sent"));
+    }
+}
 
-    size_t idx = (++indexGen) % suitable.size();
-    basePool[idx]->submitQuery(func, cb, fail);
+void themis::PostgresqlConnectionPool::subscribe(std::shared_ptr<Subscription::State> subscription) {
+    subscriptions[subscription->channel].push_back(std::move(subscription));
+    if(listener) listener->syncChannels();
+    // the first callback opens the connection, it listens once it is up
+    else if(!listenPending) connect(LISTEN_SLOT, 0, 0);
+}
+
+void themis::PostgresqlConnectionPool::unsubscribe(const std::shared_ptr<Subscription::State>& subscription) {
+    auto it = subscriptions.find(subscription->channel);
+    if(it == subscriptions.end()) return;
+    auto& callbacks = it->second;
+    callbacks.erase(std::remove(callbacks.begin(), callbacks.end(), subscription), callbacks.end());
+    if(callbacks.empty()) subscriptions.erase(it);
+    if(listener) listener->syncChannels();
+}
+
+void themis::PostgresqlConnectionPool::dispatchNotification(const PGnotify* notify) {
+    auto it = subscriptions.find(notify->relname);
+    if(it == subscriptions.end()) return;
+    auto notification = std::make_shared<const Notification>(Notification {
+        notify->relname, notify->extra ? notify->extra : "", notify->be_pid});
+    for (auto& subscription: it->second) {
+        if(subscription->cancelled) continue;
+        if(!subscription->queue) {
+            // on the driver thread, the callback only hands it over
+            try {
+                subscription->callback(*notification);
+            } catch(const std::exception& e) {
+                LOG(WARNING) << "notification callback of " << notification->channel << " threw : " << e.what();
+            }
+            continue;
+        }
+        subscription->queue->addImmediate([subscription, notification]() {
+            // cancelled while it was queued
+            if(subscription->cancelled) return;
+            subscription->callback(*notification);
+        });
+    }
 }
@@ -2,13 +2,24 @@
 #define PostgresqlConnectionPool_h 1
 
 #include "sql/Driver.h"
+#include "sql/driver/Statement.h"
+#include "sql/driver/Notification.h"
+#include "StatementCache.h"
+#include "utils/Cancellation.h"
+#include "utils/EventQueue.h"
 #include <event2/event.h>
 #include <libpq-fe.h>
 #include <vector>
+#include <algorithm>
+#include <deque>
 #include <queue>
+#include <map>
+#include <set>
 #include <ng-log/logging.h>
 #include <stdexcept>
 #include <functional>
+#include <chrono>
+#include <random>
 
 namespace themis
 {
@@ -26,12 +37,21 @@ namespace themis
         PGresult* at(size_t index) {
             return sets[index];
         }
+        size_t size() const {
+            return sets.size();
+        }
     };
 
     class PostgresqlDriver;
+    class RowStream;
+    class CopySource;
+    class CopyOutStream;
+    class Transaction;
 
     class PostgresqlConnectionPool : public ConnectionPool {
         friend PostgresqlDriver;
+        friend Transaction;
+        friend Subscription;
 
     public:
         /// @brief use this function to submit query
@@ -43,91 +63,612 @@ namespace themis
         using QueryErrorCallbackFunction = std::function<void (std::unique_ptr<std::exception>)>;
         
     private:
+
+        struct ConnectionDetail;
+
+        /**
+         * @brief the pool side of a Transaction, shared by the handle and the tasks of the
+         * transaction. only touched by the driver thread
+         * 
+         */
+        struct PinnedTransaction {
+            /// @brief the connection it runs on, set once its first statement is routed and
+            /// reset once its end is queued. no other task goes to the connection meanwhile
+            ConnectionDetail* connection = nullptr;
+            /// @brief the BEGIN is queued
+            bool begun = false;
+            /// @brief the COMMIT or ROLLBACK is queued, it takes no more statements
+            bool ended = false;
+            /// @brief a statement was dropped before it was sent, the COMMIT is sent as ROLLBACK
+            bool failed = false;
+            /// @brief the connection went down while pinned, the server rolled it back
+            bool lost = false;
+        };
     
         struct ConnectionDetail {
             PGconn *conn;
             event *readEvent; 
             event *writeEvent;
-            event *reconnectEvent;
             PostgresqlConnectionPool& parentPool;
             /// @brief position in parent connection pool
             size_t pos; 
-
-            size_t retryCount = 0;
+            /// @brief index of the config it was opened with
+            size_t config;
+            /// @brief when the last task was submitted to it, or it was opened
+            std::chrono::steady_clock::time_point lastActive;
+            /// @brief the connection failed and waits to be replaced, it takes no more query
+            bool broken = false;
             /// @brief the sets to temporarily holds the result from query
             std::unique_ptr<PGResultSets> pendingResult;
 
             struct QueryTask {
                 QueryFunction query;
+                /// @brief set instead of query for a statement executed prepared
+                std::shared_ptr<const Statement> statement;
                 QueryCallbackFunction cb;
                 QueryErrorCallbackFunction onErr;
+                /// @brief a cancelled task is dropped before it is sent
+                CancellationToken token;
+                /// @brief when it was submitted, to measure how long it queued
+                std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+                /// @brief set for a statement whose rows are streamed, it is never pipelined
+                std::shared_ptr<RowStream> stream;
+                /// @brief set for a COPY FROM STDIN, the data sent to the server
+                std::shared_ptr<CopySource> copySource;
+                /// @brief set for a COPY TO STDOUT, the data goes there in chunks
+                std::shared_ptr<CopyOutStream> copySink;
+                /// @brief set for a statement of a transaction, it runs on the pinned connection
+                std::shared_ptr<PinnedTransaction> transaction;
+                /// @brief how the task ends its transaction, the connection is released once it is queued
+                enum class Ending {
+                    NONE,
+                    COMMIT,
+                    ROLLBACK
+                } ending = Ending::NONE;
 
-                QueryTask(QueryFunction query, QueryCallbackFunction cb, QueryErrorCallbackFunction onErr)
-                : query(query), cb(cb), onErr(onErr) {}
+                QueryTask(QueryFunction query, QueryCallbackFunction cb, QueryErrorCallbackFunction onErr, CancellationToken token)
+                : query(query), cb(cb), onErr(onErr), token(std::move(token)) {}
+                QueryTask(std::shared_ptr<const Statement> statement, QueryCallbackFunction cb, QueryErrorCallbackFunction onErr, CancellationToken token)
+                : statement(std::move(statement)), cb(cb), onErr(onErr), token(std::move(token)) {}
                 QueryTask(const QueryTask& t) 
-                : query(t.query), cb(t.cb), onErr(t.onErr) {}
+                : query(t.query), statement(t.statement), cb(t.cb), onErr(t.onErr), token(t.token), submitted(t.submitted), 
+                stream(t.stream), copySource(t.copySource), copySink(t.copySink), 
+                transaction(t.transaction), ending(t.ending) {}
+            };
+
+            /// @brief what the command on the wire does for the task at the front
+            enum class Step {
+                /// @brief run the task, its results go to the user
+                EXECUTE,
+                /// @brief prepare the statement of the task before executing it
+                PREPARE,
+                /// @brief deallocate statements evicted from the cache, no task involved
+                DEALLOCATE
+            };
+
+            /**
+             * @brief the cancel request of the query on the wire, shared with the callback
+             * subscribed to the token of the query
+             * 
+             */
+            struct CancelState {
+                PGcancel* cancel;
+                /// @brief the query finished, cancelling now would hit the next one
+                bool finished = false;
+
+                CancelState(PGcancel* cancel) : cancel(cancel) {}
+                ~CancelState() {
+                    if(cancel) PQfreeCancel(cancel);
+                }
             };
 
             /// @brief queries yet to be submit to database
             std::queue<QueryTask> queries;
+            /// @brief cancel state of the query at the front, if it is sent and cancellable
+            std::shared_ptr<CancelState> activeCancel;
+            size_t cancelSubscription = 0;
+            /// @brief statements prepared on this connection, by sql and param types
+            StatementCache statementCache;
+            /// @brief the params of the statement being sent. out of pipeline mode they are
+            /// kept until the statement completes, it may have to be executed after preparing
+            Statement::ParamBuffers params;
+            Step step = Step::EXECUTE;
+            /// @brief the name the statement at the front is prepared or executed with
+            std::string statementName;
+            /// @brief the rows of the streamed statement at the front read since the last batch
+            std::unique_ptr<PGResultSets> streamBatch;
+            size_t streamBatchRows = 0;
+            /// @brief reading stopped because the stream at the front is blocked, polled by the driver loop
+            bool streamPaused = false;
+            /// @brief the direction of the COPY the command at the front is in, if any
+            enum class Copy {
+                NONE,
+                IN,
+                OUT
+            } copying = Copy::NONE;
+            /// @brief copy in, the data libpq did not take yet. copy out, the data read since the last chunk
+            std::string copyChunk;
+            /// @brief the source is done, the end of the copy is still to be sent
+            bool copyEnding = false;
+            /// @brief the reason the copy in is aborted with, empty if it completes
+            std::string copyEndError;
+            /// @brief a command was sent and its results are not all read
+            bool commandActive = false;
+            /// @brief the first error of the command on the wire and its sqlstate
+            std::string error;
+            std::string sqlState;
+
+            /// @brief a task sent in pipeline mode, completed when the sync after it is back
+            struct PipelinedTask {
+                QueryTask task;
+                std::unique_ptr<PGResultSets> results;
+                /// @brief the message of the first error of the task, empty while it succeeds
+                std::string error;
+
+                PipelinedTask(const QueryTask& task)
+                : task(task), results(std::make_unique<PGResultSets>()) {}
+            };
+
+            /// @brief a command sent in pipeline mode, results come back in the same order
+            struct Command {
+                enum Kind {
+                    PREPARE,
+                    EXECUTE,
+                    DEALLOCATE,
+                    SYNC
+                } kind;
+                /// @brief the task a prepare or execute belongs to
+                PipelinedTask* task = nullptr;
+                /// @brief the cache key of the statement, dropped if the server does not have it
+                std::string key;
+                std::string name;
+                /// @brief for a sync, the number of tasks in the batch it ends
+                size_t tasks = 0;
+
+                Command(Kind kind, PipelinedTask* task = nullptr, std::string key = "", std::string name = "", size_t tasks = 0)
+                : kind(kind), task(task), key(std::move(key)), name(std::move(name)), tasks(tasks) {}
+            };
+
+            /// @brief the transaction the connection is pinned to, if any
+            std::shared_ptr<PinnedTransaction> pinned;
+
+            /// @brief 1 when pipelining is off
+            size_t pipelineDepth;
+            PipelineIsolation isolation;
+            /// @brief tasks sent in pipeline mode, oldest first, they stay put until completed
+            std::deque<PipelinedTask> pipelined;
+            std::deque<Command> commands;
 
             ~ConnectionDetail() {
 
-                LOG(INFO) << "connection with detail " << parentPool.configs[pos].toString() << " is closing"; 
-                // fail all queries 
-                while(!queries.empty()) {
-                    QueryTask task = queries.front();
-                    queries.pop();
-                    task.onErr(std::make_unique<std::runtime_error>
-                        ("the query is submitted to the pool, but the connection associated with it is down"));
-                }
+                LOG(INFO) << "connection with detail " << parentPool.configs[config].toString() << " is closing"; 
+                failAll();
 
                 if(readEvent) event_free(readEvent);
                 if(writeEvent) event_free(writeEvent);
-                if(reconnectEvent) event_free(reconnectEvent);
                 if(conn) PQfinish(conn);
             }
-            ConnectionDetail(PGconn* conn, event_base* base, size_t pos, PostgresqlConnectionPool& parentPool);
+            ConnectionDetail(PGconn* conn, event_base* base, size_t pos, size_t config, PostgresqlConnectionPool& parentPool);
             ConnectionDetail(const ConnectionDetail& d) = delete;
             void operator=(const ConnectionDetail& d) = delete;
 
-            void submitQuery(QueryFunction func, QueryCallbackFunction cb, QueryErrorCallbackFunction fail);
+            void submitQuery(QueryTask task);
+            /// @brief tasks queued or sent and not completed yet
+            size_t outstanding() const {
+                return queries.size() + pipelined.size();
+            }
+            /// @brief tell the pool how long the task about to be sent waited
+            void reportWait(const QueryTask& task);
+            /// @brief the connection can take the query at the front
+            bool readyToSend();
+            /// @brief the tasks in flight the task may join, a transaction is pipelined even
+            /// when the config is not, so that its BEGIN and COMMIT cost no round trip
+            size_t depthFor(const QueryTask& task) const {
+                return task.transaction ? std::max(pipelineDepth, TRANSACTION_PIPELINE_DEPTH) : pipelineDepth;
+            }
+            /// @brief the task at the front was cancelled before it was sent, fail it
+            void dropCancelled();
+            /**
+             * @brief send the query at the front, after dropping the cancelled ones.
+             * if the query has a token, cancelling it sends a cancel request to the server.
+             * with a pipeline depth above one, statements are sent back to back in pipeline
+             * mode, query functions may send anything so they still run one at a time
+             * 
+             * @param queue the driver queue the cancel request is made on
+             */
+            void sendNextQuery(EventQueue* queue);
+            /**
+             * @brief send statements until the pipeline is full, a sync ends every batch.
+             * once sent, a statement is no longer cancelled on the server because the
+             * cancel request would hit whatever statement of the pipeline is running
+             * 
+             */
+            void sendPipelined();
+            /**
+             * @brief end the batch of the last tasks sent
+             * 
+             * @param tasks the number of tasks in the batch
+             * @return bool false if the connection is broken
+             */
+            bool sendSync(size_t tasks);
+            void handlePipelineResponse();
+            /// @brief hand the results of the first tasks to the user, the batch failed if one did
+            void completeBatch(size_t tasks);
+            /// @brief the query at the front completed, it can no longer be cancelled
+            void finishActiveQuery();
+            /**
+             * @brief execute a prepared statement with the params in the buffers
+             * 
+             * @param statement the statement the params were filled from
+             * @param name the name of the statement
+             * @param singleRow have the rows returned one result each, for a stream
+             * @return bool false if libpq refused to send it
+             */
+            bool sendPrepared(const Statement& statement, const std::string& name, bool singleRow = false);
+            /**
+             * @brief add a row of the streamed statement at the front to the batch, hand the
+             * batch over once full or once the statement completed
+             * 
+             * @param row the single row result, nullptr to hand over what was read
+             */
+            void streamRow(PGresult* row);
+            /// @brief the stream or the copy sink at the front can not take more data for now
+            bool frontBlocked() const;
+            /// @brief read on if the stream at the front is no longer blocked
+            void pollStream();
+            /**
+             * @brief send the data of the copy source at the front until the socket is
+             * full or the source waits, then the end of the copy once the source is done
+             * 
+             * @return bool true once the end was sent, the command completes as any other
+             */
+            bool pumpCopyIn();
+            /// @brief pump the copy in at the front, called by the driver loop as it runs
+            void pollCopy();
+            /**
+             * @brief read the data of the copy out at the front, stops while the sink is blocked
+             * 
+             * @return bool true once all data was read, the command completes as any other
+             */
+            bool readCopyOut();
+            /// @brief hand the data read to the sink of the copy at the front
+            void flushCopyOut();
+            /// @brief forget the copy on the wire, the connection is done with it
+            void resetCopy();
+            /// @brief remove the task at the front and fail it
+            void failFront(std::unique_ptr<std::exception> e);
             void handleConnectionResponse();
+            /// @brief fail the queries sent and queued, the connection is down
+            void failAll();
+            /**
+             * @brief the connection is broken, fail its queries and have the pool open
+             * a new one. this connection is freed later by the pool, not here
+             * 
+             */
+            void handleConnectionError();
+        };
+
+        /**
+         * @brief a connection being opened without blocking the driver thread, libpq is
+         * polled whenever the socket is ready and the attempt fails after the connect
+         * timeout. before a retry it only waits out the backoff
+         * 
+         */
+        struct PendingConnection {
+            PostgresqlConnectionPool& parentPool;
+            size_t pos;
+            size_t config;
+            /// @brief the failed attempts before this one
+            size_t attempt;
+            /// @brief null while waiting for the backoff
+            PGconn* conn = nullptr;
+            event* ev = nullptr;
+            std::chrono::steady_clock::time_point begin;
+            std::chrono::steady_clock::time_point deadline;
+
+            PendingConnection(PostgresqlConnectionPool& parentPool, size_t pos, size_t config, size_t attempt)
+            : parentPool(parentPool), pos(pos), config(config), attempt(attempt) {}
+            PendingConnection(const PendingConnection&) = delete;
+            ~PendingConnection() {
+                if(ev) event_free(ev);
+                if(conn) PQfinish(conn);
+            }
+
+            /**
+             * @brief start connecting
+             * 
+             * @return bool false if libpq could not even start
+             */
+            bool start();
+            /**
+             * @brief call connect again after the delay
+             * 
+             * @param delay the backoff
+             */
+            void waitRetry(std::chrono::milliseconds delay);
+            /// @brief wait until the socket is ready for what libpq needs next
+            void waitSocket(PostgresPollingStatusType status);
+            void poll(short what);
+        };
+
+        /**
+         * @brief the connection notifications are received on, opened with the first
+         * config once something is listened to. it runs no query, only LISTEN and UNLISTEN
+         * 
+         */
+        struct ListenConnection {
+            PGconn* conn;
+            event* readEvent;
+            event* writeEvent;
+            PostgresqlConnectionPool& parentPool;
+            /// @brief the connection failed and waits to be replaced
+            bool broken = false;
+            /// @brief the channels the server was asked to listen to
+            std::set<std::string> listening;
+            /// @brief a LISTEN or UNLISTEN was sent and its results are not all read
+            bool commandActive = false;
+
+            ListenConnection(PGconn* conn, event_base* base, PostgresqlConnectionPool& parentPool);
+            ListenConnection(const ListenConnection&) = delete;
+            ~ListenConnection() {
+                if(readEvent) event_free(readEvent);
+                if(writeEvent) event_free(writeEvent);
+                if(conn) PQfinish(conn);
+            }
+
+            /// @brief listen to the channels subscribed and unlisten the ones left since the last time
+            void syncChannels();
+            /// @brief read the results of the command sent and hand the notifications over
+            void handleResponse();
+            /**
+             * @brief the connection is broken, have the pool open a new one. the
+             * notifications sent meanwhile are lost, the channels are listened to again
+             * 
+             */
             void handleConnectionError();
         };
 
+        /// @brief the slot of the listen connection, it is not in the base pool
+        static constexpr size_t LISTEN_SLOT = SIZE_MAX;
+
+        /// @brief the connections, a slot holds one or is empty. slots are reused but never
+        /// removed, the driver loop walks them
         std::vector<std::unique_ptr<ConnectionDetail>> basePool;
+        /// @brief the connection being opened or waiting to be retried, by slot
+        std::vector<std::unique_ptr<PendingConnection>> pending;
         event_base* driverBase;
+        std::mt19937 jitter {std::random_device()()};
+        /// @brief closes idle connections, every second
+        event* reapEvent = nullptr;
+        /// @brief opens the connections asked for by growFor, outside the driver loop
+        event* growEvent = nullptr;
+        /// @brief the configs a connection should be added for
+        std::vector<bool> growRequested;
+
+        /**
+         * @brief start opening a connection in the slot using the config at index, 
+         * the connection it replaces is freed
+         * 
+         * @param slot the slot
+         * @param configIndex the index of the config
+         * @param attempt the failed attempts so far
+         */
+        void connect(size_t slot, size_t configIndex, size_t attempt);
+
+        /**
+         * @brief connect again after a backoff doubling with the attempts, the half of
+         * it is random so that the connections of every server do not retry in step.
+         * gives up after the max retry of the config
+         * 
+         * @param slot the slot
+         * @param configIndex the index of the config
+         * @param attempt the failed attempts so far
+         */
+        void scheduleReconnect(size_t slot, size_t configIndex, size_t attempt);
+
+        /// @brief the pending connection of the slot is up
+        void connected(size_t slot);
 
         /**
-         * @brief try to build the connection using the config at index
+         * @brief count the connections of a config
          * 
          * @param configIndex the index of the config
+         * @param withPending count the ones being opened or waiting to retry as well
+         * @return size_t live connections, plus pending ones if asked
          */
-        void buildConnection(size_t configIndex);
+        size_t countConnections(size_t configIndex, bool withPending) const;
 
-        size_t indexGen;
+        /**
+         * @brief a task of the config queued too long, open one more connection for
+         * it unless one is already on its way or the config is at its max
+         * 
+         * @param configIndex the index of the config
+         */
+        void growFor(size_t configIndex);
+        void grow();
+
+        /// @brief close the connections idle for longer than their config allows, down to the min,
+        /// and fail the waiting tasks cancelled meanwhile
+        void reapIdle();
+
+        /// @brief breaks ties between connections equally loaded
+        size_t indexGen = 0;
+
+        /// @brief tasks waiting for a connection while every live one is pinned by a transaction
+        std::deque<ConnectionDetail::QueryTask> waiting;
+        bool draining = false;
+
+        std::unique_ptr<ListenConnection> listener;
+        std::unique_ptr<PendingConnection> listenPending;
+        /// @brief the callbacks of every channel listened to, a channel without any is unlistened
+        std::map<std::string, std::vector<std::shared_ptr<Subscription::State>>> subscriptions;
+
+        /// @brief the pending connection of a slot, or of the listen connection
+        std::unique_ptr<PendingConnection>& pendingAt(size_t slot) {
+            return slot == LISTEN_SLOT ? listenPending : pending[slot];
+        }
+
+        /**
+         * @brief add the callback, the listen connection is opened with the first one
+         * 
+         * @param subscription the callback and its channel
+         */
+        void subscribe(std::shared_ptr<Subscription::State> subscription);
+        void unsubscribe(const std::shared_ptr<Subscription::State>& subscription);
+        /// @brief hand the notification to the callbacks of its channel
+        void dispatchNotification(const PGnotify* notify);
+
+        /// @brief the statements ending transactions, prepared once per connection as any other
+        std::shared_ptr<const Statement> beginStatement = std::make_shared<const Statement>("BEGIN");
+        std::shared_ptr<const Statement> commitStatement = std::make_shared<const Statement>("COMMIT");
+        std::shared_ptr<const Statement> rollbackStatement = std::make_shared<const Statement>("ROLLBACK");
+
+        StatementCacheStats statementStats;
+
+        /**
+         * @brief give the task to the live connection with the fewest tasks outstanding
+         * 
+         * @param task the task, failed at once if every connection is down
+         */
+        void submitTask(ConnectionDetail::QueryTask task);
+
+        /**
+         * @brief queue the task on a connection. a task of a transaction goes to the
+         * connection pinned by it, or pins the least loaded one that is not pinned
+         * 
+         * @param task the task
+         * @return bool false if every live connection is pinned
+         */
+        bool route(ConnectionDetail::QueryTask& task);
+
+        /// @brief route the waiting tasks a connection is free for now, fail them if every connection is down
+        void drainWaiting();
+
+        /// @brief fail the waiting tasks whose token was cancelled, at the max connections
+        /// they would wait for a transaction to end otherwise
+        void dropCancelledWaiting();
+
+        /**
+         * @brief queue a statement of the transaction, after its BEGIN if it is the first
+         * 
+         * @param transaction the transaction
+         * @param statement the statement
+         * @param cb callback after the statement finished
+         * @param fail callback after the statement failed
+         * @param token dropping the statement before it is sent makes the transaction roll back
+         */
+        void submitPinned(std::shared_ptr<PinnedTransaction> transaction, std::shared_ptr<const Statement> statement,
+            QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token);
+
+        /**
+         * @brief queue the COMMIT or ROLLBACK of the transaction, the connection takes
+         * other tasks right after it
+         * 
+         * @param transaction the transaction, begun and not ended
+         * @param ending how it ends
+         * @param cb callback after the transaction ended, a COMMIT that rolled back
+         * succeeds with a ROLLBACK status
+         * @param fail callback if the end failed
+         */
+        void endPinned(std::shared_ptr<PinnedTransaction> transaction, ConnectionDetail::QueryTask::Ending ending,
+            QueryCallbackFunction cb, QueryErrorCallbackFunction fail);
 
     public:
 
+        PostgresqlConnectionPool() = default;
+        PostgresqlConnectionPool(const PostgresqlConnectionPool&) = delete;
+        ~PostgresqlConnectionPool();
+
         void setEventbase(event_base* base) {
             driverBase = base;
         }
 
+        /// @brief the pipeline depth of a transaction on a connection without pipelining
+        static constexpr size_t TRANSACTION_PIPELINE_DEPTH = 16;
+
+        /// @brief backoff of the first retry, and the most it grows to
+        static constexpr std::chrono::milliseconds RECONNECT_DELAY {500};
+        static constexpr std::chrono::milliseconds MAX_RECONNECT_DELAY {30000};
+
         /**
-         * @brief call this after configuring
+         * @brief call this after configuring, starts opening the min connections of every
+         * config at once. the connections are up once the driver loop polled them
          * 
          */
         virtual void initialize() override;
 
+        /// @brief a connection is being opened, not counting the ones waiting to retry
+        bool isConnecting() const;
+
         /**
          * @brief submit the query task to this pool
          * 
          * @param func user query function
          * @param cb callback after query finished
          * @param fail callback after query failed
+         * @param token the query is dropped if cancelled before it is sent, and cancelled
+         * on the server if it is running
+         */
+        void submit(QueryFunction func, QueryCallbackFunction cb, QueryErrorCallbackFunction fail, 
+            CancellationToken token = CancellationToken());
+
+        /**
+         * @brief submit a statement to this pool, it is prepared on the connection
+         * it runs on unless it already was
+         * 
+         * @param statement the statement
+         * @param cb callback after query finished
+         * @param fail callback after query failed
+         * @param token see above
+         */
+        void submit(std::shared_ptr<const Statement> statement, QueryCallbackFunction cb, QueryErrorCallbackFunction fail, 
+            CancellationToken token = CancellationToken());
+
+        /**
+         * @brief submit a statement whose rows go to the stream in batches, the callback
+         * gets the last result of the statement, without rows
+         * 
+         * @param statement the statement
+         * @param stream the stream taking the rows
+         * @param cb callback after query finished
+         * @param fail callback after query failed, the batches read before are delivered
+         * @param token see above, batches read after it is cancelled are dropped
+         */
+        void submit(std::shared_ptr<const Statement> statement, std::shared_ptr<RowStream> stream, 
+            QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token = CancellationToken());
+
+        /**
+         * @brief submit a COPY ... FROM STDIN, the data is read from the source while the
+         * connection takes it. it is sent as a simple query and never pipelined
+         * 
+         * @param sql the copy statement, no params
+         * @param source the data, in the format the statement names
+         * @param cb callback after the copy finished, the result tells the rows copied
+         * @param fail callback after the copy failed, the server discards what it got
+         * @param token see above, cancelling it aborts the copy
          */
-        void submit(QueryFunction func, QueryCallbackFunction cb, QueryErrorCallbackFunction fail);
+        void copyIn(std::string sql, std::shared_ptr<CopySource> source, 
+            QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token = CancellationToken());
+
+        /**
+         * @brief submit a COPY ... TO STDOUT, the data goes to the sink in chunks
+         * 
+         * @param sql the copy statement, no params
+         * @param sink the stream taking the data
+         * @param cb callback after the copy finished
+         * @param fail callback after the copy failed, the chunks read before are delivered
+         * @param token see above, chunks read after it is cancelled are dropped
+         */
+        void copyOut(std::string sql, std::shared_ptr<CopyOutStream> sink, 
+            QueryCallbackFunction cb, QueryErrorCallbackFunction fail, CancellationToken token = CancellationToken());
+
+        /// @brief the connections open, not counting the ones being opened
+        size_t getConnectionCount() const;
+
+        /// @brief the hits and misses of the statement caches of all connections
+        const StatementCacheStats& getStatementCacheStats() const {
+            return statementStats;
+        }
     };
 
 } // namespace themis
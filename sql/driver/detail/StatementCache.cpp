@@ -0,0 +1,53 @@
+#include "StatementCache.h"
+
+themis::StatementCache::StatementCache(size_t capacity, StatementCacheStats* stats)
+: capacity(capacity ? capacity : 1), stats(stats) {}
+
+const std::string* themis::StatementCache::find(const std::string& sql) {
+    auto it = index.find(sql);
+    if(it == index.end()) {
+        if(stats) stats->misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if(stats) stats->hits.fetch_add(1, std::memory_order_relaxed);
+    // move to the front, the iterators stay valid
+    entries.splice(entries.begin(), entries, it->second);
+    return &it->second->second;
+}
+
+std::string themis::StatementCache::allocateName() {
+    return "themis_s" + std::to_string(nextId++);
+}
+
+void themis::StatementCache::insert(const std::string& sql, std::string name) {
+    auto it = index.find(sql);
+    if(it != index.end()) {
+        // prepared twice, keep the newer one and drop the older
+        evicted.push_back(std::move(it->second->second));
+        it->second->second = std::move(name);
+        entries.splice(entries.begin(), entries, it->second);
+        return;
+    }
+    if(entries.size() >= capacity) {
+        auto& last = entries.back();
+        evicted.push_back(std::move(last.second));
+        index.erase(last.first);
+        entries.pop_back();
+        if(stats) stats->evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    entries.emplace_front(sql, std::move(name));
+    index.emplace(sql, entries.begin());
+}
+
+void themis::StatementCache::erase(const std::string& sql, const std::string& name) {
+    auto it = index.find(sql);
+    if(it == index.end() || it->second->second != name) return;
+    entries.erase(it->second);
+    index.erase(it);
+}
+
+std::vector<std::string> themis::StatementCache::takeEvicted() {
+    std::vector<std::string> names;
+    names.swap(evicted);
+    return names;
+}
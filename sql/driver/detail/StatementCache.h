@@ -0,0 +1,105 @@
+#ifndef StatementCache_h
+#define StatementCache_h 1
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace themis
+{
+
+    /**
+     * @brief hit rate of the statement caches of a pool, updated by the driver thread
+     * and readable from any thread
+     *
+     */
+    struct StatementCacheStats {
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> misses = 0;
+        std::atomic<uint64_t> evictions = 0;
+
+        double getHitRate() const {
+            uint64_t h = hits.load(std::memory_order_relaxed);
+            uint64_t total = h + misses.load(std::memory_order_relaxed);
+            return total ? double(h) / double(total) : 0.0;
+        }
+    };
+
+    /**
+     * @brief the statements prepared on one connection, by sql text, least recently
+     * used first out. the names of the evicted statements are kept until the driver
+     * deallocates them on the server.
+     * belongs to the connection, so a new connection starts with an empty cache
+     *
+     */
+    class StatementCache {
+    private:
+        /// @brief sql text and statement name, most recently used first
+        std::list<std::pair<std::string, std::string>> entries;
+        std::unordered_map<std::string, decltype(entries)::iterator> index;
+        std::vector<std::string> evicted;
+        size_t capacity;
+        size_t nextId = 0;
+        StatementCacheStats* stats;
+
+    public:
+        /**
+         * @brief create an empty cache
+         *
+         * @param capacity statements kept prepared, at least one
+         * @param stats the stats to count into, may be nullptr
+         */
+        StatementCache(size_t capacity, StatementCacheStats* stats = nullptr);
+
+        /**
+         * @brief look the sql up and count a hit or a miss
+         *
+         * @param sql the sql text
+         * @return const std::string* the name of the prepared statement, nullptr if
+         * the sql has to be prepared first
+         */
+        const std::string* find(const std::string& sql);
+
+        /// @brief a name no statement of this connection uses
+        std::string allocateName();
+
+        /**
+         * @brief remember a statement prepared, or sent to be, the least recently used
+         * one is evicted if the cache is full
+         *
+         * @param sql the sql text
+         * @param name the name it was prepared with
+         */
+        void insert(const std::string& sql, std::string name);
+
+        /**
+         * @brief forget a statement the server does not know, unless the sql was
+         * prepared again under another name since
+         *
+         * @param sql the sql text
+         * @param name the name it was prepared with
+         */
+        void erase(const std::string& sql, const std::string& name);
+
+        bool hasEvicted() const {
+            return !evicted.empty();
+        }
+
+        /**
+         * @brief take the names of the evicted statements, to deallocate them
+         *
+         * @return std::vector<std::string> the names
+         */
+        std::vector<std::string> takeEvicted();
+
+        size_t size() const {
+            return entries.size();
+        }
+    };
+
+} // namespace themis
+
+#endif
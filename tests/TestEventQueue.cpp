@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "utils/EventQueue.h"
+
+TEST(TestEventQueue, TestCallback) {
+    using namespace themis;
+    // move-only functors are accepted, small ones are stored inline
+    auto value = std::make_unique<int>(1);
+    int result = 0;
+    Callback c([v = std::move(value), &result]() {
+        result = *v;
+    });
+    auto small = [p = std::unique_ptr<int>(), q = (int*) nullptr]() {};
+    ASSERT_TRUE(Callback::isInline<decltype(small)>());
+    Callback moved = std::move(c);
+    ASSERT_FALSE(c);
+    moved();
+    ASSERT_EQ(result, 1);
+
+    // large functors fall back to the heap
+    char large[128] = {0};
+    large[127] = 7;
+    Callback big([large, &result]() {
+        result = large[127];
+    });
+    Callback bigMoved = std::move(big);
+    bigMoved();
+    ASSERT_EQ(result, 7);
+    ASSERT_THROW(big(), std::bad_function_call);
+}
+
+static void produceAndDrain(std::unique_ptr<themis::EventQueue>& q, size_t events) {
+    constexpr size_t PRODUCERS = 4;
+    std::vector<size_t> last(PRODUCERS, 0);
+    size_t count = 0;
+    bool ordered = true;
+
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&q, &last, &count, &ordered, p, events]() {
+            for (size_t i = 1; i <= events; i++) {
+                q->addImmediate([&last, &count, &ordered, p, i]() {
+                    // events of one producer must arrive in order
+                    if(last[p] + 1 != i) ordered = false;
+                    last[p] = i;
+                    ++count;
+                });
+            }
+        });
+    }
+    while(count < PRODUCERS * events) {
+        if(!q->poll(64)) std::this_thread::yield();
+    }
+    for (auto& t: producers) t.join();
+    ASSERT_TRUE(ordered);
+    ASSERT_EQ(count, PRODUCERS * events);
+    ASSERT_FALSE(q->poll());
+}
+
+TEST(TestEventQueue, TestUnbounded) {
+    using namespace themis;
+    auto q = std::make_unique<EventQueue>();
+    ASSERT_FALSE(q->poll());
+    produceAndDrain(q, 20000);
+}
+
+TEST(TestEventQueue, TestBounded) {
+    using namespace themis;
+    auto q = std::make_unique<EventQueue>(16);
+    int count = 0;
+    for (int i = 0; i < 16; i++) {
+        q->addImmediate([&count]() { ++count; });
+    }
+    // full, the callback is left to the caller
+    Callback extra([&count]() { count += 100; });
+    ASSERT_FALSE(q->tryAddImmediate(extra));
+    ASSERT_TRUE(extra);
+    // waiting on a full queue from the polling thread would never end
+    q->poll(1);
+    ASSERT_EQ(count, 1);
+    q->addImmediate([&count]() { ++count; });
+    ASSERT_THROW(q->addImmediate([]() {}), std::runtime_error);
+
+    // batches are limited
+    q->poll(10);
+    ASSERT_EQ(count, 11);
+    ASSERT_TRUE(q->tryAddImmediate(extra));
+    q->poll();
+    ASSERT_EQ(count, 117);
+
+    // producers wait for room instead of failing
+    produceAndDrain(q, 2000);
+}
+
+TEST(TestEventQueue, TestTimers) {
+    using namespace themis;
+    using namespace std::chrono_literals;
+    auto q = std::make_unique<EventQueue>();
+    int timeouts = 0, ticks = 0, cancelled = 0;
+
+    TimerHandle timeout = q->addTimeout(20ms, [&timeouts]() { ++timeouts; });
+    TimerHandle never = q->addTimeout(20ms, [&cancelled]() { ++cancelled; });
+    TimerHandle interval;
+    interval = q->addInterval(5ms, [&ticks, &interval]() {
+        // an interval can stop itself
+        if(++ticks == 3) interval.cancel();
+    });
+    never.cancel();
+
+    // nothing is due yet, the loop can sleep until the first tick
+    q->poll();
+    ASSERT_EQ(timeouts, 0);
+    auto wait = q->getIdleWait(1s);
+    ASSERT_LE(wait, 5ms);
+    ASSERT_TRUE(timeout.isActive());
+
+    auto start = EventQueue::Clock::now();
+    while(EventQueue::Clock::now() - start < 100ms) {
+        q->poll();
+        std::this_thread::sleep_for(q->getIdleWait(1ms));
+    }
+    ASSERT_EQ(timeouts, 1);
+    ASSERT_EQ(ticks, 3);
+    ASSERT_EQ(cancelled, 0);
+    ASSERT_FALSE(timeout.isActive());
+    ASSERT_FALSE(interval.isActive());
+    // no timer is left
+    ASSERT_EQ(q->getIdleWait(1s), 1s);
+}
+
+TEST(TestEventQueue, TestDispatch) {
+    using namespace themis;
+    auto q = std::make_unique<EventQueue>();
+    int count = 0;
+    // outside of poll, dispatch only queues
+    q->dispatch([&count]() { ++count; });
+    ASSERT_EQ(count, 0);
+    q->poll();
+    ASSERT_EQ(count, 1);
+
+    // inside poll it runs inline, nesting is bounded
+    size_t depth = 0, maxDepth = 0, runs = 0;
+    std::function<void ()> recurse = [&]() {
+        ++runs;
+        maxDepth = std::max(maxDepth, ++depth);
+        if(runs < 100) q->dispatch([&]() { recurse(); });
+        --depth;
+    };
+    q->addImmediate([&]() { recurse(); });
+    q->poll();
+    ASSERT_EQ(runs, 100);
+    ASSERT_LE(maxDepth, EventQueue::MAX_INLINE_DEPTH + 1);
+    ASSERT_FALSE(q->isPolling());
+}
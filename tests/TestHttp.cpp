@@ -2,6 +2,8 @@
 
 #define private public
 #include "protocol/http/HttpSessionHandler.h"
+#include "web/Controller.h"
+#include <sys/socket.h>
 
 TEST(TestHttp, TestRequestParseWithLength) {
     using namespace themis;
@@ -40,4 +42,137 @@ TEST(TestHttp, TestRequestParseWithLength) {
     handler.handleSession();
     ASSERT_EQ(handler.state, HttpSessionHandler::AWAIT_HEADER);
 
-}
\ No newline at end of file
+}
+
+namespace {
+
+    /// @brief never responds, keeps the token of the last request
+    class PendingController : public themis::Controller {
+    public:
+        themis::CancellationToken token;
+        themis::HttpResponsePromise::ResolveFunction resolve;
+
+        PendingController() : Controller("/pending") {}
+        virtual std::unique_ptr<themis::HttpResponsePromise> service(std::unique_ptr<themis::HttpRequest> req, 
+            const std::unique_ptr<themis::EventQueue>& queue) override {
+            token = req->getCancellationToken();
+            return std::make_unique<themis::HttpResponsePromise>(queue, [this](auto res, auto fail) {
+                resolve = res;
+            });
+        }
+    };
+
+}
+
+TEST(TestHttp, TestClientGone) {
+    using namespace themis;
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto session = std::make_unique<Session>(sockaddr_in(), fds[0]);
+    SessionHandle handle = session->getHandle();
+    ASSERT_TRUE(handle.isOpen());
+
+    ControllerManager manager;
+    auto controller = std::make_unique<PendingController>();
+    PendingController* pending = controller.get();
+    manager.addController(std::move(controller));
+
+    auto req = std::make_unique<HttpRequest>();
+    req->path = "/pending";
+    req->m = HttpRequest::GET;
+    manager.serveRequest(std::move(req), session);
+    ASSERT_EQ(manager.responseList.size(), 1);
+    ASSERT_FALSE(pending->token.isCancelled());
+
+    // the client hangs up before the controller responds
+    session = nullptr;
+    ASSERT_FALSE(handle.isOpen());
+    ASSERT_TRUE(handle.getClosedToken().isCancelled());
+    ASSERT_TRUE(pending->token.isCancelled());
+    ASSERT_TRUE(manager.responseList.empty());
+
+    // the late response goes nowhere
+    pending->resolve(std::make_unique<HttpResponse>());
+    manager.poll();
+    close(fds[1]);
+}
+
+namespace {
+
+    std::string drain(themis::Buffer& buffer) {
+        std::string out(buffer.size(), '\0');
+        themis::BufferReader(buffer).getBytes(out.data(), out.size());
+        return out;
+    }
+
+}
+
+TEST(TestHttp, TestStreamedResponse) {
+    using namespace themis;
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto session = std::make_unique<Session>(sockaddr_in(), fds[0]);
+
+    ControllerManager manager;
+    auto controller = std::make_unique<PendingController>();
+    PendingController* pending = controller.get();
+    manager.addController(std::move(controller));
+
+    auto req = std::make_unique<HttpRequest>();
+    req->path = "/pending";
+    req->m = HttpRequest::GET;
+    manager.serveRequest(std::move(req), session);
+
+    auto response = std::make_unique<HttpResponse>();
+    response->getResponseStream() << "id\n";
+    auto body = response->startStream();
+    body->setWatermarks(4, 16);
+    std::vector<bool> changes;
+    body->setWritabilityListener([&changes](bool writable) {
+        changes.push_back(writable);
+    });
+    // held until the response is sent
+    body->write("1\n");
+    pending->resolve(std::move(response));
+    manager.poll();
+    ASSERT_TRUE(manager.responseList.empty());
+
+    // the headers are over the high watermark
+    ASSERT_EQ(changes, std::vector<bool>({false}));
+    std::string head = drain(session->getOutputBuffer());
+    ASSERT_NE(head.find("Transfer-Encoding: chunked\r\n"), std::string::npos);
+    ASSERT_EQ(head.find("Content-Length"), std::string::npos);
+    ASSERT_EQ(head.substr(head.find("\r\n\r\n") + 4), "3\r\nid\n\r\n2\r\n1\n\r\n");
+    session->notifyWritten();
+    ASSERT_EQ(changes, std::vector<bool>({false, true}));
+
+    body->write(std::string(20, 'x'));
+    ASSERT_FALSE(body->isWritable());
+    ASSERT_EQ(drain(session->getOutputBuffer()), "14\r\n" + std::string(20, 'x') + "\r\n");
+    session->notifyWritten();
+    ASSERT_TRUE(body->isWritable());
+
+    body->write("");
+    body->end();
+    ASSERT_FALSE(body->isOpen());
+    ASSERT_EQ(drain(session->getOutputBuffer()), "0\r\n\r\n");
+    ASSERT_FALSE(session->writtenListener);
+    ASSERT_FALSE(pending->token.isCancelled());
+
+    // the client hangs up in the middle of the next one
+    req = std::make_unique<HttpRequest>();
+    req->path = "/pending";
+    req->m = HttpRequest::GET;
+    manager.serveRequest(std::move(req), session);
+    response = std::make_unique<HttpResponse>();
+    body = response->startStream();
+    pending->resolve(std::move(response));
+    manager.poll();
+    body->write("2\n");
+    session = nullptr;
+    ASSERT_TRUE(pending->token.isCancelled());
+    ASSERT_FALSE(body->isOpen());
+    body->write("3\n");
+    body->end();
+    close(fds[1]);
+}
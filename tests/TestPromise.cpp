@@ -1,5 +1,11 @@
 #include <gtest/gtest.h>
 #include "utils/Promise.h"
+#include "utils/Task.h"
+#include "utils/PromiseCombinator.h"
+#include "utils/Cancellation.h"
+#include "utils/AdaptiveLock.h"
+#include <thread>
+#include <vector>
 
 TEST(TestConcurrency, TestPromise) {
     using namespace themis;
@@ -62,4 +68,383 @@ TEST(TestConcurrency, TestPromiseException) {
     ASSERT_TRUE(flag);
     q->poll();
     ASSERT_EQ(val, 0);
-}
\ No newline at end of file
+}
+
+TEST(TestConcurrency, TestPromiseInline) {
+    using namespace themis;
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    Promise<int,int>::ResolveFunction resolve;
+    Promise<int,int> p(q, [&](Promise<int,int>::ResolveFunction res, FailFunction fail) {
+        resolve = res;
+    });
+    int val = 0;
+    p.then([&](std::unique_ptr<int> i) -> std::unique_ptr<int> {
+        return std::make_unique<int>(*i + 1);
+    })->then([&](std::unique_ptr<int> i) {
+        val = *i;
+    });
+    // resolved from a callback of the queue, the whole chain runs in the same poll
+    q->addImmediate([&]() {
+        resolve(std::make_unique<int>(1));
+        ASSERT_EQ(val, 2);
+    });
+    q->poll();
+    ASSERT_EQ(val, 2);
+}
+
+namespace {
+
+    using namespace themis;
+
+    template<size_t>
+    using Int = int;
+
+    template<size_t ...I>
+    auto intChain(std::index_sequence<I...>) -> Promise<Int<I>...>;
+
+    /// @brief a promise passing an int through 20 callbacks, more than dispatch runs inline
+    using LongChain = decltype(intChain(std::make_index_sequence<21>()));
+
+    void countCalls(Promise<int>& p, int* calls) {
+        p.then([calls](std::unique_ptr<int> i) {
+            ++*calls;
+        });
+    }
+
+    template<typename ...T>
+    void countCalls(Promise<int, int, T...>& p, int* calls) {
+        countCalls(*p.then([calls](std::unique_ptr<int> i) -> std::unique_ptr<int> {
+            ++*calls;
+            return i;
+        }), calls);
+    }
+
+}
+
+TEST(TestConcurrency, TestPromiseFreedChain) {
+    using namespace themis;
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    LongChain::ResolveFunction resolve;
+    auto root = std::make_unique<LongChain>(q, [&](LongChain::ResolveFunction res, FailFunction fail) {
+        resolve = res;
+    });
+    int calls = 0;
+    countCalls(*root, &calls);
+    int ranInline = 0;
+    q->addImmediate([&]() {
+        resolve(std::make_unique<int>(1));
+        // the rest of the chain was put on the queue, then the chain is freed before it runs,
+        // like a response released by its controller
+        ranInline = calls;
+        root = nullptr;
+    });
+    q->poll();
+    q->poll();
+    ASSERT_GT(ranInline, 0);
+    ASSERT_LT(ranInline, 20);
+    ASSERT_EQ(calls, ranInline);
+}
+
+namespace {
+
+    using namespace themis;
+
+    /// @brief a promise resolved with the value on the queue, like a driver query
+    std::unique_ptr<Promise<int>> later(const std::unique_ptr<EventQueue>& q, int value) {
+        return std::make_unique<Promise<int>>(q, [&q, value](Promise<int>::ResolveFunction res, FailFunction fail) {
+            q->addImmediate([res, value]() {
+                res(std::make_unique<int>(value));
+            });
+        });
+    }
+
+    Task<int> add(const std::unique_ptr<EventQueue>& worker, int a, int b) {
+        auto x = co_await later(worker, a);
+        auto y = co_await later(worker, b);
+        co_return *x + *y;
+    }
+
+    Task<int> sum(const std::unique_ptr<EventQueue>& q, const std::unique_ptr<EventQueue>& worker, std::thread::id* resumedOn) {
+        auto first = co_await add(worker, 1, 2);
+        auto third = co_await later(worker, 3);
+        *resumedOn = std::this_thread::get_id();
+        co_return *first + *third;
+    }
+
+    Task<int> failing(const std::unique_ptr<EventQueue>& q) {
+        auto p = std::make_unique<Promise<int>>(q, [](Promise<int>::ResolveFunction res, FailFunction fail) {
+            fail(std::make_unique<std::runtime_error>("query failed"));
+        });
+        co_await std::move(p);
+        co_return 0;
+    }
+
+}
+
+TEST(TestConcurrency, TestCoroutine) {
+    using namespace themis;
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    // the worker queue is polled by another thread, like the database driver
+    std::unique_ptr<EventQueue> worker = std::make_unique<EventQueue>();
+    std::atomic<bool> stop = false;
+    std::thread workerThread([&]() {
+        while(!stop) {
+            if(!worker->poll()) std::this_thread::yield();
+        }
+    });
+
+    // the first queue parameter is the one the task is resumed on
+    std::thread::id resumedOn;
+    int value = 0;
+    bool failed = false;
+    auto p = toPromise(sum(q, worker, &resumedOn), q);
+    p->then([&](std::unique_ptr<int> v) {
+        value = *v;
+    })->except([&](std::unique_ptr<std::exception> e) {
+        failed = true;
+    });
+    auto start = std::chrono::steady_clock::now();
+    while(value == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        q->poll();
+    }
+    stop = true;
+    workerThread.join();
+    ASSERT_FALSE(failed);
+    ASSERT_EQ(value, 6);
+    ASSERT_EQ(resumedOn, std::this_thread::get_id());
+
+    // failed promises throw inside the coroutine, and fail the task
+    std::string error;
+    auto f = toPromise(failing(q), q);
+    f->then([&](std::unique_ptr<int> v) {
+        value = 0;
+    })->except([&](std::unique_ptr<std::exception> e) {
+        error = e->what();
+    });
+    for (int i = 0; i < 4; i++) q->poll();
+    ASSERT_EQ(error, "query failed");
+}
+
+TEST(TestConcurrency, TestFramePool) {
+    using namespace themis;
+    FramePool& pool = FramePool::local();
+    void* block = pool.allocate(100);
+    pool.deallocate(block, 100);
+    size_t cached = pool.getCachedBlocks();
+    // frames of the same size class reuse the block
+    ASSERT_EQ(pool.allocate(120), block);
+    ASSERT_EQ(pool.getCachedBlocks(), cached - 1);
+    pool.deallocate(block, 120);
+    // large frames are not pooled
+    void* large = pool.allocate(FramePool::MAX_POOLED_SIZE + 1);
+    pool.deallocate(large, FramePool::MAX_POOLED_SIZE + 1);
+    ASSERT_EQ(pool.getCachedBlocks(), cached);
+}
+
+namespace {
+
+    std::unique_ptr<Promise<std::string>> failLater(const std::unique_ptr<EventQueue>& q, const std::string& msg) {
+        return std::make_unique<Promise<std::string>>(q, [&q, msg](Promise<std::string>::ResolveFunction res, FailFunction fail) {
+            q->addImmediate([fail, msg]() {
+                fail(std::make_unique<std::runtime_error>(msg));
+            });
+        });
+    }
+
+    std::unique_ptr<Promise<std::string>> textLater(const std::unique_ptr<EventQueue>& q, const std::string& text) {
+        return std::make_unique<Promise<std::string>>(q, [&q, text](Promise<std::string>::ResolveFunction res, FailFunction fail) {
+            q->addImmediate([res, text]() {
+                res(std::make_unique<std::string>(text));
+            });
+        });
+    }
+
+}
+
+TEST(TestConcurrency, TestCombinator) {
+    using namespace themis;
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    // sub-promises of another thread, like database queries
+    std::unique_ptr<EventQueue> worker = std::make_unique<EventQueue>();
+    std::atomic<bool> stop = false;
+    std::thread workerThread([&]() {
+        while(!stop) {
+            if(!worker->poll()) std::this_thread::yield();
+        }
+    });
+    auto pollUntil = [&q](const bool& done) {
+        auto start = std::chrono::steady_clock::now();
+        while(!done && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+            q->poll();
+        }
+    };
+
+    // all, with results of different types in the order given
+    bool done = false;
+    int number = 0;
+    std::string text;
+    auto a = all(q, later(worker, 1), textLater(worker, "two"), later(q, 3));
+    a->then([&](std::unique_ptr<std::tuple<std::unique_ptr<int>, std::unique_ptr<std::string>, std::unique_ptr<int>>> r) {
+        number = *std::get<0>(*r) + *std::get<2>(*r);
+        text = *std::get<1>(*r);
+        done = true;
+    });
+    pollUntil(done);
+    ASSERT_EQ(number, 4);
+    ASSERT_EQ(text, "two");
+
+    // all fails with the first error
+    done = false;
+    std::string error;
+    auto af = all(q, later(worker, 1), failLater(worker, "broken"));
+    af->then([&](auto r) {
+        done = true;
+    })->except([&](std::unique_ptr<std::exception> e) {
+        error = e->what();
+        done = true;
+    });
+    pollUntil(done);
+    ASSERT_EQ(error, "broken");
+
+    // allSettled reports every outcome
+    done = false;
+    bool firstOk = false, secondOk = true;
+    auto s = allSettled(q, later(worker, 1), failLater(worker, "broken"));
+    s->then([&](std::unique_ptr<std::tuple<Settled<int>, Settled<std::string>>> r) {
+        firstOk = std::get<0>(*r).isFulfilled() && *std::get<0>(*r).value == 1;
+        secondOk = std::get<1>(*r).isFulfilled();
+        done = true;
+    });
+    pollUntil(done);
+    ASSERT_TRUE(firstOk);
+    ASSERT_FALSE(secondOk);
+
+    // any skips failures, race takes the first outcome
+    done = false;
+    size_t index = 99;
+    auto an = any(q, failLater(q, "broken"), textLater(worker, "late"));
+    an->then([&](std::unique_ptr<FirstOf<std::string, std::string>> r) {
+        index = r->index();
+        text = *std::get<1>(*r);
+        done = true;
+    });
+    pollUntil(done);
+    ASSERT_EQ(index, 1);
+    ASSERT_EQ(text, "late");
+
+    done = false;
+    error.clear();
+    auto ra = race(q, failLater(q, "first"), later(worker, 1));
+    ra->then([&](auto r) {
+        done = true;
+    })->except([&](std::unique_ptr<std::exception> e) {
+        error = e->what();
+        done = true;
+    });
+    pollUntil(done);
+    ASSERT_EQ(error, "first");
+
+    stop = true;
+    workerThread.join();
+}
+
+TEST(TestConcurrency, TestCancellation) {
+    using namespace themis;
+    // an empty token is never cancelled
+    CancellationToken empty;
+    ASSERT_FALSE(empty);
+    empty.cancel();
+    ASSERT_FALSE(empty.isCancelled());
+
+    CancellationToken token = CancellationToken::create();
+    CancellationToken copy = token;
+    int first = 0, second = 0;
+    token.subscribe([&]() { ++first; });
+    size_t id = copy.subscribe([&]() { ++second; });
+    copy.unsubscribe(id);
+    ASSERT_FALSE(token.isCancelled());
+    copy.cancel();
+    copy.cancel();
+    ASSERT_TRUE(token.isCancelled());
+    ASSERT_EQ(first, 1);
+    ASSERT_EQ(second, 0);
+    // already cancelled, run right away
+    ASSERT_EQ(token.subscribe([&]() { ++second; }), 0);
+    ASSERT_EQ(second, 1);
+
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    // a deadline rejects the promise, the late result is ignored
+    Promise<int>::ResolveFunction resolve;
+    Promise<int> p(q, [&](Promise<int>::ResolveFunction res, FailFunction fail) {
+        resolve = res;
+    });
+    bool fulfilled = false, timedOut = false;
+    p.then([&](std::unique_ptr<int> i) {
+        fulfilled = true;
+    })->except([&](std::unique_ptr<std::exception> e) {
+        timedOut = dynamic_cast<TimeoutException*>(e.get()) != nullptr;
+    });
+    q->addTimeout(std::chrono::milliseconds(1), [&]() {
+        p.reject(std::make_unique<TimeoutException>("timed out"));
+    });
+    while(!timedOut) q->poll();
+    resolve(std::make_unique<int>(1));
+    q->poll();
+    ASSERT_FALSE(fulfilled);
+    ASSERT_EQ(p.getState(), FAILED);
+
+    // resolving a freed promise, from another thread, does nothing
+    FailFunction fail;
+    auto freed = std::make_unique<Promise<int>>(q, [&](Promise<int>::ResolveFunction res, FailFunction f) {
+        resolve = res;
+        fail = f;
+    });
+    freed->then([&](std::unique_ptr<int> i) {
+        fulfilled = true;
+    });
+    freed = nullptr;
+    std::thread([&]() {
+        resolve(std::make_unique<int>(1));
+        fail(std::make_unique<std::runtime_error>("late"));
+    }).join();
+    q->poll();
+    ASSERT_FALSE(fulfilled);
+}
+
+TEST(TestConcurrency, TestAdaptiveLock) {
+    using namespace themis;
+    AdaptiveLock lock;
+    LockStats stats;
+    lock.setStats(&stats);
+    constexpr size_t THREADS = 4;
+    constexpr size_t ITERATIONS = 20000;
+    size_t counter = 0;
+
+    // hold the lock long enough for the others to go to sleep
+    lock.lock();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < THREADS; t++) {
+        threads.emplace_back([&]() {
+            for (size_t i = 0; i < ITERATIONS; i++) {
+                std::lock_guard<AdaptiveLock> guard(lock);
+                ++counter;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    lock.unlock();
+    for (auto& t: threads) t.join();
+
+    ASSERT_EQ(counter, THREADS * ITERATIONS);
+    ASSERT_TRUE(lock.try_lock());
+    ASSERT_FALSE(lock.try_lock());
+    lock.unlock();
+
+    auto s = stats.snapshot();
+    ASSERT_EQ(s.acquisitions, THREADS * ITERATIONS + 2);
+    ASSERT_GE(s.parks, 1);
+    ASSERT_GT(s.parkNanoseconds, 0);
+    ASSERT_LE(s.parks, s.contended);
+    stats.reset();
+    ASSERT_EQ(stats.snapshot().acquisitions, 0);
+}
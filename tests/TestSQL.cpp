@@ -1,10 +1,84 @@
 #include <gtest/gtest.h>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <optional>
 #include <ng-log/logging.h>
+#define private public
 #include "sql/Driver.h"
 #include "sql/driver/PostgresqlDriver.h"
 #include "sql/driver/detail/PostgresqlConnectionPool.h"
 
-TEST(TestSQL, TestPostgresDriverBasic) {
+namespace {
+
+    using namespace themis;
+
+    /**
+     * @brief the database of the live tests, from the libpq connection string in
+     * THEMIS_PG_DSN, e.g. "host=127.0.0.1 port=5432 user=postgres password=admin dbname=themis_test"
+     * 
+     * @return std::optional<DatasourceConfig> none if it is unset or malformed
+     */
+    std::optional<DatasourceConfig> liveConfig() {
+        const char* dsn = std::getenv("THEMIS_PG_DSN");
+        if(!dsn || !*dsn) return std::nullopt;
+        char* error = nullptr;
+        PQconninfoOption* options = PQconninfoParse(dsn, &error);
+        if(!options) {
+            if(error) PQfreemem(error);
+            return std::nullopt;
+        }
+        DatasourceConfig config;
+        std::string host = "127.0.0.1", port = "5432";
+        for (PQconninfoOption* o = options; o->keyword; o++) {
+            if(!o->val) continue;
+            std::string key = o->keyword;
+            if(key == "host" || key == "hostaddr") host = o->val;
+            else if(key == "port") port = o->val;
+            else if(key == "user") config.getUsername() = o->val;
+            else if(key == "password") config.getPassword() = o->val;
+            else if(key == "dbname") config.getDatabase() = o->val;
+        }
+        PQconninfoFree(options);
+        config.getAddress() = host + ":" + port;
+        return config;
+    }
+
+    /// @brief if a connection to THEMIS_PG_DSN can be opened, tried once
+    bool liveDatabaseUp() {
+        static const bool up = []() {
+            const char* dsn = std::getenv("THEMIS_PG_DSN");
+            const char* keys[] = {"dbname", "connect_timeout", nullptr};
+            const char* values[] = {dsn, "3", nullptr};
+            PGconn* conn = PQconnectdbParams(keys, values, 1);
+            bool ok = PQstatus(conn) == CONNECTION_OK;
+            PQfinish(conn);
+            return ok;
+        }();
+        return up;
+    }
+
+}
+
+/**
+ * @brief a test against the database of THEMIS_PG_DSN, skipped when it is not set
+ * or the database cannot be reached
+ * 
+ */
+class TestSQLLive : public ::testing::Test {
+protected:
+    themis::DatasourceConfig config;
+
+    void SetUp() override {
+        auto live = liveConfig();
+        if(!live) GTEST_SKIP() << "THEMIS_PG_DSN is not set";
+        if(!liveDatabaseUp()) GTEST_SKIP() << "cannot connect to THEMIS_PG_DSN";
+        config = *live;
+    }
+};
+
+TEST_F(TestSQLLive, TestPostgresDriverBasic) {
     FLAGS_alsologtostderr = 1;
     FLAGS_colorlogtostderr = 1;
     FLAGS_v = 10;
@@ -13,11 +87,6 @@ TEST(TestSQL, TestPostgresDriverBasic) {
     nglog::InitializeLogging("");
 
     using namespace themis;
-    DatasourceConfig config;
-    config.getAddress() = "127.0.0.1:5432";
-    config.getUsername() = "postgres";
-    config.getPassword() = "admin";
-    config.getDatabase() = "themis_test";
     // PostgresqlDriver::get()->addConfig(config);
     PostgresqlDriver::get()->addConfigToPool(config);
     PostgresqlDriver::get()->initialize();
@@ -36,4 +105,899 @@ TEST(TestSQL, TestPostgresDriverBasic) {
     std::this_thread::sleep_for(std::chrono::seconds(10));
 
     PostgresqlDriver::get()->shutdown();
-}
\ No newline at end of file
+}
+
+namespace {
+
+    /**
+     * @brief the driver with its loop run by the test instead of its thread, so that the
+     * test sees the state between two loops and the callbacks of the driver queue run on
+     * the test thread. shut down when it goes out of scope, configure the pools before
+     * 
+     */
+    struct LoopedDriver {
+        PostgresqlDriver* driver;
+
+        LoopedDriver() : driver(PostgresqlDriver::get()) {
+            driver->initialize();
+            driver->stopThread();
+        }
+
+        ~LoopedDriver() {
+            driver->shutdown();
+        }
+
+        PostgresqlDriver* operator->() {
+            return driver;
+        }
+
+        PostgresqlConnectionPool& pool(const std::string& id = "default_pool") {
+            return driver->getPool(id);
+        }
+
+        /**
+         * @brief run the loop until done holds
+         * 
+         * @param done checked before every loop
+         * @param timeout how long to wait at most
+         * @return bool false if it timed out
+         */
+        bool pump(const std::function<bool ()>& done, std::chrono::milliseconds timeout = std::chrono::seconds(10)) {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            while(!done()) {
+                if(std::chrono::steady_clock::now() > deadline) return false;
+                driver->loopOnce();
+            }
+            return true;
+        }
+    };
+
+    /// @brief the first value of a result, or the error it failed with
+    struct Outcome {
+        bool settled = false;
+        std::string value;
+        std::string error;
+    };
+
+    void track(const std::unique_ptr<PostgresqlDriver::QueryPromise>& promise, Outcome& outcome) {
+        promise->then([&outcome](std::unique_ptr<PGResultSets> result) {
+            PGresult* last = result->size() ? result->at(result->size() - 1) : nullptr;
+            if(last && PQntuples(last)) outcome.value = PQgetvalue(last, 0, 0);
+            outcome.settled = true;
+        })->except([&outcome](std::unique_ptr<std::exception> e) {
+            outcome.error = e->what();
+            outcome.settled = true;
+        });
+    }
+
+}
+
+TEST_F(TestSQLLive, TestPipelineFailure) {
+    using namespace themis;
+    config.getPipelineDepth() = 8;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    auto& connection = driver.pool().basePool[0];
+    ASSERT_TRUE(connection.get());
+
+    Outcome outcomes[3];
+    auto first = driver->query(Statement("SELECT 1"));
+    auto failing = driver->query(Statement("SELECT 1/0"));
+    auto third = driver->query(Statement("SELECT 3"));
+    track(first, outcomes[0]);
+    track(failing, outcomes[1]);
+    track(third, outcomes[2]);
+
+    // all three are sent before the first result is back
+    ASSERT_TRUE(driver.pump([&]() { return !connection->pipelined.empty(); }));
+    ASSERT_EQ(connection->pipelined.size(), 3);
+    ASSERT_TRUE(driver.pump([&]() { return outcomes[0].settled && outcomes[1].settled && outcomes[2].settled; }));
+
+    // each result goes to its own promise, the failure fails only its statement
+    ASSERT_EQ(outcomes[0].value, "1");
+    ASSERT_TRUE(outcomes[0].error.empty());
+    ASSERT_NE(outcomes[1].error.find("division by zero"), std::string::npos);
+    ASSERT_EQ(outcomes[2].value, "3");
+    ASSERT_TRUE(outcomes[2].error.empty());
+
+    // and the connection runs on
+    Outcome after;
+    auto later = driver->query(Statement("SELECT 4"));
+    track(later, after);
+    ASSERT_TRUE(driver.pump([&]() { return after.settled; }));
+    ASSERT_EQ(after.value, "4");
+    ASSERT_EQ(driver.pool().getConnectionCount(), 1);
+}
+
+TEST(TestSQL, TestReconnectBackoff) {
+    using namespace themis;
+    using namespace std::chrono;
+    DatasourceConfig config;
+    // nothing listens there, every attempt is refused
+    config.getAddress() = "127.0.0.1:1";
+    config.getUsername() = "postgres";
+    config.getDatabase() = "themis_test";
+    config.getMaxRetry() = 2;
+    PostgresqlDriver::get()->addConfigToPool("dead_pool", config);
+    auto started = steady_clock::now();
+    LoopedDriver driver;
+
+    // initialize only waits for the first attempt, the retry waits out its backoff in the loop
+    ASSERT_LT(steady_clock::now() - started, PostgresqlConnectionPool::RECONNECT_DELAY);
+    auto& pool = driver.pool("dead_pool");
+    ASSERT_EQ(pool.getConnectionCount(), 0);
+    auto& pending = pool.pending[0];
+    ASSERT_TRUE(pending.get());
+    ASSERT_EQ(pending->attempt, 1);
+    ASSERT_EQ(pending->conn, nullptr);
+
+    // a query fails at once instead of waiting for a connection
+    Outcome outcome;
+    auto query = driver->query("dead_pool", Statement("SELECT 1"));
+    track(query, outcome);
+    ASSERT_TRUE(driver.pump([&]() { return outcome.settled; }, milliseconds(100)));
+    ASSERT_FALSE(outcome.error.empty());
+
+    // each backoff doubles, no loop waits for one
+    size_t attempt = 1;
+    steady_clock::time_point firstRetry;
+    auto last = steady_clock::now();
+    auto longest = steady_clock::duration::zero();
+    ASSERT_TRUE(driver.pump([&]() {
+        auto now = steady_clock::now();
+        longest = std::max(longest, now - last);
+        last = now;
+        if(pending && pending->attempt != attempt) {
+            attempt = pending->attempt;
+            firstRetry = now;
+        }
+        return !pending;
+    }));
+    auto gaveUp = steady_clock::now();
+    ASSERT_EQ(attempt, 2);
+    ASSERT_GE(firstRetry - started, PostgresqlConnectionPool::RECONNECT_DELAY);
+    ASSERT_GE(gaveUp - firstRetry, PostgresqlConnectionPool::RECONNECT_DELAY * 2);
+    ASSERT_LT(longest, milliseconds(100));
+    ASSERT_EQ(pool.getConnectionCount(), 0);
+}
+
+TEST_F(TestSQLLive, TestStreamBackpressure) {
+    using namespace themis;
+    using namespace std::chrono;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    auto& connection = driver.pool().basePool[0];
+    ASSERT_TRUE(connection.get());
+
+    constexpr size_t TOTAL = 20000;
+    constexpr size_t BATCH = 100;
+    constexpr size_t WINDOW = 2;
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    std::vector<int> values;
+    auto rows = std::make_shared<RowStream>(q, [&](std::unique_ptr<PGResultSets> batch) {
+        PGresult* result = batch->at(0);
+        for (int i = 0; i < PQntuples(result); i++) values.push_back(std::stoi(PQgetvalue(result, i, 0)));
+    }, BATCH, WINDOW);
+    rows->pause();
+    Outcome outcome;
+    auto promise = driver->stream(Statement("SELECT generate_series(1, 20000)"), rows);
+    track(promise, outcome);
+
+    // paused before the first row, nothing is read
+    ASSERT_TRUE(driver.pump([&]() { return connection->streamPaused; }));
+    driver.pump([]() { return false; }, milliseconds(50));
+    q->poll();
+    ASSERT_TRUE(connection->streamPaused);
+    ASSERT_TRUE(values.empty());
+
+    // resumed with nobody consuming, reading stops once the window is full
+    rows->resume();
+    ASSERT_TRUE(driver.pump([&]() { return connection->streamPaused; }));
+    driver.pump([]() { return false; }, milliseconds(50));
+    ASSERT_EQ(rows->pending, WINDOW);
+    ASSERT_TRUE(values.empty());
+
+    // consumed as it comes, paused again halfway
+    size_t most = 0;
+    ASSERT_TRUE(driver.pump([&]() {
+        q->poll();
+        most = std::max<size_t>(most, rows->pending);
+        return values.size() >= TOTAL / 2;
+    }));
+    rows->pause();
+    q->poll();
+    size_t atPause = values.size();
+    driver.pump([&]() { q->poll(); return false; }, milliseconds(50));
+    ASSERT_EQ(values.size(), atPause);
+    ASSERT_FALSE(outcome.settled);
+
+    rows->resume();
+    ASSERT_TRUE(driver.pump([&]() {
+        q->poll();
+        most = std::max<size_t>(most, rows->pending);
+        return outcome.settled;
+    }));
+    ASSERT_TRUE(outcome.error.empty());
+    ASSERT_LE(most, WINDOW);
+    ASSERT_EQ(values.size(), TOTAL);
+    ASSERT_EQ(rows->getRowCount(), TOTAL);
+    for (size_t i = 0; i < TOTAL; i++) ASSERT_EQ(values[i], (int)i + 1);
+}
+
+TEST_F(TestSQLLive, TestStreamCancel) {
+    using namespace themis;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    ASSERT_TRUE(driver.pool().basePool[0].get());
+
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    size_t delivered = 0;
+    auto rows = std::make_shared<RowStream>(q, [&](std::unique_ptr<PGResultSets> batch) {
+        delivered += PQntuples(batch->at(0));
+    }, 100, 2);
+    auto token = CancellationToken::create();
+    Outcome outcome;
+    auto promise = driver->stream(Statement("SELECT generate_series(1, 1000000)"), rows, token);
+    track(promise, outcome);
+
+    ASSERT_TRUE(driver.pump([&]() {
+        q->poll();
+        return delivered >= 1000;
+    }));
+    // nothing is left on the queue, no batch may come after this
+    size_t atCancel = delivered;
+    token.cancel();
+    ASSERT_TRUE(driver.pump([&]() {
+        q->poll();
+        return outcome.settled;
+    }));
+    ASSERT_FALSE(outcome.error.empty());
+    ASSERT_EQ(delivered, atCancel);
+    ASSERT_LT(delivered, 1000000);
+
+    // the connection takes the next query
+    Outcome after;
+    auto later = driver->query(Statement("SELECT 2"));
+    track(later, after);
+    ASSERT_TRUE(driver.pump([&]() { return after.settled; }));
+    ASSERT_EQ(after.value, "2");
+}
+
+TEST_F(TestSQLLive, TestCopyRoundTrip) {
+    using namespace themis;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    ASSERT_TRUE(driver.pool().basePool[0].get());
+
+    // one connection, the temporary table is seen by the copies after
+    Outcome created;
+    auto create = driver->query(Statement("CREATE TEMP TABLE copy_round_trip (id integer, name text)"));
+    track(create, created);
+    ASSERT_TRUE(driver.pump([&]() { return created.settled; }));
+    ASSERT_TRUE(created.error.empty());
+
+    constexpr size_t TOTAL = 5000;
+    std::vector<std::pair<int, std::optional<std::string>>> items;
+    for (size_t i = 1; i <= TOTAL; i++) {
+        // escaped on the way in and out
+        if(i % 1000 == 0) items.push_back({(int)i, std::nullopt});
+        else items.push_back({(int)i, "row\t" + std::to_string(i) + (i % 7 ? "" : "\t\\")});
+    }
+    CopyTextEncoder expected;
+    for (auto& [id, name]: items) expected.row(id, name);
+
+    // in chunks far smaller than the data
+    auto source = makeCopySource<CopyTextEncoder>(items, [](CopyTextEncoder& e, const auto& item) {
+        e.row(item.first, item.second);
+    }, 1024);
+    std::string copied;
+    bool loaded = false;
+    auto in = driver->copyIn("COPY copy_round_trip FROM STDIN", source);
+    in->then([&](std::unique_ptr<PGResultSets> result) {
+        copied = PQcmdTuples(result->at(0));
+        loaded = true;
+    })->except([&](std::unique_ptr<std::exception> e) {
+        FAIL() << e->what();
+    });
+    ASSERT_TRUE(driver.pump([&]() { return loaded; }));
+    ASSERT_EQ(copied, std::to_string(TOTAL));
+
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    std::string data;
+    size_t chunks = 0;
+    auto sink = std::make_shared<CopyOutStream>(q, [&](std::string chunk) {
+        data += chunk;
+        chunks++;
+    }, 4096, 2);
+    Outcome exported;
+    auto out = driver->copyOut("COPY copy_round_trip TO STDOUT", sink);
+    track(out, exported);
+    ASSERT_TRUE(driver.pump([&]() {
+        q->poll();
+        return exported.settled;
+    }));
+    ASSERT_TRUE(exported.error.empty());
+    ASSERT_GT(chunks, 1);
+    ASSERT_EQ(sink->getByteCount(), data.size());
+    ASSERT_EQ(data, expected.take());
+}
+
+TEST_F(TestSQLLive, TestTransactionPipeline) {
+    using namespace themis;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    auto& pool = driver.pool();
+    auto& connection = pool.basePool[0];
+    ASSERT_TRUE(connection.get());
+
+    auto transaction = driver->begin();
+    Outcome first;
+    auto query = transaction->query(Statement("SELECT 1"));
+    track(query, first);
+    // the BEGIN goes out with the first statement, before the result of either is back
+    ASSERT_TRUE(driver.pump([&]() { return !connection->pipelined.empty(); }));
+    ASSERT_EQ(connection->pipelined.size(), 2);
+    ASSERT_EQ(connection->pipelined[0].task.statement, pool.beginStatement);
+    ASSERT_EQ(connection->pipelined[1].task.statement->getSql(), "SELECT 1");
+    ASSERT_EQ(connection->pinned, transaction->pinned);
+    ASSERT_TRUE(driver.pump([&]() { return first.settled; }));
+    ASSERT_EQ(first.value, "1");
+    ASSERT_TRUE(driver.pump([&]() { return connection->pipelined.empty(); }));
+    ASSERT_EQ(PQtransactionStatus(connection->conn), PQTRANS_INTRANS);
+
+    // and the COMMIT with the last one
+    Outcome committed;
+    auto commit = transaction->commit(Statement("SELECT 2"));
+    track(commit, committed);
+    ASSERT_TRUE(driver.pump([&]() { return !connection->pipelined.empty(); }));
+    ASSERT_EQ(connection->pipelined.size(), 2);
+    ASSERT_EQ(connection->pipelined[0].task.statement->getSql(), "SELECT 2");
+    ASSERT_EQ(connection->pipelined[1].task.statement, pool.commitStatement);
+    // released as soon as the end is queued
+    ASSERT_EQ(connection->pinned, nullptr);
+    ASSERT_TRUE(driver.pump([&]() { return committed.settled && connection->pipelined.empty(); }));
+    ASSERT_TRUE(committed.error.empty());
+    ASSERT_EQ(committed.value, "2");
+    ASSERT_EQ(PQtransactionStatus(connection->conn), PQTRANS_IDLE);
+}
+
+TEST_F(TestSQLLive, TestTransactionRouting) {
+    using namespace themis;
+    config.getMinConnections() = 2;
+    config.getMaxConnections() = 2;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    auto& pool = driver.pool();
+    ASSERT_EQ(pool.getConnectionCount(), 2);
+
+    auto transaction = driver->begin();
+    Outcome first;
+    auto query = transaction->query(Statement("SELECT 1"));
+    track(query, first);
+    ASSERT_TRUE(driver.pump([&]() { return first.settled; }));
+    auto* pinned = transaction->pinned->connection;
+    ASSERT_NE(pinned, nullptr);
+    auto* other = pool.basePool[0].get() == pinned ? pool.basePool[1].get() : pool.basePool[0].get();
+
+    // the others go to the connection not pinned, even with more queued on it
+    Outcome outcomes[3];
+    std::unique_ptr<PostgresqlDriver::QueryPromise> queries[3];
+    for (int i = 0; i < 3; i++) {
+        queries[i] = driver->query(Statement("SELECT " + std::to_string(i + 10)));
+        track(queries[i], outcomes[i]);
+    }
+    ASSERT_EQ(other->outstanding(), 3);
+    ASSERT_EQ(pinned->outstanding(), 0);
+    ASSERT_TRUE(pool.waiting.empty());
+
+    // the transaction runs on meanwhile
+    Outcome second;
+    auto next = transaction->query(Statement("SELECT 2"));
+    track(next, second);
+    ASSERT_TRUE(driver.pump([&]() {
+        return second.settled && outcomes[0].settled && outcomes[1].settled && outcomes[2].settled;
+    }));
+    ASSERT_EQ(second.value, "2");
+    for (int i = 0; i < 3; i++) ASSERT_EQ(outcomes[i].value, std::to_string(i + 10));
+    ASSERT_EQ(transaction->pinned->connection, pinned);
+
+    Outcome committed;
+    auto commit = transaction->commit();
+    track(commit, committed);
+    ASSERT_TRUE(driver.pump([&]() { return committed.settled; }));
+    ASSERT_TRUE(committed.error.empty());
+    ASSERT_EQ(pinned->pinned, nullptr);
+}
+
+TEST_F(TestSQLLive, TestTransactionWaiting) {
+    using namespace themis;
+    using namespace std::chrono;
+    config.getMinConnections() = 1;
+    config.getMaxConnections() = 2;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    auto& pool = driver.pool();
+    ASSERT_EQ(pool.getConnectionCount(), 1);
+
+    // pin the only connection
+    auto transaction = driver->begin();
+    Outcome first;
+    auto query = transaction->query(Statement("SELECT 1"));
+    track(query, first);
+    ASSERT_TRUE(driver.pump([&]() { return first.settled; }));
+
+    // a query waits for the connection the pool opens for it
+    Outcome grown;
+    auto waiting = driver->query(Statement("SELECT 3"));
+    track(waiting, grown);
+    ASSERT_EQ(pool.waiting.size(), 1);
+    ASSERT_TRUE(driver.pump([&]() { return grown.settled; }));
+    ASSERT_EQ(grown.value, "3");
+    ASSERT_EQ(pool.getConnectionCount(), 2);
+
+    // pin the second one as well, the pool is at its max
+    auto another = driver->begin();
+    Outcome second;
+    auto anotherQuery = another->query(Statement("SELECT 2"));
+    track(anotherQuery, second);
+    ASSERT_TRUE(driver.pump([&]() { return second.settled; }));
+    ASSERT_NE(another->pinned->connection, transaction->pinned->connection);
+
+    // the queries wait for a transaction to end, the cancelled one fails meanwhile
+    Outcome blocked, cancelled;
+    auto token = CancellationToken::create();
+    auto blockedQuery = driver->query(Statement("SELECT 4"));
+    auto cancelledQuery = driver->query(Statement("SELECT 5"), token);
+    track(blockedQuery, blocked);
+    track(cancelledQuery, cancelled);
+    ASSERT_EQ(pool.waiting.size(), 2);
+    token.cancel();
+    ASSERT_TRUE(driver.pump([&]() { return cancelled.settled; }, seconds(3)));
+    ASSERT_NE(cancelled.error.find("cancelled"), std::string::npos);
+    ASSERT_FALSE(blocked.settled);
+    ASSERT_EQ(pool.waiting.size(), 1);
+    ASSERT_EQ(pool.getConnectionCount(), 2);
+    ASSERT_FALSE(pool.pending[0] || pool.pending[1]);
+
+    // the end releases the connection to it
+    Outcome committed;
+    auto commit = transaction->commit();
+    track(commit, committed);
+    ASSERT_TRUE(driver.pump([&]() { return committed.settled && blocked.settled; }));
+    ASSERT_TRUE(committed.error.empty());
+    ASSERT_EQ(blocked.value, "4");
+    ASSERT_TRUE(pool.waiting.empty());
+}
+
+TEST_F(TestSQLLive, TestTransactionRollback) {
+    using namespace themis;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    auto& pool = driver.pool();
+    auto& connection = pool.basePool[0];
+    ASSERT_TRUE(connection.get());
+
+    // a failed statement, the COMMIT rolls back and fails
+    {
+        auto transaction = driver->begin();
+        Outcome failed, committed;
+        auto query = transaction->query(Statement("SELECT 1/0"));
+        track(query, failed);
+        auto commit = transaction->commit();
+        track(commit, committed);
+        ASSERT_TRUE(driver.pump([&]() { return failed.settled && committed.settled; }));
+        ASSERT_NE(failed.error.find("division by zero"), std::string::npos);
+        ASSERT_NE(committed.error.find("rolled back"), std::string::npos);
+    }
+
+    // a statement cancelled before it was sent, the COMMIT is sent as ROLLBACK
+    {
+        auto token = CancellationToken::create();
+        auto transaction = driver->begin(token);
+        Outcome dropped, committed;
+        auto query = transaction->query(Statement("SELECT 1"));
+        track(query, dropped);
+        token.cancel();
+        auto commit = transaction->commit();
+        track(commit, committed);
+        ASSERT_TRUE(driver.pump([&]() { return !connection->pipelined.empty(); }));
+        ASSERT_EQ(connection->pipelined.back().task.statement, pool.rollbackStatement);
+        ASSERT_TRUE(driver.pump([&]() { return dropped.settled && committed.settled; }));
+        ASSERT_NE(dropped.error.find("cancelled"), std::string::npos);
+        ASSERT_NE(committed.error.find("rolled back"), std::string::npos);
+    }
+
+    // a handle dropped before the end, its destructor rolls back
+    auto transaction = driver->begin();
+    Outcome first;
+    auto query = transaction->query(Statement("SELECT 1"));
+    track(query, first);
+    ASSERT_TRUE(driver.pump([&]() { return first.settled && connection->pipelined.empty(); }));
+    ASSERT_EQ(PQtransactionStatus(connection->conn), PQTRANS_INTRANS);
+    transaction = nullptr;
+    ASSERT_TRUE(driver.pump([&]() { return !connection->pinned; }));
+    ASSERT_EQ(connection->pipelined.back().task.statement, pool.rollbackStatement);
+    ASSERT_TRUE(driver.pump([&]() { return connection->pipelined.empty(); }));
+    ASSERT_EQ(PQtransactionStatus(connection->conn), PQTRANS_IDLE);
+
+    // the connection takes the next query, outside of any transaction
+    Outcome after;
+    auto later = driver->query(Statement("SELECT 2"));
+    track(later, after);
+    ASSERT_TRUE(driver.pump([&]() { return after.settled; }));
+    ASSERT_EQ(after.value, "2");
+}
+
+namespace {
+
+    /// @brief send a notification through the pool and wait for the query to end
+    bool notify(LoopedDriver& driver, const std::string& channel, const std::string& payload) {
+        Outcome sent;
+        auto query = driver->query(Statement("SELECT pg_notify($1, $2)", channel, payload));
+        track(query, sent);
+        return driver.pump([&]() { return sent.settled; }) && sent.error.empty();
+    }
+
+    /// @brief the listen connection is up and the server answered the channels it was asked to listen to
+    bool listening(PostgresqlConnectionPool& pool, const std::string& channel) {
+        return pool.listener && !pool.listener->broken && !pool.listener->commandActive &&
+        pool.listener->listening.count(channel);
+    }
+
+}
+
+TEST_F(TestSQLLive, TestListenNotify) {
+    using namespace themis;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    auto& pool = driver.pool();
+
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    bool polling = false;
+    auto poll = [&]() {
+        polling = true;
+        q->poll();
+        polling = false;
+    };
+    std::vector<Notification> orders, others;
+    Subscription other = driver->listen("test_others", q, [&](const Notification& n) {
+        others.push_back(n);
+    });
+    {
+        Subscription order = driver->listen("test_orders", q, [&](const Notification& n) {
+            EXPECT_TRUE(polling);
+            orders.push_back(n);
+        });
+        // the listen connection is opened with the first callback
+        ASSERT_TRUE(driver.pump([&]() { return listening(pool, "test_orders") && listening(pool, "test_others"); }));
+
+        // handed to the queue of the callback, it only runs when the queue does
+        ASSERT_TRUE(notify(driver, "test_orders", "42"));
+        driver.pump([]() { return false; }, std::chrono::milliseconds(50));
+        ASSERT_TRUE(orders.empty());
+        ASSERT_TRUE(driver.pump([&]() {
+            poll();
+            return !orders.empty();
+        }));
+        ASSERT_EQ(orders.size(), 1);
+        ASSERT_EQ(orders[0].channel, "test_orders");
+        ASSERT_EQ(orders[0].payload, "42");
+        // sent by a connection of the pool, not the listen connection
+        ASSERT_NE(orders[0].pid, 0);
+        ASSERT_NE(orders[0].pid, PQbackendPID(pool.listener->conn));
+        ASSERT_TRUE(others.empty());
+    }
+
+    // the handle is gone, the channel is unlistened on the driver thread and the other one kept
+    ASSERT_TRUE(driver.pump([&]() {
+        return !pool.listener->commandActive && !pool.listener->listening.count("test_orders");
+    }));
+    ASSERT_FALSE(pool.subscriptions.count("test_orders"));
+    ASSERT_TRUE(pool.subscriptions.count("test_others"));
+    ASSERT_TRUE(listening(pool, "test_others"));
+
+    // notifications arrive in the order they were sent, the first is not delivered
+    ASSERT_TRUE(notify(driver, "test_orders", "43"));
+    ASSERT_TRUE(notify(driver, "test_others", "44"));
+    ASSERT_TRUE(driver.pump([&]() {
+        poll();
+        return !others.empty();
+    }));
+    ASSERT_EQ(others[0].payload, "44");
+    ASSERT_EQ(orders.size(), 1);
+}
+
+TEST_F(TestSQLLive, TestListenReconnect) {
+    using namespace themis;
+    PostgresqlDriver::get()->addConfigToPool(config);
+    LoopedDriver driver;
+    auto& pool = driver.pool();
+
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    std::vector<std::string> payloads;
+    Subscription subscription = driver->listen("test_orders", q, [&](const Notification& n) {
+        payloads.push_back(n.payload);
+    });
+    ASSERT_TRUE(driver.pump([&]() { return listening(pool, "test_orders"); }));
+    int pid = PQbackendPID(pool.listener->conn);
+
+    // the server ends the session of the listen connection
+    Outcome terminated;
+    auto query = driver->query(Statement("SELECT pg_terminate_backend(" + std::to_string(pid) + ")"));
+    track(query, terminated);
+    ASSERT_TRUE(driver.pump([&]() { return terminated.settled; }));
+    ASSERT_EQ(terminated.value, "t");
+    ASSERT_TRUE(driver.pump([&]() { return pool.listener->broken; }));
+
+    // a new connection after the backoff, listening to the channel again
+    ASSERT_TRUE(driver.pump([&]() {
+        return listening(pool, "test_orders") && PQbackendPID(pool.listener->conn) != pid;
+    }));
+    ASSERT_TRUE(notify(driver, "test_orders", "42"));
+    ASSERT_TRUE(driver.pump([&]() {
+        q->poll();
+        return !payloads.empty();
+    }));
+    ASSERT_EQ(payloads.size(), 1);
+    ASSERT_EQ(payloads[0], "42");
+}
+
+TEST(TestSQL, TestStatementCache) {
+    using namespace themis;
+    StatementCacheStats stats;
+    StatementCache cache(2, &stats);
+
+    ASSERT_EQ(cache.find("select 1"), nullptr);
+    std::string first = cache.allocateName();
+    cache.insert("select 1", first);
+    ASSERT_EQ(cache.find("select 2"), nullptr);
+    cache.insert("select 2", cache.allocateName());
+    ASSERT_NE(first, cache.allocateName());
+
+    // touch the first so that the second is the least recently used
+    ASSERT_EQ(*cache.find("select 1"), first);
+    cache.insert("select 3", cache.allocateName());
+    ASSERT_EQ(cache.size(), 2);
+    ASSERT_EQ(cache.find("select 2"), nullptr);
+    ASSERT_NE(cache.find("select 1"), nullptr);
+    ASSERT_TRUE(cache.hasEvicted());
+    ASSERT_EQ(cache.takeEvicted(), std::vector<std::string>{"themis_s1"});
+    ASSERT_FALSE(cache.hasEvicted());
+
+    // prepared again under another name, the old name no longer removes it
+    cache.erase("select 1", "themis_s9");
+    ASSERT_NE(cache.find("select 1"), nullptr);
+    cache.erase("select 1", first);
+    ASSERT_EQ(cache.find("select 1"), nullptr);
+
+    ASSERT_EQ(stats.hits, 3);
+    ASSERT_EQ(stats.misses, 4);
+    ASSERT_EQ(stats.evictions, 1);
+    ASSERT_DOUBLE_EQ(stats.getHitRate(), 3.0 / 7.0);
+}
+
+TEST(TestSQL, TestStatementBind) {
+    using namespace themis;
+    Statement statement("insert into t values ($1, $2, $3, $4, $5, $6)", 42, 0.5, true, "text", std::optional<int>());
+    statement.bind(std::vector<unsigned char>());
+    Statement::ParamBuffers buffers;
+    statement.fillParams(buffers);
+    ASSERT_EQ(statement.getParamCount(), 6);
+    ASSERT_EQ(statement.getTypes(), (std::vector<Oid> {23, 701, 16, 0, 0, 17}));
+    // numbers go in binary, big endian
+    ASSERT_EQ(buffers.formats[0], 1);
+    ASSERT_EQ(std::string(buffers.values[0], buffers.lengths[0]), std::string("\0\0\0\x2a", 4));
+    ASSERT_EQ(buffers.lengths[1], 8);
+    ASSERT_EQ(std::string(buffers.values[2], buffers.lengths[2]), "\x01");
+    // strings go as text, NULL as a null pointer, an empty bytea is not NULL
+    ASSERT_EQ(buffers.formats[3], 0);
+    ASSERT_STREQ(buffers.values[3], "text");
+    ASSERT_EQ(buffers.values[4], nullptr);
+    ASSERT_NE(buffers.values[5], nullptr);
+    ASSERT_EQ(buffers.lengths[5], 0);
+
+    // the same text with other param types is prepared apart
+    std::string key = buffers.key;
+    Statement("insert into t values ($1, $2, $3, $4, $5, $6)", int64_t(42), 0.5, true, "text", std::nullopt, 
+        std::vector<unsigned char>()).fillParams(buffers);
+    ASSERT_NE(key, buffers.key);
+    Statement("select $1", "only text").fillParams(buffers);
+    ASSERT_EQ(buffers.key, "select $1");
+}
+
+TEST(TestSQL, TestPoolSizing) {
+    using namespace themis;
+    DatasourceConfig config;
+    config.getMinConnections() = 2;
+    config.getMaxConnections() = 8;
+    config.getIdleTimeout() = 5;
+    config.getQueueWaitThreshold() = 50;
+    DatasourceConfig copy(config);
+    ASSERT_EQ(copy.getMinConnections(), 2);
+    ASSERT_EQ(copy.getMaxConnections(), 8);
+    ASSERT_EQ(copy.getIdleTimeout(), 5);
+    ASSERT_EQ(copy.getQueueWaitThreshold(), 50);
+
+    // no connection is up, the query fails at once instead of queueing
+    PostgresqlConnectionPool pool;
+    pool.addConfig(copy);
+    std::string error;
+    pool.submit(std::make_shared<Statement>("select 1"), [](std::unique_ptr<PGResultSets>) {}, 
+        [&error](std::unique_ptr<std::exception> e) { error = e->what(); });
+    ASSERT_EQ(error, "all connection in the required pool is down");
+    ASSERT_EQ(pool.getConnectionCount(), 0);
+}
+
+namespace {
+
+    struct Account {
+        int64_t id;
+        std::string_view name;
+        std::optional<double> balance;
+        bool active;
+        themis::Timestamp created;
+        std::vector<unsigned char> avatar;
+        std::vector<std::optional<int>> tags;
+
+        static auto columns() {
+            using themis::column;
+            return std::make_tuple(column("id", &Account::id), column("name", &Account::name), 
+                column("balance", &Account::balance), column("active", &Account::active), 
+                column("created", &Account::created), column("avatar", &Account::avatar), 
+                column("tags", &Account::tags));
+        }
+    };
+
+    /// @brief a result built by hand, as the server would send it
+    PGresult* makeResult(int format, std::vector<std::pair<const char*, Oid>> columns, 
+        std::vector<std::vector<std::optional<std::string>>> rows) {
+        PGresult* result = PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK);
+        std::vector<PGresAttDesc> attrs;
+        for (auto& [name, type]: columns) {
+            attrs.push_back(PGresAttDesc {const_cast<char*>(name), 0, 0, format, type, -1, -1});
+        }
+        PQsetResultAttrs(result, (int)attrs.size(), attrs.data());
+        for (int r = 0; r < (int)rows.size(); r++) {
+            for (int c = 0; c < (int)rows[r].size(); c++) {
+                auto& v = rows[r][c];
+                PQsetvalue(result, r, c, v ? const_cast<char*>(v->data()) : nullptr, v ? (int)v->size() : -1);
+            }
+        }
+        return result;
+    }
+
+    std::string bigEndian(uint64_t v, int bytes) {
+        std::string s;
+        for (int i = bytes - 1; i >= 0; i--) s.push_back(char(v >> (i * 8)));
+        return s;
+    }
+
+}
+
+TEST(TestSQL, TestRowMapperText) {
+    using namespace themis;
+    PGresult* result = makeResult(0, {{"id", 20}, {"name", 25}, {"balance", 701}, {"active", 16}, 
+        {"created", 1184}, {"avatar", 17}, {"tags", 1007}}, {
+        {"1", "alice", "12.5", "t", "2024-01-02 03:04:05.25+02", "\\x0aff", "{1,NULL, 3}"},
+        {"2", "bob", std::nullopt, "f", "1970-01-01 00:00:00", "\\x", "{}"}
+    });
+    auto rows = mapRows<Account>(result);
+    ASSERT_EQ(rows.size(), 2);
+    ASSERT_EQ(rows[0].id, 1);
+    ASSERT_EQ(rows[0].name, "alice");
+    ASSERT_EQ(rows[0].balance, 12.5);
+    ASSERT_TRUE(rows[0].active);
+    ASSERT_EQ(rows[0].created.time_since_epoch().count(), (1704164645LL - 7200) * 1000000 + 250000);
+    ASSERT_EQ(rows[0].avatar, (std::vector<unsigned char> {0x0a, 0xff}));
+    ASSERT_EQ(rows[0].tags, (std::vector<std::optional<int>> {1, std::nullopt, 3}));
+    ASSERT_EQ(rows[1].balance, std::nullopt);
+    ASSERT_FALSE(rows[1].active);
+    ASSERT_EQ(rows[1].created.time_since_epoch().count(), 0);
+    ASSERT_TRUE(rows[1].avatar.empty());
+    ASSERT_TRUE(rows[1].tags.empty());
+
+    // a missing column is found when the mapper is made, a NULL into a plain member when read
+    struct Named { std::string name; };
+    ASSERT_THROW(RowMapper(result, column("missing", &Named::name)), std::runtime_error);
+    struct Balance { double balance; };
+    RowMapper balances(result, column("balance", &Balance::balance));
+    ASSERT_EQ(balances.row(0).balance, 12.5);
+    ASSERT_THROW(balances.row(1), std::runtime_error);
+
+    struct Quoted { std::vector<std::string> words; };
+    PGresult* words = makeResult(0, {{"words", 1009}}, {{"{plain,\"with space\",\"quote \\\" in\",\"NULL\"}"}});
+    ASSERT_EQ(RowMapper(words, column("words", &Quoted::words)).row(0).words, 
+        (std::vector<std::string> {"plain", "with space", "quote \" in", "NULL"}));
+    PQclear(words);
+    PQclear(result);
+}
+
+TEST(TestSQL, TestRowMapperBinary) {
+    using namespace themis;
+    // int4 array of 7 and NULL: one dimension, has nulls, int4 elements, 2 elements from 1
+    std::string tags = bigEndian(1, 4) + bigEndian(1, 4) + bigEndian(23, 4) + bigEndian(2, 4) + bigEndian(1, 4)
+    + bigEndian(4, 4) + bigEndian(7, 4) + bigEndian(0xffffffff, 4);
+    PGresult* result = makeResult(1, {{"id", 23}, {"name", 1043}, {"balance", 700}, {"active", 16}, 
+        {"created", 1114}, {"avatar", 17}, {"tags", 1007}}, {
+        {bigEndian(uint32_t(-5), 4), "carol", bigEndian(std::bit_cast<uint32_t>(0.5f), 4), std::string(1, '\1'), 
+            bigEndian(86400LL * 1000000, 8), std::string("\0\1", 2), tags}
+    });
+    auto rows = mapRows<Account>(result);
+    ASSERT_EQ(rows.size(), 1);
+    ASSERT_EQ(rows[0].id, -5);
+    ASSERT_EQ(rows[0].name, "carol");
+    // the name points into the result, no copy
+    ASSERT_EQ(rows[0].name.data(), PQgetvalue(result, 0, 1));
+    ASSERT_EQ(rows[0].balance, 0.5);
+    ASSERT_TRUE(rows[0].active);
+    ASSERT_EQ(std::chrono::floor<std::chrono::days>(rows[0].created), 
+        std::chrono::sys_days(std::chrono::year_month_day {std::chrono::year(2000), std::chrono::January, std::chrono::day(2)}));
+    ASSERT_EQ(rows[0].avatar, (std::vector<unsigned char> {0, 1}));
+    ASSERT_EQ(rows[0].tags, (std::vector<std::optional<int>> {7, std::nullopt}));
+
+    struct Small { int8_t id; Bytes avatar; };
+    RowMapper small(result, column("id", &Small::id), column("avatar", &Small::avatar));
+    ASSERT_EQ(small.row(0).id, -5);
+    ASSERT_EQ(small.row(0).avatar.size(), 2);
+    // a binary int4 read as text, and a value that does not fit
+    struct Wrong { std::string id; };
+    ASSERT_THROW(RowMapper(result, column("id", &Wrong::id)).row(0), std::runtime_error);
+    struct Unsigned { uint16_t id; };
+    ASSERT_THROW(RowMapper(result, column("id", &Unsigned::id)).row(0), std::runtime_error);
+    PQclear(result);
+}
+
+TEST(TestSQL, TestCopyEncoders) {
+    using namespace themis;
+    CopyTextEncoder text;
+    text.row(1, "a\tb\\c\n", std::nullopt, true, std::optional<double>(0.5));
+    text.row(int64_t(-2), Timestamp(std::chrono::sys_days(std::chrono::year(2000) / 1 / 2)) + std::chrono::microseconds(1500000),
+        std::vector<unsigned char> {0, 255}, std::optional<int>(), Timestamp::max());
+    ASSERT_EQ(text.take(), "1\ta\\tb\\\\c\\n\t\\N\tt\t0.5\n"
+        "-2\t2000-01-02 00:00:01.500000+00\t\\\\x00ff\t\\N\tinfinity\n");
+    ASSERT_EQ(text.size(), 0);
+
+    CopyBinaryEncoder binary;
+    // the header and the trailer come even without rows
+    binary.finish();
+    binary.finish();
+    std::string header("PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0", 19);
+    ASSERT_EQ(binary.take(), header + "\xff\xff");
+
+    CopyBinaryEncoder rows;
+    rows.row(int16_t(1), 2, int64_t(-1), "xy", std::nullopt, false, 0.5f);
+    rows.row(Timestamp(std::chrono::sys_days(std::chrono::year(2000) / 1 / 2)), std::vector<unsigned char> {7});
+    rows.finish();
+    ASSERT_EQ(rows.take(), header 
+        + bigEndian(7, 2) + bigEndian(2, 4) + bigEndian(1, 2) + bigEndian(4, 4) + bigEndian(2, 4) 
+        + bigEndian(8, 4) + bigEndian(uint64_t(-1), 8) + bigEndian(2, 4) + "xy" + bigEndian(0xffffffff, 4) 
+        + bigEndian(1, 4) + std::string(1, '\0') + bigEndian(4, 4) + bigEndian(std::bit_cast<uint32_t>(0.5f), 4)
+        + bigEndian(2, 2) + bigEndian(8, 4) + bigEndian(86400LL * 1000000, 8) + bigEndian(1, 4) + "\7"
+        + "\xff\xff");
+
+    // a range is encoded in chunks, the last one ends the copy
+    std::vector<int> ids(1000);
+    auto source = makeCopySource<CopyTextEncoder>(ids, [](CopyTextEncoder& e, int id) { e.row(id); }, 100);
+    std::string chunk, all;
+    size_t chunks = 0;
+    while(source->read(chunk) == CopySource::Status::DATA) {
+        all += chunk;
+        chunk.clear();
+        chunks++;
+    }
+    ASSERT_EQ(all.size(), 2000);
+    ASSERT_GT(chunks, 10);
+
+    CopyPipe pipe;
+    ASSERT_EQ(pipe.read(chunk), CopySource::Status::WAIT);
+    pipe.write("1\n");
+    ASSERT_EQ(pipe.getQueuedBytes(), 2);
+    pipe.end();
+    ASSERT_EQ(pipe.read(chunk), CopySource::Status::DATA);
+    ASSERT_EQ(chunk, "1\n");
+    ASSERT_EQ(pipe.read(chunk), CopySource::Status::END);
+    CopyPipe failed;
+    failed.write("1\n");
+    failed.fail("the client left");
+    ASSERT_THROW(failed.read(chunk), std::runtime_error);
+}
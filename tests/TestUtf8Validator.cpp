@@ -0,0 +1,43 @@
+#include <gtest/gtest.h>
+#include "utils/Utf8Validator.h"
+#include <string>
+
+static bool validate(const std::string& s) {
+    return themis::Utf8Validator::validate(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+}
+
+TEST(TestUtf8Validator, TestValidate) {
+    using namespace themis;
+    std::string text;
+    for (int i = 0; i < 8; i++) text += "plain ascii, caf\xc3\xa9, \xe4\xb8\xad\xe6\x96\x87, \xf0\x9f\x98\x80 ";
+    ASSERT_TRUE(validate(text));
+    ASSERT_TRUE(validate(""));
+    // lone continuation, overlong, surrogate, above U+10FFFF, truncated
+    for (std::string bad: {"\x80", "\xc0\xaf", "\xe0\x80\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xe4\xb8", "\xff"}) {
+        ASSERT_FALSE(validate(bad));
+        ASSERT_FALSE(validate(text + bad));
+        ASSERT_FALSE(validate(bad + text));
+        ASSERT_FALSE(validate(text + bad + text));
+    }
+}
+
+TEST(TestUtf8Validator, TestIncremental) {
+    using namespace themis;
+    std::string text;
+    for (int i = 0; i < 8; i++) text += "caf\xc3\xa9 \xe4\xb8\xad\xe6\x96\x87 \xf0\x9f\x98\x80 0123456789";
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+    // every split point, including inside characters
+    for (size_t split = 0; split <= text.size(); split++) {
+        Utf8Validator v;
+        ASSERT_TRUE(v.update(data, split));
+        ASSERT_TRUE(v.update(data + split, text.size() - split));
+        ASSERT_TRUE(v.finish());
+    }
+
+    Utf8Validator v;
+    ASSERT_TRUE(v.update(data, 4));
+    ASSERT_FALSE(v.finish());
+    ASSERT_FALSE(v.update(reinterpret_cast<const uint8_t*>("a"), 1));
+    v.reset();
+    ASSERT_TRUE(v.finish());
+}
@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
 #define private public
 #include "web/WebsocketController.h"
+#include "network/ReactorPool.h"
+#include "web/OrderedListener.h"
+#include "web/TopicHub.h"
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
 
 TEST(TestWebsocket, TestCalculateSecKey) {
 
@@ -10,4 +16,401 @@ TEST(TestWebsocket, TestCalculateSecKey) {
     std::string client = "dGhlIHNhbXBsZSBub25jZQ==";
     ASSERT_EQ(mgr.calculateSecKey(client), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
 
-}
\ No newline at end of file
+}
+
+TEST(TestWebsocket, TestShardPolicy) {
+
+    using namespace themis;
+    auto req = std::make_unique<HttpRequest>();
+    std::vector<size_t> loads = {3, 1, 2};
+
+    RoundRobinPolicy rr;
+    ASSERT_EQ(rr.select(req, loads), 0);
+    ASSERT_EQ(rr.select(req, loads), 1);
+    ASSERT_EQ(rr.select(req, loads), 2);
+    ASSERT_EQ(rr.select(req, loads), 0);
+
+    LeastConnectionPolicy lc;
+    ASSERT_EQ(lc.select(req, loads), 1);
+
+    KeyHashPolicy hash("room");
+    req->getParameters().insert({"room", "lobby"});
+    size_t shard = hash.select(req, loads);
+    ASSERT_LT(shard, loads.size());
+    ASSERT_EQ(hash.select(req, loads), shard);
+
+}
+
+/// build a masked client frame
+static std::vector<uint8_t> makeClientFrame(uint8_t opcode, bool fin, const std::string& payload) {
+    uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    std::vector<uint8_t> frame;
+    frame.push_back((fin ? 0x80 : 0) | opcode);
+    frame.push_back(0x80 | (uint8_t) payload.size());
+    frame.insert(frame.end(), mask, mask + 4);
+    for (size_t i = 0; i < payload.size(); i++) {
+        frame.push_back(payload[i] ^ mask[i % 4]);
+    }
+    return frame;
+}
+
+/**
+ * @brief a websocket handler on a session without a socket, the output piles up
+ * in its buffer and the write event never fires
+ * 
+ */
+class TestWebsocketHandler : public ::testing::Test {
+protected:
+    std::unique_ptr<themis::EventQueue> queue;
+    event_base* base = nullptr;
+    std::vector<std::unique_ptr<themis::WebsocketSessionHandler>> handlers;
+    themis::WebsocketSessionHandler* handler = nullptr;
+
+    themis::WebsocketSessionHandler& addHandler() {
+        auto session = std::make_unique<themis::Session>(sockaddr_in(), -1);
+        handlers.push_back(std::make_unique<themis::WebsocketSessionHandler>(session));
+        handlers.back()->getSession()->setWriteEvent(event_new(base, -1, 0, [](evutil_socket_t, short, void*) {}, nullptr));
+        return *handlers.back();
+    }
+
+    /// @brief install a listener of the given type on the handler
+    template<class L, class ...Args>
+    L* listen(themis::WebsocketSessionHandler& h, Args&& ...args) {
+        auto listener = std::make_unique<L>(h, queue, std::forward<Args>(args)...);
+        L* l = listener.get();
+        h.setListener(std::move(listener));
+        return l;
+    }
+
+    void SetUp() override {
+        queue = std::make_unique<themis::EventQueue>();
+        base = event_base_new();
+        handler = &addHandler();
+    }
+
+    void TearDown() override {
+        for (auto& h: handlers) {
+            h->setListener(nullptr);
+            event_free(h->getSession()->getWriteEvent());
+            h->getSession()->setWriteEvent(nullptr);
+        }
+        handlers.clear();
+        event_base_free(base);
+    }
+};
+
+class RecordingListener : public themis::WebsocketSessionHandler::EventListener {
+public:
+    std::vector<std::string> texts;
+    std::string fragments;
+    bool last = false;
+    RecordingListener(themis::WebsocketSessionHandler& handler, const std::unique_ptr<themis::EventQueue>& queue) 
+    : themis::WebsocketSessionHandler::EventListener(handler, queue) {}
+    virtual void onText(themis::WebsocketSessionHandler& handler, const std::string& msg) override {
+        texts.push_back(msg);
+    }
+    virtual void onFragment(themis::WebsocketSessionHandler& handler, bool text, const uint8_t* data, size_t length, bool l) override {
+        fragments.append(reinterpret_cast<const char*>(data), length);
+        last = l;
+    }
+};
+
+TEST_F(TestWebsocketHandler, TestFragmentedMessage) {
+
+    using namespace themis;
+    auto* l = listen<RecordingListener>(*handler);
+
+    BufferWriter writer(handler->getSession()->getInputBuffer());
+    auto f1 = makeClientFrame(0x1, false, "Hel");
+    auto f2 = makeClientFrame(0x0, true, "lo");
+    writer.write(f1.data(), f1.size());
+    writer.write(f2.data(), f2.size() - 1);
+    handler->handleSession();
+    ASSERT_TRUE(l->texts.empty());
+    writer.write(f2.data() + f2.size() - 1, 1);
+    handler->handleSession();
+    ASSERT_EQ(l->texts.size(), 1);
+    ASSERT_EQ(l->texts[0], "Hello");
+
+    // streaming hands out pieces without reassembly
+    handler->setStreaming(true);
+    auto f3 = makeClientFrame(0x1, true, "streamed");
+    writer.write(f3.data(), f3.size());
+    handler->handleSession();
+    ASSERT_EQ(l->fragments, "streamed");
+    ASSERT_TRUE(l->last);
+    ASSERT_EQ(l->texts.size(), 1);
+
+    // frames over the limit fail the session with 1009
+    handler->setMaxFrameSize(4);
+    auto f4 = makeClientFrame(0x2, true, "too long");
+    writer.write(f4.data(), f4.size());
+    handler->handleSession();
+    ASSERT_TRUE(handler->getSession()->isClosing());
+    uint8_t close[4];
+    BufferReader reader(handler->getSession()->getOutputBuffer());
+    ASSERT_EQ(reader.getBytes(close, 4), 4);
+    ASSERT_EQ(close[0], 0x88);
+    ASSERT_EQ((close[2] << 8) | close[3], WebsocketCloseException::MESSAGE_TOO_BIG);
+
+}
+
+class WritabilityListener : public themis::WebsocketSessionHandler::EventListener {
+public:
+    std::vector<bool> changes;
+    WritabilityListener(themis::WebsocketSessionHandler& handler, const std::unique_ptr<themis::EventQueue>& queue) 
+    : themis::WebsocketSessionHandler::EventListener(handler, queue) {}
+    virtual void onWritabilityChanged(themis::WebsocketSessionHandler& handler, bool writable) override {
+        changes.push_back(writable);
+    }
+};
+
+TEST_F(TestWebsocketHandler, TestBackpressure) {
+
+    using namespace themis;
+    auto* l = listen<WritabilityListener>(*handler);
+    handler->setWatermarks(20, 30, 60);
+    handler->setOverflowPolicy(WebsocketSessionHandler::DROP_OLDEST);
+
+    // each message takes 17 bytes once framed
+    for (char c = 'a'; c < 'e'; c++) {
+        handler->getOutputStream() << std::string(15, c);
+        handler->finish(true);
+    }
+    // two messages are framed, the third was dropped for the fourth
+    ASSERT_EQ(handler->getSession()->getOutputBuffer().size(), 34);
+    ASSERT_EQ(handler->pending.size(), 1);
+    ASSERT_EQ(handler->pending.front().data, std::string(15, 'd'));
+    ASSERT_FALSE(handler->isWritable());
+    ASSERT_EQ(l->changes, std::vector<bool>({false}));
+
+    // the peer consumed everything
+    handler->getSession()->getOutputBuffer().reset();
+    handler->handleWritten();
+    ASSERT_TRUE(handler->pending.empty());
+    ASSERT_EQ(handler->getQueuedBytes(), 17);
+    ASSERT_TRUE(handler->isWritable());
+    ASSERT_EQ(l->changes, std::vector<bool>({false, true}));
+
+    // the latest value per key is kept
+    handler->setOverflowPolicy(WebsocketSessionHandler::COALESCE);
+    handler->getOutputStream() << std::string(15, 'e');
+    handler->finish(true);
+    handler->getOutputStream() << "old";
+    handler->finish(true, "price");
+    handler->getOutputStream() << "new";
+    handler->finish(true, "price");
+    ASSERT_EQ(handler->pending.size(), 1);
+    ASSERT_EQ(handler->pending.front().data, "new");
+
+    handler->setOverflowPolicy(WebsocketSessionHandler::DISCONNECT);
+    handler->getOutputStream() << std::string(60, 'f');
+    handler->finish(false);
+    ASSERT_TRUE(handler->getSession()->isClosing());
+    ASSERT_EQ(handler->getQueuedBytes(), 0);
+
+}
+
+TEST(TestWebsocket, TestDisconnectStalledPeer) {
+
+    using namespace themis;
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    evutil_make_socket_nonblocking(fds[0]);
+    evutil_make_socket_nonblocking(fds[1]);
+    Reactor reactor;
+    auto session = std::make_unique<Session>(sockaddr_in(), fds[0]);
+    auto owned = std::make_unique<WebsocketSessionHandler>(session);
+    WebsocketSessionHandler* handler = owned.get();
+    handler->setWatermarks(1 << 16, 1 << 17, 1 << 20);
+    handler->setOverflowPolicy(WebsocketSessionHandler::DISCONNECT);
+    reactor.addSessionHandler(std::move(owned));
+
+    // the peer never reads, the socket fills up and the output piles up behind it
+    std::string message(1 << 16, 'x');
+    for (int i = 0; i < 1000; i++) {
+        handler->getOutputStream() << message;
+        handler->finish(false);
+        if(handler->getSession()->isClosing()) break;
+        reactor.loopOnce();
+        reactor.flush();
+    }
+    ASSERT_TRUE(handler->getSession()->isClosing());
+    ASSERT_TRUE(event_pending(handler->getSession()->getWriteEvent(), EV_WRITE, nullptr));
+
+    // removed at the end of the tick, without waiting for the socket to drain
+    reactor.loopOnce();
+    reactor.flush();
+    ASSERT_EQ(reactor.getSessionCount(), 0);
+    char drained[4096];
+    ssize_t received;
+    while((received = recv(fds[1], drained, sizeof(drained), 0)) > 0);
+    ASSERT_EQ(received, 0);
+    close(fds[1]);
+
+}
+
+TEST(TestWebsocket, TestFlushLatencyWait) {
+
+    using namespace themis;
+    using namespace std::chrono;
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    evutil_make_socket_nonblocking(fds[0]);
+    Reactor reactor;
+    reactor.setFlushLatency(milliseconds(5));
+    ASSERT_EQ(reactor.getIdleWait(milliseconds(10)), milliseconds(10));
+
+    // the handshake is held back, the loop must not sleep past its budget
+    auto session = std::make_unique<Session>(sockaddr_in(), fds[0]);
+    reactor.addSessionHandler(std::make_unique<WebsocketSessionHandler>(session));
+    auto wait = reactor.getIdleWait(milliseconds(10));
+    ASSERT_GT(wait, steady_clock::duration::zero());
+    ASSERT_LE(wait, milliseconds(5));
+    ASSERT_FALSE(reactor.flush());
+    std::this_thread::sleep_for(wait);
+    ASSERT_EQ(reactor.getIdleWait(milliseconds(10)), steady_clock::duration::zero());
+    ASSERT_TRUE(reactor.flush());
+    ASSERT_EQ(reactor.getIdleWait(milliseconds(10)), milliseconds(10));
+
+    // the peer hangs up, the session is removed
+    close(fds[1]);
+    reactor.loopOnce();
+    ASSERT_EQ(reactor.getSessionCount(), 0);
+
+}
+
+TEST_F(TestWebsocketHandler, TestInvalidUtf8) {
+
+    using namespace themis;
+    auto* l = listen<RecordingListener>(*handler);
+
+    // a character split across two frames is fine
+    BufferWriter writer(handler->getSession()->getInputBuffer());
+    auto f1 = makeClientFrame(0x1, false, "caf\xc3");
+    auto f2 = makeClientFrame(0x0, true, "\xa9");
+    writer.write(f1.data(), f1.size());
+    writer.write(f2.data(), f2.size());
+    handler->handleSession();
+    ASSERT_EQ(l->texts.size(), 1);
+    ASSERT_EQ(l->texts[0], "caf\xc3\xa9");
+
+    auto f3 = makeClientFrame(0x1, true, "bad \xc0\xaf");
+    writer.write(f3.data(), f3.size());
+    handler->handleSession();
+    ASSERT_EQ(l->texts.size(), 1);
+    ASSERT_TRUE(handler->getSession()->isClosing());
+    uint8_t close[4];
+    BufferReader reader(handler->getSession()->getOutputBuffer());
+    ASSERT_EQ(reader.getBytes(close, 4), 4);
+    ASSERT_EQ(close[0], 0x88);
+    ASSERT_EQ((close[2] << 8) | close[3], WebsocketCloseException::INVALID_PAYLOAD);
+
+}
+
+TEST_F(TestWebsocketHandler, TestCloseReasonTruncated) {
+
+    using namespace themis;
+    // the limit of 123 bytes falls in the middle of the first euro sign
+    handler->close(WebsocketCloseException::NORMAL_CLOSURE, std::string(121, 'a') + "\xe2\x82\xac\xe2\x82\xac");
+    uint8_t header[4];
+    BufferReader reader(handler->getSession()->getOutputBuffer());
+    ASSERT_EQ(reader.getBytes(header, 4), 4);
+    ASSERT_EQ(header[0], 0x88);
+    ASSERT_EQ(header[1], 2 + 121);
+    std::string reason(121, 0);
+    ASSERT_EQ(reader.getBytes(reinterpret_cast<uint8_t*>(reason.data()), reason.size()), reason.size());
+    ASSERT_EQ(reason, std::string(121, 'a'));
+    ASSERT_TRUE(Utf8Validator::validate(reinterpret_cast<const uint8_t*>(reason.data()), reason.size()));
+
+}
+
+class EchoProcessor : public themis::MessageProcessor {
+public:
+    std::string prefix;
+    EchoProcessor(std::string prefix) : prefix(prefix) {}
+    virtual std::optional<Reply> processText(const std::string& msg) override {
+        // uneven work, a pool without ordering would reorder the replies
+        if(std::stoi(msg) % 3 == 0) std::this_thread::sleep_for(std::chrono::microseconds(200));
+        return Reply{prefix + msg, true};
+    }
+};
+
+TEST_F(TestWebsocketHandler, TestOrderedListener) {
+
+    using namespace themis;
+    auto* l = listen<OrderedListener<EchoProcessor>>(*handler, std::string("echo "));
+
+    constexpr int MESSAGES = 50;
+    BufferWriter writer(handler->getSession()->getInputBuffer());
+    for (int i = 0; i < MESSAGES; i++) {
+        auto frame = makeClientFrame(0x1, true, std::to_string(i));
+        writer.write(frame.data(), frame.size());
+    }
+    handler->handleSession();
+
+    // replies are written on the thread polling the queue of the reactor
+    std::vector<std::string> replies;
+    BufferReader reader(handler->getSession()->getOutputBuffer());
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while(replies.size() < MESSAGES && std::chrono::steady_clock::now() < deadline) {
+        if(!queue->poll()) std::this_thread::yield();
+        uint8_t header[2];
+        while(reader.getBytes(header, 2) == 2) {
+            ASSERT_EQ(header[0], 0x81);
+            std::string payload(header[1], 0);
+            ASSERT_EQ(reader.getBytes(reinterpret_cast<uint8_t*>(payload.data()), payload.size()), payload.size());
+            replies.push_back(payload);
+        }
+    }
+    ASSERT_EQ(replies.size(), MESSAGES);
+    for (int i = 0; i < MESSAGES; i++) {
+        ASSERT_EQ(replies[i], "echo " + std::to_string(i));
+    }
+    ASSERT_EQ(l->getBacklog(), 0);
+
+    // the session is gone, the late reply is dropped
+    auto frame = makeClientFrame(0x1, true, "7");
+    writer.write(frame.data(), frame.size());
+    handler->handleSession();
+    handler->setListener(nullptr);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    queue->poll();
+    ASSERT_EQ(handler->getSession()->getOutputBuffer().size(), 0);
+
+}
+
+TEST_F(TestWebsocketHandler, TestTopicHub) {
+
+    using namespace themis;
+    TopicHub hub;
+    WebsocketSessionHandler& h1 = *handler;
+    WebsocketSessionHandler& h2 = addHandler();
+    listen<TopicListener>(h1, &hub, std::string("orders"));
+    listen<TopicListener>(h2, &hub, std::string("orders"));
+    ASSERT_EQ(hub.getMemberCount("orders"), 2);
+    ASSERT_EQ(hub.publish("prices", "nobody"), 0);
+
+    // written by the thread polling the queue of the reactor
+    ASSERT_EQ(hub.publish("orders", "42"), 2);
+    ASSERT_EQ(h1.getSession()->getOutputBuffer().size(), 0);
+    queue->poll();
+    for (auto* h: {&h1, &h2}) {
+        BufferReader reader(h->getSession()->getOutputBuffer());
+        uint8_t frame[4];
+        ASSERT_EQ(reader.getBytes(frame, 4), 4);
+        ASSERT_EQ(frame[0], 0x81);
+        ASSERT_EQ(frame[1], 2);
+        ASSERT_EQ(std::string(frame + 2, frame + 4), "42");
+    }
+
+    // the session left, the message queued for it is dropped
+    hub.publish("orders", "43");
+    h2.setListener(nullptr);
+    ASSERT_EQ(hub.getMemberCount("orders"), 1);
+    queue->poll();
+    ASSERT_EQ(h1.getSession()->getOutputBuffer().size(), 4);
+    ASSERT_EQ(h2.getSession()->getOutputBuffer().size(), 0);
+    h1.setListener(nullptr);
+    ASSERT_EQ(hub.getMemberCount("orders"), 0);
+}
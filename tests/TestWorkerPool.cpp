@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include "utils/WorkerPool.h"
+#include <thread>
+#include <vector>
+
+TEST(TestWorkerPool, TestOffload) {
+    using namespace themis;
+    std::unique_ptr<EventQueue> q = std::make_unique<EventQueue>();
+    WorkerPool pool(2);
+    std::thread::id caller = std::this_thread::get_id();
+
+    int value = 0;
+    std::string error;
+    bool onCaller = false;
+    auto result = pool.offload(q, []() {
+        int sum = 0;
+        for (int i = 1; i <= 100; i++) sum += i;
+        return sum;
+    });
+    result->then([&](std::unique_ptr<int> v) {
+        value = *v;
+        onCaller = std::this_thread::get_id() == caller;
+    });
+    auto failed = pool.offload(q, []() -> std::string {
+        throw std::runtime_error("too heavy");
+    });
+    failed->then([](std::unique_ptr<std::string> s) {
+        ASSERT_TRUE(false);
+    })->except([&](std::unique_ptr<std::exception> e) {
+        error = e->what();
+    });
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while((value == 0 || error.empty()) && std::chrono::steady_clock::now() < deadline) {
+        if(!q->poll()) std::this_thread::yield();
+    }
+    ASSERT_EQ(value, 5050);
+    ASSERT_TRUE(onCaller);
+    ASSERT_EQ(error, "too heavy");
+}
+
+TEST(TestWorkerPool, TestStealing) {
+    using namespace themis;
+    constexpr int TASKS = 2000;
+    std::atomic<int> done = 0;
+    {
+        WorkerPool pool(4);
+        ASSERT_EQ(pool.getThreadCount(), 4);
+        // all the work is spawned by one worker, the others have to steal it
+        pool.submit([&pool, &done]() {
+            for (int i = 0; i < TASKS; i++) {
+                pool.submit([&done]() {
+                    volatile int spin = 0;
+                    for (int j = 0; j < 1000; j++) spin = spin + j;
+                    ++done;
+                });
+            }
+            ++done;
+        });
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while(done < TASKS + 1 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_EQ(done, TASKS + 1);
+        ASSERT_EQ(pool.getPendingCount(), 0);
+        for (size_t i = 0; i < pool.getThreadCount(); i++) {
+            ASSERT_EQ(pool.getQueueDepth(i), 0);
+        }
+        // a task is counted once it returned
+        while(pool.getExecutedCount() < TASKS + 1) std::this_thread::yield();
+        ASSERT_LE(pool.getStolenCount(), TASKS);
+
+        // whatever is submitted before the pool is freed still runs
+        for (int i = 0; i < 100; i++) {
+            pool.submit([&done]() { ++done; });
+        }
+    }
+    ASSERT_EQ(done, TASKS + 101);
+}
+
+TEST(TestWorkerPool, TestSharedPool) {
+    using namespace themis;
+    // the first calls race, they all get the same pool
+    std::vector<WorkerPool*> seen(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < seen.size(); i++) {
+        threads.emplace_back([&seen, i]() {
+            seen[i] = &WorkerPool::get();
+        });
+    }
+    for (auto& t: threads) t.join();
+    for (auto* p: seen) ASSERT_EQ(p, seen[0]);
+    ASSERT_GE(seen[0]->getThreadCount(), 1);
+    // the count only applies before the pool is started
+    ASSERT_THROW(WorkerPool::configure(2), std::runtime_error);
+}
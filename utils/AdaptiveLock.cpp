@@ -0,0 +1,82 @@
+#include "AdaptiveLock.h"
+#include <algorithm>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    /// @brief tell the core we are spinning, so the sibling hyper-thread gets the pipeline
+    inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    /// @brief sleep while the word still holds the value
+    inline void park(std::atomic<uint32_t>& word, uint32_t value) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+#else
+        word.wait(value, std::memory_order_relaxed);
+#endif
+    }
+
+    inline void unpark(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+        word.notify_one();
+#endif
+    }
+
+}
+
+void themis::AdaptiveLock::lockContended() {
+    LockStats* s = stats.load(std::memory_order_relaxed);
+    uint64_t spins = 0;
+    unsigned pauses = 1;
+    for (unsigned round = 0; round < SPIN_ROUNDS; round++) {
+        for (unsigned i = 0; i < pauses; i++) cpuRelax();
+        spins += pauses;
+        pauses = std::min(pauses * 2, MAX_PAUSES);
+        // only try when it looks free, a failed exchange steals the cache line from the owner
+        uint32_t expected = 0;
+        if(state.load(std::memory_order_relaxed) == 0 &&
+        state.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            if(s) {
+                s->acquisitions.fetch_add(1, std::memory_order_relaxed);
+                s->contended.fetch_add(1, std::memory_order_relaxed);
+                s->spins.fetch_add(spins, std::memory_order_relaxed);
+            }
+            return;
+        }
+    }
+
+    // the owner is busy for a while, sleep until it unlocks
+    auto begin = s ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    // we may leave other sleepers behind, so take the lock in the waited state
+    while(state.exchange(2, std::memory_order_acquire) != 0) {
+        park(state, 2);
+    }
+    if(s) {
+        s->acquisitions.fetch_add(1, std::memory_order_relaxed);
+        s->contended.fetch_add(1, std::memory_order_relaxed);
+        s->spins.fetch_add(spins, std::memory_order_relaxed);
+        s->parks.fetch_add(1, std::memory_order_relaxed);
+        s->parkNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count(), std::memory_order_relaxed);
+    }
+}
+
+void themis::AdaptiveLock::wake() {
+    unpark(state);
+}
@@ -0,0 +1,117 @@
+#ifndef AdaptiveLock_h
+#define AdaptiveLock_h 1
+
+#include <atomic>
+#include <cstdint>
+
+namespace themis
+{
+
+    /**
+     * @brief contention statistics of one or several locks, attach it with
+     * AdaptiveLock::setStats. counting costs a few atomic increments per acquisition,
+     * so locks count nothing unless stats are attached
+     *
+     */
+    struct LockStats {
+        std::atomic<uint64_t> acquisitions = 0;
+        /// @brief acquisitions that did not get the lock on the first try
+        std::atomic<uint64_t> contended = 0;
+        /// @brief pause instructions executed while spinning
+        std::atomic<uint64_t> spins = 0;
+        /// @brief acquisitions that had to sleep
+        std::atomic<uint64_t> parks = 0;
+        std::atomic<uint64_t> parkNanoseconds = 0;
+
+        /// @brief a plain copy of the counters, to export
+        struct Snapshot {
+            uint64_t acquisitions;
+            uint64_t contended;
+            uint64_t spins;
+            uint64_t parks;
+            uint64_t parkNanoseconds;
+        };
+
+        Snapshot snapshot() const {
+            return {
+                acquisitions.load(std::memory_order_relaxed),
+                contended.load(std::memory_order_relaxed),
+                spins.load(std::memory_order_relaxed),
+                parks.load(std::memory_order_relaxed),
+                parkNanoseconds.load(std::memory_order_relaxed)
+            };
+        }
+
+        void reset() {
+            acquisitions = 0;
+            contended = 0;
+            spins = 0;
+            parks = 0;
+            parkNanoseconds = 0;
+        }
+    };
+
+    /**
+     * @brief a lock that spins for a short, bounded time with exponential backoff of
+     * pause instructions, then sleeps on a futex until the owner wakes it up.
+     * short critical sections (a queue push) are taken while spinning, a long one
+     * (the libpq io of the driver loop) no longer keeps the waiting threads busy.
+     * the state is 0 unlocked, 1 locked, 2 locked and someone may sleep, the owner
+     * only makes the wake up system call in the last case.
+     * meets the Lockable requirements, use it with std::lock_guard
+     *
+     */
+    class AdaptiveLock {
+    public:
+        /// @brief spinning rounds before sleeping, the pauses double every round
+        static constexpr unsigned SPIN_ROUNDS = 10;
+        static constexpr unsigned MAX_PAUSES = 64;
+
+    private:
+        std::atomic<uint32_t> state = 0;
+        std::atomic<LockStats*> stats = nullptr;
+
+        void lockContended();
+        void wake();
+
+    public:
+        AdaptiveLock() = default;
+        AdaptiveLock(const AdaptiveLock&) = delete;
+        AdaptiveLock& operator=(const AdaptiveLock&) = delete;
+
+        void lock() {
+            uint32_t expected = 0;
+            if(state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                LockStats* s = stats.load(std::memory_order_relaxed);
+                if(s) s->acquisitions.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            lockContended();
+        }
+
+        bool try_lock() {
+            uint32_t expected = 0;
+            if(!state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) return false;
+            LockStats* s = stats.load(std::memory_order_relaxed);
+            if(s) s->acquisitions.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        void unlock() {
+            if(state.exchange(0, std::memory_order_release) == 2) wake();
+        }
+
+        /**
+         * @brief count the acquisitions of this lock into the stats, the stats must
+         * outlive the lock or be detached first
+         *
+         * @param s the stats, nullptr to stop counting
+         */
+        void setStats(LockStats* s) {
+            stats.store(s, std::memory_order_relaxed);
+        }
+    };
+
+} // namespace themis
+
+#endif
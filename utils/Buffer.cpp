@@ -1,5 +1,6 @@
 #include "Buffer.h"
 #include <unistd.h>
+#include <sys/uio.h>
 #include <cstring>
 
 void themis::Buffer::allocateChunk() {
@@ -82,27 +83,46 @@ bool themis::BufferReader::sendTo(evutil_socket_t socket) {
             buffer.readIndex = 0;
         }
 
-        // there are no more data in this buffer
-        if(current == buffer.chunks.end() ||
-        (current == --buffer.chunks.end() && buffer.readIndex == buffer.writeIndex)) return false;
-
-        size_t sendSize;
-        if(current == --buffer.chunks.end()) {
-            // last chunk
-            sendSize = buffer.writeIndex - buffer.readIndex;
-        } else {
-            sendSize = buffer.SIZE_PER_CHUNK - buffer.readIndex;
+        // gather the chunks into a single write
+        iovec vec[MAX_IOVEC];
+        int count = 0;
+        size_t total = 0;
+        size_t index = buffer.readIndex;
+        for(auto it = current; it != buffer.chunks.end() && count < MAX_IOVEC; ++it) {
+            size_t end = it == --buffer.chunks.end() ? buffer.writeIndex : buffer.SIZE_PER_CHUNK;
+            if(end > index) {
+                vec[count].iov_base = (*it).data() + index;
+                vec[count].iov_len = end - index;
+                total += end - index;
+                ++count;
+            }
+            index = 0;
         }
-        ssize_t result = write(socket, (*current).data() + buffer.readIndex, sendSize);
-        if(result != sendSize) {
-            if(result == -1 && errno != EAGAIN) throw std::exception();
 
+        // there are no more data in this buffer
+        if(total == 0) return false;
+
+        ssize_t result = writev(socket, vec, count);
+        if(result == -1) {
+            if(errno != EAGAIN) throw std::exception();
             // send again later
-            buffer.readIndex += sendSize;
             return true;
         }
-       
-        buffer.readIndex += result;
+
+        // skip what the socket has taken
+        for(size_t remain = result; remain > 0; ) {
+            if(buffer.readIndex == buffer.SIZE_PER_CHUNK) {
+                ++current;
+                buffer.readIndex = 0;
+            }
+            size_t end = current == --buffer.chunks.end() ? buffer.writeIndex : buffer.SIZE_PER_CHUNK;
+            size_t s = end - buffer.readIndex > remain ? remain : end - buffer.readIndex;
+            buffer.readIndex += s;
+            remain -= s;
+        }
+
+        // the socket is full, send again later
+        if((size_t) result < total) return true;
     }
     return false;
 }
@@ -200,14 +220,36 @@ size_t themis::BufferReader::getBytes(void *dest, size_t count) {
     return acquired;
 }
 
+size_t themis::BufferReader::getSpan(uint8_t **dest, size_t count) {
+    if(buffer.readIndex == buffer.SIZE_PER_CHUNK) {
+        ++current;
+        buffer.readIndex = 0;
+    }
+
+    if(current == buffer.chunks.end() ||
+    (current == --buffer.chunks.end() && buffer.readIndex == buffer.writeIndex)) return 0;
+
+    size_t available;
+    if(current == --buffer.chunks.end()) {
+        // last chunk
+        available = buffer.writeIndex - buffer.readIndex;
+    } else {
+        available = buffer.SIZE_PER_CHUNK - buffer.readIndex;
+    }
+    size_t s = available > count ? count : available;
+    *dest = (*current).data() + buffer.readIndex;
+    buffer.readIndex += s;
+    return s;
+}
+
 void themis::BufferReader::revert() {
     current = buffer.chunks.begin();
     buffer.readIndex = originalReadIndex;
 }
 
 void themis::BufferReader::finialize() {
-    // otherwise 
+    // the consumed bytes can no longer be reverted
+    originalReadIndex = buffer.readIndex;
     if(current == buffer.chunks.begin()) return;
     buffer.chunks.erase(buffer.chunks.begin(), current);
-    originalReadIndex = buffer.readIndex;
 }
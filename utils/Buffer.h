@@ -62,6 +62,27 @@ namespace themis {
         void clear() {
             chunks.clear();
         }
+
+        /**
+         * @brief drop all data and keep a single empty chunk, 
+         * the buffer can be used again afterwards
+         * 
+         */
+        void reset() {
+            chunks.clear();
+            readIndex = writeIndex = 0;
+            allocateChunk();
+        }
+
+        /**
+         * @brief get the number of bytes not yet consumed
+         * 
+         * @return size_t 
+         */
+        size_t size() {
+            if(chunks.empty()) return 0;
+            return (chunks.size() - 1) * SIZE_PER_CHUNK + writeIndex - readIndex;
+        }
     };
 
     /**
@@ -114,6 +135,8 @@ namespace themis {
 
         size_t originalReadIndex;
         Buffer::ChunkIterator current; // the chunk being currently consumed
+        /// @brief max number of chunks gathered into one write
+        const static int MAX_IOVEC = 64;
     public:
         /**
          * @brief Destroy the Buffer Reader means the buffer chunk consumed will be remove 
@@ -129,7 +152,8 @@ namespace themis {
         BufferReader(Buffer& b);
 
         /**
-         * @brief send out as much bytes as possible from this buffer
+         * @brief send out as much bytes as possible from this buffer, 
+         * gathering the chunks into as few writes as possible
          * 
          * @param socket target socket
          * @return true if should send again
@@ -162,6 +186,18 @@ namespace themis {
          */
         size_t getBytes(void* dest, size_t count);
 
+        /**
+         * @brief acquire up to @param count bytes without copying, the bytes are the 
+         * longest contiguous region from the current read position inside one chunk,
+         * and the read position is advanced past them. 
+         * the region stays valid until the reader is finialized
+         * 
+         * @param dest set to the beginning of the region
+         * @param count max number of bytes
+         * @return size_t size of the region, 0 if there are no more data
+         */
+        size_t getSpan(uint8_t** dest, size_t count);
+
         /**
          * @brief reset current chunk and read position
          * 
@@ -0,0 +1,135 @@
+#ifndef Callback_h
+#define Callback_h 1
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <functional>
+
+namespace themis
+{
+
+    /**
+     * @brief a move-only void() callable with inline storage. functors that fit in
+     * INLINE_SIZE bytes (a lambda capturing a few pointers or unique_ptrs) are stored
+     * in place, larger ones fall back to the heap. unlike std::function the functor
+     * does not need to be copyable, and moving a callback never allocates
+     *
+     */
+    class Callback {
+    public:
+        static constexpr size_t INLINE_SIZE = 48;
+
+    private:
+        /// @brief type erased operations of the stored functor
+        struct Operations {
+            void (*invoke)(void* storage);
+            /// @brief move construct the functor into dest and destroy the source
+            void (*relocate)(void* dest, void* src);
+            void (*destroy)(void* storage);
+        };
+
+        template<typename F>
+        static constexpr bool fitsInline = sizeof(F) <= INLINE_SIZE
+            && alignof(F) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<F>;
+
+        template<typename F>
+        struct InlineOperations {
+            static void invoke(void* s) { (*static_cast<F*>(s))(); }
+            static void relocate(void* d, void* s) {
+                new (d) F(std::move(*static_cast<F*>(s)));
+                static_cast<F*>(s)->~F();
+            }
+            static void destroy(void* s) { static_cast<F*>(s)->~F(); }
+            static constexpr Operations table = {invoke, relocate, destroy};
+        };
+
+        template<typename F>
+        struct HeapOperations {
+            static F*& pointer(void* s) { return *static_cast<F**>(s); }
+            static void invoke(void* s) { (*pointer(s))(); }
+            static void relocate(void* d, void* s) { new (d) F*(pointer(s)); }
+            static void destroy(void* s) { delete pointer(s); }
+            static constexpr Operations table = {invoke, relocate, destroy};
+        };
+
+        alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+        const Operations* ops = nullptr;
+
+        void moveFrom(Callback& other) noexcept {
+            if(other.ops) {
+                other.ops->relocate(storage, other.storage);
+                ops = other.ops;
+                other.ops = nullptr;
+            }
+        }
+
+    public:
+        Callback() = default;
+
+        template<typename F, typename D = std::decay_t<F>,
+            typename = std::enable_if_t<!std::is_same_v<D, Callback> && std::is_invocable_v<D&>>>
+        Callback(F&& f) {
+            if constexpr (fitsInline<D>) {
+                new (storage) D(std::forward<F>(f));
+                ops = &InlineOperations<D>::table;
+            } else {
+                new (storage) D*(new D(std::forward<F>(f)));
+                ops = &HeapOperations<D>::table;
+            }
+        }
+
+        Callback(Callback&& other) noexcept {
+            moveFrom(other);
+        }
+
+        Callback& operator=(Callback&& other) noexcept {
+            if(this != &other) {
+                reset();
+                moveFrom(other);
+            }
+            return *this;
+        }
+
+        Callback(const Callback&) = delete;
+        Callback& operator=(const Callback&) = delete;
+
+        ~Callback() {
+            reset();
+        }
+
+        /**
+         * @brief destroy the stored functor, if any
+         *
+         */
+        void reset() {
+            if(ops) {
+                ops->destroy(storage);
+                ops = nullptr;
+            }
+        }
+
+        void operator()() {
+            if(!ops) throw std::bad_function_call();
+            ops->invoke(storage);
+        }
+
+        explicit operator bool() const {
+            return ops != nullptr;
+        }
+
+        /**
+         * @brief check if a functor of type F would be stored without allocation
+         *
+         */
+        template<typename F>
+        static constexpr bool isInline() {
+            return fitsInline<std::decay_t<F>>;
+        }
+    };
+
+} // namespace themis
+
+#endif
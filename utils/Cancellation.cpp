@@ -0,0 +1,49 @@
+#include "Cancellation.h"
+#include <mutex>
+
+themis::CancellationToken themis::CancellationToken::create(Clock::time_point deadline) {
+    CancellationToken token;
+    token.state = std::make_shared<State>();
+    token.state->deadline = deadline;
+    return token;
+}
+
+void themis::CancellationToken::cancel() const {
+    if(!state.get()) return;
+    std::vector<std::pair<size_t, std::function<void ()>>> callbacks;
+    {
+        std::lock_guard<AdaptiveLock> lock(state->lock);
+        if(state->cancelled.exchange(true, std::memory_order_acq_rel)) return;
+        callbacks.swap(state->callbacks);
+    }
+    // run outside the lock, the callbacks may unsubscribe
+    for (auto& c: callbacks) {
+        c.second();
+    }
+}
+
+size_t themis::CancellationToken::subscribe(std::function<void ()> fn) const {
+    if(!state.get()) return 0;
+    {
+        std::lock_guard<AdaptiveLock> lock(state->lock);
+        if(!state->cancelled.load(std::memory_order_relaxed)) {
+            size_t id = state->nextId++;
+            state->callbacks.emplace_back(id, std::move(fn));
+            return id;
+        }
+    }
+    fn();
+    return 0;
+}
+
+void themis::CancellationToken::unsubscribe(size_t id) const {
+    if(!state.get() || id == 0) return;
+    std::lock_guard<AdaptiveLock> lock(state->lock);
+    auto& callbacks = state->callbacks;
+    for (auto it = callbacks.begin(); it != callbacks.end(); it++) {
+        if(it->first == id) {
+            callbacks.erase(it);
+            return;
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef Cancellation_h
+#define Cancellation_h 1
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "AdaptiveLock.h"
+
+namespace themis
+{
+
+    /**
+     * @brief thrown through a promise chain when the deadline of the request expired
+     *
+     */
+    class TimeoutException : public std::runtime_error {
+    public:
+        TimeoutException(const std::string& what) : std::runtime_error(what) {}
+    };
+
+    /**
+     * @brief thrown through a promise chain when the work was cancelled
+     *
+     */
+    class CancelledException : public std::runtime_error {
+    public:
+        CancelledException(const std::string& what) : std::runtime_error(what) {}
+    };
+
+    /**
+     * @brief a cancellation token is shared by all the work done for one request,
+     * copies of the token refer to the same state. cancelling runs the subscribed
+     * callbacks once, on the cancelling thread, so subscribers should only hand the
+     * work over to their own thread. an empty (default constructed) token is never
+     * cancelled
+     *
+     */
+    class CancellationToken {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+    private:
+        struct State {
+            std::atomic<bool> cancelled = false;
+            AdaptiveLock lock;
+            std::vector<std::pair<size_t, std::function<void ()>>> callbacks;
+            size_t nextId = 1;
+            Clock::time_point deadline = Clock::time_point::max();
+        };
+        std::shared_ptr<State> state;
+
+    public:
+        CancellationToken() = default;
+
+        /**
+         * @brief create a new token that can be cancelled
+         *
+         * @param deadline the time the work should be done by, informational
+         * @return CancellationToken token
+         */
+        static CancellationToken create(Clock::time_point deadline = Clock::time_point::max());
+
+        /**
+         * @brief cancel the work, the callbacks run on this thread before this returns.
+         * cancelling twice does nothing
+         *
+         */
+        void cancel() const;
+
+        bool isCancelled() const {
+            return state.get() && state->cancelled.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief get the deadline given on creation
+         *
+         * @return Clock::time_point the deadline, or time_point::max() if there is none
+         */
+        Clock::time_point getDeadline() const {
+            return state.get() ? state->deadline : Clock::time_point::max();
+        }
+
+        /**
+         * @brief call fn once the token is cancelled, or right now if it already is
+         *
+         * @param fn callback
+         * @return size_t id to unsubscribe with, 0 if fn already ran or the token is empty
+         */
+        size_t subscribe(std::function<void ()> fn) const;
+
+        /**
+         * @brief remove a callback that has not run yet
+         *
+         * @param id the id returned by subscribe
+         */
+        void unsubscribe(size_t id) const;
+
+        explicit operator bool() const {
+            return state.get() != nullptr;
+        }
+    };
+
+} // namespace themis
+
+#endif
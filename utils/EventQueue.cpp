@@ -1,26 +1,42 @@
 #include "EventQueue.h"
-#include "Spinlock.h"
+#include <stdexcept>
 #include <ng-log/logging.h>
 
+themis::EventQueue::EventQueue(size_t capacity)
+: bounded(std::make_unique<BoundedMpscQueue<CallbackFunction>>(capacity)) {}
 
 void themis::EventQueue::addImmediate(CallbackFunction fn) {
-    Spinlock l(immediate.f);
-    immediate.callbacks.push(fn);
-}
-
-bool themis::EventQueue::poll() {
-    bool busy = true;
-    // try immediate quue
-    Spinlock lock(immediate.f, true);
-    busy |= immediate.callbacks.empty();
-    for(;;) {
-        lock.lock();
-        if(immediate.callbacks.empty()) return busy;
-        auto p = immediate.callbacks.front();
-        immediate.callbacks.pop();
-        lock.unlock();
-        // if not unlocked before calling user callback, 
-        // there will be deadlock if user call addImmediate
+    if(!bounded.get()) {
+        immediate.push(std::move(fn));
+        return;
+    }
+    for (size_t attempt = 0; !bounded->tryPush(std::move(fn)); attempt++) {
+        // the queue is full, only the polling thread can make room
+        if(consumer.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+            throw std::runtime_error("event queue is full, events can not be added from the polling thread");
+        }
+        // yield a few times, then back off so that the polling thread gets the cpu
+        if(attempt < 16) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+bool themis::EventQueue::tryAddImmediate(CallbackFunction &fn) {
+    if(!bounded.get()) {
+        immediate.push(std::move(fn));
+        return true;
+    }
+    return bounded->tryPush(std::move(fn));
+}
+
+namespace {
+
+    /// @brief the queue the thread is polling, if any
+    thread_local const themis::EventQueue* pollingQueue = nullptr;
+    /// @brief how many dispatched callbacks are running inline on this thread
+    thread_local size_t inlineDepth = 0;
+
+    void runCallback(themis::Callback& p) {
         try
         {
             p();
@@ -30,5 +46,95 @@ bool themis::EventQueue::poll() {
             LOG(WARNING) << "an uncaught exception happened in the event queue, do not do this otherwise there might be unhandled exception";
         }
     }
-    return busy;
+
+} // namespace
+
+void themis::EventQueue::dispatch(CallbackFunction fn) {
+    if(pollingQueue != this || inlineDepth >= MAX_INLINE_DEPTH) {
+        addImmediate(std::move(fn));
+        return;
+    }
+    ++inlineDepth;
+    runCallback(fn);
+    --inlineDepth;
+}
+
+bool themis::EventQueue::isPolling() const {
+    return pollingQueue == this;
+}
+
+themis::TimerHandle themis::EventQueue::addTimer(Clock::duration delay, Clock::duration interval, CallbackFunction fn) {
+    auto state = std::make_shared<TimerHandle::State>();
+    state->fn = std::move(fn);
+    state->interval = interval;
+    Clock::time_point deadline = Clock::now() + delay;
+    // the heap belongs to the polling thread
+    addImmediate([this, deadline, state]() {
+        if(state->cancelled) return;
+        timers.push({deadline, timerSequence++, state});
+    });
+    return TimerHandle(std::move(state));
+}
+
+themis::TimerHandle themis::EventQueue::addInterval(Clock::duration interval, CallbackFunction fn) {
+    if(interval <= Clock::duration::zero()) throw std::invalid_argument("interval must be positive");
+    return addTimer(interval, interval, std::move(fn));
+}
+
+size_t themis::EventQueue::runTimers(size_t maxBatch) {
+    size_t count = 0;
+    Clock::time_point now = Clock::now();
+    while(count < maxBatch && !timers.empty() && timers.top().deadline <= now) {
+        Timer timer = timers.top();
+        timers.pop();
+        auto& state = timer.state;
+        // cancelled timers are dropped lazily when they reach the top
+        if(state->cancelled) continue;
+        ++count;
+        if(state->interval == Clock::duration::zero()) {
+            state->fired = true;
+            runCallback(state->fn);
+            // release whatever the callback captured
+            state->fn.reset();
+            continue;
+        }
+        runCallback(state->fn);
+        if(state->cancelled) continue;
+        timer.deadline += state->interval;
+        if(timer.deadline <= now) {
+            // the loop fell behind, skip the missed ticks
+            timer.deadline = now + state->interval;
+        }
+        timer.sequence = timerSequence++;
+        timers.push(std::move(timer));
+    }
+    return count;
+}
+
+themis::EventQueue::Clock::duration themis::EventQueue::getIdleWait(Clock::duration maxWait) {
+    // drop cancelled timers so they do not cut the sleep short
+    while(!timers.empty() && timers.top().state->cancelled) timers.pop();
+    if(timers.empty()) return maxWait;
+    Clock::duration wait = timers.top().deadline - Clock::now();
+    if(wait < Clock::duration::zero()) return Clock::duration::zero();
+    return wait < maxWait ? wait : maxWait;
+}
+
+bool themis::EventQueue::poll(size_t maxBatch) {
+    consumer.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    // a callback may poll another queue, restore the outer one afterwards
+    const EventQueue* outer = pollingQueue;
+    pollingQueue = this;
+    size_t count = 0;
+    CallbackFunction p;
+    // drain without any lock, the callbacks are free to add new events
+    while(count < maxBatch && tryPop(p)) {
+        ++count;
+        runCallback(p);
+        p.reset();
+    }
+    // the timers added by the callbacks above are already in the heap
+    count += runTimers(maxBatch);
+    pollingQueue = outer;
+    return count > 0;
 }
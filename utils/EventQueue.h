@@ -2,48 +2,212 @@
 #define EventQueue_h 1
 
 #include <functional>
-#include <queue>
 #include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <queue>
+#include <vector>
+#include "Callback.h"
+#include "MpscQueue.h"
 
 namespace themis
 {
 
     /**
-     * @brief a event queue is a queue that accept events and provide events 
-     * there are multiple inner queues, when an event is added to queue, 
-     * main thread should poll and run its callback
+     * @brief a handle to a timed or interval event, used to cancel it.
+     * handles can be copied, and cancelled from any thread
+     *
+     */
+    class TimerHandle {
+    private:
+        friend class EventQueue;
+
+        struct State {
+            Callback fn;
+            /// @brief zero for a one-shot timeout
+            std::chrono::steady_clock::duration interval;
+            std::atomic<bool> cancelled = false;
+            /// @brief a one-shot timeout has run
+            std::atomic<bool> fired = false;
+        };
+        std::shared_ptr<State> state;
+
+        TimerHandle(std::shared_ptr<State> state) : state(std::move(state)) {}
+
+    public:
+        TimerHandle() = default;
+
+        /**
+         * @brief stop the timer, the callback will not run after the polling thread
+         * sees the cancellation. cancelling from inside the callback stops an interval
+         *
+         */
+        void cancel() {
+            if(state.get()) state->cancelled = true;
+        }
+
+        /**
+         * @brief check if the timer may still run
+         *
+         * @return true if it is neither cancelled nor a timeout that has fired
+         */
+        bool isActive() const {
+            return state.get() && !state->cancelled && !state->fired;
+        }
+    };
+
+    /**
+     * @brief a event queue is a queue that accept events and provide events
+     * there are multiple inner queues, when an event is added to queue,
+     * main thread should poll and run its callback.
+     * any thread can add events, only one thread (the owner of the queue) should poll.
+     * the queue is lock-free, unbounded by default or bounded if a capacity is given.
+     * timed and interval events are kept in a heap owned by the polling thread, a poll
+     * only looks at the earliest deadline so waiting timers cost nothing
      */
     class EventQueue {
+    public:
+        using CallbackFunction = Callback;
+        using Clock = std::chrono::steady_clock;
+
+        /// @brief the default number of callbacks run by one poll
+        static constexpr size_t DEFAULT_BATCH = 1024;
+        /// @brief how deep dispatch may nest inline callbacks before falling back to the queue
+        static constexpr size_t MAX_INLINE_DEPTH = 16;
+
     private:
-        using CallbackFunction = std::function<void ()>;
+        MpscQueue<CallbackFunction> immediate;
+        /// @brief used instead of the unbounded queue if a capacity is given
+        std::unique_ptr<BoundedMpscQueue<CallbackFunction>> bounded;
+        /// @brief the thread that polled last, a full bounded queue must not wait on itself
+        std::atomic<std::thread::id> consumer;
+
+        struct Timer {
+            Clock::time_point deadline;
+            /// @brief keeps timers with the same deadline in the order they were added
+            uint64_t sequence;
+            std::shared_ptr<TimerHandle::State> state;
 
-        struct ImmediateQueue {
-            std::atomic_flag f;
-            std::queue<CallbackFunction> callbacks;
-        } immediate;
+            bool operator>(const Timer& other) const {
+                return deadline != other.deadline ? deadline > other.deadline : sequence > other.sequence;
+            }
+        };
+        /// @brief only touched by the polling thread
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+        uint64_t timerSequence = 0;
+
+        bool tryPop(CallbackFunction& fn) {
+            return bounded.get() ? bounded->tryPop(fn) : immediate.tryPop(fn);
+        }
+
+        /**
+         * @brief hand the timer over to the polling thread
+         *
+         */
+        TimerHandle addTimer(Clock::duration delay, Clock::duration interval, CallbackFunction fn);
+
+        /**
+         * @brief run the timers that are due
+         *
+         * @return size_t number of timers that ran
+         */
+        size_t runTimers(size_t maxBatch);
 
     public:
         /**
-         * @brief add a callback to the immediate queue, 
-         * this callback will be invoked once next poll happen
-         * 
+         * @brief Construct a new unbounded Event Queue
+         *
+         */
+        EventQueue() = default;
+
+        /**
+         * @brief Construct a new bounded Event Queue, no allocation happens when
+         * adding events to a bounded queue
+         *
+         * @param capacity the maximum number of pending events, rounded up to a power of two
+         */
+        explicit EventQueue(size_t capacity);
+
+        /**
+         * @brief add a callback to the immediate queue,
+         * this callback will be invoked once next poll happen.
+         * if the queue is bounded and full, wait for the polling thread to make room
+         *
          * @param fn function
-         * @param e function to run when exception occured in function fn
+         * @throw std::runtime_error if the queue is full and this is the polling thread
          */
         void addImmediate(CallbackFunction fn);
 
         /**
-         * @brief poll and run all active events
-         * 
+         * @brief add a callback if there is room for it, never waits
+         *
+         * @param fn function, left untouched if the queue is full
+         * @return true if added
+         * @return false the bounded queue is full
+         */
+        bool tryAddImmediate(CallbackFunction& fn);
+
+        /**
+         * @brief run the callback right away if the calling thread is inside poll of this
+         * queue and the inline nesting is shallow, otherwise add it like addImmediate.
+         * use this for continuations that would only take a pointless trip through the queue
+         *
+         * @param fn function
+         */
+        void dispatch(CallbackFunction fn);
+
+        /**
+         * @brief check if the calling thread is running a callback of this queue
+         *
+         */
+        bool isPolling() const;
+
+        /**
+         * @brief run the callback once after the delay, can be called from any thread.
+         * the callback runs in poll, so it is late by at most one loop
+         *
+         * @param delay delay
+         * @param fn function
+         * @return TimerHandle handle to cancel the timeout
+         */
+        TimerHandle addTimeout(Clock::duration delay, CallbackFunction fn) {
+            return addTimer(delay, Clock::duration::zero(), std::move(fn));
+        }
+
+        /**
+         * @brief run the callback every interval until cancelled, can be called from any thread.
+         * ticks missed because the loop was busy are skipped, not run in a burst
+         *
+         * @param interval interval, the first run is one interval from now
+         * @param fn function
+         * @return TimerHandle handle to cancel the interval
+         */
+        TimerHandle addInterval(Clock::duration interval, CallbackFunction fn);
+
+        /**
+         * @brief how long the polling thread may sleep without delaying a timer,
+         * only the polling thread can call this
+         *
+         * @param maxWait the longest sleep wanted
+         * @return Clock::duration time until the earliest timer, at most maxWait
+         */
+        Clock::duration getIdleWait(Clock::duration maxWait);
+
+        /**
+         * @brief poll and run the active events, at most maxBatch of them so that
+         * callbacks adding new events can not starve the caller
+         *
+         * @param maxBatch maximum number of callbacks to run
          * @return true if any events happened
          * @return false nothing happened
          */
-        bool poll();
+        bool poll(size_t maxBatch = DEFAULT_BATCH);
     };
-    
+
 } // namespace themis
 
 
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,53 @@
+#include "FramePool.h"
+#include <new>
+
+themis::FramePool::~FramePool() {
+    for (size_t i = 0; i < CLASS_COUNT; i++) {
+        while(freeLists[i]) {
+            FreeBlock* next = freeLists[i]->next;
+            ::operator delete(freeLists[i]);
+            freeLists[i] = next;
+        }
+    }
+}
+
+themis::FramePool &themis::FramePool::local() {
+    thread_local FramePool pool;
+    return pool;
+}
+
+void *themis::FramePool::allocate(size_t size) {
+    if(size == 0 || size > MAX_POOLED_SIZE) return ::operator new(size);
+    size_t index = (size - 1) / GRANULARITY;
+    if(FreeBlock* block = freeLists[index]) {
+        freeLists[index] = block->next;
+        --cached[index];
+        return block;
+    }
+    // round up so that the block fits any frame of the same class
+    return ::operator new((index + 1) * GRANULARITY);
+}
+
+void themis::FramePool::deallocate(void *block, size_t size) {
+    if(size == 0 || size > MAX_POOLED_SIZE) {
+        ::operator delete(block);
+        return;
+    }
+    size_t index = (size - 1) / GRANULARITY;
+    if(cached[index] >= MAX_CACHED) {
+        ::operator delete(block);
+        return;
+    }
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeLists[index];
+    freeLists[index] = freed;
+    ++cached[index];
+}
+
+size_t themis::FramePool::getCachedBlocks() const {
+    size_t count = 0;
+    for (size_t i = 0; i < CLASS_COUNT; i++) {
+        count += cached[i];
+    }
+    return count;
+}
@@ -0,0 +1,74 @@
+#ifndef FramePool_h
+#define FramePool_h 1
+
+#include <cstddef>
+
+namespace themis
+{
+
+    /**
+     * @brief a per-thread pool of small memory blocks for coroutine frames and promises.
+     * every reactor runs on its own thread, so every reactor gets its own pool
+     * and frames are recycled without any synchronization. blocks are grouped
+     * into size classes of GRANULARITY bytes, larger frames go to the global heap.
+     * a block freed on another thread simply moves to the pool of that thread
+     *
+     */
+    class FramePool {
+    public:
+        static constexpr size_t GRANULARITY = 64;
+        static constexpr size_t CLASS_COUNT = 16;
+        /// @brief frames larger than this are not pooled
+        static constexpr size_t MAX_POOLED_SIZE = GRANULARITY * CLASS_COUNT;
+        /// @brief at most this many free blocks are kept per size class
+        static constexpr size_t MAX_CACHED = 256;
+
+    private:
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        FreeBlock* freeLists[CLASS_COUNT] = {};
+        size_t cached[CLASS_COUNT] = {};
+
+        FramePool() = default;
+
+    public:
+        ~FramePool();
+        FramePool(const FramePool&) = delete;
+        FramePool& operator=(const FramePool&) = delete;
+
+        /**
+         * @brief get the pool of the calling thread
+         *
+         * @return FramePool& pool
+         */
+        static FramePool& local();
+
+        /**
+         * @brief allocate a block of at least size bytes
+         *
+         * @param size size in bytes
+         * @return void* the block
+         */
+        void* allocate(size_t size);
+
+        /**
+         * @brief give the block back, size must be the one used to allocate it
+         *
+         * @param block block
+         * @param size size in bytes
+         */
+        void deallocate(void* block, size_t size);
+
+        /**
+         * @brief get the number of free blocks kept by this pool
+         *
+         * @return size_t block count
+         */
+        size_t getCachedBlocks() const;
+    };
+
+} // namespace themis
+
+#endif
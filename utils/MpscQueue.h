@@ -0,0 +1,188 @@
+#ifndef MpscQueue_h
+#define MpscQueue_h 1
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace themis
+{
+
+    /// @brief keep the producer and consumer ends on their own cache lines
+    constexpr size_t CACHE_LINE_SIZE = 64;
+
+    /**
+     * @brief an unbounded lock-free multi-producer single-consumer queue.
+     * producers link a new node with a single exchange on the head, the consumer
+     * walks the list from the tail without any atomic read-modify-write.
+     * push can be called from any thread, tryPop only from the consumer thread
+     *
+     * @tparam T element type, must be default constructible and movable
+     */
+    template<typename T>
+    class MpscQueue {
+    private:
+        struct Node {
+            std::atomic<Node*> next = nullptr;
+            T value;
+        };
+
+        alignas(CACHE_LINE_SIZE) std::atomic<Node*> head;
+        alignas(CACHE_LINE_SIZE) Node* tail;
+
+    public:
+        MpscQueue() {
+            // the tail always points to a consumed (or dummy) node
+            Node* dummy = new Node;
+            head.store(dummy, std::memory_order_relaxed);
+            tail = dummy;
+        }
+
+        ~MpscQueue() {
+            while(tail) {
+                Node* next = tail->next.load(std::memory_order_relaxed);
+                delete tail;
+                tail = next;
+            }
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        /**
+         * @brief push a value, can be called from any thread
+         *
+         * @param value value
+         */
+        void push(T value) {
+            Node* node = new Node;
+            node->value = std::move(value);
+            Node* prev = head.exchange(node, std::memory_order_acq_rel);
+            // the node is visible to the consumer only after this store, a producer
+            // preempted here delays the consumer but never loses the node
+            prev->next.store(node, std::memory_order_release);
+        }
+
+        /**
+         * @brief pop a value, only the consumer thread can call this
+         *
+         * @param value where to move the value to
+         * @return true if a value was popped
+         * @return false the queue is empty, or the next producer has not finished linking
+         */
+        bool tryPop(T& value) {
+            Node* next = tail->next.load(std::memory_order_acquire);
+            if(!next) return false;
+            value = std::move(next->value);
+            delete tail;
+            tail = next;
+            return true;
+        }
+
+        /**
+         * @brief check if there is nothing to pop, only the consumer thread can call this
+         *
+         */
+        bool empty() const {
+            return tail->next.load(std::memory_order_acquire) == nullptr;
+        }
+    };
+
+    /**
+     * @brief a bounded lock-free multi-producer single-consumer ring, after D. Vyukov.
+     * every cell carries a sequence number telling whether it is free for the
+     * producer of a given position or filled for the consumer, so no allocation
+     * happens after construction
+     *
+     * @tparam T element type, must be default constructible and movable
+     */
+    template<typename T>
+    class BoundedMpscQueue {
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueuePosition = 0;
+        alignas(CACHE_LINE_SIZE) size_t dequeuePosition = 0;
+
+    public:
+        /**
+         * @brief Construct a new ring
+         *
+         * @param capacity number of cells, rounded up to a power of two
+         */
+        BoundedMpscQueue(size_t capacity) {
+            size_t size = 2;
+            while(size < capacity) size <<= 1;
+            cells = std::make_unique<Cell[]>(size);
+            mask = size - 1;
+            for (size_t i = 0; i < size; i++) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        BoundedMpscQueue(const BoundedMpscQueue&) = delete;
+        BoundedMpscQueue& operator=(const BoundedMpscQueue&) = delete;
+
+        /**
+         * @brief push a value if there is room, can be called from any thread
+         *
+         * @param value the value, only moved from if the push succeeded
+         * @return true if pushed
+         * @return false the ring is full
+         */
+        bool tryPush(T&& value) {
+            size_t position = enqueuePosition.load(std::memory_order_relaxed);
+            Cell* cell;
+            for(;;) {
+                cell = &cells[position & mask];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t) sequence - (intptr_t) position;
+                if(diff == 0) {
+                    // the cell is free for this position, claim it
+                    if(enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+                } else if(diff < 0) {
+                    // the consumer has not freed this cell yet
+                    return false;
+                } else {
+                    // another producer claimed the position
+                    position = enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+            cell->value = std::move(value);
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief pop a value, only the consumer thread can call this
+         *
+         * @param value where to move the value to
+         * @return true if a value was popped
+         * @return false nothing to pop
+         */
+        bool tryPop(T& value) {
+            Cell* cell = &cells[dequeuePosition & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            if(sequence != dequeuePosition + 1) return false;
+            value = std::move(cell->value);
+            // free the cell for the producer one lap later
+            cell->sequence.store(dequeuePosition + mask + 1, std::memory_order_release);
+            ++dequeuePosition;
+            return true;
+        }
+
+        size_t capacity() const {
+            return mask + 1;
+        }
+    };
+
+} // namespace themis
+
+#endif
@@ -4,6 +4,7 @@
 #include <utility>
 #include <memory>
 #include "EventQueue.h"
+#include "FramePool.h"
 
 
 namespace themis
@@ -22,15 +23,36 @@ namespace themis
     /// @brief this function throw exception through promise chain
     using FailFunction = std::function<void (std::unique_ptr<std::exception>)>;
 
+    /**
+     * @brief promises are small and short lived, they are recycled through the
+     * per-thread block pool instead of the global heap
+     * 
+     */
+    class PooledPromise {
+    public:
+        static void* operator new(size_t size) {
+            return FramePool::local().allocate(size);
+        }
+
+        static void operator delete(void* p, size_t size) {
+            FramePool::local().deallocate(p, size);
+        }
+    };
 
     /**
-     * @brief a Promise delegate a task that might complete/fail in the future
+     * @brief a Promise delegate a task that might complete/fail in the future.
+     * the promises of a chain are linked directly, a promise resolves the next one
+     * itself instead of going through a resolve function. resolving goes through
+     * the event queue, unless it happens on the polling thread of the queue, then
+     * the continuation runs inline
      * 
      * @tparam TParam the parameter type provided by the resolve function
      * @tparam TResult the parameter type to pass to next resolve function
      */
     template<typename TParam, typename TResult, typename ...T>
-    class Promise<TParam, TResult, T...> {
+    class Promise<TParam, TResult, T...> : public PooledPromise {
+        template<typename ...U> friend class Promise;
+
     public:
         /// @brief this function resolve parameter to this promise
         using ResolveFunction = std::function<void (std::unique_ptr<TParam>)>;
@@ -40,28 +62,43 @@ namespace themis
         /// @brief fulfill with no error handle
         using DefaultFulfillFunction = std::function<std::unique_ptr<TResult> (std::unique_ptr<TParam>)>;
 
-        /// @brief this function is the next resolve function in promise chain
-        using ResolveNext = std::function<void (std::unique_ptr<TResult>)>;
         /// @brief if next promise is not yet registered, put the exception in this temporarily
         std::unique_ptr<std::exception> e;
 
     private:
         PromiseState state = PENDING;
         const std::unique_ptr<EventQueue>& queue;
-        ResolveNext resolveNext;
-        FailFunction failNext;
         FulfillFunction onFulfill;
         std::unique_ptr<Promise<TResult, T...>> next;
         std::unique_ptr<TParam> result;
+        /// @brief shared with the resolve functions of a root promise and with the promises
+        /// chained to it, points to the root and is cleared when the root, and with it the chain, is freed
+        std::shared_ptr<void*> control;
+
+        /// @brief construct a promise resolved by the previous promise of the chain
+        Promise(const std::unique_ptr<EventQueue>& q) : queue(q) {}
+
+        /**
+         * @brief take the result and resolve on the queue, inline if already polling it
+         * 
+         */
+        void settle(std::unique_ptr<TParam> r) {
+            result = std::move(r);
+            // a deferred resolve may run after the chain was freed
+            queue->dispatch([this, c = control]() {
+                if(c && !*c) return;
+                resolve();
+            });
+        }
 
         void resolve() {
             state = FULFILLED;
-            if(next.get()) {
+            if(onFulfill) {
                 std::unique_ptr<TResult> val = onFulfill(std::move(result), [this](std::unique_ptr<std::exception> e) {
                     raiseException(std::move(e));
                 });
                 if(state != FAILED) {
-                    resolveNext(std::move(val));
+                    next->settle(std::move(val));
                 }
             }
         }
@@ -71,7 +108,7 @@ namespace themis
             state = FAILED;
             if(next.get()) 
                 // if next promise present present, then fail next
-                failNext(std::move(e));
+                next->raiseException(std::move(e));
             else {
                 // otherwise save the exception for now
                 this->e = std::move(e);
@@ -79,17 +116,35 @@ namespace themis
         }
 
     public:
-        Promise(const std::unique_ptr<EventQueue>& q, std::function<void (ResolveFunction, FailFunction)> fn) : queue(q) {
-            fn([this](std::unique_ptr<TParam> r) {
-                result = std::move(r);
-                queue->addImmediate([this]() {
-                    resolve();
+        /**
+         * @brief construct a root promise. the resolve and fail functions may be called
+         * from any thread and after the promise was freed, they only take effect
+         * on the queue while the promise is alive and still pending
+         * 
+         */
+        Promise(const std::unique_ptr<EventQueue>& q, std::function<void (ResolveFunction, FailFunction)> fn) 
+        : queue(q), control(std::make_shared<void*>(this)) {
+            EventQueue* target = q.get();
+            fn([c = control, target](std::unique_ptr<TParam> r) {
+                target->dispatch([c, r = std::move(r)]() mutable {
+                    Promise* self = static_cast<Promise*>(*c);
+                    if(!self || self->state != PENDING) return;
+                    self->result = std::move(r);
+                    self->resolve();
+                });
+            }, [c = control, target](std::unique_ptr<std::exception> e) {
+                target->dispatch([c, e = std::move(e)]() mutable {
+                    Promise* self = static_cast<Promise*>(*c);
+                    if(!self || self->state != PENDING) return;
+                    self->raiseException(std::move(e));
                 });
-            }, [this](std::unique_ptr<std::exception> e) {
-                raiseException(std::move(e));
             });
         }
 
+        ~Promise() {
+            if(control && *control == this) *control = nullptr;
+        }
+
         /**
          * @brief standard version to register a callbak
          * 
@@ -99,21 +154,18 @@ namespace themis
          * @return const std::unique_ptr<Promise<TResult, T...>>& 
          */
         const std::unique_ptr<Promise<TResult, T...>>& then(FulfillFunction f) {
-            next = std::make_unique<Promise<TResult, T...>>(queue, [this, f](ResolveNext rn, FailFunction fail) {
-                if(state == FULFILLED) {
-                    // this promise is already fulfilled, and should be called immediately
-                    rn(onFulfill(std::move(result), [this](std::unique_ptr<std::exception> e) {
-                        raiseException(std::move(e));
-                    }));
-                } else if(state == FAILED) {
-                    // an exception already occurred, immediately fail the next promise
-                    fail(std::move(e));
-                } else {
-                    resolveNext = rn;
-                    failNext = fail;
-                    onFulfill = f;
-                }
-            });
+            next.reset(new Promise<TResult, T...>(queue));
+            next->control = control;
+            if(state == FULFILLED) {
+                // this promise is already fulfilled, and should be called immediately
+                onFulfill = std::move(f);
+                resolve();
+            } else if(state == FAILED) {
+                // an exception already occurred, immediately fail the next promise
+                next->raiseException(std::move(e));
+            } else {
+                onFulfill = std::move(f);
+            }
             return next;
         };
 
@@ -139,7 +191,9 @@ namespace themis
      * @tparam TParam parameter type this promise take
      */
     template<typename TParam>
-    class Promise<TParam> {
+    class Promise<TParam> : public PooledPromise {
+        template<typename ...U> friend class Promise;
+
     public:
 
         using ResolveFunction = std::function<void (std::unique_ptr<TParam>)>;
@@ -152,8 +206,26 @@ namespace themis
         const std::unique_ptr<EventQueue>& queue;
         FulfillFunction onFulfill;
         bool hasCallback = false;
+        /// @brief shared with the resolve functions of a root promise and with the promises
+        /// chained to it, points to the root and is cleared when the root, and with it the chain, is freed
+        std::shared_ptr<void*> control;
+
+        /// @brief construct a promise resolved by the previous promise of the chain
+        Promise(const std::unique_ptr<EventQueue>& q) : queue(q) {}
+
+        void settle(std::unique_ptr<TParam> r) {
+            // rejected from outside, the rest of the chain is too late
+            if(state != PENDING) return;
+            result = std::move(r);
+            queue->dispatch([this, c = control]() {
+                if(c && !*c) return;
+                if(state == PENDING) resolve();
+            });
+        }
 
         void raiseException(std::unique_ptr<std::exception> err) {
+            // an exception is handled once, a rejected promise ignores the chain
+            if(state == FAILED) return;
             // actual point to handle the exception
             state = FAILED;
             if(hasErrorCallback) {
@@ -180,17 +252,57 @@ namespace themis
     public:
 
         
-        Promise(const std::unique_ptr<EventQueue>& q, std::function<void (ResolveFunction,FailFunction)> fn) : queue(q) {
-            fn([this](std::unique_ptr<TParam> r) {
-                result = std::move(r);
-                queue->addImmediate([this]() {
-                    resolve();              
+        /**
+         * @brief construct a root promise. the resolve and fail functions may be called
+         * from any thread and after the promise was freed, they only take effect
+         * on the queue while the promise is alive and still pending
+         * 
+         */
+        Promise(const std::unique_ptr<EventQueue>& q, std::function<void (ResolveFunction,FailFunction)> fn) 
+        : queue(q), control(std::make_shared<void*>(this)) {
+            EventQueue* target = q.get();
+            fn([c = control, target](std::unique_ptr<TParam> r) {
+                target->dispatch([c, r = std::move(r)]() mutable {
+                    Promise* self = static_cast<Promise*>(*c);
+                    if(!self || self->state != PENDING) return;
+                    self->result = std::move(r);
+                    self->resolve();
+                });
+            }, [c = control, target](std::unique_ptr<std::exception> e) {
+                target->dispatch([c, e = std::move(e)]() mutable {
+                    Promise* self = static_cast<Promise*>(*c);
+                    if(!self || self->state != PENDING) return;
+                    self->raiseException(std::move(e));
                 });
-            }, [this](std::unique_ptr<std::exception> e) {
-                raiseException(std::move(e));
             });
         }
 
+        ~Promise() {
+            if(control && *control == this) *control = nullptr;
+        }
+
+        /**
+         * @brief fail the promise from outside of the chain, a timeout for instance.
+         * does nothing if the promise already settled, a later resolve is ignored.
+         * call it on the thread polling the queue of the promise
+         * 
+         * @param err the exception to pass to the except callback
+         */
+        void reject(std::unique_ptr<std::exception> err) {
+            if(state != PENDING) return;
+            raiseException(std::move(err));
+        }
+
+        /// @brief the state of this promise
+        PromiseState getState() const {
+            return state;
+        }
+
+        /// @brief the queue this promise resolves on
+        const std::unique_ptr<EventQueue>& getQueue() {
+            return queue;
+        }
+
         Promise<TParam>* then(FulfillFunction fn) {
             if(state == FULFILLED) {
                 // call immediately if there are already result
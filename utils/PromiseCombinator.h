@@ -0,0 +1,241 @@
+#ifndef PromiseCombinator_h
+#define PromiseCombinator_h 1
+
+#include <tuple>
+#include <variant>
+#include <string>
+#include <stdexcept>
+#include "Promise.h"
+
+namespace themis
+{
+
+    /**
+     * @brief the outcome of one promise given to allSettled,
+     * either value or error is set
+     *
+     * @tparam T result type of the promise
+     */
+    template<typename T>
+    struct Settled {
+        std::unique_ptr<T> value;
+        std::unique_ptr<std::exception> error;
+
+        bool isFulfilled() const {
+            return error.get() == nullptr;
+        }
+    };
+
+    /// @brief the result of any and race, the index of the variant tells which promise won
+    template<typename ...T>
+    using FirstOf = std::variant<std::unique_ptr<T>...>;
+
+    namespace detail
+    {
+
+        /**
+         * @brief take over the promise and hand its outcome to the target queue.
+         * the handlers are registered on the queue of the promise, and the promise is
+         * freed on that queue once it settled, so promises of other threads (database
+         * queries for instance) can be combined safely
+         *
+         */
+        template<typename T, typename OnValue, typename OnError>
+        void watch(std::unique_ptr<Promise<T>> promise, EventQueue* target, OnValue onValue, OnError onError) {
+            Promise<T>* raw = promise.get();
+            auto holder = std::make_shared<std::unique_ptr<Promise<T>>>(std::move(promise));
+            raw->getQueue()->addImmediate([raw, holder, target, onValue, onError]() {
+                // the promise is still running the handler, free it later on its own queue
+                auto release = [raw, holder]() {
+                    raw->getQueue()->addImmediate([p = std::move(*holder)]() {});
+                };
+                raw->then([release, target, onValue](std::unique_ptr<T> value) {
+                    release();
+                    target->dispatch([onValue, v = std::move(value)]() mutable {
+                        onValue(std::move(v));
+                    });
+                })->except([release, target, onError](std::unique_ptr<std::exception> e) {
+                    release();
+                    target->dispatch([onError, e = std::move(e)]() mutable {
+                        onError(std::move(e));
+                    });
+                });
+            });
+        }
+
+        /// @brief the state of a combinator, only touched on the queue of the combined promise
+        template<typename Result>
+        struct CombinatorState {
+            typename Promise<Result>::ResolveFunction resolve;
+            FailFunction fail;
+            bool settled = false;
+            size_t remaining;
+        };
+
+        template<typename Result, typename Launch>
+        std::unique_ptr<Promise<Result>> combine(const std::unique_ptr<EventQueue>& queue, Launch launch) {
+            return std::make_unique<Promise<Result>>(queue, [launch](typename Promise<Result>::ResolveFunction resolve, FailFunction fail) {
+                launch(resolve, fail);
+            });
+        }
+
+    } // namespace detail
+
+    /**
+     * @brief fulfill with the results of all promises, or fail with the first error.
+     * the promises are already running, so their round trips overlap
+     *
+     * @param queue the queue the combined promise resolves on
+     * @param promises the promises, the combinator takes them over
+     * @return std::unique_ptr<Promise<std::tuple<std::unique_ptr<T>...>>> results in the order given
+     */
+    template<typename ...T>
+    std::unique_ptr<Promise<std::tuple<std::unique_ptr<T>...>>>
+    all(const std::unique_ptr<EventQueue>& queue, std::unique_ptr<Promise<T>>... promises) {
+        static_assert(sizeof...(T) > 0, "all needs at least one promise");
+        using Result = std::tuple<std::unique_ptr<T>...>;
+        struct State : detail::CombinatorState<Result> {
+            Result results;
+        };
+        auto state = std::make_shared<State>();
+        state->remaining = sizeof...(T);
+        EventQueue* target = queue.get();
+        auto combined = detail::combine<Result>(queue, [state](auto resolve, FailFunction fail) {
+            state->resolve = resolve;
+            state->fail = fail;
+        });
+        [&]<size_t ...I>(std::index_sequence<I...>) {
+            (detail::watch(std::move(promises), target, [state](auto value) {
+                if(state->settled) return;
+                std::get<I>(state->results) = std::move(value);
+                if(--state->remaining == 0) {
+                    state->settled = true;
+                    state->resolve(std::make_unique<Result>(std::move(state->results)));
+                }
+            }, [state](std::unique_ptr<std::exception> e) {
+                if(state->settled) return;
+                state->settled = true;
+                state->fail(std::move(e));
+            }), ...);
+        }(std::index_sequence_for<T...>());
+        return combined;
+    }
+
+    /**
+     * @brief fulfill once every promise settled, with the value or the error of each one,
+     * the combined promise never fails
+     *
+     * @param queue the queue the combined promise resolves on
+     * @param promises the promises, the combinator takes them over
+     * @return std::unique_ptr<Promise<std::tuple<Settled<T>...>>> outcomes in the order given
+     */
+    template<typename ...T>
+    std::unique_ptr<Promise<std::tuple<Settled<T>...>>>
+    allSettled(const std::unique_ptr<EventQueue>& queue, std::unique_ptr<Promise<T>>... promises) {
+        static_assert(sizeof...(T) > 0, "allSettled needs at least one promise");
+        using Result = std::tuple<Settled<T>...>;
+        struct State : detail::CombinatorState<Result> {
+            Result results;
+
+            void settleOne() {
+                if(--this->remaining == 0) {
+                    this->settled = true;
+                    this->resolve(std::make_unique<Result>(std::move(results)));
+                }
+            }
+        };
+        auto state = std::make_shared<State>();
+        state->remaining = sizeof...(T);
+        EventQueue* target = queue.get();
+        auto combined = detail::combine<Result>(queue, [state](auto resolve, FailFunction fail) {
+            state->resolve = resolve;
+            state->fail = fail;
+        });
+        [&]<size_t ...I>(std::index_sequence<I...>) {
+            (detail::watch(std::move(promises), target, [state](auto value) {
+                std::get<I>(state->results).value = std::move(value);
+                state->settleOne();
+            }, [state](std::unique_ptr<std::exception> e) {
+                std::get<I>(state->results).error = std::move(e);
+                state->settleOne();
+            }), ...);
+        }(std::index_sequence_for<T...>());
+        return combined;
+    }
+
+    /**
+     * @brief fulfill with the first promise that fulfills, fail only if all of them fail.
+     * the error then lists the errors of every promise
+     *
+     * @param queue the queue the combined promise resolves on
+     * @param promises the promises, the combinator takes them over
+     * @return std::unique_ptr<Promise<FirstOf<T...>>> the winning value, at the index of its promise
+     */
+    template<typename ...T>
+    std::unique_ptr<Promise<FirstOf<T...>>>
+    any(const std::unique_ptr<EventQueue>& queue, std::unique_ptr<Promise<T>>... promises) {
+        static_assert(sizeof...(T) > 0, "any needs at least one promise");
+        using Result = FirstOf<T...>;
+        struct State : detail::CombinatorState<Result> {
+            std::string errors;
+        };
+        auto state = std::make_shared<State>();
+        state->remaining = sizeof...(T);
+        EventQueue* target = queue.get();
+        auto combined = detail::combine<Result>(queue, [state](auto resolve, FailFunction fail) {
+            state->resolve = resolve;
+            state->fail = fail;
+        });
+        [&]<size_t ...I>(std::index_sequence<I...>) {
+            (detail::watch(std::move(promises), target, [state](auto value) {
+                if(state->settled) return;
+                state->settled = true;
+                state->resolve(std::make_unique<Result>(std::in_place_index<I>, std::move(value)));
+            }, [state](std::unique_ptr<std::exception> e) {
+                if(state->settled) return;
+                state->errors += "\r\n[" + std::to_string(I) + "] " + e->what();
+                if(--state->remaining == 0) {
+                    state->settled = true;
+                    state->fail(std::make_unique<std::runtime_error>("all promises failed :" + state->errors));
+                }
+            }), ...);
+        }(std::index_sequence_for<T...>());
+        return combined;
+    }
+
+    /**
+     * @brief settle like the first promise that settles, fulfilled or failed
+     *
+     * @param queue the queue the combined promise resolves on
+     * @param promises the promises, the combinator takes them over
+     * @return std::unique_ptr<Promise<FirstOf<T...>>> the first value, at the index of its promise
+     */
+    template<typename ...T>
+    std::unique_ptr<Promise<FirstOf<T...>>>
+    race(const std::unique_ptr<EventQueue>& queue, std::unique_ptr<Promise<T>>... promises) {
+        static_assert(sizeof...(T) > 0, "race needs at least one promise");
+        using Result = FirstOf<T...>;
+        auto state = std::make_shared<detail::CombinatorState<Result>>();
+        state->remaining = sizeof...(T);
+        EventQueue* target = queue.get();
+        auto combined = detail::combine<Result>(queue, [state](auto resolve, FailFunction fail) {
+            state->resolve = resolve;
+            state->fail = fail;
+        });
+        [&]<size_t ...I>(std::index_sequence<I...>) {
+            (detail::watch(std::move(promises), target, [state](auto value) {
+                if(state->settled) return;
+                state->settled = true;
+                state->resolve(std::make_unique<Result>(std::in_place_index<I>, std::move(value)));
+            }, [state](std::unique_ptr<std::exception> e) {
+                if(state->settled) return;
+                state->settled = true;
+                state->fail(std::move(e));
+            }), ...);
+        }(std::index_sequence_for<T...>());
+        return combined;
+    }
+
+} // namespace themis
+
+#endif
@@ -0,0 +1,399 @@
+#ifndef Task_h
+#define Task_h 1
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include "EventQueue.h"
+#include "FramePool.h"
+#include "Promise.h"
+
+namespace themis
+{
+
+    template<typename T> class Task;
+
+    namespace detail
+    {
+
+        /**
+         * @brief find the event queue among the parameters of a coroutine
+         *
+         */
+        inline EventQueue* findQueue() {
+            return nullptr;
+        }
+
+        template<typename First, typename ...Rest>
+        EventQueue* findQueue(First& first, Rest&... rest) {
+            if constexpr (std::is_same_v<std::decay_t<First>, std::unique_ptr<EventQueue>>) {
+                return first.get();
+            } else {
+                return findQueue(rest...);
+            }
+        }
+
+        /**
+         * @brief the state shared by the promise types of Task<T> and Task<void>
+         *
+         */
+        class TaskPromiseBase {
+        public:
+            /// @brief the queue the coroutine is resumed on, taken from the parameters
+            /// or inherited from the coroutine awaiting it
+            EventQueue* queue = nullptr;
+            /// @brief the coroutine awaiting this one
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+            /// @brief set for a detached top-level task, called when the coroutine ends
+            std::function<void ()> onComplete;
+
+            TaskPromiseBase() = default;
+
+            template<typename ...Args>
+            TaskPromiseBase(Args&... args) : queue(findQueue(args...)) {}
+
+            // frames come from the pool of the current reactor thread
+            static void* operator new(size_t size) {
+                return FramePool::local().allocate(size);
+            }
+
+            static void operator delete(void* frame, size_t size) {
+                FramePool::local().deallocate(frame, size);
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+
+                template<typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                    auto& p = h.promise();
+                    if(p.continuation) return p.continuation;
+                    if(p.onComplete) {
+                        // a detached task owns its frame
+                        auto complete = std::move(p.onComplete);
+                        complete();
+                        h.destroy();
+                    }
+                    return std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            FinalAwaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception() {
+                exception = std::current_exception();
+            }
+        };
+
+        /**
+         * @brief convert the exception of a failed task to the error type used by promises
+         *
+         */
+        inline std::unique_ptr<std::exception> toPromiseError(std::exception_ptr e) {
+            try {
+                std::rethrow_exception(e);
+            } catch(const std::exception& ex) {
+                return std::make_unique<std::runtime_error>(ex.what());
+            } catch(...) {
+                return std::make_unique<std::runtime_error>("unknown exception thrown in coroutine");
+            }
+        }
+
+        /**
+         * @brief take the queue of the awaiting coroutine, if it has one
+         *
+         */
+        template<typename P>
+        EventQueue* queueOf(std::coroutine_handle<P> h) {
+            if constexpr (std::is_base_of_v<TaskPromiseBase, P>) {
+                return h.promise().queue;
+            } else {
+                return nullptr;
+            }
+        }
+
+    } // namespace detail
+
+    /**
+     * @brief a coroutine producing a value of type T, the result is handed out as
+     * std::unique_ptr<T> like the result of a promise.
+     * a task is lazy, it starts when it is awaited by another task or when it is
+     * detached. it is always resumed on its event queue, which is the
+     * const std::unique_ptr<EventQueue>& among its parameters, or the queue of the
+     * task awaiting it. awaiting a Promise suspends the task until the promise
+     * fulfills, even if the promise belongs to the queue of another thread
+     *
+     * @tparam T result type
+     */
+    template<typename T>
+    class Task {
+    public:
+        class promise_type : public detail::TaskPromiseBase {
+        public:
+            std::unique_ptr<T> result;
+
+            using TaskPromiseBase::TaskPromiseBase;
+
+            Task get_return_object() {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            void return_value(std::unique_ptr<T> value) {
+                result = std::move(value);
+            }
+
+            template<typename U, typename = std::enable_if_t<std::is_convertible_v<U&&, T>>>
+            void return_value(U&& value) {
+                result = std::make_unique<T>(std::forward<U>(value));
+            }
+
+            std::unique_ptr<T> take() {
+                if(exception) std::rethrow_exception(exception);
+                return std::move(result);
+            }
+        };
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+
+        explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    public:
+        Task(Task&& t) noexcept : handle(std::exchange(t.handle, nullptr)) {}
+        Task& operator=(Task&& t) noexcept {
+            if(this != &t) {
+                if(handle) handle.destroy();
+                handle = std::exchange(t.handle, nullptr);
+            }
+            return *this;
+        }
+        Task(const Task&) = delete;
+        ~Task() {
+            if(handle) handle.destroy();
+        }
+
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return false; }
+
+            template<typename P>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<P> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                if(!handle.promise().queue) handle.promise().queue = detail::queueOf(awaiting);
+                // start the task right away, it comes back to the awaiting coroutine when done
+                return handle;
+            }
+
+            std::unique_ptr<T> await_resume() {
+                return handle.promise().take();
+            }
+        };
+
+        Awaiter operator co_await() && noexcept {
+            return Awaiter{handle};
+        }
+
+        /**
+         * @brief start the task without awaiting it, the task owns itself from now on
+         * and calls back once it finishes
+         *
+         * @param queue the queue to resume the task on, if it did not take one as parameter
+         * @param resolve called with the result
+         * @param fail called if the task threw
+         */
+        void detach(EventQueue* queue, std::function<void (std::unique_ptr<T>)> resolve, FailFunction fail) {
+            auto h = std::exchange(handle, nullptr);
+            auto& p = h.promise();
+            if(!p.queue) p.queue = queue;
+            p.onComplete = [&p, resolve, fail]() {
+                if(p.exception) fail(detail::toPromiseError(p.exception));
+                else resolve(std::move(p.result));
+            };
+            h.resume();
+        }
+    };
+
+    /**
+     * @brief a coroutine producing no value
+     *
+     */
+    template<>
+    class Task<void> {
+    public:
+        class promise_type : public detail::TaskPromiseBase {
+        public:
+            using TaskPromiseBase::TaskPromiseBase;
+
+            Task get_return_object() {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            void return_void() {}
+
+            void take() {
+                if(exception) std::rethrow_exception(exception);
+            }
+        };
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+
+        explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    public:
+        Task(Task&& t) noexcept : handle(std::exchange(t.handle, nullptr)) {}
+        Task& operator=(Task&& t) noexcept {
+            if(this != &t) {
+                if(handle) handle.destroy();
+                handle = std::exchange(t.handle, nullptr);
+            }
+            return *this;
+        }
+        Task(const Task&) = delete;
+        ~Task() {
+            if(handle) handle.destroy();
+        }
+
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return false; }
+
+            template<typename P>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<P> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                if(!handle.promise().queue) handle.promise().queue = detail::queueOf(awaiting);
+                return handle;
+            }
+
+            void await_resume() {
+                handle.promise().take();
+            }
+        };
+
+        Awaiter operator co_await() && noexcept {
+            return Awaiter{handle};
+        }
+
+        /**
+         * @brief start the task without awaiting it, the task owns itself from now on
+         *
+         * @param queue the queue to resume the task on, if it did not take one as parameter
+         * @param fail called if the task threw, may be empty
+         */
+        void detach(EventQueue* queue, FailFunction fail = nullptr) {
+            auto h = std::exchange(handle, nullptr);
+            auto& p = h.promise();
+            if(!p.queue) p.queue = queue;
+            p.onComplete = [&p, fail]() {
+                if(p.exception && fail) fail(detail::toPromiseError(p.exception));
+            };
+            h.resume();
+        }
+    };
+
+    /**
+     * @brief awaits a final promise, the handlers are registered on the queue of the
+     * promise and the awaiting task is resumed on its own queue
+     *
+     * @tparam TParam the promise result type
+     */
+    template<typename TParam>
+    class PromiseAwaiter {
+    private:
+        std::unique_ptr<Promise<TParam>> owned;
+        Promise<TParam>* promise;
+        std::unique_ptr<TParam> result;
+        std::unique_ptr<std::exception> error;
+        std::coroutine_handle<> awaiting;
+        EventQueue* resumeQueue = nullptr;
+        /// @brief the handlers are being registered, the promise may settle meanwhile
+        bool registering = false;
+        bool settled = false;
+
+        /**
+         * @brief called on the thread of the promise once it fulfilled or failed
+         *
+         */
+        void settle() {
+            if(registering) {
+                // resume after both handlers are registered
+                settled = true;
+                return;
+            }
+            if(owned.get()) {
+                // the promise is still running this handler, free it on its own queue later
+                promise->getQueue()->addImmediate([p = std::move(owned)]() {});
+            }
+            std::coroutine_handle<> h = awaiting;
+            if(resumeQueue) resumeQueue->addImmediate([h]() { h.resume(); });
+            else h.resume();
+        }
+
+    public:
+        PromiseAwaiter(std::unique_ptr<Promise<TParam>> p) : owned(std::move(p)), promise(owned.get()) {}
+        PromiseAwaiter(Promise<TParam>& p) : promise(&p) {}
+
+        bool await_ready() noexcept { return false; }
+
+        template<typename P>
+        void await_suspend(std::coroutine_handle<P> h) {
+            awaiting = h;
+            resumeQueue = detail::queueOf(h);
+            // the promise is only touched on the thread that polls its own queue
+            promise->getQueue()->addImmediate([this]() {
+                registering = true;
+                promise->then([this](std::unique_ptr<TParam> r) {
+                    result = std::move(r);
+                    settle();
+                })->except([this](std::unique_ptr<std::exception> e) {
+                    error = std::move(e);
+                    settle();
+                });
+                registering = false;
+                if(settled) settle();
+            });
+        }
+
+        std::unique_ptr<TParam> await_resume() {
+            if(error.get()) throw std::runtime_error(error->what());
+            return std::move(result);
+        }
+    };
+
+    template<typename TParam>
+    PromiseAwaiter<TParam> operator co_await(std::unique_ptr<Promise<TParam>>&& p) {
+        return PromiseAwaiter<TParam>(std::move(p));
+    }
+
+    template<typename TParam>
+    PromiseAwaiter<TParam> operator co_await(Promise<TParam>& p) {
+        return PromiseAwaiter<TParam>(p);
+    }
+
+    /**
+     * @brief run the task and expose its result as a promise on the given queue
+     *
+     * @param task the task
+     * @param queue the queue of the promise, also used to resume the task
+     * @return std::unique_ptr<Promise<T>> promise fulfilled with the result of the task
+     */
+    template<typename T>
+    std::unique_ptr<Promise<T>> toPromise(Task<T> task, const std::unique_ptr<EventQueue>& queue) {
+        return std::make_unique<Promise<T>>(queue, [&task, &queue](typename Promise<T>::ResolveFunction resolve, FailFunction fail) {
+            task.detach(queue.get(), resolve, fail);
+        });
+    }
+
+} // namespace themis
+
+#endif
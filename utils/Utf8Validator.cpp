@@ -0,0 +1,230 @@
+#include "Utf8Validator.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define THEMIS_UTF8_SSSE3 1
+#endif
+
+namespace {
+
+#ifdef THEMIS_UTF8_SSSE3
+
+    /// error bits of the lookup tables, see Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte"
+    constexpr uint8_t TOO_SHORT = 1 << 0;
+    constexpr uint8_t TOO_LONG = 1 << 1;
+    constexpr uint8_t OVERLONG_3 = 1 << 2;
+    constexpr uint8_t TOO_LARGE = 1 << 3;
+    constexpr uint8_t SURROGATE = 1 << 4;
+    constexpr uint8_t OVERLONG_2 = 1 << 5;
+    constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+    constexpr uint8_t OVERLONG_4 = 1 << 6;
+    constexpr uint8_t TWO_CONTS = 1 << 7;
+    constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    __attribute__((target("ssse3")))
+    inline __m128i lookup(__m128i table, __m128i nibbles) {
+        return _mm_shuffle_epi8(table, nibbles);
+    }
+
+    __attribute__((target("ssse3")))
+    inline __m128i highNibbles(__m128i v) {
+        return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+    }
+
+    /**
+     * @brief find the errors of the block with respect to the 3 bytes before it
+     *
+     */
+    __attribute__((target("ssse3")))
+    inline __m128i checkBlock(__m128i input, __m128i prevInput) {
+        const __m128i byte1High = _mm_setr_epi8(
+            // 0_______ ________ <ascii in byte 1>
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            // 10______ ________ <continuation in byte 1>
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            // 1100____ ________ <two byte lead in byte 1>
+            TOO_SHORT | OVERLONG_2,
+            // 1101____ ________ <two byte lead in byte 1>
+            TOO_SHORT,
+            // 1110____ ________ <three byte lead in byte 1>
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            // 1111____ ________ <four+ byte lead in byte 1>
+            (char) (TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4));
+        const __m128i byte1Low = _mm_setr_epi8(
+            // ____0000 ________
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            // ____0001 ________
+            CARRY | OVERLONG_2,
+            // ____001_ ________
+            CARRY,
+            CARRY,
+            // ____0100 ________
+            CARRY | TOO_LARGE,
+            // ____0101 ________
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            // ____011_ ________
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            // ____1___ ________
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            // ____1101 ________
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000);
+        const __m128i byte2High = _mm_setr_epi8(
+            // ________ 0_______ <ascii in byte 2>
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            // ________ 1000____
+            (char) (TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+            // ________ 1001____
+            (char) (TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+            // ________ 101_____
+            (char) (TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+            (char) (TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+            // ________ 11______ <lead in byte 2>
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+        __m128i prev1 = _mm_alignr_epi8(input, prevInput, 15);
+        __m128i special = _mm_and_si128(
+            _mm_and_si128(lookup(byte1High, highNibbles(prev1)),
+                lookup(byte1Low, _mm_and_si128(prev1, _mm_set1_epi8(0x0F)))),
+            lookup(byte2High, highNibbles(input)));
+
+        // the bytes 2 or 3 positions after a three or four byte lead must be continuations
+        __m128i prev2 = _mm_alignr_epi8(input, prevInput, 14);
+        __m128i prev3 = _mm_alignr_epi8(input, prevInput, 13);
+        __m128i isThird = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+        __m128i isFourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char) (0xF0 - 0x80)));
+        __m128i must23 = _mm_and_si128(_mm_or_si128(isThird, isFourth), _mm_set1_epi8((char) 0x80));
+        return _mm_xor_si128(must23, special);
+    }
+
+    /**
+     * @brief validate input that starts at a character boundary, 16 bytes at a time
+     *
+     */
+    __attribute__((target("ssse3")))
+    bool validateSsse3(const uint8_t* data, size_t length) {
+        __m128i error = _mm_setzero_si128();
+        __m128i prevInput = _mm_setzero_si128();
+        __m128i prevIncomplete = _mm_setzero_si128();
+        // a block is incomplete if it ends in a lead byte that needs more bytes than the block has
+        const __m128i maxValue = _mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            (char) (0xF0 - 1), (char) (0xE0 - 1), (char) (0xC0 - 1));
+
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16) {
+            __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            if(_mm_movemask_epi8(input) == 0) {
+                // ascii block, only the last block can be wrong
+                error = _mm_or_si128(error, prevIncomplete);
+            } else {
+                error = _mm_or_si128(error, checkBlock(input, prevInput));
+                prevIncomplete = _mm_subs_epu8(input, maxValue);
+            }
+            prevInput = input;
+        }
+        if(i < length) {
+            // pad the tail with ascii, so an incomplete character shows up as too short
+            uint8_t tail[16] = {0};
+            for (size_t j = i; j < length; j++) tail[j - i] = data[j];
+            __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tail));
+            error = _mm_or_si128(error, checkBlock(input, prevInput));
+            prevIncomplete = _mm_subs_epu8(input, maxValue);
+        }
+        error = _mm_or_si128(error, prevIncomplete);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+    }
+
+    const bool HAS_SSSE3 = __builtin_cpu_supports("ssse3");
+
+#endif
+
+} // namespace
+
+void themis::Utf8Validator::step(uint8_t b) {
+    if(needed) {
+        if(b < lower || b > upper) {
+            valid = false;
+            return;
+        }
+        lower = 0x80;
+        upper = 0xBF;
+        --needed;
+        return;
+    }
+    if(b < 0x80) return;
+    if(b >= 0xC2 && b <= 0xDF) {
+        needed = 1;
+    } else if(b == 0xE0) {
+        // overlong
+        needed = 2;
+        lower = 0xA0;
+    } else if(b == 0xED) {
+        // surrogate
+        needed = 2;
+        upper = 0x9F;
+    } else if(b >= 0xE1 && b <= 0xEF) {
+        needed = 2;
+    } else if(b == 0xF0) {
+        // overlong
+        needed = 3;
+        lower = 0x90;
+    } else if(b >= 0xF1 && b <= 0xF3) {
+        needed = 3;
+    } else if(b == 0xF4) {
+        // over U+10FFFF
+        needed = 3;
+        upper = 0x8F;
+    } else {
+        valid = false;
+    }
+}
+
+bool themis::Utf8Validator::update(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    // complete the character left from the last update
+    for (; i < length && needed && valid; i++) {
+        step(data[i]);
+    }
+    if(!valid) return false;
+
+    // leave the last incomplete character to the state machine
+    size_t end = length;
+    for (size_t k = 1; k <= 3 && k <= length - i; k++) {
+        uint8_t b = data[length - k];
+        if(b < 0x80) break;
+        if(b >= 0xC0) {
+            size_t size = b >= 0xF0 ? 4 : (b >= 0xE0 ? 3 : 2);
+            if(k < size) end = length - k;
+            break;
+        }
+    }
+
+    if(!validate(data + i, end - i)) {
+        valid = false;
+        return false;
+    }
+    for (i = end; i < length && valid; i++) {
+        step(data[i]);
+    }
+    return valid;
+}
+
+bool themis::Utf8Validator::validate(const uint8_t *data, size_t length) {
+#ifdef THEMIS_UTF8_SSSE3
+    if(HAS_SSSE3 && length >= 16) return validateSsse3(data, length);
+#endif
+    Utf8Validator v;
+    for (size_t i = 0; i < length && v.valid; i++) {
+        v.step(data[i]);
+    }
+    return v.finish();
+}
@@ -0,0 +1,74 @@
+#ifndef Utf8Validator_h
+#define Utf8Validator_h 1
+
+#include <cstddef>
+#include <cstdint>
+
+namespace themis
+{
+
+    /**
+     * @brief an incremental utf-8 validator, the input can be split at any byte,
+     * characters crossing the boundary between two updates are carried over.
+     * complete runs are checked 16 bytes at a time with ssse3 if the cpu supports it
+     *
+     */
+    class Utf8Validator {
+    private:
+        /// @brief continuation bytes the current character still needs
+        uint8_t needed = 0;
+        /// @brief the range the next continuation byte must fall in
+        uint8_t lower = 0x80, upper = 0xBF;
+        bool valid = true;
+
+        /**
+         * @brief feed one byte to the scalar state machine
+         *
+         * @param b byte
+         */
+        void step(uint8_t b);
+
+    public:
+        /**
+         * @brief validate the next piece of input
+         *
+         * @param data input
+         * @param length size of input
+         * @return true if the input so far is valid, or ends in an incomplete character
+         * @return false the input is not utf-8, later updates keep returning false
+         */
+        bool update(const uint8_t* data, size_t length);
+
+        /**
+         * @brief check the end of input
+         *
+         * @return true if the whole input is valid and does not end in an incomplete character
+         */
+        bool finish() const {
+            return valid && needed == 0;
+        }
+
+        /**
+         * @brief start over for a new input
+         *
+         */
+        void reset() {
+            needed = 0;
+            lower = 0x80;
+            upper = 0xBF;
+            valid = true;
+        }
+
+        /**
+         * @brief validate a complete input
+         *
+         * @param data input
+         * @param length size of input
+         * @return true if the input is utf-8
+         */
+        static bool validate(const uint8_t* data, size_t length);
+    };
+
+} // namespace themis
+
+#endif
@@ -0,0 +1,163 @@
+#include "WorkerPool.h"
+#include <stdexcept>
+#include <ng-log/logging.h>
+
+namespace {
+    /// @brief the pool and the index of the worker running on this thread, if any
+    thread_local themis::WorkerPool* currentPool = nullptr;
+    thread_local size_t currentWorker = 0;
+    thread_local uint32_t stealSeed = 0;
+}
+
+std::atomic<bool> themis::WorkerPool::sharedStarted = false;
+std::atomic<size_t> themis::WorkerPool::sharedThreadCount = 0;
+
+themis::WorkerPool::WorkerPool(size_t threadCount) {
+    if(threadCount == 0) throw std::invalid_argument("a worker pool needs at least one thread");
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back(std::make_unique<Worker>());
+    }
+    // start the threads once every deque exists, they steal from each other
+    for (size_t i = 0; i < threadCount; i++) {
+        workers[i]->thread = std::thread([this, i]() {
+            run(i);
+        });
+    }
+}
+
+themis::WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(parkMutex);
+        stop = true;
+    }
+    parkCondition.notify_all();
+    for (auto& w: workers) {
+        if(w->thread.joinable()) w->thread.join();
+    }
+}
+
+themis::WorkerPool& themis::WorkerPool::get() {
+    // built once even when the first calls race, destroyed at exit
+    static WorkerPool pool([]() {
+        sharedStarted = true;
+        size_t count = sharedThreadCount;
+        return count ? count : std::max<size_t>(1, std::thread::hardware_concurrency());
+    }());
+    return pool;
+}
+
+void themis::WorkerPool::configure(size_t threadCount) {
+    if(sharedStarted) throw std::runtime_error("the shared worker pool is already running");
+    sharedThreadCount = threadCount;
+}
+
+void themis::WorkerPool::submit(Callback fn) {
+    // a worker keeps the work it spawns, others spread it over the workers
+    size_t index = currentPool == this ? currentWorker
+        : nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    // counted before it is visible, so that taking it never drops the count below zero
+    pending.fetch_add(1, std::memory_order_seq_cst);
+    push(index, std::move(fn));
+    // a worker about to park checks pending after announcing itself, so either it
+    // sees this task or this sees it sleeping
+    if(sleepers.load(std::memory_order_seq_cst) > 0) {
+        { std::lock_guard<std::mutex> lock(parkMutex); }
+        parkCondition.notify_one();
+    }
+}
+
+void themis::WorkerPool::push(size_t index, Callback task) {
+    Worker& w = *workers[index];
+    std::lock_guard<AdaptiveLock> lock(w.lock);
+    w.tasks.push_back(std::move(task));
+    w.depth.store(w.tasks.size(), std::memory_order_relaxed);
+}
+
+bool themis::WorkerPool::popLocal(size_t index, Callback& task) {
+    Worker& w = *workers[index];
+    if(w.depth.load(std::memory_order_relaxed) == 0) return false;
+    std::lock_guard<AdaptiveLock> lock(w.lock);
+    if(w.tasks.empty()) return false;
+    // oldest first, the requests waiting the longest are answered first
+    task = std::move(w.tasks.front());
+    w.tasks.pop_front();
+    w.depth.store(w.tasks.size(), std::memory_order_relaxed);
+    return true;
+}
+
+bool themis::WorkerPool::steal(size_t index, Callback& task) {
+    size_t count = workers.size();
+    if(count < 2) return false;
+    // start at a random victim so that thieves do not all hit the same deque
+    stealSeed = stealSeed * 1103515245u + 12345u + index;
+    size_t start = (stealSeed >> 16) % count;
+    for (size_t i = 0; i < count; i++) {
+        size_t victim = (start + i) % count;
+        if(victim == index) continue;
+        Worker& w = *workers[victim];
+        if(w.depth.load(std::memory_order_relaxed) == 0) continue;
+        std::lock_guard<AdaptiveLock> lock(w.lock);
+        if(w.tasks.empty()) continue;
+        // take from the other end than the owner
+        task = std::move(w.tasks.back());
+        w.tasks.pop_back();
+        w.depth.store(w.tasks.size(), std::memory_order_relaxed);
+        stolen.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void themis::WorkerPool::run(size_t index) {
+    currentPool = this;
+    currentWorker = index;
+    while(true) {
+        Callback task;
+        if(popLocal(index, task) || steal(index, task)) {
+            pending.fetch_sub(1, std::memory_order_relaxed);
+            try {
+                task();
+            } catch(const std::exception& e) {
+                LOG(ERROR) << "uncaught exception in worker " << index << " : " << e.what();
+            }
+            executed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(parkMutex);
+        // everything submitted before the stop has run
+        if(stop && pending.load() == 0) return;
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        parkCondition.wait(lock, [this]() {
+            return stop || pending.load(std::memory_order_seq_cst) > 0;
+        });
+        sleepers.fetch_sub(1, std::memory_order_seq_cst);
+    }
+}
+
+void themis::SerialExecutor::execute(Callback fn) {
+    tasks.push(std::move(fn));
+    // the first task schedules the executor, the others find it scheduled
+    if(count.fetch_add(1, std::memory_order_acq_rel) == 0) {
+        pool.submit([self = shared_from_this()]() {
+            self->drain();
+        });
+    }
+}
+
+void themis::SerialExecutor::drain() {
+    for (size_t ran = 0; ran < BATCH; ran++) {
+        Callback fn;
+        // counted but not yet linked by its producer, it is a matter of instructions
+        while(!tasks.tryPop(fn)) std::this_thread::yield();
+        try {
+            fn();
+        } catch(const std::exception& e) {
+            LOG(ERROR) << "uncaught exception in serial executor : " << e.what();
+        }
+        if(count.fetch_sub(1, std::memory_order_acq_rel) == 1) return;
+    }
+    // still busy, let the other executors run first
+    pool.submit([self = shared_from_this()]() {
+        self->drain();
+    });
+}
@@ -0,0 +1,214 @@
+#ifndef WorkerPool_h
+#define WorkerPool_h 1
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "AdaptiveLock.h"
+#include "Callback.h"
+#include "MpscQueue.h"
+#include "Promise.h"
+
+namespace themis
+{
+
+    /**
+     * @brief a work-stealing pool of threads for cpu heavy work (image resize, report
+     * rendering, large json) that would otherwise block every connection of a reactor.
+     * every worker has its own deque, work submitted from outside is spread over the
+     * workers round robin and work submitted from a worker stays on its deque.
+     * a worker runs its own deque oldest first, when it runs dry it steals from the
+     * others, and parks only when there is nothing left anywhere
+     *
+     */
+    class WorkerPool {
+    private:
+        struct alignas(CACHE_LINE_SIZE) Worker {
+            AdaptiveLock lock;
+            std::deque<Callback> tasks;
+            /// @brief the size of tasks, readable without the lock
+            std::atomic<size_t> depth = 0;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        /// @brief tasks in any deque, not yet taken by a worker
+        std::atomic<size_t> pending = 0;
+        std::atomic<size_t> executed = 0;
+        std::atomic<size_t> stolen = 0;
+        std::atomic<size_t> nextWorker = 0;
+
+        /// @brief parking of idle workers
+        std::mutex parkMutex;
+        std::condition_variable parkCondition;
+        std::atomic<size_t> sleepers = 0;
+        bool stop = false;
+
+        /// @brief if the shared pool was started
+        static std::atomic<bool> sharedStarted;
+        static std::atomic<size_t> sharedThreadCount;
+
+        void run(size_t index);
+        void push(size_t index, Callback task);
+        bool popLocal(size_t index, Callback& task);
+        bool steal(size_t index, Callback& task);
+
+    public:
+        /**
+         * @brief start the workers
+         *
+         * @param threadCount number of threads, at least one
+         */
+        explicit WorkerPool(size_t threadCount);
+        /// @brief run everything already submitted, then join the workers
+        ~WorkerPool();
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        /**
+         * @brief get the pool shared by the controllers, can be called from any thread.
+         * it is started once by the first call with the thread count set by configure,
+         * and joined at exit
+         *
+         * @return WorkerPool& the pool
+         */
+        static WorkerPool& get();
+
+        /**
+         * @brief set the thread count of the shared pool, call this before it is first used.
+         * the count only applies to the first call to get
+         *
+         * @param threadCount number of threads, the hardware concurrency by default
+         */
+        static void configure(size_t threadCount);
+
+        /**
+         * @brief run fn on a worker, can be called from any thread.
+         * an exception thrown by fn is logged and dropped
+         *
+         * @param fn the work
+         */
+        void submit(Callback fn);
+
+        /**
+         * @brief run fn on a worker and resolve the promise with its result on the given
+         * queue, so the continuation runs back on the thread of the caller
+         *
+         * @param queue the queue of the caller, usually the one of the controller manager
+         * @param fn the work, returns the result and may throw to fail the promise
+         * @return std::unique_ptr<Promise<T>> the result
+         */
+        template<typename F, typename T = std::invoke_result_t<F&>>
+        std::unique_ptr<Promise<T>> offload(const std::unique_ptr<EventQueue>& queue, F fn) {
+            static_assert(!std::is_void_v<T>, "offloaded work must return a result");
+            return std::make_unique<Promise<T>>(queue, [this, &fn](typename Promise<T>::ResolveFunction resolve, FailFunction fail) {
+                submit([fn = std::move(fn), resolve, fail]() mutable {
+                    std::unique_ptr<T> result;
+                    try {
+                        result = std::make_unique<T>(fn());
+                    } catch(const std::exception& e) {
+                        fail(std::make_unique<std::runtime_error>(e.what()));
+                        return;
+                    } catch(...) {
+                        fail(std::make_unique<std::runtime_error>("unknown exception thrown in offloaded work"));
+                        return;
+                    }
+                    // the promise resolves on its own queue
+                    resolve(std::move(result));
+                });
+            });
+        }
+
+        size_t getThreadCount() const {
+            return workers.size();
+        }
+
+        /**
+         * @brief count the contention on the deques into the stats
+         *
+         * @param stats the stats, nullptr to stop counting
+         */
+        void setLockStats(LockStats* stats) {
+            for (auto& w: workers) {
+                w->lock.setStats(stats);
+            }
+        }
+
+        /// @brief the number of tasks waiting in the deque of a worker
+        size_t getQueueDepth(size_t worker) const {
+            return workers[worker]->depth.load(std::memory_order_relaxed);
+        }
+
+        /// @brief the number of tasks waiting in all deques
+        size_t getPendingCount() const {
+            return pending.load(std::memory_order_relaxed);
+        }
+
+        /// @brief the number of tasks run so far
+        size_t getExecutedCount() const {
+            return executed.load(std::memory_order_relaxed);
+        }
+
+        /// @brief the number of tasks run by another worker than the one they were given to
+        size_t getStolenCount() const {
+            return stolen.load(std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * @brief runs its tasks on a worker pool one at a time, in the order they were added.
+     * tasks of different executors run in parallel, so giving every connection its own
+     * executor spreads the connections over the cores without reordering the messages
+     * of one connection. after BATCH tasks the executor goes back to the end of the pool
+     * so that a busy connection does not hold a worker forever
+     *
+     */
+    class SerialExecutor : public std::enable_shared_from_this<SerialExecutor> {
+    public:
+        static constexpr size_t BATCH = 64;
+
+    private:
+        WorkerPool& pool;
+        MpscQueue<Callback> tasks;
+        /// @brief tasks added and not yet run, the executor is scheduled while not zero
+        std::atomic<size_t> count = 0;
+
+        void drain();
+
+    public:
+        /// @brief executors are shared with their scheduled drain, create them with make_shared
+        explicit SerialExecutor(WorkerPool& pool) : pool(pool) {}
+
+        /**
+         * @brief add a task, can be called from any thread
+         *
+         * @param fn the task
+         */
+        void execute(Callback fn);
+
+        /// @brief the number of tasks added and not yet run
+        size_t getQueuedCount() const {
+            return count.load(std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * @brief run fn on the shared worker pool, the promise resolves on the given queue
+     *
+     * @param queue the queue of the caller
+     * @param fn the work
+     * @return std::unique_ptr<Promise<T>> the result
+     */
+    template<typename F, typename T = std::invoke_result_t<F&>>
+    std::unique_ptr<Promise<T>> offload(const std::unique_ptr<EventQueue>& queue, F fn) {
+        return WorkerPool::get().offload(queue, std::move(fn));
+    }
+
+} // namespace themis
+
+#endif
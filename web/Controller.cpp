@@ -5,27 +5,44 @@ bool themis::MethodFilter::filter(const std::unique_ptr<HttpRequest> &req) {
     return method == req->getMethod();
 }
 
-void themis::ControllerManager::serveNotFound(const std::unique_ptr<Session> &session, const std::string &path) {
+void themis::ControllerManager::serveNotFound(Session &session, const std::string &path) {
     // return a not found
     HttpResponse notfound;
     notfound.setStatus(404);
     notfound.getResponseStream() << "controller at path \"" << path << "\" not found";
-    notfound.serializeToBuffer(session->getOutputBuffer());
+    notfound.serializeToBuffer(session.getOutputBuffer());
     // enable write event and reset timeout
-    session->setLastActive(time(nullptr));
-    event_add(session->getWriteEvent(), nullptr);
+    session.setLastActive(time(nullptr));
+    session.scheduleFlush();
 }
 
-void themis::ControllerManager::serveInternalError(const std::unique_ptr<Session> &session, const std::string& path, std::unique_ptr<std::exception> e) {
+void themis::ControllerManager::serveInternalError(Session &session, const std::string& path, std::unique_ptr<std::exception> e) {
     
     HttpResponse internalError;
     internalError.setStatus(500);
     internalError.getResponseStream() << "controller at path \"" 
     << path << "\" failed the response promise with error : \r\n"
     <<  e->what();
-    internalError.serializeToBuffer(session->getOutputBuffer());
-    session->setLastActive(time(nullptr));
-    event_add(session->getWriteEvent(), nullptr);
+    internalError.serializeToBuffer(session.getOutputBuffer());
+    session.setLastActive(time(nullptr));
+    session.scheduleFlush();
+}
+
+void themis::ControllerManager::serveGatewayTimeout(Session &session, const std::string &path) {
+
+    HttpResponse timeout;
+    timeout.setStatus(504);
+    timeout.getResponseStream() << "controller at path \"" << path << "\" did not respond in time";
+    timeout.serializeToBuffer(session.getOutputBuffer());
+    session.setLastActive(time(nullptr));
+    session.scheduleFlush();
+}
+
+themis::ControllerManager::~ControllerManager() {
+    // the sessions may outlive the manager, stop listening to them
+    for (auto& detail: responseList) {
+        detail.session.getClosedToken().unsubscribe(detail.closeSubscription);
+    }
 }
 
 themis::ControllerManager &themis::ControllerManager::addController(std::unique_ptr<Controller> controller) {
@@ -33,6 +50,12 @@ themis::ControllerManager &themis::ControllerManager::addController(std::unique_
     return *this;
 }
 
+void themis::ControllerManager::releaseResponse(DetailIterator it) {
+    (*it).deadline.cancel();
+    (*it).session.getClosedToken().unsubscribe((*it).closeSubscription);
+    responseList.erase(it);
+}
+
 void themis::ControllerManager::serveRequest(std::unique_ptr<HttpRequest> req, 
     const std::unique_ptr<Session> &session) {
     // try to match a controller
@@ -40,31 +63,61 @@ void themis::ControllerManager::serveRequest(std::unique_ptr<HttpRequest> req,
     if(controllerMap.count(path)) {
 
         LOG(INFO) << req->getMethodString() << " " << path;
-        ResponseDetail detail(session, 
-            controllerMap.at(path)->service(std::move(req), queue), 
-            path);
+        bool hasDeadline = requestTimeout.count() > 0;
+        CancellationToken token = CancellationToken::create(hasDeadline ? 
+            CancellationToken::Clock::now() + requestTimeout : CancellationToken::Clock::time_point::max());
+        req->setCancellationToken(token);
+        // the request, and the path it holds, is handed over to the controller
+        std::string detailPath = path;
+        ResponseDetail detail(session->getHandle(), 
+            controllerMap.at(detailPath)->service(std::move(req), queue), 
+            detailPath, token);
         responseList.emplace_back(std::move(detail));
+        DetailIterator detailIterator = --responseList.end();
+
+        if(hasDeadline) {
+            detailIterator->deadline = queue->addTimeout(requestTimeout, [detailIterator]() {
+                // drop the queries of the request, then answer with a 504 through the except callback
+                detailIterator->token.cancel();
+                detailIterator->promise->reject(std::make_unique<TimeoutException>
+                    ("controller at path \"" + detailIterator->path + "\" timed out"));
+            });
+        }
+        // the client hung up, nobody will read the response, stop the work for it
+        detailIterator->closeSubscription = detailIterator->session.getClosedToken().subscribe([this, detailIterator]() {
+            VLOG(5) << "client gone, dropping response of " << detailIterator->path;
+            detailIterator->closeSubscription = 0;
+            detailIterator->token.cancel();
+            releaseResponse(detailIterator);
+        });
+
         // assign callback funciton when user resolve with response
-        responseList.back().promise->then([detailIterator = --responseList.end(), 
-        &detailList = responseList]
+        detailIterator->promise->then([this, detailIterator]
         (std::unique_ptr<HttpResponse> resp) {
 
             // user finish response
-            const auto& session = (*detailIterator).sessionRef;
+            Session* session = (*detailIterator).session.get();
             resp->serializeToBuffer(session->getOutputBuffer());
-            event_add(session->getWriteEvent(), nullptr);
+            session->scheduleFlush();
+            // the rest of a streamed body follows, with no deadline
+            if(resp->getStream().get()) resp->getStream()->attach((*detailIterator).session, (*detailIterator).token);
             // disassociate response
-            detailList.erase(detailIterator);
+            releaseResponse(detailIterator);
 
-        })->except([detailIterator = --responseList.end(), 
-        &detailList = responseList]
+        })->except([this, detailIterator]
         (std::unique_ptr<std::exception> e) {
 
-            const auto& session = (*detailIterator).sessionRef;
-            // user fail the promise, then return a 500 internal error
-            serveInternalError(session, (*detailIterator).path, std::move(e));
+            Session* session = (*detailIterator).session.get();
+            if(dynamic_cast<TimeoutException*>(e.get())) {
+                // the deadline expired, or the controller gave up waiting itself
+                LOG(WARNING) << "Gateway Timeout : " << (*detailIterator).path;
+                serveGatewayTimeout(*session, (*detailIterator).path);
+            } else {
+                // user fail the promise, then return a 500 internal error
+                serveInternalError(*session, (*detailIterator).path, std::move(e));
+            }
             // dissociate response
-            detailList.erase(detailIterator);
+            releaseResponse(detailIterator);
 
         });
 
@@ -72,7 +125,7 @@ void themis::ControllerManager::serveRequest(std::unique_ptr<HttpRequest> req,
 
         LOG(WARNING) << "Not Found : " << req->getMethodString() << " " << path;
         // not found
-        serveNotFound(session, path);
+        serveNotFound(*session, path);
 
     }
 }
@@ -4,7 +4,10 @@
 #include <memory>
 #include <list>
 #include <map>
+#include <chrono>
 #include "utils/Promise.h"
+#include "utils/Task.h"
+#include "utils/Cancellation.h"
 #include "protocol/http/HttpResponse.h"
 #include "protocol/http/HttpRequest.h"
 #include "network/Session.h"
@@ -49,25 +52,59 @@ namespace themis
         std::unique_ptr<EventQueue> queue = std::make_unique<EventQueue>();
         std::map<std::string, std::unique_ptr<Controller>> controllerMap;
 
+        /// @brief how long a controller may take to respond, zero for no deadline
+        std::chrono::milliseconds requestTimeout = std::chrono::seconds(30);
+
         struct ResponseDetail {
-            const std::unique_ptr<Session>& sessionRef;
+            /// @brief the client, closed if it hung up while the response was pending
+            SessionHandle session;
             std::unique_ptr<HttpResponsePromise> promise;
             std::string path;
+            /// @brief the token handed to the request, cancelled on timeout or disconnect
+            CancellationToken token;
+            /// @brief fails the promise once the deadline expires
+            TimerHandle deadline;
+            /// @brief subscription to the closed token of the session
+            size_t closeSubscription = 0;
 
             ResponseDetail(const ResponseDetail&) = delete;
-            ResponseDetail(ResponseDetail&& d) : promise(std::move(d.promise)), sessionRef(d.sessionRef), path(d.path) {}
-            ResponseDetail(const std::unique_ptr<Session>& session, 
-                std::unique_ptr<HttpResponsePromise> promise, const std::string& path) : promise(std::move(promise)), sessionRef(session), path(path) {}
+            ResponseDetail(ResponseDetail&& d) : promise(std::move(d.promise)), session(std::move(d.session)), path(d.path), 
+                token(std::move(d.token)), deadline(std::move(d.deadline)), closeSubscription(d.closeSubscription) {}
+            ResponseDetail(SessionHandle session, 
+                std::unique_ptr<HttpResponsePromise> promise, const std::string& path, CancellationToken token) 
+                : promise(std::move(promise)), session(std::move(session)), path(path), token(std::move(token)) {}
         };
 
         std::list<ResponseDetail> responseList;
         using DetailIterator = std::list<ResponseDetail>::iterator;
 
+        /// @brief stop the deadline and the disconnect notification, then free the response
+        void releaseResponse(DetailIterator it);
+
         /// some preset function that might come in handy
-        static void serveNotFound(const std::unique_ptr<Session>& session, const std::string& path);
-        static void serveInternalError(const std::unique_ptr<Session>& session, const std::string& path, std::unique_ptr<std::exception> e);
+        static void serveNotFound(Session& session, const std::string& path);
+        static void serveInternalError(Session& session, const std::string& path, std::unique_ptr<std::exception> e);
+        static void serveGatewayTimeout(Session& session, const std::string& path);
 
     public:
+        ~ControllerManager();
+
+        /**
+         * @brief set how long a controller may take to resolve its response promise.
+         * once expired the request token is cancelled, the promise fails with a
+         * TimeoutException and the client receives a 504. the token is also cancelled
+         * if the client disconnects, the response is then dropped. a streamed body
+         * has no deadline once the response resolved, the token is cancelled only if
+         * the client disconnects before it ended
+         * 
+         * @param timeout the timeout, zero to wait forever
+         * @return this reference
+         */
+        ControllerManager& setRequestTimeout(std::chrono::milliseconds timeout) {
+            requestTimeout = timeout;
+            return *this;
+        }
+
         /**
          * @brief assign this controller to this manager
          * 
@@ -82,6 +119,11 @@ namespace themis
         bool poll() {
             return queue->poll();
         }
+
+        /// @brief how long the loop may sleep without delaying a timer of the base queue
+        EventQueue::Clock::duration getIdleWait(EventQueue::Clock::duration maxWait) {
+            return queue->getIdleWait(maxWait);
+        }
     };
 
     /**
@@ -111,6 +153,29 @@ namespace themis
          */
         virtual std::unique_ptr<HttpResponsePromise> service(std::unique_ptr<HttpRequest> req, const std::unique_ptr<EventQueue>& queue) = 0;
     };
+
+    /**
+     * @brief a controller written as a coroutine, promises (database queries for instance)
+     * can be awaited one after another instead of chaining then callbacks
+     * 
+     */
+    class CoroutineController : public Controller {
+    public:
+        CoroutineController(const std::string& path) : Controller(path) {}
+
+        /**
+         * @brief handle the given request, the coroutine is resumed on the given queue
+         * 
+         * @param req request
+         * @param queue event queue of the controller manager
+         * @return Task<HttpResponse> the response, throw to respond with an internal error
+         */
+        virtual Task<HttpResponse> serviceAsync(std::unique_ptr<HttpRequest> req, const std::unique_ptr<EventQueue>& queue) = 0;
+
+        virtual std::unique_ptr<HttpResponsePromise> service(std::unique_ptr<HttpRequest> req, const std::unique_ptr<EventQueue>& queue) override {
+            return toPromise(serviceAsync(std::move(req), queue), queue);
+        }
+    };
     
 } // namespace themis
 
@@ -0,0 +1,111 @@
+#ifndef OrderedListener_h
+#define OrderedListener_h 1
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "utils/WorkerPool.h"
+#include "protocol/websocket/WebsocketSessionHandler.h"
+
+namespace themis
+{
+
+    /**
+     * @brief the part of a websocket listener that runs on the worker pool.
+     * the messages of one session are processed one at a time and in order,
+     * but never on the reactor thread, so do not touch the session handler here
+     *
+     */
+    class MessageProcessor {
+    public:
+        /// @brief a message sent back to the client by the reactor owning the session
+        struct Reply {
+            std::string data;
+            bool text = true;
+        };
+
+        virtual ~MessageProcessor() = default;
+        virtual std::optional<Reply> processText(const std::string& msg) { return std::nullopt; }
+        virtual std::optional<Reply> processBinary(const std::vector<uint8_t>& msg) { return std::nullopt; }
+        /// @brief the session is gone, called after every message received before
+        virtual void processDisconnect() {}
+    };
+
+    /**
+     * @brief a listener handing the messages of its session to a ProcessorType on the
+     * worker pool, in order through a serial executor of its own. replies are written
+     * by the reactor of the session, replies for a session that is gone are dropped.
+     * register it like any listener, the extra arguments construct the processor :
+     * addController<OrderedListener<MyProcessor>>("/ws/path", args...)
+     *
+     * @tparam ProcessorType derived of MessageProcessor, one per session
+     */
+    template<typename ProcessorType>
+    class OrderedListener : public WebsocketSessionHandler::EventListener {
+        static_assert(std::is_base_of_v<MessageProcessor, ProcessorType>,
+            "processor type must be derived of themis::MessageProcessor");
+
+    private:
+        /// @brief shared with the tasks, the processor may outlive the listener
+        std::shared_ptr<ProcessorType> processor;
+        std::shared_ptr<SerialExecutor> executor;
+        /// @brief the handler replies are written to, cleared when the session is gone.
+        /// only touched on the reactor thread
+        std::shared_ptr<WebsocketSessionHandler*> target;
+
+        template<typename Process>
+        void process(Process fn) {
+            EventQueue* reactorQueue = eventQueue.get();
+            executor->execute([p = processor, t = target, reactorQueue, fn = std::move(fn)]() mutable {
+                std::optional<MessageProcessor::Reply> reply = fn(*p);
+                if(!reply) return;
+                // write on the reactor owning the session
+                reactorQueue->addImmediate([t, r = std::move(*reply)]() {
+                    WebsocketSessionHandler* handler = *t;
+                    if(!handler) return;
+                    handler->getOutputStream() << r.data;
+                    handler->finish(r.text);
+                });
+            });
+        }
+
+    public:
+        template<typename ...TArgs>
+        OrderedListener(WebsocketSessionHandler& handler, const std::unique_ptr<EventQueue>& queue, TArgs ...args)
+        : EventListener(handler, queue), processor(std::make_shared<ProcessorType>(args...)),
+        executor(std::make_shared<SerialExecutor>(WorkerPool::get())),
+        target(std::make_shared<WebsocketSessionHandler*>(&handler)) {}
+
+        ~OrderedListener() {
+            *target = nullptr;
+        }
+
+        /// @brief the number of messages received and not yet processed
+        size_t getBacklog() const {
+            return executor->getQueuedCount();
+        }
+
+        virtual void onText(WebsocketSessionHandler& handler, const std::string& msg) override {
+            process([msg](ProcessorType& p) {
+                return p.processText(msg);
+            });
+        }
+
+        virtual void onBinary(WebsocketSessionHandler& handler, const std::vector<uint8_t>& msg) override {
+            process([msg](ProcessorType& p) {
+                return p.processBinary(msg);
+            });
+        }
+
+        virtual void onDisconnect() override {
+            *target = nullptr;
+            executor->execute([p = processor]() {
+                p->processDisconnect();
+            });
+        }
+    };
+
+} // namespace themis
+
+#endif
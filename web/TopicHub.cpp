@@ -0,0 +1,70 @@
+#include "TopicHub.h"
+#include "sql/driver/PostgresqlDriver.h"
+#include <mutex>
+
+size_t themis::TopicHub::join(const std::string& topic, EventQueue* queue, std::shared_ptr<WebsocketSessionHandler*> target) {
+    std::lock_guard<AdaptiveLock> guard(lock);
+    size_t id = nextId++;
+    topics[topic].insert({id, Member {queue, std::move(target)}});
+    return id;
+}
+
+void themis::TopicHub::leave(const std::string& topic, size_t id) {
+    std::lock_guard<AdaptiveLock> guard(lock);
+    auto it = topics.find(topic);
+    if(it == topics.end()) return;
+    it->second.erase(id);
+    if(it->second.empty()) topics.erase(it);
+}
+
+size_t themis::TopicHub::publish(const std::string& topic, std::string message, bool text, const std::string& key) {
+    std::vector<Member> members;
+    {
+        std::lock_guard<AdaptiveLock> guard(lock);
+        auto it = topics.find(topic);
+        if(it == topics.end()) return 0;
+        members.reserve(it->second.size());
+        for (auto& m: it->second) members.push_back(m.second);
+    }
+    // one copy of the message for every session
+    auto shared = std::make_shared<const std::string>(std::move(message));
+    for (auto& m: members) {
+        m.queue->addImmediate([t = std::move(m.target), shared, text, key]() {
+            WebsocketSessionHandler* handler = *t;
+            if(!handler) return;
+            handler->getOutputStream() << *shared;
+            handler->finish(text, key);
+        });
+    }
+    return members.size();
+}
+
+size_t themis::TopicHub::getMemberCount(const std::string& topic) {
+    std::lock_guard<AdaptiveLock> guard(lock);
+    auto it = topics.find(topic);
+    return it == topics.end() ? 0 : it->second.size();
+}
+
+themis::Subscription themis::TopicHub::relay(std::string channel, std::string topic, std::string poolID) {
+    // publishing only hands the message to the reactors, it runs on the driver thread
+    return PostgresqlDriver::get()->listen(std::move(poolID), std::move(channel), [this, topic](const Notification& n) {
+        publish(topic, n.payload, true, topic);
+    });
+}
+
+void themis::TopicListener::join(const std::string& topic) {
+    if(joined.count(topic)) return;
+    joined.insert({topic, hub->join(topic, eventQueue.get(), target)});
+}
+
+void themis::TopicListener::leave(const std::string& topic) {
+    auto it = joined.find(topic);
+    if(it == joined.end()) return;
+    hub->leave(topic, it->second);
+    joined.erase(it);
+}
+
+void themis::TopicListener::leaveAll() {
+    for (auto& [topic, id]: joined) hub->leave(topic, id);
+    joined.clear();
+}
@@ -0,0 +1,123 @@
+#ifndef TopicHub_h
+#define TopicHub_h 1
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "utils/AdaptiveLock.h"
+#include "utils/EventQueue.h"
+#include "sql/driver/Notification.h"
+#include "protocol/websocket/WebsocketSessionHandler.h"
+
+namespace themis
+{
+
+    /**
+     * @brief websocket sessions grouped by topic, a message published to a topic is
+     * written to every session in it by the reactor owning the session. publish from
+     * any thread, or relay the notifications of a database channel to a topic so that
+     * clients are pushed the changes instead of polling for them
+     *
+     */
+    class TopicHub {
+    private:
+        struct Member {
+            /// @brief the queue of the reactor owning the session
+            EventQueue* queue;
+            /// @brief the handler, cleared when the session is gone. only touched on the reactor thread
+            std::shared_ptr<WebsocketSessionHandler*> target;
+        };
+
+        AdaptiveLock lock;
+        std::map<std::string, std::map<size_t, Member>> topics;
+        size_t nextId = 1;
+
+    public:
+        TopicHub() = default;
+        TopicHub(const TopicHub&) = delete;
+
+        /**
+         * @brief add a session to the topic, called by its listener on the reactor thread
+         *
+         * @param topic the topic
+         * @param queue the queue of the reactor owning the session
+         * @param target the handler of the session, set to nullptr once it is gone
+         * @return size_t the id to leave with
+         */
+        size_t join(const std::string& topic, EventQueue* queue, std::shared_ptr<WebsocketSessionHandler*> target);
+
+        void leave(const std::string& topic, size_t id);
+
+        /**
+         * @brief send the message to every session in the topic, can be called from any thread
+         *
+         * @param topic the topic
+         * @param message the message
+         * @param text if the message is a text message
+         * @param key under the COALESCE policy a message held back with the same key is replaced
+         * @return size_t the sessions it was handed to
+         */
+        size_t publish(const std::string& topic, std::string message, bool text = true, const std::string& key = "");
+
+        /// @brief the sessions in the topic
+        size_t getMemberCount(const std::string& topic);
+
+        /**
+         * @brief publish the payload of every notification sent to the channel to the topic,
+         * see PostgresqlDriver::listen. the topic is the coalescing key, a session under the
+         * COALESCE policy that fell behind gets the latest payload only. the hub must outlive
+         * the subscription, declare the subscription after the hub when both are members
+         *
+         * @param channel the channel
+         * @param topic the topic
+         * @param poolID the pool listening
+         * @return Subscription relaying stops once it is cancelled or destroyed
+         */
+        Subscription relay(std::string channel, std::string topic, std::string poolID = "default_pool");
+    };
+
+    /**
+     * @brief a listener putting its session in a topic of the hub until it disconnects,
+     * register it like any listener : addController<TopicListener>("/ws/orders", &hub, std::string("orders")).
+     * derive from it to let clients pick their topics with join and leave
+     *
+     */
+    class TopicListener : public WebsocketSessionHandler::EventListener {
+    private:
+        TopicHub* hub;
+        std::shared_ptr<WebsocketSessionHandler*> target;
+        /// @brief the topics joined and the ids to leave them with
+        std::map<std::string, size_t> joined;
+
+        void leaveAll();
+
+    protected:
+        /// @brief put the session in the topic, once
+        void join(const std::string& topic);
+        void leave(const std::string& topic);
+
+    public:
+        /**
+         * @param hub the hub, outlives the session
+         * @param topic the topic joined at once, empty for none
+         */
+        TopicListener(WebsocketSessionHandler& handler, const std::unique_ptr<EventQueue>& queue, TopicHub* hub, std::string topic = "")
+        : EventListener(handler, queue), hub(hub), target(std::make_shared<WebsocketSessionHandler*>(&handler)) {
+            if(!topic.empty()) join(topic);
+        }
+
+        virtual ~TopicListener() {
+            *target = nullptr;
+            leaveAll();
+        }
+
+        virtual void onDisconnect() override {
+            *target = nullptr;
+            leaveAll();
+        }
+    };
+
+} // namespace themis
+
+#endif
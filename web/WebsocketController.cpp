@@ -34,21 +34,32 @@ void themis::WebsocketControllerManager::serveUpgradeResponse(std::string secKey
     resp.serializeToBuffer(old->getOutputBuffer());
 }
 
-std::unique_ptr<themis::WebsocketSessionHandler>
-themis::WebsocketControllerManager::upgradeSession(const std::unique_ptr<HttpRequest> &request, const std::unique_ptr<Session> &old) {
-    auto& path = request->getPath();
+bool themis::WebsocketControllerManager::isUpgradeRequest(const std::unique_ptr<HttpRequest> &request) {
     std::string connection;
     std::string secKey;
-
-    if(controllerMap.count(path) && 
+    return controllerMap.count(request->getPath()) && 
     request->getHeader("Connection", connection) && 
     connection == "Upgrade" &&
-    request->getHeader("Sec-WebSocket-key", secKey)) {
+    request->getHeader("Sec-WebSocket-key", secKey);
+}
+
+std::unique_ptr<themis::WebsocketSessionHandler>
+themis::WebsocketControllerManager::upgradeSession(const std::unique_ptr<HttpRequest> &request, const std::unique_ptr<Session> &old, 
+    const std::unique_ptr<EventQueue>& queue) {
+    auto& path = request->getPath();
+    std::string secKey;
+
+    if(isUpgradeRequest(request)) {
 
+        request->getHeader("Sec-WebSocket-key", secKey);
         serveUpgradeResponse(secKey, old);
         // upgrade the old session into websocket session
         auto handler =  std::make_unique<WebsocketSessionHandler>(old);
-        auto listener = controllerMap.at(path)->service(eventQueue, *handler.get());
+        handler->setMaxFrameSize(maxFrameSize);
+        handler->setMaxMessageSize(maxMessageSize);
+        handler->setWatermarks(lowWatermark, highWatermark, maxQueuedBytes);
+        handler->setOverflowPolicy(overflowPolicy);
+        auto listener = controllerMap.at(path)->service(queue, *handler.get());
         handler->setListener(std::move(listener));
         return handler;
     } 
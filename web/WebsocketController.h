@@ -46,7 +46,12 @@ namespace themis
     class WebsocketControllerManager {
     private:
         std::map<std::string, std::unique_ptr<WebsocketController>> controllerMap;
-        std::unique_ptr<EventQueue> eventQueue = std::make_unique<EventQueue>();
+        size_t maxFrameSize = 4 * 1024 * 1024;
+        size_t maxMessageSize = 16 * 1024 * 1024;
+        size_t lowWatermark = 64 * 1024;
+        size_t highWatermark = 256 * 1024;
+        size_t maxQueuedBytes = 8 * 1024 * 1024;
+        WebsocketSessionHandler::OverflowPolicy overflowPolicy = WebsocketSessionHandler::DISCONNECT;
 
         std::string calculateSecKey(std::string client);
         /**
@@ -71,26 +76,61 @@ namespace themis
             return *this;
         }
 
+        /**
+         * @brief set the default limits of incoming frames and messages for every upgraded session, 
+         * listeners can still override them on their own handler
+         * 
+         * @param frameSize max payload size of a single frame
+         * @param messageSize max size of a reassembled message
+         * @return this reference
+         */
+        WebsocketControllerManager& setMessageLimits(size_t frameSize, size_t messageSize) {
+            maxFrameSize = frameSize;
+            maxMessageSize = messageSize;
+            return *this;
+        }
+
+        /**
+         * @brief set the default outbound backpressure for every upgraded session, 
+         * see WebsocketSessionHandler::setWatermarks
+         * 
+         * @param low writable again at this many queued bytes
+         * @param high unwritable at this many queued bytes
+         * @param max cap of queued bytes
+         * @param policy what to do when the cap is hit
+         * @return this reference
+         */
+        WebsocketControllerManager& setBackpressure(size_t low, size_t high, size_t max, 
+            WebsocketSessionHandler::OverflowPolicy policy) {
+            lowWatermark = low;
+            highWatermark = high;
+            maxQueuedBytes = max;
+            overflowPolicy = policy;
+            return *this;
+        }
+
+        /**
+         * @brief check if the request hit any path in the controller map and 
+         * carries the headers required by the websocket handshake
+         * 
+         * @param request 
+         * @return true if the session can be upgraded
+         */
+        bool isUpgradeRequest(const std::unique_ptr<HttpRequest>& request);
+
         /**
          * @brief if the request hit any path in the controller map, then try
          * to upgrade the @param old session into a websocket session
          * 
          * @param request 
          * @param old 
+         * @param queue the event queue of the reactor that will own the session, 
+         * handed to the listener
          * @return std::unique_ptr<WebsocketSessionHandler> null if the upgrade did not happened
          */
         std::unique_ptr<WebsocketSessionHandler> 
-        upgradeSession(const std::unique_ptr<HttpRequest>& request, const std::unique_ptr<Session>& old);
-        
-        /**
-         * @brief poll the event queu for once
-         * 
-         * @return true if any event has been dispatched
-         * @return false 
-         */
-        bool poll() {
-            return eventQueue->poll();
-        }
+        upgradeSession(const std::unique_ptr<HttpRequest>& request, const std::unique_ptr<Session>& old, 
+            const std::unique_ptr<EventQueue>& queue);
     };
 
 